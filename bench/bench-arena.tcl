@@ -0,0 +1,41 @@
+package require tjson
+
+# Request-style workload: parse a few documents, read them, throw them away.
+# Compares destroying every handle with one arena reset per request.
+# Usage: tclsh bench-arena.tcl ?num_requests?
+
+set num_requests [expr {[llength $argv] ? [lindex $argv 0] : 2000}]
+
+set records [list]
+for {set i 0} {$i < 200} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "active": true, "tags": \["red", "green"\], "address": {"city": "Nicosia", "zip": "10$i"}}}]
+}
+set payload "\[[join $records ,]\]"
+set small {{"id": 1, "name": "user1", "tags": ["red", "green"]}}
+
+# best of 5 batches
+proc bench {label script} {
+    global num_requests
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script $num_requests]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-30s %10.2f us/request" $label $best]
+}
+
+bench {destroy each handle} {
+    set a [::tjson::parse $payload]
+    set b [::tjson::parse $small]
+    ::tjson::get_object_item $b name
+    ::tjson::destroy $a
+    ::tjson::destroy $b
+}
+bench {arena reset} {
+    set a [::tjson::parse -arena $payload]
+    set b [::tjson::parse -arena $small]
+    ::tjson::get_object_item $b name
+    ::tjson::arena_reset
+}
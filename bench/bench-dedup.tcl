@@ -0,0 +1,78 @@
+package require tjson
+
+# A product catalog whose records repeat a few policy subtrees and long
+# category strings, parsed as is and with -dedup: memory, parsing,
+# conversion and the cost of modifying shared parts.
+# Usage: tclsh bench-dedup.tcl ?num_products?
+
+set num_products [expr {[llength $argv] ? [lindex $argv 0] : 20000}]
+
+set policies {
+    {{"carrier": "standard", "days": [3, 5], "regions": ["EU", "UK", "CH"], "fees": {"base": 4.9, "per_kg": 1.2}}}
+    {{"carrier": "express", "days": [1, 2], "regions": ["EU", "UK"], "fees": {"base": 9.9, "per_kg": 2.5}}}
+    {{"carrier": "freight", "days": [7, 14], "regions": ["EU"], "fees": {"base": 49.0, "per_kg": 0.4}}}
+}
+set categories {
+    {"Home & Garden > Furniture > Outdoor Seating"}
+    {"Electronics > Computers > Accessories > Cables"}
+    {"Sports & Outdoors > Camping > Tents & Shelters"}
+}
+set records [list]
+for {set i 0} {$i < $num_products} {incr i} {
+    set policy [lindex $policies [expr {$i % 3}]]
+    set category [lindex $categories [expr {($i / 3) % 3}]]
+    lappend records [subst {{"sku": "P$i", "price": [expr {$i % 500}].99, "category": $category, "shipping": $policy, "returns": {"days": 30, "restocking_fee": 0}}}]
+}
+set json "\[[join $records ,]\]"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-32s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+bench "parse" {
+    ::tjson::destroy [::tjson::parse $json]
+}
+bench "parse -dedup" {
+    ::tjson::destroy [::tjson::parse -dedup $json]
+}
+
+set plain [::tjson::parse $json]
+set shared [::tjson::parse $json]
+set bytes [dict get [::tjson::stats $plain] bytes]
+set stats [::tjson::dedup $shared]
+puts [format "%-32s %8.1f MB" "plain: tree size" [expr {$bytes / 1048576.0}]]
+puts [format "%-32s %8.1f MB" "dedup: tree size" [expr {($bytes - [dict get $stats bytes_saved]) / 1048576.0}]]
+puts [format "%-32s %8d / %d" "dedup: subtrees / strings" [dict get $stats subtrees] [dict get $stats strings]]
+
+foreach label {plain shared} {
+    set handle [set $label]
+    bench "$label: to_json" {
+        ::tjson::to_json $handle
+    }
+    bench "$label: to_simple" {
+        ::tjson::to_simple $handle
+    }
+}
+
+# a shared record gets copies of its own levels as they are modified
+foreach label {plain shared} {
+    set handle [set $label]
+    set round 0
+    bench "$label: modify x1000" {
+        foreach record [lrange [::tjson::get_child_items $handle] [expr {$round * 1000}] [expr {$round * 1000 + 999}]] {
+            ::tjson::replace_item_in_object [::tjson::get_object_item $record shipping] carrier {S custom}
+        }
+        incr round
+    }
+}
+::tjson::destroy $shared
+::tjson::destroy $plain
@@ -0,0 +1,68 @@
+package require tjson
+
+# Recursive descent ("$..name") over a large nested document, parsed plain,
+# lazily and with packed number arrays. With -lazy, subtrees whose text
+# cannot hold the name are skipped without being parsed. The last section
+# queries one document repeatedly, with and without a key index.
+# Usage: tclsh bench-deep-scan.tcl ?fanout? ?depth?
+
+set fanout [expr {[llength $argv] > 0 ? [lindex $argv 0] : 6}]
+set depth [expr {[llength $argv] > 1 ? [lindex $argv 1] : 6}]
+
+proc node {level fanout depth} {
+    if {$level == $depth} {
+        return [format {{"name": "leaf %d", "values": [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]}} $level]
+    }
+    set children {}
+    for {set i 0} {$i < $fanout} {incr i} {
+        lappend children [node [expr {$level + 1}] $fanout $depth]
+    }
+    set rare [expr {$level == 1 ? {, "rare": true} : {}}]
+    return [format {{"id": %d, "name": "node %d"%s, "children": [%s]}} $level $level $rare [join $children ,]]
+}
+set json [node 0 $fanout [expr {$depth - 1}]]
+set json "{\"meta\": {\"name\": \"root\"}, \"tree\": $json}"
+puts "document of [string length $json] bytes"
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+# parsed anew for every query, so that lazy subtrees are still unparsed
+foreach option {{} -lazy -packed} {
+    set label [expr {$option eq {} ? "plain" : $option}]
+    bench "$label: parse" {
+        ::tjson::destroy [::tjson::parse {*}$option $json]
+    }
+    foreach path {{$..name} {$..rare} {$..absent}} {
+        set handle [::tjson::parse {*}$option $json]
+        set matches [llength [::tjson::query $handle $path -values json]]
+        ::tjson::destroy $handle
+        bench "$label: parse + $path ($matches)" {
+            set handle [::tjson::parse {*}$option $json]
+            ::tjson::query $handle $path -values json
+            ::tjson::destroy $handle
+        }
+    }
+}
+
+# one document queried over and over, the index is built by the first query
+foreach option {{} -keyindex} {
+    set label [expr {$option eq {} ? "plain" : $option}]
+    set handle [::tjson::parse {*}$option $json]
+    foreach path {{$..name} {$..rare} {$..absent}} {
+        set matches [llength [::tjson::query $handle $path]]
+        bench "$label: $path ($matches)" {
+            ::tjson::query $handle $path
+        }
+    }
+    ::tjson::destroy $handle
+}
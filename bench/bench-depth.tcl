@@ -0,0 +1,56 @@
+package require tjson
+
+# Measures the explicit-stack parser and walkers: a shallow document shows the
+# per-call overhead, a deep one what the C stack used to be unable to take.
+# Usage: tclsh bench-depth.tcl ?num_records? ?depth?
+
+set num_records [expr {[llength $argv] > 0 ? [lindex $argv 0] : 100000}]
+set depth [expr {[llength $argv] > 1 ? [lindex $argv 1] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "tags": \["a", "b"\], "geo": {"lat": 1.5, "lon": 2.5}}}]
+}
+set shallow "\[[join $records ,]\]"
+set deep [string repeat "\{\"a\": \[" $depth]1[string repeat "\]\}" $depth]
+puts [format "shallow: %.1f MB, deep: %d levels" [expr {[string length $shallow] / 1048576.0}] $depth]
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 10]] 0]
+    puts [format "%-32s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+set handle [::tjson::parse $shallow]
+set typed [::tjson::to_typed $handle]
+bench {shallow parse + destroy} {
+    ::tjson::destroy [::tjson::parse $shallow]
+}
+bench {shallow to_json} {
+    ::tjson::to_json $handle
+}
+bench {shallow to_simple} {
+    ::tjson::to_simple $handle
+}
+bench {shallow typed_to_json} {
+    ::tjson::typed_to_json $typed
+}
+bench {shallow query $..lat} {
+    ::tjson::query $handle {$..lat}
+}
+::tjson::destroy $handle
+
+if {[catch {::tjson::max_depth [expr {2 * $depth + 2}]}]} {
+    puts "deep documents need ::tjson::max_depth"
+    exit
+}
+set handle [::tjson::parse $deep]
+bench {deep parse + destroy} {
+    ::tjson::destroy [::tjson::parse $deep]
+}
+bench {deep to_json} {
+    ::tjson::to_json $handle
+}
+bench {deep query $..b} {
+    ::tjson::query $handle {$..b}
+}
+::tjson::destroy $handle
@@ -0,0 +1,35 @@
+package require tjson
+
+# Compares streaming extraction with parse + query on a large document.
+# Usage: tclsh bench-extract.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "profile": {"bio": "lorem ipsum dolor sit amet", "scores": \[1, 2, 3, 4, 5\]}}}]
+}
+set json "{\"data\": \[[join $records ,]\], \"meta\": {\"count\": $num_records}}"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 3]] 0]
+    puts [format "%-28s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+bench {parse + query $.meta.count} {
+    set h [::tjson::parse $json]
+    ::tjson::to_simple [::tjson::query $h {$.meta.count}]
+    ::tjson::destroy $h
+}
+bench {extract $.meta.count} {
+    ::tjson::extract $json {$.meta.count}
+}
+bench {parse + query $.data[*].id} {
+    set h [::tjson::parse $json]
+    lmap x [::tjson::query $h {$.data[*].id}] {::tjson::to_simple $x}
+    ::tjson::destroy $h
+}
+bench {extract $.data[*].id} {
+    ::tjson::extract $json {$.data[*].id}
+}
@@ -0,0 +1,51 @@
+package require tjson
+
+# Selecting records of a large array with a filter expression evaluated in
+# C, compared with fetching every record and testing it in script.
+# Usage: tclsh bench-filter.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set categories {fiction reference poetry}
+set records {}
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [format {{"category": "%s", "title": "book %d", "price": %d.99}} \
+        [lindex $categories [expr {$i % 3}]] $i [expr {$i % 40}]]
+}
+set json "{\"book\": \[[join $records ,]\]}"
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set handle [::tjson::parse $json]
+
+bench "filter in C ($num_records records)" {
+    set matches [llength [::tjson::query $handle {$.book[?(@.price < 10 && @.category == 'fiction')].title}]]
+}
+puts "  $matches matches"
+bench "filter in script ($num_records records)" {
+    set matches 0
+    foreach book [::tjson::query $handle {$.book[*]}] {
+        set price [::tjson::to_simple [::tjson::get_object_item $book price]]
+        set category [::tjson::to_simple [::tjson::get_object_item $book category]]
+        if {$price < 10 && $category eq "fiction"} {
+            ::tjson::get_object_item $book title
+            incr matches
+        }
+    }
+}
+puts "  $matches matches"
+bench "extract with a filter ($num_records records)" {
+    set matches [llength [::tjson::extract $json {$.book[?(@.price < 10 && @.category == 'fiction')].title}]]
+}
+puts "  $matches matches"
+::tjson::destroy $handle
@@ -0,0 +1,60 @@
+package require tjson
+
+# A reference table keyed by code, as parsed and frozen: memory, key lookups,
+# queries and conversion.
+# Usage: tclsh bench-freeze.tcl ?num_entries?
+
+set num_entries [expr {[llength $argv] ? [lindex $argv 0] : 20000}]
+
+expr {srand(1)}
+set statuses {active retired planned}
+set members [list]
+for {set i 0} {$i < $num_entries} {incr i} {
+    set status [lindex $statuses [expr {$i % 3}]]
+    lappend members [subst {"C$i": {"name": "City number $i", "country": "CY", "status": "$status", "lat": [expr {$i % 90}].5, "lon": [expr {$i % 180}].25}}]
+}
+set json "{[join $members ,]}"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+set codes [list]
+for {set i 0} {$i < 10000} {incr i} {
+    lappend codes C[expr {int(rand() * $num_entries)}]
+}
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-32s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set plain [::tjson::parse $json]
+bench "freeze" {
+    ::tjson::destroy [::tjson::freeze $plain]
+}
+set frozen [::tjson::freeze $plain]
+
+foreach label {plain frozen} {
+    set handle [set $label]
+    puts [format "%-32s %8.1f MB" "$label: tree size" [expr {[dict get [::tjson::stats $handle] bytes] / 1048576.0}]]
+    bench "$label: get_object_item x10000" {
+        foreach code $codes {
+            ::tjson::get_object_item $handle $code
+        }
+    }
+    bench "$label: query x1000" {
+        foreach code [lrange $codes 0 999] {
+            ::tjson::query $handle "\$.$code.name"
+        }
+    }
+    bench "$label: to_json" {
+        ::tjson::to_json $handle
+    }
+}
+::tjson::destroy $frozen
+::tjson::destroy $plain
@@ -0,0 +1,25 @@
+package require tjson
+
+# Compares the regular and the in-situ parse on a string-heavy document.
+# Usage: tclsh bench-insitu.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": "id-$i", "name": "user$i", "email": "user$i@example.com", "tags": \["a", "b\\tc", "d"\]}}]
+}
+set json "\[[join $records ,]\]"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 10]] 0]
+    puts [format "%-28s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+bench {parse + destroy} {
+    ::tjson::destroy [::tjson::parse $json]
+}
+bench {parse -insitu + destroy} {
+    ::tjson::destroy [::tjson::parse -insitu $json]
+}
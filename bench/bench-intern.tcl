@@ -0,0 +1,64 @@
+package require tjson
+
+# Memory and parse time of records-style documents with and without key
+# interning. Resident memory is read from /proc (Linux only).
+# Usage: tclsh bench-intern.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "first_name": "user$i", "last_name": "Doe", "email_address": "user$i@example.com", "is_active_subscriber": true, "registration_timestamp": 1700000$i, "preferred_language": "en", "shipping_address": {"street_name_and_number": "Main $i", "postal_code": "10$i"}}}]
+}
+set json "\[[join $records ,]\]"
+if {[lindex $argv 1] eq {}} {
+    puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+}
+
+proc rss {} {
+    if {[catch {open /proc/self/status} fd]} {
+        return 0
+    }
+    regexp {VmRSS:\s+(\d+)} [read $fd] -> kb
+    close $fd
+    return [expr {$kb * 1024}]
+}
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-28s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+# resident memory is measured in a fresh process per variant, the node pool
+# would otherwise serve the second parse from the blocks freed by the first
+if {[lindex $argv 1] ne {}} {
+    set before [rss]
+    set handle [::tjson::parse {*}[lrange $argv 2 end] $json]
+    set after [rss]
+    set stats [::tjson::stats $handle]
+    puts [format "%-10s heap blocks: %d, resident bytes/node: %.1f" [lindex $argv 1] \
+        [dict get $stats blocks] [expr {double($after - $before) / [dict get $stats nodes]}]]
+    exit
+}
+foreach {label opts} {plain {} interned -intern} {
+    puts -nonewline [exec [info nameofexecutable] [info script] $num_records $label {*}$opts]
+    puts ""
+}
+
+bench {parse + destroy} {
+    ::tjson::destroy [::tjson::parse $json]
+}
+bench {parse -intern + destroy} {
+    ::tjson::destroy [::tjson::parse -intern $json]
+}
+::tjson::configure -intern global
+bench {parse -intern (global)} {
+    ::tjson::destroy [::tjson::parse -intern $json]
+}
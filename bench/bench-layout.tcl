@@ -0,0 +1,56 @@
+package require tjson
+
+# Memory per node and traversal speed of parsed trees. Resident memory is read
+# from /proc, so it includes allocator overhead (Linux only).
+# Usage: tclsh bench-layout.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "email": "user$i@example.com", "active": true, "tags": \["red", "green"\], "address": {"city": "Nicosia", "zip": "10$i"}, "bio": "a longer free text field of user number $i"}}]
+}
+set json "\[[join $records ,]\]"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+proc rss {} {
+    if {[catch {open /proc/self/status} fd]} {
+        return 0
+    }
+    regexp {VmRSS:\s+(\d+)} [read $fd] -> kb
+    close $fd
+    return [expr {$kb * 1024}]
+}
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 10]] 0]
+    puts [format "%-24s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+set before [rss]
+set handle [::tjson::parse $json]
+set after [rss]
+if {[info commands ::tjson::stats] ne {}} {
+    set stats [::tjson::stats $handle]
+    puts [format "nodes: %d, heap blocks: %d, bytes/node: %.1f" \
+        [dict get $stats nodes] [dict get $stats blocks] [dict get $stats bytes_per_node]]
+    if {$after > $before} {
+        puts [format "resident bytes/node: %.1f" [expr {double($after - $before) / [dict get $stats nodes]}]]
+    }
+} elseif {$after > $before} {
+    puts [format "resident bytes: %d" [expr {$after - $before}]]
+}
+
+bench {parse + destroy} {
+    ::tjson::destroy [::tjson::parse $json]
+}
+bench {to_simple} {
+    ::tjson::to_simple $handle
+}
+bench {to_json} {
+    ::tjson::to_json $handle
+}
+bench {query $..city} {
+    ::tjson::query $handle {$..city}
+}
+::tjson::destroy $handle
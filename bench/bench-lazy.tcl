@@ -0,0 +1,45 @@
+package require tjson
+
+# Compares eager and lazy parsing when only a few fields of a large document
+# are touched.
+# Usage: tclsh bench-lazy.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "profile": {"bio": "lorem ipsum dolor sit amet", "scores": \[1, 2, 3, 4, 5\]}}}]
+}
+set json "{\"data\": \[[join $records ,]\], \"meta\": {\"count\": $num_records}}"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 3]] 0]
+    puts [format "%-36s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+bench {parse + query $.meta.count} {
+    set h [::tjson::parse $json]
+    ::tjson::to_simple [::tjson::query $h {$.meta.count}]
+    ::tjson::destroy $h
+}
+bench {parse -lazy + query $.meta.count} {
+    set h [::tjson::parse -lazy $json]
+    ::tjson::to_simple [::tjson::query $h {$.meta.count}]
+    ::tjson::destroy $h
+}
+bench {parse -lazy + query $.data[10].name} {
+    set h [::tjson::parse -lazy $json]
+    ::tjson::to_simple [::tjson::query $h {$.data[10].name}]
+    ::tjson::destroy $h
+}
+bench {parse -lazy + to_simple} {
+    set h [::tjson::parse -lazy $json]
+    ::tjson::to_simple $h
+    ::tjson::destroy $h
+}
+bench {parse + to_simple} {
+    set h [::tjson::parse $json]
+    ::tjson::to_simple $h
+    ::tjson::destroy $h
+}
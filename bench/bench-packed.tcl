@@ -0,0 +1,61 @@
+package require tjson
+
+# Numeric arrays with and without -packed: parse, conversion, memory and
+# aggregates. Usage: tclsh bench-packed.tcl ?num_series? ?series_length?
+
+set num_series [expr {[llength $argv] > 0 ? [lindex $argv 0] : 200}]
+set series_length [expr {[llength $argv] > 1 ? [lindex $argv 1] : 5000}]
+
+expr {srand(1)}
+set series [list]
+for {set i 0} {$i < $num_series} {incr i} {
+    set values [list]
+    for {set k 0} {$k < $series_length} {incr k} {
+        lappend values [expr {$k % 2 ? int(rand() * 100000) : round(rand() * 1e6) / 100.0}]
+    }
+    lappend series [subst {{"sensor": "s$i", "values": \[[join $values ,]\]}}]
+}
+set json "\[[join $series ,]\]"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-32s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+foreach {label opts} {plain {} packed -packed} {
+    bench "$label: parse + destroy" {
+        ::tjson::destroy [::tjson::parse {*}$opts $json]
+    }
+    set handle [::tjson::parse {*}$opts $json]
+    puts [format "%-32s %8.1f MB" "$label: tree size" [expr {[dict get [::tjson::stats $handle] bytes] / 1048576.0}]]
+    set arrays [lmap row [::tjson::get_child_items $handle] {::tjson::get_object_item $row values}]
+    bench "$label: array_stats" {
+        foreach array $arrays {
+            ::tjson::array_stats $array
+        }
+    }
+    bench "$label: to_simple" {
+        ::tjson::to_simple $handle
+    }
+    bench "$label: to_json" {
+        ::tjson::to_json $handle
+    }
+    ::tjson::destroy $handle
+}
+
+set handle [::tjson::parse $json]
+set arrays [lmap row [::tjson::get_child_items $handle] {::tjson::get_object_item $row values}]
+bench "tcl: sum of to_simple" {
+    foreach array $arrays {
+        ::tcl::mathop::+ {*}[::tjson::to_simple $array]
+    }
+}
+::tjson::destroy $handle
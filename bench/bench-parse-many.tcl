@@ -0,0 +1,29 @@
+package require tjson
+
+# Reports the throughput of ::tjson::parse_many for an increasing number of
+# worker threads. Usage: tclsh bench-parse-many.tcl ?num_docs?
+
+set num_docs [expr {[llength $argv] ? [lindex $argv 0] : 200000}]
+
+set docs [list]
+for {set i 0} {$i < $num_docs} {incr i} {
+    lappend docs [subst {{"id": $i, "name": "user$i", "score": [expr {$i * 0.5}], "active": true, "tags": \["x", "y", "z"\], "address": {"city": "Nicosia", "zip": "10$i"}}}]
+}
+set bytes [string length [join $docs \n]]
+
+# generate the string reps once so that all runs start from the same state
+foreach doc $docs {string length $doc}
+
+set baseline 0
+foreach num_threads {1 2 4 8} {
+    set micros [lindex [time {
+        foreach h [::tjson::parse_many -threads $num_threads $docs] {
+            ::tjson::destroy $h
+        }
+    } 3] 0]
+    if {$baseline == 0} {
+        set baseline $micros
+    }
+    puts [format "threads=%-2d %8.1f ms  %7.1f MB/s  speedup=%.2fx" \
+        $num_threads [expr {$micros / 1000.0}] [expr {$bytes / $micros}] [expr {double($baseline) / $micros}]]
+}
@@ -0,0 +1,47 @@
+package require tjson
+
+# Single-value reads from a parsed document: a chain of get_object_item and
+# get_array_item calls, a JSONPath query and a JSON Pointer, each repeated
+# num_reads times.
+# Usage: tclsh bench-pointer.tcl ?num_reads?
+
+set num_reads [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set json {{"config": {"servers": [{"host": "a", "port": 80}, {"host": "b", "port": 8080}], "retries": 3}}}
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set handle [::tjson::parse $json]
+
+bench "get_object_item chain" {
+    for {set i 0} {$i < $num_reads} {incr i} {
+        set servers [::tjson::get_object_item [::tjson::get_object_item $handle config] servers]
+        ::tjson::to_simple [::tjson::get_object_item [::tjson::get_array_item $servers 1] port]
+    }
+}
+bench "query -values simple" {
+    for {set i 0} {$i < $num_reads} {incr i} {
+        ::tjson::query $handle {$.config.servers[1].port} -values simple
+    }
+}
+bench "pointer_get -simple" {
+    for {set i 0} {$i < $num_reads} {incr i} {
+        ::tjson::pointer_get $handle /config/servers/1/port -simple
+    }
+}
+bench "pointer_set" {
+    for {set i 0} {$i < $num_reads} {incr i} {
+        ::tjson::pointer_set $handle /config/servers/1/port {N 8081}
+    }
+}
+::tjson::destroy $handle
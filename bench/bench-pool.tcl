@@ -0,0 +1,40 @@
+package require tjson
+
+# Parse/destroy cycles with and without the per-thread node pool, for each
+# allocator. Usage: tclsh bench-pool.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 20000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "user$i", "active": true, "tags": \["red", "green"\], "address": {"city": "Nicosia", "zip": "10$i"}}}]
+}
+set json "\[[join $records ,]\]"
+set small {{"id": 1, "name": "user1", "tags": ["red", "green"]}}
+
+# best of 5 batches, the allocator makes single runs noisy
+proc bench {label script count} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script $count]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %10.2f us" $label $best]
+}
+
+foreach allocator {malloc tcl} {
+    foreach pool {0 1} {
+        ::tjson::configure -allocator $allocator -pool $pool
+        ::tjson::destroy [::tjson::parse $json]
+        bench "$allocator pool=$pool parse + destroy" {
+            ::tjson::destroy [::tjson::parse $json]
+        } 10
+        bench "$allocator pool=$pool small parse + destroy" {
+            ::tjson::destroy [::tjson::parse $small]
+        } 20000
+    }
+}
+::tjson::configure -allocator malloc -pool 1
+puts [::tjson::pool_stats]
@@ -0,0 +1,55 @@
+package require tjson
+
+# Redacting a field of every record of a large array, once by looping over
+# the records in Tcl and once with ::tjson::query_set / ::tjson::query_delete.
+# Every run parses the document anew, the parse alone is given for reference.
+# Usage: tclsh bench-query-edit.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records {}
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [format {{"id": %d, "name": "user%d", "password": "secret%d"}} $i $i $i]
+}
+set json "\[[join $records ,]\]"
+puts "document of [string length $json] bytes"
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+bench "parse" {
+    ::tjson::destroy [::tjson::parse $json]
+}
+bench "query + replace_item_in_object" {
+    set handle [::tjson::parse $json]
+    foreach record [::tjson::query $handle {$[*]}] {
+        ::tjson::replace_item_in_object $record password {S ***}
+    }
+    ::tjson::destroy $handle
+}
+bench "query_set \$\[*\].password" {
+    set handle [::tjson::parse $json]
+    ::tjson::query_set $handle {$[*].password} {S ***}
+    ::tjson::destroy $handle
+}
+bench "query + delete_item_from_object" {
+    set handle [::tjson::parse $json]
+    foreach record [::tjson::query $handle {$[*]}] {
+        ::tjson::delete_item_from_object $record password
+    }
+    ::tjson::destroy $handle
+}
+bench "query_delete \$\[*\].password" {
+    set handle [::tjson::parse $json]
+    ::tjson::query_delete $handle {$[*].password}
+    ::tjson::destroy $handle
+}
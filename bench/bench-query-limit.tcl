@@ -0,0 +1,51 @@
+package require tjson
+
+# Guard checks ("does any item have status error?") over a large array of
+# records, answered from all the matches, with -limit, -count and -exists.
+# Usage: tclsh bench-query-limit.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+# every 100th record is an error, the first one early in the array
+set records {}
+for {set i 0} {$i < $num_records} {incr i} {
+    set status [expr {$i % 100 == 5 ? "error" : "ok"}]
+    lappend records [format {{"id": %d, "status": "%s", "tags": ["a", "b"]}} $i $status]
+}
+set json "\[[join $records ,]\]"
+puts "document of [string length $json] bytes"
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set handle [::tjson::parse $json]
+set path {$[?(@.status == 'error')]}
+
+bench "all matches, llength" {
+    expr {[llength [::tjson::query $handle $path -values json]] > 0}
+}
+bench "-limit 1" {
+    expr {[llength [::tjson::query $handle $path -values json -limit 1]] > 0}
+}
+bench "-exists" {
+    ::tjson::query $handle $path -exists
+}
+bench "-count" {
+    ::tjson::query $handle $path -count
+}
+bench "\$\[*\].tags\[*\], all matches" {
+    llength [::tjson::query $handle {$[*].tags[*]}]
+}
+bench "\$\[*\].tags\[*\], -count" {
+    ::tjson::query $handle {$[*].tags[*]} -count
+}
+::tjson::destroy $handle
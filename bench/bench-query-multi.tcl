@@ -0,0 +1,58 @@
+package require tjson
+
+# Pulling many paths out of the same document: one query per path against
+# one query_multi call evaluating them all in a single traversal.
+# Usage: tclsh bench-query-multi.tcl ?num_records? ?num_rounds?
+
+set num_records [expr {[llength $argv] > 0 ? [lindex $argv 0] : 1000}]
+set num_rounds [expr {[llength $argv] > 1 ? [lindex $argv 1] : 100}]
+
+set records {}
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [format {{"id": %d, "name": "item %d", "price": %d.5, "stock": {"count": %d, "warehouse": "w%d"}, "tags": ["a", "b"]}} \
+        $i $i [expr {$i % 50}] [expr {$i % 7}] [expr {$i % 3}]]
+}
+set json "{\"meta\": {\"version\": 3, \"source\": \"bench\"}, \"store\": {\"items\": \[[join $records ,]\]}}"
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set paths {
+    version {$.meta.version}
+    source {$.meta.source}
+    ids {$.store.items[*].id}
+    names {$.store.items[*].name}
+    prices {$.store.items[*].price}
+    counts {$.store.items[*].stock.count}
+    warehouses {$.store.items[*].stock.warehouse}
+    first_tags {$.store.items[*].tags[0]}
+    cheap {$.store.items[?(@.price < 10)].id}
+    first {$.store.items[0].name}
+}
+
+set handle [::tjson::parse $json]
+set n $num_rounds
+
+bench "[expr {[llength $paths] / 2}] x query x$n" {
+    for {set i 0} {$i < $n} {incr i} {
+        set result {}
+        foreach {name path} $paths {
+            dict set result $name [::tjson::query $handle $path -values simple]
+        }
+    }
+}
+bench "query_multi x$n" {
+    for {set i 0} {$i < $n} {incr i} {
+        set result [::tjson::query_multi $handle $paths -values simple]
+    }
+}
+::tjson::destroy $handle
@@ -0,0 +1,70 @@
+package require tjson
+
+# The same few paths queried over and over, as literals (compiled once and
+# kept in the path object) and built anew for every call (found again in the
+# per-thread cache), matches returned as values rather than handles, and a
+# union of names against one query per name.
+# Usage: tclsh bench-query.tcl ?num_queries?
+
+set num_queries [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set json {{"store": {"book": [
+    {"category": "reference", "author": "Nigel Rees", "title": "Sayings of the Century", "price": 8.95},
+    {"category": "fiction", "author": "Evelyn Waugh", "title": "Sword of Honour", "price": 12.99},
+    {"category": "fiction", "author": "Herman Melville", "title": "Moby Dick", "price": 8.99},
+    {"category": "fiction", "author": "J. R. R. Tolkien", "title": "The Lord of the Rings", "price": 22.99}
+], "bicycle": {"color": "red", "price": 19.95}}}}
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-40s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+set handle [::tjson::parse $json]
+set n $num_queries
+
+bench "literal \$.store.bicycle.color x$n" {
+    for {set i 0} {$i < $n} {incr i} {
+        ::tjson::query $handle {$.store.bicycle.color}
+    }
+}
+bench "literal \$\['store'\].book\[2\].title x$n" {
+    for {set i 0} {$i < $n} {incr i} {
+        ::tjson::query $handle {$['store'].book[2].title}
+    }
+}
+bench "built \$.store.book\[i % 4\].author x$n" {
+    for {set i 0} {$i < $n} {incr i} {
+        ::tjson::query $handle "\$.store.book\[[expr {$i % 4}]\].author"
+    }
+}
+bench "values \$.store.book\[*\].author x[expr {$n / 10}]" {
+    for {set i 0} {$i < $n / 10} {incr i} {
+        ::tjson::query $handle {$.store.book[*].author} -values simple
+    }
+}
+bench "handles \$.store.book\[*\].author x[expr {$n / 10}]" {
+    for {set i 0} {$i < $n / 10} {incr i} {
+        lmap item [::tjson::query $handle {$.store.book[*].author}] {::tjson::to_simple $item}
+    }
+}
+bench "union \['author','title'\] x[expr {$n / 10}]" {
+    for {set i 0} {$i < $n / 10} {incr i} {
+        ::tjson::query $handle {$.store.book[*]['author','title']} -values simple
+    }
+}
+bench "two queries .author .title x[expr {$n / 10}]" {
+    for {set i 0} {$i < $n / 10} {incr i} {
+        set authors [::tjson::query $handle {$.store.book[*].author} -values simple]
+        set titles [::tjson::query $handle {$.store.book[*].title} -values simple]
+        lmap author $authors title $titles {list $author $title}
+    }
+}
+::tjson::destroy $handle
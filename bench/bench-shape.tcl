@@ -0,0 +1,45 @@
+package require tjson
+
+# Arrays of records with and without shapes: parse, member lookup and
+# conversion. Usage: tclsh bench-shape.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "first_name": "user$i", "last_name": "Doe", "email_address": "user$i@example.com", "is_active_subscriber": true, "registration_timestamp": 1700000$i, "preferred_language": "en", "country_code": "CY"}}]
+}
+set json "\[[join $records ,]\]"
+puts [format "document size: %.1f MB" [expr {[string length $json] / 1048576.0}]]
+
+# best of 5 runs
+proc bench {label script} {
+    set best {}
+    for {set i 0} {$i < 5} {incr i} {
+        set micros [lindex [uplevel 1 [list time $script]] 0]
+        if {$best eq {} || $micros < $best} {
+            set best $micros
+        }
+    }
+    puts [format "%-32s %8.1f ms" $label [expr {$best / 1000.0}]]
+}
+
+foreach {label opts} {plain {} shapes -shapes} {
+    bench "$label: parse + destroy" {
+        ::tjson::destroy [::tjson::parse {*}$opts $json]
+    }
+    set handle [::tjson::parse {*}$opts $json]
+    set rows [lrange [::tjson::get_child_items $handle] 0 9999]
+    bench "$label: get_object_item x10000" {
+        foreach row $rows {
+            ::tjson::get_object_item $row country_code
+        }
+    }
+    bench "$label: to_simple" {
+        ::tjson::to_simple $handle
+    }
+    bench "$label: to_json" {
+        ::tjson::to_json $handle
+    }
+    ::tjson::destroy $handle
+}
@@ -0,0 +1,28 @@
+package require tjson
+
+# Compares validate (with and without UTF-8 checking) with a full parse.
+# Usage: tclsh bench-validate.tcl ?num_records?
+
+set num_records [expr {[llength $argv] ? [lindex $argv 0] : 100000}]
+
+set records [list]
+for {set i 0} {$i < $num_records} {incr i} {
+    lappend records [subst {{"id": $i, "name": "usér$i", "city": "Λευκωσία", "scores": \[1, 2.5, 3\]}}]
+}
+set payload [encoding convertto utf-8 "\[[join $records ,]\]"]
+puts [format "document size: %.1f MB" [expr {[string length $payload] / 1048576.0}]]
+
+proc bench {label script} {
+    set micros [lindex [uplevel 1 [list time $script 10]] 0]
+    puts [format "%-24s %8.1f ms" $label [expr {$micros / 1000.0}]]
+}
+
+bench {validate} {
+    ::tjson::validate $payload
+}
+bench {validate -utf8} {
+    ::tjson::validate $payload -utf8
+}
+bench {parse + destroy} {
+    ::tjson::destroy [::tjson::parse [encoding convertfrom utf-8 $payload]]
+}
@@ -243,6 +243,37 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
     }                                                               /* tjson change */
 }
 
+/* tjson change: runtime nesting limit for the parser and the validator */
+static size_t nesting_limit = CJSON_NESTING_LIMIT;
+#define PARSE_STACK_INLINE 64
+
+CJSON_PUBLIC(void) cJSON_SetNestingLimit(size_t limit)
+{
+    nesting_limit = (limit > 0) ? limit : 1;
+}
+
+CJSON_PUBLIC(size_t) cJSON_GetNestingLimit(void)
+{
+    return nesting_limit;
+}
+
+/* tjson change: strings that must not be freed on their own */
+#define STRING_NOT_OWNED (INSITU_STRING | INLINE_STRING | INTERNED_STRING)
+#define VALUESTRING_NOT_OWNED (INSITU_VALUESTRING | INLINE_VALUESTRING | SHAPED_OBJECT | INTERNED_VALUESTRING)
+
+/* tjson change: a record whose members are added or removed no longer
+ * matches its shape and falls back to a plain object */
+static void unshape(cJSON * const object)
+{
+    if (object->flags & SHAPED_OBJECT)
+    {
+        object->flags &= ~SHAPED_OBJECT;
+        object->valuestring = NULL;
+    }
+}
+
+static void delete_frozen(cJSON * const root);  /* tjson change */
+
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 {
@@ -255,27 +286,58 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
     return node;
 }
 
+/* tjson change: a node followed by "tail" bytes of room for its key and value strings */
+static cJSON *cJSON_New_Item_With_Tail(const internal_hooks * const hooks, size_t tail)
+{
+    cJSON* node = (cJSON*)hooks->allocate(sizeof(cJSON) + tail);
+    if (node)
+    {
+        memset(node, '\0', sizeof(cJSON));
+    }
+
+    return node;
+}
+
 /* Delete a cJSON structure. */
 CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
 {
     cJSON *next = NULL;
     while (item != NULL)
     {
-        next = item->next;
-
+        /* tjson change: the nodes of a frozen tree go all at once, with its root */
+        if (item->flags & FROZEN_NODE)
+        {
+            next = item->next;
+            if (item->flags & FROZEN_ROOT)
+            {
+                delete_frozen(item);
+            }
+            item = next;
+            continue;
+        }
         if ((item->flags & VISIBLE_IN_TCL) && global_hooks.unregister != NULL) {    /* tjson change */
             global_hooks.unregister(item);                                          /* tjson change */
         }                                                                           /* tjson change */
 
+        /* tjson change: splice the children in after the item instead of recursing */
         if (!(item->type & cJSON_IsReference) && (item->child != NULL))
         {
-            cJSON_Delete(item->child);
+            cJSON *last = item->child->prev;
+            if ((last == NULL) || (last->next != NULL))
+            {
+                for (last = item->child; last->next != NULL; last = last->next);
+            }
+            last->next = item->next;
+            item->next = item->child;
+            item->child = NULL;
         }
-        if (!(item->type & cJSON_IsReference) && (item->valuestring != NULL))
+        next = item->next;
+
+        if (!(item->type & cJSON_IsReference) && !(item->flags & (LAZY_SUBTREE | VALUESTRING_NOT_OWNED)) && (item->valuestring != NULL))   /* tjson change */
         {
             global_hooks.deallocate(item->valuestring);
         }
-        if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
+        if (!(item->type & cJSON_StringIsConst) && !(item->flags & STRING_NOT_OWNED) && (item->string != NULL))   /* tjson change */
         {
             global_hooks.deallocate(item->string);
         }
@@ -296,6 +358,11 @@ static unsigned char get_decimal_point(void)
 #endif
 }
 
+static void* cast_away_const(const void* string);    /* tjson change */
+
+typedef struct keyset_key keyset_key;   /* tjson change */
+#define KEY_CACHE_SIZE 32               /* tjson change */
+
 typedef struct
 {
     const unsigned char *content;
@@ -303,6 +370,12 @@ typedef struct
     size_t offset;
     size_t depth; /* How deeply nested (in arrays/objects) is the input at the current offset. */
     internal_hooks hooks;
+    cJSON_bool lazy; /* tjson change: keep nested arrays/objects as LAZY_SUBTREE nodes */
+    cJSON_bool insitu; /* tjson change: content is writable, unescape strings in place */
+    unsigned char *inline_tail; /* tjson change: free space after the node being parsed */
+    size_t inline_left;
+    cJSON_KeySet *keys; /* tjson change: set to intern object keys into, if any */
+    struct keyset_key *key_cache[KEY_CACHE_SIZE]; /* tjson change: keys interned last, by length and first/last byte */
 } parse_buffer;
 
 /* check if the given size is left to read in a given parse buffer (starting with 1) */
@@ -417,7 +490,8 @@ CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
     {
         return NULL;
     }
-    if (strlen(valuestring) <= strlen(object->valuestring))
+    /* tjson change: a shared string is replaced rather than overwritten */
+    if (!(object->flags & INTERNED_VALUESTRING) && (strlen(valuestring) <= strlen(object->valuestring)))
     {
         strcpy(object->valuestring, valuestring);
         return object->valuestring;
@@ -427,11 +501,12 @@ CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
     {
         return NULL;
     }
-    if (object->valuestring != NULL)
+    if ((object->valuestring != NULL) && !(object->flags & VALUESTRING_NOT_OWNED))    /* tjson change */
     {
         cJSON_free(object->valuestring);
     }
     object->valuestring = copy;
+    object->flags &= ~VALUESTRING_NOT_OWNED;   /* tjson change */
 
     return copy;
 }
@@ -782,6 +857,250 @@ fail:
 }
 
 /* Parse the input text into an unescaped cinput, and populate item. */
+/* tjson change: key interning. Open addressing over a power of two table of
+ * keys that never move once added, kept at most 3/4 full. */
+struct keyset_key
+{
+    size_t length;
+    size_t hash;
+    char string[1];
+};
+
+struct cJSON_KeySet
+{
+    keyset_key **entries;
+    size_t capacity;
+    size_t count;
+    size_t max_count;
+    void (*lock)(void);
+    void (*unlock)(void);
+};
+
+#define KEYSET_MIN_CAPACITY 64
+
+static size_t hash_key(const unsigned char *key, size_t length)
+{
+    /* FNV-1a */
+    size_t hash = (size_t)2166136261u;
+    size_t i = 0;
+    for (i = 0; i < length; i++)
+    {
+        hash = (hash ^ key[i]) * (size_t)16777619u;
+    }
+    return hash;
+}
+
+CJSON_PUBLIC(cJSON_KeySet *) cJSON_CreateKeySet(size_t max_keys, void (*lock)(void), void (*unlock)(void))
+{
+    cJSON_KeySet *keys = (cJSON_KeySet*)malloc(sizeof(cJSON_KeySet));
+    if (keys == NULL)
+    {
+        return NULL;
+    }
+    memset(keys, 0, sizeof(cJSON_KeySet));
+    keys->max_count = max_keys;
+    keys->lock = lock;
+    keys->unlock = unlock;
+    return keys;
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteKeySet(cJSON_KeySet *keys)
+{
+    size_t i = 0;
+    if (keys == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < keys->capacity; i++)
+    {
+        free(keys->entries[i]);
+    }
+    free(keys->entries);
+    free(keys);
+}
+
+CJSON_PUBLIC(size_t) cJSON_KeySetSize(const cJSON_KeySet *keys)
+{
+    return keys != NULL ? keys->count : 0;
+}
+
+static cJSON_bool keyset_grow(cJSON_KeySet *keys)
+{
+    size_t capacity = (keys->capacity == 0) ? KEYSET_MIN_CAPACITY : keys->capacity * 2;
+    keyset_key **entries = (keyset_key**)calloc(capacity, sizeof(keyset_key*));
+    size_t i = 0;
+    if (entries == NULL)
+    {
+        return false;
+    }
+    for (i = 0; i < keys->capacity; i++)
+    {
+        if (keys->entries[i] != NULL)
+        {
+            size_t slot = keys->entries[i]->hash & (capacity - 1);
+            while (entries[slot] != NULL)
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            entries[slot] = keys->entries[i];
+        }
+    }
+    free(keys->entries);
+    keys->entries = entries;
+    keys->capacity = capacity;
+    return true;
+}
+
+/* Returns the shared copy of "key", adding it if needed, or NULL if the set is full. */
+static keyset_key *keyset_intern(cJSON_KeySet *keys, const unsigned char *key, size_t length)
+{
+    size_t hash = hash_key(key, length);
+    keyset_key *entry = NULL;
+    size_t slot = 0;
+
+    if (keys->lock != NULL)
+    {
+        keys->lock();
+    }
+    if (keys->capacity > 0)
+    {
+        slot = hash & (keys->capacity - 1);
+        while (keys->entries[slot] != NULL)
+        {
+            entry = keys->entries[slot];
+            if ((entry->hash == hash) && (entry->length == length) && (memcmp(entry->string, key, length) == 0))
+            {
+                goto done;
+            }
+            slot = (slot + 1) & (keys->capacity - 1);
+        }
+        entry = NULL;
+    }
+    if (keys->count >= keys->max_count)
+    {
+        goto done;
+    }
+    if ((keys->count + 1) * 4 > keys->capacity * 3)
+    {
+        if (!keyset_grow(keys))
+        {
+            goto done;
+        }
+        slot = hash & (keys->capacity - 1);
+        while (keys->entries[slot] != NULL)
+        {
+            slot = (slot + 1) & (keys->capacity - 1);
+        }
+    }
+    entry = (keyset_key*)malloc(sizeof(keyset_key) + length);
+    if (entry == NULL)
+    {
+        goto done;
+    }
+    entry->length = length;
+    entry->hash = hash;
+    memcpy(entry->string, key, length);
+    entry->string[length] = '\0';
+    keys->entries[slot] = entry;
+    keys->count++;
+
+done:
+    if (keys->unlock != NULL)
+    {
+        keys->unlock();
+    }
+    return entry;
+}
+
+/* Returns the shared copy of "key" if the set has one. */
+static keyset_key *keyset_find(cJSON_KeySet *keys, const unsigned char *key, size_t length)
+{
+    size_t hash = hash_key(key, length);
+    keyset_key *entry = NULL;
+    size_t slot = 0;
+
+    if (keys->lock != NULL)
+    {
+        keys->lock();
+    }
+    if (keys->capacity > 0)
+    {
+        slot = hash & (keys->capacity - 1);
+        while (keys->entries[slot] != NULL)
+        {
+            entry = keys->entries[slot];
+            if ((entry->hash == hash) && (entry->length == length) && (memcmp(entry->string, key, length) == 0))
+            {
+                break;
+            }
+            entry = NULL;
+            slot = (slot + 1) & (keys->capacity - 1);
+        }
+    }
+    if (keys->unlock != NULL)
+    {
+        keys->unlock();
+    }
+    return entry;
+}
+
+static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer);
+
+/* tjson change: parses the name of an object member into item->string, from
+ * the key set of the buffer when there is one and the name has no escapes */
+static cJSON_bool parse_key(cJSON * const item, parse_buffer * const input_buffer)
+{
+    if ((input_buffer->keys != NULL) && (buffer_at_offset(input_buffer)[0] == '\"'))
+    {
+        const unsigned char *start = buffer_at_offset(input_buffer) + 1;
+        const unsigned char *end = start;
+        const unsigned char *limit = input_buffer->content + input_buffer->length;
+        keyset_key *key = NULL;
+        while ((end < limit) && (*end != '\"') && (*end != '\\'))
+        {
+            end++;
+        }
+        if ((end < limit) && (*end == '\"'))
+        {
+            /* records repeat the same few keys, look in the keys this parse
+             * used last before hashing (and locking a shared set) */
+            size_t length = (size_t)(end - start);
+            size_t slot = (length > 0) ? ((length * 31 + start[0] * 7 + end[-1]) & (KEY_CACHE_SIZE - 1)) : 0;
+            key = input_buffer->key_cache[slot];
+            if ((key == NULL) || (key->length != length) || (memcmp(key->string, start, length) != 0))
+            {
+                key = keyset_intern(input_buffer->keys, start, length);
+                input_buffer->key_cache[slot] = key;
+            }
+        }
+        if (key != NULL)
+        {
+            item->string = key->string;
+            item->flags |= INTERNED_STRING;
+            input_buffer->offset = (size_t)(end - input_buffer->content) + 1;
+            return true;
+        }
+    }
+
+    if (!parse_string(item, input_buffer))
+    {
+        return false;
+    }
+
+    /* swap valuestring and string, because we parsed the name */
+    item->string = item->valuestring;
+    item->valuestring = NULL;
+    if (item->flags & INSITU_VALUESTRING)
+    {
+        item->flags = (item->flags & ~INSITU_VALUESTRING) | INSITU_STRING;
+    }
+    if (item->flags & INLINE_VALUESTRING)
+    {
+        item->flags = (item->flags & ~INLINE_VALUESTRING) | INLINE_STRING;
+    }
+    return true;
+}
+
 static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer)
 {
     const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
@@ -819,12 +1138,43 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
             goto fail; /* string ended unexpectedly */
         }
 
-        /* This is at most how much we need for the output */
-        allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-        output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
-        if (output == NULL)
+        /* tjson change: the unescaped string never outgrows its source span,
+         * so an in-situ parse writes it over the input, terminated where the
+         * closing quote was */
+        if (input_buffer->insitu)
         {
-            goto fail; /* allocation failure */
+            output = (unsigned char*)cast_away_const(input_pointer);
+            if (skipped_bytes == 0)
+            {
+                output[input_end - input_pointer] = '\0';
+                item->type = cJSON_String;
+                item->valuestring = (char*)output;
+                item->flags |= INSITU_VALUESTRING;
+                input_buffer->offset = (size_t) (input_end - input_buffer->content) + 1;
+                return true;
+            }
+        }
+        else
+        {
+            /* This is at most how much we need for the output */
+            allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
+            /* tjson change: short strings go to the room left after the node,
+             * allocation_length counts the opening quote so it has room for the terminator */
+            if (allocation_length <= input_buffer->inline_left)
+            {
+                output = input_buffer->inline_tail;
+                input_buffer->inline_tail += allocation_length;
+                input_buffer->inline_left -= allocation_length;
+                item->flags |= INLINE_VALUESTRING;
+            }
+            else
+            {
+                output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+                if (output == NULL)
+                {
+                    goto fail; /* allocation failure */
+                }
+            }
         }
     }
 
@@ -890,6 +1240,10 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 
     item->type = cJSON_String;
     item->valuestring = (char*)output;
+    if (input_buffer->insitu)
+    {
+        item->flags |= INSITU_VALUESTRING;  /* tjson change */
+    }
 
     input_buffer->offset = (size_t) (input_end - input_buffer->content);
     input_buffer->offset++;
@@ -897,7 +1251,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     return true;
 
 fail:
-    if (output != NULL)
+    if ((output != NULL) && !input_buffer->insitu && !(item->flags & INLINE_VALUESTRING))    /* tjson change */
     {
         input_buffer->hooks.deallocate(output);
     }
@@ -1041,10 +1395,9 @@ static cJSON_bool print_string(const cJSON * const item, printbuffer * const p)
 /* Predeclare these prototypes. */
 static cJSON_bool parse_value(cJSON * const item, parse_buffer * const input_buffer);
 static cJSON_bool print_value(const cJSON * const item, printbuffer * const output_buffer);
-static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buffer);
 static cJSON_bool print_array(const cJSON * const item, printbuffer * const output_buffer);
-static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_buffer);
 static cJSON_bool print_object(const cJSON * const item, printbuffer * const output_buffer);
+static cJSON_bool parse_lazy_subtree(cJSON * const item, parse_buffer * const input_buffer);   /* tjson change */
 
 /* Utility to jump whitespace and cr/lf */
 static parse_buffer *buffer_skip_whitespace(parse_buffer * const buffer)
@@ -1104,9 +1457,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
 }
 
 /* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+static cJSON *parse_with_length_opts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, cJSON_bool lazy, cJSON_bool insitu, cJSON_KeySet *keys)  /* tjson change */
 {
-    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 }, 0, 0, 0, 0, 0, { 0 } };
     cJSON *item = NULL;
 
     /* reset error position */
@@ -1122,6 +1475,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer
     buffer.length = buffer_length;
     buffer.offset = 0;
     buffer.hooks = global_hooks;
+    buffer.lazy = lazy;     /* tjson change */
+    buffer.insitu = insitu; /* tjson change */
+    buffer.keys = keys;     /* tjson change */
 
     item = cJSON_New_Item(&global_hooks);
     if (item == NULL) /* memory fail */
@@ -1183,79 +1539,1367 @@ fail:
     return NULL;
 }
 
-/* Default options for cJSON_Parse */
-CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
-{
-    return cJSON_ParseWithOpts(value, 0, 0);
-}
-
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_length)
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
 {
-    return cJSON_ParseWithLengthOpts(value, buffer_length, 0, 0);
+    return parse_with_length_opts(value, buffer_length, return_parse_end, require_null_terminated, false, false, NULL);
 }
 
-#define cjson_min(a, b) (((a) < (b)) ? (a) : (b))
+/* tjson change: lazy parsing */
 
-static unsigned char *print(const cJSON * const item, cJSON_bool format, const internal_hooks * const hooks)
+/* Skips a JSON string starting at its opening quote. Returns NULL if the string
+ * is something parse_string would reject. */
+static const unsigned char *validate_string(const unsigned char *p, const unsigned char * const end)
 {
-    static const size_t default_buffer_size = 256;
-    printbuffer buffer[1];
-    unsigned char *printed = NULL;
+    for (p++; p < end; p++)
+    {
+        if (*p == '\"')
+        {
+            return p + 1;
+        }
+        if (*p != '\\')
+        {
+            continue;
+        }
+        if ((p + 1) >= end)
+        {
+            return NULL;
+        }
+        switch (p[1])
+        {
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+            case '\"':
+            case '\\':
+            case '/':
+                p++;
+                break;
 
-    memset(buffer, 0, sizeof(buffer));
+            case 'u':
+            {
+                unsigned int code = 0;
+                size_t i = 0;
+                for (i = 2; i < 6; i++)
+                {
+                    if (((p + i) >= end) || !isxdigit(p[i]))
+                    {
+                        return NULL;
+                    }
+                }
+                code = parse_hex4(p + 2);
+                if ((code >= 0xDC00) && (code <= 0xDFFF))
+                {
+                    return NULL;
+                }
+                p += 5;
+                if ((code >= 0xD800) && (code <= 0xDBFF))
+                {
+                    /* the second half of the surrogate pair must follow */
+                    if (((p + 2) >= end) || (p[1] != '\\') || (p[2] != 'u'))
+                    {
+                        return NULL;
+                    }
+                    for (i = 3; i < 7; i++)
+                    {
+                        if (((p + i) >= end) || !isxdigit(p[i]))
+                        {
+                            return NULL;
+                        }
+                    }
+                    code = parse_hex4(p + 3);
+                    if ((code < 0xDC00) || (code > 0xDFFF))
+                    {
+                        return NULL;
+                    }
+                    p += 6;
+                }
+                break;
+            }
 
-    /* create buffer */
-    buffer->buffer = (unsigned char*) hooks->allocate(default_buffer_size);
-    buffer->length = default_buffer_size;
-    buffer->format = format;
-    buffer->hooks = *hooks;
-    if (buffer->buffer == NULL)
-    {
-        goto fail;
+            default:
+                return NULL;
+        }
     }
 
-    /* print the value */
-    if (!print_value(item, buffer))
+    return NULL;
+}
+
+/* Skips a number in strict JSON syntax. Anything longer than parse_number's
+ * conversion buffer is rejected. */
+static const unsigned char *validate_number(const unsigned char *p, const unsigned char * const end)
+{
+    const unsigned char *start = p;
+
+    if ((p < end) && (*p == '-'))
     {
-        goto fail;
+        p++;
     }
-    update_offset(buffer);
-
-    /* check if reallocate is available */
-    if (hooks->reallocate != NULL)
+    if ((p < end) && (*p == '0'))
     {
-        printed = (unsigned char*) hooks->reallocate(buffer->buffer, buffer->offset + 1);
-        if (printed == NULL) {
-            goto fail;
-        }
-        buffer->buffer = NULL;
+        p++;
     }
-    else /* otherwise copy the JSON over to a new buffer */
+    else if ((p < end) && (*p >= '1') && (*p <= '9'))
     {
-        printed = (unsigned char*) hooks->allocate(buffer->offset + 1);
-        if (printed == NULL)
+        while ((p < end) && isdigit(*p))
         {
-            goto fail;
+            p++;
         }
-        memcpy(printed, buffer->buffer, cjson_min(buffer->length, buffer->offset + 1));
-        printed[buffer->offset] = '\0'; /* just to be sure */
-
-        /* free the buffer */
-        hooks->deallocate(buffer->buffer);
     }
-
-    return printed;
-
-fail:
-    if (buffer->buffer != NULL)
+    else
     {
-        hooks->deallocate(buffer->buffer);
+        return NULL;
     }
-
-    if (printed != NULL)
+    if ((p < end) && (*p == '.'))
     {
-        hooks->deallocate(printed);
-    }
+        p++;
+        if ((p >= end) || !isdigit(*p))
+        {
+            return NULL;
+        }
+        while ((p < end) && isdigit(*p))
+        {
+            p++;
+        }
+    }
+    if ((p < end) && ((*p == 'e') || (*p == 'E')))
+    {
+        p++;
+        if ((p < end) && ((*p == '+') || (*p == '-')))
+        {
+            p++;
+        }
+        if ((p >= end) || !isdigit(*p))
+        {
+            return NULL;
+        }
+        while ((p < end) && isdigit(*p))
+        {
+            p++;
+        }
+    }
+
+    if ((size_t)(p - start) >= 64)
+    {
+        return NULL;
+    }
+
+    return p;
+}
+
+/* Skips a number the way parse_number reads it: the longest prefix strtod
+ * takes from the run of number characters, of which it sees at most 63. So
+ * [01] or [1.] pass, as they do in cJSON_ParseWithLength. */
+static const unsigned char *skip_parsed_number(const unsigned char *p, const unsigned char * const end)
+{
+    unsigned char number_c_string[64];
+    unsigned char *after_end = NULL;
+    unsigned char decimal_point = get_decimal_point();
+    size_t i = 0;
+
+    /* parse_value only takes these for a number */
+    if ((p >= end) || ((*p != '-') && !isdigit(*p)))
+    {
+        return NULL;
+    }
+    for (i = 0; (i < (sizeof(number_c_string) - 1)) && ((p + i) < end); i++)
+    {
+        if (isdigit(p[i]) || (p[i] == '+') || (p[i] == '-') || (p[i] == 'e') || (p[i] == 'E'))
+        {
+            number_c_string[i] = p[i];
+        }
+        else if (p[i] == '.')
+        {
+            number_c_string[i] = decimal_point;
+        }
+        else
+        {
+            break;
+        }
+    }
+    number_c_string[i] = '\0';
+
+    strtod((const char*)number_c_string, (char**)&after_end);
+    if (after_end == number_c_string)
+    {
+        return NULL;
+    }
+
+    return p + (after_end - number_c_string);
+}
+
+#define skip_ws(p, end) while (((p) < (end)) && (*(p) <= 32)) { (p)++; }
+#define VALIDATE_IN_OBJECT(stack, depth) (((stack)[((depth) - 1) / 8] >> (((depth) - 1) % 8)) & 1)
+
+/* Iterative validator. With "strict" numbers follow the JSON grammar and
+ * only whitespace may follow the value. Otherwise it accepts exactly what
+ * parse_value accepts, trailing data included, as in cJSON_ParseWithLength,
+ * so that a -lazy parse takes the same documents as a plain one and a
+ * validated buffer never fails to materialize later. */
+static cJSON_bool validate(const unsigned char * const content, size_t length, cJSON_bool strict, size_t *error_offset)
+{
+    /* one bit per open container, set for objects */
+    unsigned char inline_stack[PARSE_STACK_INLINE];
+    unsigned char *stack = inline_stack;
+    size_t capacity = PARSE_STACK_INLINE * 8;
+    size_t depth = 0;
+    const unsigned char *p = content;
+    const unsigned char * const end = content + length;
+    cJSON_bool valid = false;
+
+    if ((length > 4) && (strncmp((const char*)p, "\xEF\xBB\xBF", 3) == 0))
+    {
+        p += 3;
+    }
+
+    for (;;)
+    {
+        const unsigned char *value_start = NULL;
+
+        /* a value is expected */
+        skip_ws(p, end);
+        if (p >= end)
+        {
+            goto fail;
+        }
+        value_start = p;
+        switch (*p)
+        {
+            case '[':
+            case '{':
+                if (depth >= nesting_limit)
+                {
+                    goto fail;
+                }
+                if (depth == capacity)
+                {
+                    unsigned char *grown = (unsigned char*)global_hooks.allocate(capacity / 4);
+                    if (grown == NULL)
+                    {
+                        goto fail;
+                    }
+                    memcpy(grown, stack, capacity / 8);
+                    if (stack != inline_stack)
+                    {
+                        global_hooks.deallocate(stack);
+                    }
+                    stack = grown;
+                    capacity *= 2;
+                }
+                if (*p++ == '{')
+                {
+                    stack[depth / 8] |= (unsigned char)(1 << (depth % 8));
+                }
+                else
+                {
+                    stack[depth / 8] &= (unsigned char)~(1 << (depth % 8));
+                }
+                depth++;
+                skip_ws(p, end);
+                if ((p < end) && (*p == (VALIDATE_IN_OBJECT(stack, depth) ? '}' : ']')))
+                {
+                    p++;
+                    depth--;
+                    break;
+                }
+                if (VALIDATE_IN_OBJECT(stack, depth))
+                {
+                    goto key;
+                }
+                continue;
+
+            case '\"':
+                p = validate_string(p, end);
+                break;
+
+            case 'n':
+                p = (((size_t)(end - p) >= 4) && (strncmp((const char*)p, "null", 4) == 0)) ? p + 4 : NULL;
+                break;
+
+            case 't':
+                p = (((size_t)(end - p) >= 4) && (strncmp((const char*)p, "true", 4) == 0)) ? p + 4 : NULL;
+                break;
+
+            case 'f':
+                p = (((size_t)(end - p) >= 5) && (strncmp((const char*)p, "false", 5) == 0)) ? p + 5 : NULL;
+                break;
+
+            default:
+                p = strict ? validate_number(p, end) : skip_parsed_number(p, end);
+                break;
+        }
+        if (p == NULL)
+        {
+            p = value_start;
+            goto fail;
+        }
+
+        /* a value has been consumed, close as many containers as possible */
+        for (;;)
+        {
+            if (depth == 0)
+            {
+                if (strict)
+                {
+                    skip_ws(p, end);
+                    if (p < end)
+                    {
+                        goto fail;
+                    }
+                }
+                valid = true;
+                goto done;
+            }
+            skip_ws(p, end);
+            if (p >= end)
+            {
+                goto fail;
+            }
+            if (*p == ',')
+            {
+                p++;
+                break;
+            }
+            if (*p != (VALIDATE_IN_OBJECT(stack, depth) ? '}' : ']'))
+            {
+                goto fail;
+            }
+            p++;
+            depth--;
+        }
+        if (!VALIDATE_IN_OBJECT(stack, depth))
+        {
+            continue;
+        }
+
+key:
+        skip_ws(p, end);
+        if ((p >= end) || (*p != '\"'))
+        {
+            goto fail;
+        }
+        value_start = p;
+        p = validate_string(p, end);
+        if (p == NULL)
+        {
+            p = value_start;
+            goto fail;
+        }
+        skip_ws(p, end);
+        if ((p >= end) || (*p != ':'))
+        {
+            goto fail;
+        }
+        p++;
+    }
+
+fail:
+    if (error_offset != NULL)
+    {
+        *error_offset = (size_t)(p - content);
+    }
+
+done:
+    if (stack != inline_stack)
+    {
+        global_hooks.deallocate(stack);
+    }
+    return valid;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_Validate(const char *value, size_t buffer_length)
+{
+    if ((value == NULL) || (buffer_length == 0))
+    {
+        return false;
+    }
+
+    return validate((const unsigned char*)value, buffer_length, true, NULL);
+}
+
+/* Length of a validated array/object starting at "p", found by matching
+ * brackets only. */
+static size_t skip_container(const unsigned char * const start, const unsigned char * const end)
+{
+    const unsigned char *p = start;
+    size_t depth = 0;
+
+    while (p < end)
+    {
+        switch (*p++)
+        {
+            case '\"':
+                while ((p < end) && (*p != '\"'))
+                {
+                    p += (*p == '\\') ? 2 : 1;
+                }
+                p++;
+                break;
+
+            case '[':
+            case '{':
+                depth++;
+                break;
+
+            case ']':
+            case '}':
+                if (--depth == 0)
+                {
+                    return (size_t)(p - start);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/* Records the boundaries of the array/object at the current offset instead of parsing it. */
+static cJSON_bool parse_lazy_subtree(cJSON * const item, parse_buffer * const input_buffer)
+{
+    const unsigned char *start = buffer_at_offset(input_buffer);
+    size_t length = skip_container(start, input_buffer->content + input_buffer->length);
+
+    if (length == 0)
+    {
+        return false;
+    }
+
+    item->type = (start[0] == '[') ? cJSON_Array : cJSON_Object;
+    /* INSITU_VALUESTRING on a lazy node: its span may be unescaped in place */
+    item->flags |= LAZY_SUBTREE | (input_buffer->insitu ? INSITU_VALUESTRING : 0);
+    item->valuestring = (char*)cast_away_const(start);
+    item->valuedouble = (double)length;
+    input_buffer->offset += length;
+
+    return true;
+}
+
+static cJSON *parse_lazy(const char *value, size_t buffer_length, cJSON_bool insitu, cJSON_KeySet *keys)
+{
+    size_t error_offset = 0;
+
+    if ((value == NULL) || (buffer_length == 0))
+    {
+        return NULL;
+    }
+
+    if (!validate((const unsigned char*)value, buffer_length, false, &error_offset))
+    {
+        global_error.json = (const unsigned char*)value;
+        global_error.position = error_offset;
+        return NULL;
+    }
+
+    return parse_with_length_opts(value, buffer_length, NULL, false, true, insitu, keys);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseLazyWithLength(const char *value, size_t buffer_length)
+{
+    return parse_lazy(value, buffer_length, false, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituWithLength(char *value, size_t buffer_length, cJSON_bool lazy)
+{
+    if (lazy)
+    {
+        return parse_lazy(value, buffer_length, true, NULL);
+    }
+
+    return parse_with_length_opts(value, buffer_length, NULL, false, false, true, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInternedWithLength(const char *value, size_t buffer_length, cJSON_KeySet *keys, cJSON_bool lazy)
+{
+    if (lazy)
+    {
+        return parse_lazy(value, buffer_length, false, keys);
+    }
+
+    return parse_with_length_opts(value, buffer_length, NULL, false, false, false, keys);
+}
+
+/* tjson change: a PACKED_ARRAY owns one block at valuestring, the number of
+ * values followed by the values themselves */
+static double *packed_values(const cJSON * const array, size_t *count)
+{
+    size_t *header = (size_t*)(void*)array->valuestring;
+
+    *count = header[0];
+    return (double*)(void*)(header + 1);
+}
+
+static double *pack_array(cJSON * const array, size_t count)
+{
+    size_t *header = (size_t*)global_hooks.allocate(sizeof(size_t) + (count * sizeof(double)));
+
+    if (header == NULL)
+    {
+        return NULL;
+    }
+    header[0] = count;
+    array->valuestring = (char*)(void*)header;
+    array->flags |= PACKED_ARRAY;
+
+    return (double*)(void*)(header + 1);
+}
+
+/* Gives a PACKED_ARRAY its number nodes back and frees the vector. */
+static cJSON_bool unpack_array(cJSON * const array)
+{
+    size_t count = 0;
+    size_t i = 0;
+    const double *values = packed_values(array, &count);
+    cJSON *first = NULL;
+    cJSON *last = NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        cJSON *number = cJSON_New_Item(&global_hooks);
+        if (number == NULL)
+        {
+            cJSON_Delete(first);
+            return false;
+        }
+        number->type = cJSON_Number;
+        cJSON_SetNumberHelper(number, values[i]);
+        if (first == NULL)
+        {
+            first = number;
+        }
+        else
+        {
+            last->next = number;
+            number->prev = last;
+        }
+        last = number;
+    }
+    first->prev = last;
+
+    global_hooks.deallocate(array->valuestring);
+    array->valuestring = NULL;
+    array->flags &= ~PACKED_ARRAY;
+    array->child = first;
+
+    return true;
+}
+
+/* Gives a SHARED_SUBTREE node children of its own: copies of the shared
+ * ones that borrow their strings and keep sharing their own children. */
+static cJSON_bool unshare_subtree(cJSON * const node)
+{
+    cJSON *shared = NULL;
+    cJSON *first = NULL;
+    cJSON *last = NULL;
+
+    for (shared = node->child; shared != NULL; shared = shared->next)
+    {
+        cJSON *copy = cJSON_New_Item(&global_hooks);
+        if (copy == NULL)
+        {
+            cJSON_Delete(first);
+            return false;
+        }
+        copy->type = shared->type & (0xFF | cJSON_StringIsConst);
+        copy->string = shared->string;
+        copy->flags = (shared->string != NULL) ? INTERNED_STRING : 0;
+        if ((shared->type & (cJSON_String | cJSON_Raw)) && (shared->valuestring != NULL))
+        {
+            copy->valuestring = shared->valuestring;
+            copy->flags |= INTERNED_VALUESTRING;
+        }
+        copy->valuedouble = shared->valuedouble;
+        copy->valueint = shared->valueint;
+        if (shared->flags & PACKED_ARRAY)
+        {
+            size_t count = 0;
+            const double *values = packed_values(shared, &count);
+            double *copied = pack_array(copy, count);
+            if (copied == NULL)
+            {
+                cJSON_Delete(copy);
+                cJSON_Delete(first);
+                return false;
+            }
+            memcpy(copied, values, count * sizeof(double));
+        }
+        else if (shared->child != NULL)
+        {
+            copy->child = shared->child;
+            copy->type |= cJSON_IsReference;
+            copy->flags |= SHARED_SUBTREE;
+        }
+        if (first == NULL)
+        {
+            first = copy;
+        }
+        else
+        {
+            last->next = copy;
+            copy->prev = last;
+        }
+        last = copy;
+    }
+    if (first != NULL)
+    {
+        first->prev = last;
+    }
+
+    node->child = first;
+    node->type &= ~cJSON_IsReference;
+    node->flags &= ~SHARED_SUBTREE;
+
+    return true;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_Materialize(const cJSON *item)
+{
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 }, 0, 0, 0, 0, 0, { 0 } };
+    cJSON *node = (cJSON*)cast_away_const(item);
+    int kept_type = 0;
+    cJSON_bool parsed = false;
+
+    if ((node != NULL) && (node->flags & PACKED_ARRAY))
+    {
+        return unpack_array(node);
+    }
+    if ((node != NULL) && (node->flags & SHARED_SUBTREE))
+    {
+        return unshare_subtree(node);
+    }
+    if ((node == NULL) || !(node->flags & LAZY_SUBTREE))
+    {
+        return true;
+    }
+
+    buffer.content = (const unsigned char*)node->valuestring;
+    buffer.length = (size_t)node->valuedouble;
+    buffer.hooks = global_hooks;
+    buffer.lazy = true;
+    buffer.insitu = (node->flags & INSITU_VALUESTRING) != 0;
+
+    kept_type = node->type & (cJSON_IsReference | cJSON_StringIsConst);
+    node->flags &= ~(LAZY_SUBTREE | INSITU_VALUESTRING);
+    node->valuestring = NULL;
+    node->valuedouble = 0;
+
+    parsed = parse_value(node, &buffer);
+    node->type |= kept_type;
+    if (!parsed && (node->child != NULL))
+    {
+        cJSON_Delete(node->child);
+        node->child = NULL;
+    }
+
+    return parsed;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_MaterializeForRead(const cJSON *item)
+{
+    if ((item != NULL) && (item->flags & SHARED_SUBTREE))
+    {
+        return true;
+    }
+
+    return cJSON_Materialize(item);
+}
+
+/* Packs "array" if its elements are at least "min_count" numbers. */
+static cJSON_bool pack_number_array(cJSON * const array, size_t min_count)
+{
+    cJSON *child = NULL;
+    size_t count = 0;
+    double *values = NULL;
+
+    for (child = array->child; child != NULL; child = child->next)
+    {
+        if (((child->type & 0xFF) != cJSON_Number) || (child->flags & VISIBLE_IN_TCL))
+        {
+            return false;
+        }
+        count++;
+    }
+    if ((count == 0) || (count < min_count))
+    {
+        return false;
+    }
+
+    values = pack_array(array, count);
+    if (values == NULL)
+    {
+        return false;
+    }
+    for (child = array->child; child != NULL; child = child->next)
+    {
+        *values++ = child->valuedouble;
+    }
+    cJSON_Delete(array->child);
+    array->child = NULL;
+
+    return true;
+}
+
+CJSON_PUBLIC(size_t) cJSON_PackArrays(cJSON *item, size_t min_count)
+{
+    /* the containers whose children are being visited */
+    cJSON *inline_stack[PARSE_STACK_INLINE];
+    cJSON **stack = inline_stack;
+    size_t capacity = PARSE_STACK_INLINE;
+    size_t size = 0;
+    cJSON *current = item;
+    size_t packed = 0;
+
+    while (current != NULL)
+    {
+        if (((current->type & 0xFF) == cJSON_Array) && !(current->type & cJSON_IsReference)
+            && !(current->flags & (LAZY_SUBTREE | PACKED_ARRAY)) && pack_number_array(current, min_count))
+        {
+            packed++;
+        }
+        if ((current->child != NULL) && !(current->type & cJSON_IsReference) && !(current->flags & LAZY_SUBTREE))
+        {
+            if (size == capacity)
+            {
+                cJSON **grown = (cJSON**)global_hooks.allocate(2 * capacity * sizeof(cJSON*));
+                if (grown == NULL)
+                {
+                    break; /* what has been packed so far stays packed */
+                }
+                memcpy(grown, stack, size * sizeof(cJSON*));
+                if (stack != inline_stack)
+                {
+                    global_hooks.deallocate(stack);
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[size++] = current;
+            current = current->child;
+            continue;
+        }
+        /* move on to the next sibling, leaving the containers that are done */
+        while ((size > 0) && (current->next == NULL))
+        {
+            current = stack[--size];
+        }
+        current = (size > 0) ? current->next : NULL;
+    }
+
+    if (stack != inline_stack)
+    {
+        global_hooks.deallocate(stack);
+    }
+
+    return packed;
+}
+
+CJSON_PUBLIC(const double *) cJSON_GetPackedArray(const cJSON *item, size_t *count)
+{
+    if ((item == NULL) || !(item->flags & PACKED_ARRAY))
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    return packed_values(item, count);
+}
+
+/* tjson change: hash-consing of subtrees and strings, see cJSON_Dedup. The
+ * work tables are allocated with malloc/free, like the key sets. */
+
+static cJSON_bool add_item_to_array(cJSON *array, cJSON *item);
+
+/* strings that are too short to be worth a shared copy and its header */
+#define DEDUP_MIN_STRING sizeof(keyset_key)
+
+typedef struct
+{
+    size_t hash;
+    cJSON *node;
+    cJSON_bool is_key;
+} dedup_entry;
+
+/* open addressing, kept at most 3/4 full */
+typedef struct
+{
+    dedup_entry *entries;
+    size_t capacity;
+    size_t count;
+} dedup_table;
+
+typedef struct
+{
+    cJSON *node;
+    cJSON *child;   /* the next child to visit */
+    size_t hash;
+    cJSON_bool pinned;  /* holds a node that must not be shared */
+} dedup_frame;
+
+static size_t dedup_mix(size_t hash, size_t value)
+{
+    hash = (hash ^ value) * (size_t)16777619u;
+    return hash ^ (hash >> 15);
+}
+
+static cJSON_bool dedup_table_add(dedup_table * const table, size_t hash, cJSON *node, cJSON_bool is_key)
+{
+    size_t slot = 0;
+
+    if ((table->count + 1) * 4 > table->capacity * 3)
+    {
+        size_t capacity = (table->capacity == 0) ? KEYSET_MIN_CAPACITY : table->capacity * 2;
+        dedup_entry *entries = (dedup_entry*)calloc(capacity, sizeof(dedup_entry));
+        size_t i = 0;
+        if (entries == NULL)
+        {
+            return false;
+        }
+        for (i = 0; i < table->capacity; i++)
+        {
+            if (table->entries[i].node != NULL)
+            {
+                slot = table->entries[i].hash & (capacity - 1);
+                while (entries[slot].node != NULL)
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                entries[slot] = table->entries[i];
+            }
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    slot = hash & (table->capacity - 1);
+    while (table->entries[slot].node != NULL)
+    {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    table->entries[slot].hash = hash;
+    table->entries[slot].node = node;
+    table->entries[slot].is_key = is_key;
+    table->count++;
+
+    return true;
+}
+
+/* The hash of a value that has no children to visit: a scalar, an empty or
+ * packed array/object or a subtree shared already, known by its children. */
+static size_t dedup_hash_value(const cJSON * const item)
+{
+    size_t hash = 0;
+    size_t count = 0;
+    const double *values = NULL;
+
+    switch (item->type & 0xFF)
+    {
+        case cJSON_Number:
+            hash = hash_key((const unsigned char*)&item->valuedouble, sizeof(double));
+            break;
+        case cJSON_String:
+        case cJSON_Raw:
+            hash = (item->valuestring != NULL) ? hash_key((const unsigned char*)item->valuestring, strlen(item->valuestring)) : 0;
+            break;
+        case cJSON_Array:
+        case cJSON_Object:
+            values = cJSON_GetPackedArray(item, &count);
+            if (values != NULL)
+            {
+                hash = hash_key((const unsigned char*)values, count * sizeof(double));
+            }
+            else if (item->flags & SHARED_SUBTREE)
+            {
+                hash = (size_t)item->child;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return dedup_mix((size_t)(item->type & 0xFF), hash);
+}
+
+/* Whether two siblings of equal subtrees hold the same value. Their own
+ * children were deduplicated first, so equal arrays/objects share them. */
+static cJSON_bool dedup_equal_values(const cJSON * const a, const cJSON * const b)
+{
+    size_t a_count = 0;
+    size_t b_count = 0;
+    const double *a_values = NULL;
+    const double *b_values = NULL;
+
+    if ((a->type & 0xFF) != (b->type & 0xFF))
+    {
+        return false;
+    }
+    switch (a->type & 0xFF)
+    {
+        case cJSON_Number:
+            return memcmp(&a->valuedouble, &b->valuedouble, sizeof(double)) == 0;
+        case cJSON_String:
+        case cJSON_Raw:
+            if ((a->valuestring == NULL) || (b->valuestring == NULL))
+            {
+                return a->valuestring == b->valuestring;
+            }
+            return strcmp(a->valuestring, b->valuestring) == 0;
+        case cJSON_Array:
+        case cJSON_Object:
+            if ((a->flags | b->flags) & PACKED_ARRAY)
+            {
+                a_values = cJSON_GetPackedArray(a, &a_count);
+                b_values = cJSON_GetPackedArray(b, &b_count);
+                return (a_values != NULL) && (b_values != NULL) && (a_count == b_count)
+                    && (memcmp(a_values, b_values, a_count * sizeof(double)) == 0);
+            }
+            if ((a->child == NULL) || (b->child == NULL))
+            {
+                return a->child == b->child;
+            }
+            return (a->flags & b->flags & SHARED_SUBTREE) && (a->child == b->child);
+        default:
+            return true;
+    }
+}
+
+static cJSON_bool dedup_equal(const cJSON * const a, const cJSON * const b)
+{
+    const cJSON *a_child = a->child;
+    const cJSON *b_child = b->child;
+
+    if ((a->type & 0xFF) != (b->type & 0xFF))
+    {
+        return false;
+    }
+    while ((a_child != NULL) && (b_child != NULL))
+    {
+        if ((a_child->string == NULL) != (b_child->string == NULL))
+        {
+            return false;
+        }
+        if ((a_child->string != NULL) && (strcmp(a_child->string, b_child->string) != 0))
+        {
+            return false;
+        }
+        if (!dedup_equal_values(a_child, b_child))
+        {
+            return false;
+        }
+        a_child = a_child->next;
+        b_child = b_child->next;
+    }
+
+    return a_child == b_child;
+}
+
+/* The bytes taken by a chain of siblings and their subtrees, counted like
+ * ::tjson::stats counts them, or 0 if that cannot be told. */
+static size_t dedup_chain_bytes(const cJSON *first)
+{
+    const cJSON **stack = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t bytes = 0;
+    const cJSON *item = first;
+
+    while (item != NULL)
+    {
+        size_t count = 0;
+        bytes += sizeof(cJSON);
+        if ((item->string != NULL) && !(item->flags & (INSITU_STRING | INTERNED_STRING)))
+        {
+            bytes += strlen(item->string) + 1;
+        }
+        if (cJSON_GetPackedArray(item, &count) != NULL)
+        {
+            bytes += sizeof(size_t) + (count * sizeof(double));
+        }
+        else if ((item->type & (cJSON_String | cJSON_Raw)) && (item->valuestring != NULL)
+            && !(item->flags & (INSITU_VALUESTRING | INTERNED_VALUESTRING)) && !(item->type & cJSON_IsReference))
+        {
+            bytes += strlen(item->valuestring) + 1;
+        }
+        if ((item->child != NULL) && !(item->type & cJSON_IsReference))
+        {
+            if (item->next != NULL)
+            {
+                if (size == capacity)
+                {
+                    const cJSON **grown = (const cJSON**)realloc((void*)stack, (capacity + PARSE_STACK_INLINE) * sizeof(cJSON*));
+                    if (grown == NULL)
+                    {
+                        free((void*)stack);
+                        return 0;
+                    }
+                    stack = grown;
+                    capacity += PARSE_STACK_INLINE;
+                }
+                stack[size++] = item->next;
+            }
+            item = item->child;
+            continue;
+        }
+        item = item->next;
+        if ((item == NULL) && (size > 0))
+        {
+            item = stack[--size];
+        }
+    }
+    free((void*)stack);
+
+    return bytes;
+}
+
+/* Makes "node" share the children of "equal", which are moved to "store"
+ * the first time they are shared. */
+static cJSON_bool dedup_share(cJSON * const node, cJSON * const equal, cJSON * const store, cJSON_DedupStats * const stats)
+{
+    size_t freed = dedup_chain_bytes(node->child);
+
+    if (!(equal->flags & SHARED_SUBTREE))
+    {
+        cJSON *holder = cJSON_New_Item(&global_hooks);
+        if (holder == NULL)
+        {
+            return false;
+        }
+        holder->type = equal->type & 0xFF;
+        holder->child = equal->child;
+        if (!add_item_to_array(store, holder))
+        {
+            holder->child = NULL;
+            cJSON_Delete(holder);
+            return false;
+        }
+        equal->type |= cJSON_IsReference;
+        equal->flags |= SHARED_SUBTREE;
+        freed = (freed > sizeof(cJSON)) ? freed - sizeof(cJSON) : 0;
+    }
+
+    cJSON_Delete(node->child);
+    node->child = equal->child;
+    node->type |= cJSON_IsReference;
+    node->flags |= SHARED_SUBTREE;
+    stats->subtrees++;
+    stats->bytes_saved += freed;
+
+    return true;
+}
+
+static cJSON_bool dedup_has_children(const cJSON * const item)
+{
+    return (item->type & (cJSON_Array | cJSON_Object)) && (item->child != NULL)
+        && !(item->type & cJSON_IsReference) && !(item->flags & (LAZY_SUBTREE | PACKED_ARRAY));
+}
+
+/* Adds a finished child to the hash of its parent. A parent holding nodes
+ * visible in Tcl or shaped records is pinned: it may not be deleted as a
+ * duplicate nor be reached through shared children. */
+static void dedup_fold(dedup_frame * const parent, const cJSON * const child, size_t hash, cJSON_bool pinned)
+{
+    size_t key_hash = (child->string != NULL) ? hash_key((const unsigned char*)child->string, strlen(child->string)) : 0;
+
+    parent->hash = dedup_mix(dedup_mix(parent->hash, key_hash), hash);
+    parent->pinned = parent->pinned || pinned || (child->flags & (VISIBLE_IN_TCL | SHAPED_OBJECT));
+}
+
+/* Turns the arrays/objects under "item" that equal one met before into
+ * references to its children, visiting the children of a node first. */
+static cJSON_bool dedup_subtrees(cJSON * const item, cJSON * const store, cJSON_DedupStats * const stats)
+{
+    dedup_table seen = { NULL, 0, 0 };
+    dedup_frame *stack = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    cJSON_bool ok = true;
+    cJSON *current = item;
+
+    while (ok)
+    {
+        if (dedup_has_children(current))
+        {
+            if (size == capacity)
+            {
+                dedup_frame *grown = (dedup_frame*)realloc(stack, (capacity + PARSE_STACK_INLINE) * sizeof(dedup_frame));
+                if (grown == NULL)
+                {
+                    ok = false;
+                    break;
+                }
+                stack = grown;
+                capacity += PARSE_STACK_INLINE;
+            }
+            stack[size].node = current;
+            stack[size].child = current->child;
+            stack[size].hash = dedup_mix(0, (size_t)(current->type & 0xFF));
+            stack[size].pinned = false;
+            size++;
+        }
+        else if (size > 0)
+        {
+            dedup_fold(&stack[size - 1], current, dedup_hash_value(current),
+                       (current->flags & LAZY_SUBTREE) || ((current->type & cJSON_IsReference) && !(current->flags & SHARED_SUBTREE)));
+        }
+
+        /* finish the containers whose children are all done */
+        while ((size > 0) && (stack[size - 1].child == NULL))
+        {
+            dedup_frame *frame = &stack[--size];
+            cJSON *node = frame->node;
+            if (!frame->pinned && (node != item) && !(node->flags & SHAPED_OBJECT))
+            {
+                cJSON *equal = NULL;
+                size_t slot = 0;
+                if (seen.capacity > 0)
+                {
+                    for (slot = frame->hash & (seen.capacity - 1); seen.entries[slot].node != NULL; slot = (slot + 1) & (seen.capacity - 1))
+                    {
+                        if ((seen.entries[slot].hash == frame->hash) && dedup_equal(node, seen.entries[slot].node))
+                        {
+                            equal = seen.entries[slot].node;
+                            break;
+                        }
+                    }
+                }
+                ok = (equal != NULL) ? dedup_share(node, equal, store, stats) : dedup_table_add(&seen, frame->hash, node, false);
+                if (!ok)
+                {
+                    break;
+                }
+            }
+            if (size > 0)
+            {
+                dedup_fold(&stack[size - 1], node, frame->hash, frame->pinned);
+            }
+        }
+        if (!ok || (size == 0))
+        {
+            break;
+        }
+        current = stack[size - 1].child;
+        stack[size - 1].child = current->next;
+    }
+
+    free(seen.entries);
+    free(stack);
+
+    return ok;
+}
+
+/* Points the key or string value of "node" at "shared" instead of its own copy. */
+static void dedup_use_string(cJSON * const node, cJSON_bool is_key, char *shared)
+{
+    if (is_key)
+    {
+        global_hooks.deallocate(node->string);
+        node->string = shared;
+        node->flags |= INTERNED_STRING;
+    }
+    else
+    {
+        global_hooks.deallocate(node->valuestring);
+        node->valuestring = shared;
+        node->flags |= INTERNED_VALUESTRING;
+    }
+}
+
+/* Shares the key or string value of "node" through "keys" if it is in there
+ * already or was met before, in which case its first holder shares it too. */
+static cJSON_bool dedup_string(cJSON * const node, cJSON_bool is_key, dedup_table * const seen, cJSON_KeySet * const keys, cJSON_DedupStats * const stats)
+{
+    const char *string = is_key ? node->string : node->valuestring;
+    size_t length = strlen(string);
+    size_t hash = 0;
+    size_t slot = 0;
+    keyset_key *key = NULL;
+
+    if (length < DEDUP_MIN_STRING)
+    {
+        return true;
+    }
+    key = keyset_find(keys, (const unsigned char*)string, length);
+    if (key != NULL)
+    {
+        dedup_use_string(node, is_key, key->string);
+        stats->strings++;
+        stats->bytes_saved += length + 1;
+        return true;
+    }
+
+    hash = hash_key((const unsigned char*)string, length);
+    if (seen->capacity > 0)
+    {
+        for (slot = hash & (seen->capacity - 1); seen->entries[slot].node != NULL; slot = (slot + 1) & (seen->capacity - 1))
+        {
+            dedup_entry *entry = &seen->entries[slot];
+            const char *first = entry->is_key ? entry->node->string : entry->node->valuestring;
+            if ((entry->hash == hash) && (strcmp(first, string) == 0))
+            {
+                key = keyset_intern(keys, (const unsigned char*)string, length);
+                if (key == NULL)
+                {
+                    return true; /* the set is full */
+                }
+                dedup_use_string(entry->node, entry->is_key, key->string);
+                dedup_use_string(node, is_key, key->string);
+                stats->strings++;
+                stats->bytes_saved += (length + 1) - offsetof(keyset_key, string);
+                return true;
+            }
+        }
+    }
+
+    return dedup_table_add(seen, hash, node, is_key);
+}
+
+/* Shares the strings met more than once in the subtree of "item", which is
+ * walked in document order, without following references. */
+static cJSON_bool dedup_strings(cJSON * const item, dedup_table * const seen, cJSON_KeySet * const keys, cJSON_DedupStats * const stats)
+{
+    cJSON **stack = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    cJSON_bool ok = true;
+    cJSON *current = item;
+
+    while ((current != NULL) && ok)
+    {
+        if ((current->string != NULL) && !(current->type & cJSON_StringIsConst) && !(current->flags & STRING_NOT_OWNED))
+        {
+            ok = dedup_string(current, true, seen, keys, stats);
+        }
+        if (ok && (current->type & (cJSON_String | cJSON_Raw)) && (current->valuestring != NULL)
+            && !(current->type & cJSON_IsReference) && !(current->flags & (VALUESTRING_NOT_OWNED | LAZY_SUBTREE)))
+        {
+            ok = dedup_string(current, false, seen, keys, stats);
+        }
+        if ((current->child != NULL) && !(current->type & cJSON_IsReference) && !(current->flags & LAZY_SUBTREE))
+        {
+            if (size == capacity)
+            {
+                cJSON **grown = (cJSON**)realloc(stack, (capacity + PARSE_STACK_INLINE) * sizeof(cJSON*));
+                if (grown == NULL)
+                {
+                    ok = false;
+                    break;
+                }
+                stack = grown;
+                capacity += PARSE_STACK_INLINE;
+            }
+            stack[size++] = current;
+            current = current->child;
+            continue;
+        }
+        /* move on to the next sibling, leaving the containers that are done */
+        while ((size > 0) && (current->next == NULL))
+        {
+            current = stack[--size];
+        }
+        current = (size > 0) ? current->next : NULL;
+    }
+    free(stack);
+
+    return ok;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_Dedup(cJSON *item, cJSON *store, cJSON_KeySet *keys, cJSON_DedupStats *stats)
+{
+    dedup_table seen = { NULL, 0, 0 };
+    cJSON_bool ok = false;
+
+    memset(stats, 0, sizeof(cJSON_DedupStats));
+    if ((item == NULL) || (store == NULL) || (keys == NULL) || ((item->flags | store->flags) & FROZEN_NODE)
+        || !cJSON_Materialize(item))
+    {
+        return false;
+    }
+
+    /* subtrees first, so that the strings of the deleted ones are not visited */
+    ok = dedup_subtrees(item, store, stats)
+        && dedup_strings(item, &seen, keys, stats)
+        && dedup_strings(store, &seen, keys, stats);
+    free(seen.entries);
+
+    return ok;
+}
+
+/* Default options for cJSON_Parse */
+CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
+{
+    return cJSON_ParseWithOpts(value, 0, 0);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_length)
+{
+    return cJSON_ParseWithLengthOpts(value, buffer_length, 0, 0);
+}
+
+#define cjson_min(a, b) (((a) < (b)) ? (a) : (b))
+
+static unsigned char *print(const cJSON * const item, cJSON_bool format, const internal_hooks * const hooks)
+{
+    static const size_t default_buffer_size = 256;
+    printbuffer buffer[1];
+    unsigned char *printed = NULL;
+
+    memset(buffer, 0, sizeof(buffer));
+
+    /* create buffer */
+    buffer->buffer = (unsigned char*) hooks->allocate(default_buffer_size);
+    buffer->length = default_buffer_size;
+    buffer->format = format;
+    buffer->hooks = *hooks;
+    if (buffer->buffer == NULL)
+    {
+        goto fail;
+    }
+
+    /* print the value */
+    if (!print_value(item, buffer))
+    {
+        goto fail;
+    }
+    update_offset(buffer);
+
+    /* check if reallocate is available */
+    if (hooks->reallocate != NULL)
+    {
+        printed = (unsigned char*) hooks->reallocate(buffer->buffer, buffer->offset + 1);
+        if (printed == NULL) {
+            goto fail;
+        }
+        buffer->buffer = NULL;
+    }
+    else /* otherwise copy the JSON over to a new buffer */
+    {
+        printed = (unsigned char*) hooks->allocate(buffer->offset + 1);
+        if (printed == NULL)
+        {
+            goto fail;
+        }
+        memcpy(printed, buffer->buffer, cjson_min(buffer->length, buffer->offset + 1));
+        printed[buffer->offset] = '\0'; /* just to be sure */
+
+        /* free the buffer */
+        hooks->deallocate(buffer->buffer);
+    }
+
+    return printed;
+
+fail:
+    if (buffer->buffer != NULL)
+    {
+        hooks->deallocate(buffer->buffer);
+    }
+
+    if (printed != NULL)
+    {
+        hooks->deallocate(printed);
+    }
 
     return NULL;
 }
@@ -1320,59 +2964,302 @@ CJSON_PUBLIC(cJSON_bool) cJSON_PrintPreallocated(cJSON *item, char *buffer, cons
     return print_value(item, &p);
 }
 
-/* Parser core - when encountering text, process appropriately. */
-static cJSON_bool parse_value(cJSON * const item, parse_buffer * const input_buffer)
+/* tjson change: the parser is iterative. Open arrays/objects are kept on an
+ * explicit stack instead of the C stack, so the nesting depth is bounded by
+ * cJSON_SetNestingLimit only. */
+/* Append a child, keeping the child->prev == last element invariant. */
+static void append_parsed_child(cJSON * const parent, cJSON * const child)
 {
-    if ((input_buffer == NULL) || (input_buffer->content == NULL))
+    if (parent->child == NULL)
     {
-        return false; /* no input */
+        parent->child = child;
+        child->prev = child;
+    }
+    else
+    {
+        cJSON *last = parent->child->prev;
+        last->next = child;
+        child->prev = last;
+        parent->child->prev = child;
     }
+}
+
+/* tjson change: keys and string values up to this length are stored in the
+ * allocation of their node, saving a heap block and a pointer chase each */
+#define INLINE_STRING_MAX 24
+
+/* Room needed for the string at "offset" if it is short enough to be inlined, otherwise 0.
+ * Escapes only shrink a string, so its raw length is an upper bound. */
+static size_t inline_string_size(const parse_buffer * const input_buffer, size_t offset)
+{
+    const unsigned char *start = input_buffer->content + offset;
+    const unsigned char *end = input_buffer->content + input_buffer->length;
+    const unsigned char *p = start + 1;
 
-    /* parse the different types of values */
-    /* null */
-    if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "null", 4) == 0))
+    if ((offset >= input_buffer->length) || (*start != '\"'))
     {
-        item->type = cJSON_NULL;
-        input_buffer->offset += 4;
-        return true;
+        return 0;
     }
-    /* false */
-    if (can_read(input_buffer, 5) && (strncmp((const char*)buffer_at_offset(input_buffer), "false", 5) == 0))
+    if ((size_t)(end - p) > (INLINE_STRING_MAX + 1))
     {
-        item->type = cJSON_False;
-        input_buffer->offset += 5;
-        return true;
+        end = p + INLINE_STRING_MAX + 1;
     }
-    /* true */
-    if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "true", 4) == 0))
+    for (; p < end; p++)
     {
-        item->type = cJSON_True;
-        item->valueint = 1;
-        input_buffer->offset += 4;
-        return true;
+        if (*p == '\"')
+        {
+            return (size_t)(p - start);
+        }
+        if (*p == '\\')
+        {
+            p++;
+        }
     }
-    /* string */
-    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '\"'))
+
+    return 0;
+}
+
+/* Room needed after the node of the next array element or object member for
+ * its key and string value, peeking past the key without parsing it. */
+static size_t inline_member_size(const parse_buffer * const input_buffer, cJSON_bool member)
+{
+    size_t offset = input_buffer->offset;
+    size_t key_size = 0;
+
+    if (member && (input_buffer->keys != NULL))
     {
-        return parse_string(item, input_buffer);
+        /* the name goes to the key set, skip it of any length to size the value */
+        const unsigned char *p = input_buffer->content + offset + 1;
+        const unsigned char *end = input_buffer->content + input_buffer->length;
+        while ((p < end) && (*p != '\"'))
+        {
+            p += (*p == '\\') ? 2 : 1;
+        }
+        if (p >= end)
+        {
+            return 0;
+        }
+        offset = (size_t)(p - input_buffer->content) + 1;
     }
-    /* number */
-    if (can_access_at_index(input_buffer, 0) && ((buffer_at_offset(input_buffer)[0] == '-') || ((buffer_at_offset(input_buffer)[0] >= '0') && (buffer_at_offset(input_buffer)[0] <= '9'))))
+    else if (member)
     {
-        return parse_number(item, input_buffer);
+        key_size = inline_string_size(input_buffer, offset);
+        if (key_size == 0)
+        {
+            return 0;
+        }
+        offset += key_size + 1;
     }
-    /* array */
-    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '['))
+    if (member)
     {
-        return parse_array(item, input_buffer);
+        while ((offset < input_buffer->length) && (input_buffer->content[offset] <= 32))
+        {
+            offset++;
+        }
+        if ((offset >= input_buffer->length) || (input_buffer->content[offset] != ':'))
+        {
+            return key_size;
+        }
+        offset++;
+        while ((offset < input_buffer->length) && (input_buffer->content[offset] <= 32))
+        {
+            offset++;
+        }
     }
-    /* object */
-    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '{'))
+
+    return key_size + inline_string_size(input_buffer, offset);
+}
+
+/* Parser core - when encountering text, process appropriately. */
+static cJSON_bool parse_value(cJSON * const item, parse_buffer * const input_buffer)
+{
+    cJSON *inline_stack[PARSE_STACK_INLINE];
+    cJSON **stack = inline_stack;
+    size_t capacity = PARSE_STACK_INLINE;
+    size_t size = 0;
+    cJSON *current = item;
+    cJSON_bool success = false;
+
+    if ((input_buffer == NULL) || (input_buffer->content == NULL))
     {
-        return parse_object(item, input_buffer);
+        return false; /* no input */
     }
 
-    return false;
+    for (;;)
+    {
+        cJSON *parent = NULL;
+        cJSON *new_item = NULL;
+        size_t inline_size = 0;
+        unsigned char c = 0;
+
+        /* parse the different types of values */
+        /* null */
+        if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "null", 4) == 0))
+        {
+            current->type = cJSON_NULL;
+            input_buffer->offset += 4;
+        }
+        /* false */
+        else if (can_read(input_buffer, 5) && (strncmp((const char*)buffer_at_offset(input_buffer), "false", 5) == 0))
+        {
+            current->type = cJSON_False;
+            input_buffer->offset += 5;
+        }
+        /* true */
+        else if (can_read(input_buffer, 4) && (strncmp((const char*)buffer_at_offset(input_buffer), "true", 4) == 0))
+        {
+            current->type = cJSON_True;
+            current->valueint = 1;
+            input_buffer->offset += 4;
+        }
+        else if (cannot_access_at_index(input_buffer, 0))
+        {
+            goto fail;
+        }
+        /* string */
+        else if ((c = buffer_at_offset(input_buffer)[0]) == '\"')
+        {
+            if (!parse_string(current, input_buffer))
+            {
+                goto fail;
+            }
+        }
+        /* number */
+        else if ((c == '-') || ((c >= '0') && (c <= '9')))
+        {
+            if (!parse_number(current, input_buffer))
+            {
+                goto fail;
+            }
+        }
+        /* nested arrays/objects of a lazy parse are only delimited */
+        else if (((c == '[') || (c == '{')) && input_buffer->lazy && (input_buffer->depth > 0))
+        {
+            if (!parse_lazy_subtree(current, input_buffer))
+            {
+                goto fail;
+            }
+        }
+        /* array or object: open it and go on with its first element */
+        else if ((c == '[') || (c == '{'))
+        {
+            if (input_buffer->depth >= nesting_limit)
+            {
+                goto fail; /* to deeply nested */
+            }
+            if (size == capacity)
+            {
+                cJSON **grown = (cJSON**)input_buffer->hooks.allocate(2 * capacity * sizeof(cJSON*));
+                if (grown == NULL)
+                {
+                    goto fail; /* allocation failure */
+                }
+                memcpy(grown, stack, size * sizeof(cJSON*));
+                if (stack != inline_stack)
+                {
+                    input_buffer->hooks.deallocate(stack);
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[size++] = current;
+            input_buffer->depth++;
+            current->type = (c == '[') ? cJSON_Array : cJSON_Object;
+
+            input_buffer->offset++;
+            buffer_skip_whitespace(input_buffer);
+            if (cannot_access_at_index(input_buffer, 0))
+            {
+                goto fail;
+            }
+            if (buffer_at_offset(input_buffer)[0] == ((c == '[') ? ']' : '}'))
+            {
+                /* empty array/object */
+                input_buffer->offset++;
+                input_buffer->depth--;
+                size--;
+            }
+            else
+            {
+                goto element;
+            }
+        }
+        else
+        {
+            goto fail;
+        }
+
+        /* a value has been parsed, close as many containers as possible */
+        for (;;)
+        {
+            if (size == 0)
+            {
+                success = true;
+                goto done;
+            }
+            buffer_skip_whitespace(input_buffer);
+            if (cannot_access_at_index(input_buffer, 0))
+            {
+                goto fail;
+            }
+            c = buffer_at_offset(input_buffer)[0];
+            if (c == ',')
+            {
+                input_buffer->offset++;
+                buffer_skip_whitespace(input_buffer);
+                break;
+            }
+            if (c != (((stack[size - 1]->type & 0xFF) == cJSON_Array) ? ']' : '}'))
+            {
+                goto fail; /* expected end of array/object */
+            }
+            input_buffer->offset++;
+            input_buffer->depth--;
+            size--;
+        }
+
+element:
+        /* allocate the next element and attach it to the innermost container */
+        parent = stack[size - 1];
+        inline_size = input_buffer->insitu ? 0 : inline_member_size(input_buffer, (parent->type & 0xFF) == cJSON_Object);
+        new_item = cJSON_New_Item_With_Tail(&(input_buffer->hooks), inline_size);
+        if (new_item == NULL)
+        {
+            goto fail; /* allocation failure */
+        }
+        append_parsed_child(parent, new_item);
+        current = new_item;
+        input_buffer->inline_tail = (unsigned char*)(new_item + 1);
+        input_buffer->inline_left = inline_size;
+
+        if ((parent->type & 0xFF) == cJSON_Object)
+        {
+            /* parse the name of the child */
+            if (cannot_access_at_index(input_buffer, 0) || !parse_key(current, input_buffer))
+            {
+                goto fail; /* failed to parse name */
+            }
+            buffer_skip_whitespace(input_buffer);
+
+            if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != ':'))
+            {
+                goto fail; /* invalid object */
+            }
+            input_buffer->offset++;
+            buffer_skip_whitespace(input_buffer);
+        }
+    }
+
+fail:
+    input_buffer->depth -= size;
+
+done:
+    if (stack != inline_stack)
+    {
+        input_buffer->hooks.deallocate(stack);
+    }
+
+    return success;
 }
 
 /* Render a value to text. */
@@ -1439,9 +3326,11 @@ static cJSON_bool print_value(const cJSON * const item, printbuffer * const outp
             return print_string(item, output_buffer);
 
         case cJSON_Array:
+            cJSON_MaterializeForRead(item);     /* tjson change */
             return print_array(item, output_buffer);
 
         case cJSON_Object:
+            cJSON_MaterializeForRead(item);     /* tjson change */
             return print_object(item, output_buffer);
 
         default:
@@ -1449,104 +3338,6 @@ static cJSON_bool print_value(const cJSON * const item, printbuffer * const outp
     }
 }
 
-/* Build an array from input text. */
-static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buffer)
-{
-    cJSON *head = NULL; /* head of the linked list */
-    cJSON *current_item = NULL;
-
-    if (input_buffer->depth >= CJSON_NESTING_LIMIT)
-    {
-        return false; /* to deeply nested */
-    }
-    input_buffer->depth++;
-
-    if (buffer_at_offset(input_buffer)[0] != '[')
-    {
-        /* not an array */
-        goto fail;
-    }
-
-    input_buffer->offset++;
-    buffer_skip_whitespace(input_buffer);
-    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ']'))
-    {
-        /* empty array */
-        goto success;
-    }
-
-    /* check if we skipped to the end of the buffer */
-    if (cannot_access_at_index(input_buffer, 0))
-    {
-        input_buffer->offset--;
-        goto fail;
-    }
-
-    /* step back to character in front of the first element */
-    input_buffer->offset--;
-    /* loop through the comma separated array elements */
-    do
-    {
-        /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
-        if (new_item == NULL)
-        {
-            goto fail; /* allocation failure */
-        }
-
-        /* attach next item to list */
-        if (head == NULL)
-        {
-            /* start the linked list */
-            current_item = head = new_item;
-        }
-        else
-        {
-            /* add to the end and advance */
-            current_item->next = new_item;
-            new_item->prev = current_item;
-            current_item = new_item;
-        }
-
-        /* parse next value */
-        input_buffer->offset++;
-        buffer_skip_whitespace(input_buffer);
-        if (!parse_value(current_item, input_buffer))
-        {
-            goto fail; /* failed to parse value */
-        }
-        buffer_skip_whitespace(input_buffer);
-    }
-    while (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ','));
-
-    if (cannot_access_at_index(input_buffer, 0) || buffer_at_offset(input_buffer)[0] != ']')
-    {
-        goto fail; /* expected end of array */
-    }
-
-success:
-    input_buffer->depth--;
-
-    if (head != NULL) {
-        head->prev = current_item;
-    }
-
-    item->type = cJSON_Array;
-    item->child = head;
-
-    input_buffer->offset++;
-
-    return true;
-
-fail:
-    if (head != NULL)
-    {
-        cJSON_Delete(head);
-    }
-
-    return false;
-}
-
 /* Render an array to text */
 static cJSON_bool print_array(const cJSON * const item, printbuffer * const output_buffer)
 {
@@ -1578,148 +3369,35 @@ static cJSON_bool print_array(const cJSON * const item, printbuffer * const outp
             return false;
         }
         update_offset(output_buffer);
-        if (current_element->next)
-        {
-            length = (size_t) (output_buffer->format ? 2 : 1);
-            output_pointer = ensure(output_buffer, length + 1);
-            if (output_pointer == NULL)
-            {
-                return false;
-            }
-            *output_pointer++ = ',';
-            if(output_buffer->format)
-            {
-                *output_pointer++ = ' ';
-            }
-            *output_pointer = '\0';
-            output_buffer->offset += length;
-        }
-        current_element = current_element->next;
-    }
-
-    output_pointer = ensure(output_buffer, 2);
-    if (output_pointer == NULL)
-    {
-        return false;
-    }
-    *output_pointer++ = ']';
-    *output_pointer = '\0';
-    output_buffer->depth--;
-
-    return true;
-}
-
-/* Build an object from the text. */
-static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_buffer)
-{
-    cJSON *head = NULL; /* linked list head */
-    cJSON *current_item = NULL;
-
-    if (input_buffer->depth >= CJSON_NESTING_LIMIT)
-    {
-        return false; /* to deeply nested */
-    }
-    input_buffer->depth++;
-
-    if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != '{'))
-    {
-        goto fail; /* not an object */
-    }
-
-    input_buffer->offset++;
-    buffer_skip_whitespace(input_buffer);
-    if (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == '}'))
-    {
-        goto success; /* empty object */
-    }
-
-    /* check if we skipped to the end of the buffer */
-    if (cannot_access_at_index(input_buffer, 0))
-    {
-        input_buffer->offset--;
-        goto fail;
-    }
-
-    /* step back to character in front of the first element */
-    input_buffer->offset--;
-    /* loop through the comma separated array elements */
-    do
-    {
-        /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
-        if (new_item == NULL)
-        {
-            goto fail; /* allocation failure */
-        }
-
-        /* attach next item to list */
-        if (head == NULL)
-        {
-            /* start the linked list */
-            current_item = head = new_item;
-        }
-        else
-        {
-            /* add to the end and advance */
-            current_item->next = new_item;
-            new_item->prev = current_item;
-            current_item = new_item;
-        }
-
-        /* parse the name of the child */
-        input_buffer->offset++;
-        buffer_skip_whitespace(input_buffer);
-        if (!parse_string(current_item, input_buffer))
-        {
-            goto fail; /* failed to parse name */
-        }
-        buffer_skip_whitespace(input_buffer);
-
-        /* swap valuestring and string, because we parsed the name */
-        current_item->string = current_item->valuestring;
-        current_item->valuestring = NULL;
-
-        if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != ':'))
-        {
-            goto fail; /* invalid object */
-        }
-
-        /* parse the value */
-        input_buffer->offset++;
-        buffer_skip_whitespace(input_buffer);
-        if (!parse_value(current_item, input_buffer))
+        if (current_element->next)
         {
-            goto fail; /* failed to parse value */
+            length = (size_t) (output_buffer->format ? 2 : 1);
+            output_pointer = ensure(output_buffer, length + 1);
+            if (output_pointer == NULL)
+            {
+                return false;
+            }
+            *output_pointer++ = ',';
+            if(output_buffer->format)
+            {
+                *output_pointer++ = ' ';
+            }
+            *output_pointer = '\0';
+            output_buffer->offset += length;
         }
-        buffer_skip_whitespace(input_buffer);
+        current_element = current_element->next;
     }
-    while (can_access_at_index(input_buffer, 0) && (buffer_at_offset(input_buffer)[0] == ','));
 
-    if (cannot_access_at_index(input_buffer, 0) || (buffer_at_offset(input_buffer)[0] != '}'))
+    output_pointer = ensure(output_buffer, 2);
+    if (output_pointer == NULL)
     {
-        goto fail; /* expected end of object */
-    }
-
-success:
-    input_buffer->depth--;
-
-    if (head != NULL) {
-        head->prev = current_item;
+        return false;
     }
+    *output_pointer++ = ']';
+    *output_pointer = '\0';
+    output_buffer->depth--;
 
-    item->type = cJSON_Object;
-    item->child = head;
-
-    input_buffer->offset++;
     return true;
-
-fail:
-    if (head != NULL)
-    {
-        cJSON_Delete(head);
-    }
-
-    return false;
 }
 
 /* Render an object to text. */
@@ -1836,6 +3514,409 @@ static cJSON_bool print_object(const cJSON * const item, printbuffer * const out
     return true;
 }
 
+/* tjson change: frozen trees. cJSON_Freeze copies a tree into one block laid
+ * out as a header, the nodes in breadth-first order, the key indexes of the
+ * larger objects and the distinct strings. Breadth-first order keeps the
+ * children of each array/object next to each other, so a member is found by
+ * its position, and the index of an object (at its valuestring) lists the
+ * positions of its members sorted by key for a binary search. */
+typedef struct
+{
+    size_t num_nodes;
+    size_t size;
+} frozen_header;
+
+#define FROZEN_INDEX_MIN 8
+
+typedef struct
+{
+    const cJSON *source;
+    size_t packed_index;    /* element of the packed array "source", or (size_t)-1 */
+    size_t first_child;
+    size_t num_children;
+    size_t string;          /* offsets into the strings, or (size_t)-1 */
+    size_t valuestring;
+    size_t index;           /* offset of the key index into the indexes, or (size_t)-1 */
+} frozen_entry;
+
+typedef struct
+{
+    const char *string;
+    size_t length;
+    size_t hash;
+    size_t offset;
+} frozen_string;
+
+typedef struct
+{
+    frozen_string *slots;
+    size_t capacity;
+    size_t count;
+    size_t bytes;
+} frozen_strings;
+
+/* Offset of "string" among the distinct strings, adding it if it is new. */
+static size_t frozen_intern(frozen_strings * const strings, const char * const string)
+{
+    size_t length = strlen(string);
+    size_t hash = hash_key((const unsigned char*)string, length);
+    size_t slot = 0;
+
+    if (2 * (strings->count + 1) > strings->capacity)
+    {
+        size_t capacity = (strings->capacity == 0) ? KEYSET_MIN_CAPACITY : 2 * strings->capacity;
+        frozen_string *slots = (frozen_string*)global_hooks.allocate(capacity * sizeof(frozen_string));
+        size_t i = 0;
+        if (slots == NULL)
+        {
+            return (size_t)-1;
+        }
+        memset(slots, 0, capacity * sizeof(frozen_string));
+        for (i = 0; i < strings->capacity; i++)
+        {
+            if (strings->slots[i].string != NULL)
+            {
+                slot = strings->slots[i].hash & (capacity - 1);
+                while (slots[slot].string != NULL)
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = strings->slots[i];
+            }
+        }
+        if (strings->slots != NULL)
+        {
+            global_hooks.deallocate(strings->slots);
+        }
+        strings->slots = slots;
+        strings->capacity = capacity;
+    }
+
+    slot = hash & (strings->capacity - 1);
+    while (strings->slots[slot].string != NULL)
+    {
+        frozen_string *candidate = &strings->slots[slot];
+        if ((candidate->hash == hash) && (candidate->length == length) && (memcmp(candidate->string, string, length) == 0))
+        {
+            return candidate->offset;
+        }
+        slot = (slot + 1) & (strings->capacity - 1);
+    }
+    strings->slots[slot].string = string;
+    strings->slots[slot].length = length;
+    strings->slots[slot].hash = hash;
+    strings->slots[slot].offset = strings->bytes;
+    strings->count++;
+    strings->bytes += length + 1;
+
+    return strings->slots[slot].offset;
+}
+
+typedef struct
+{
+    const char *key;
+    unsigned int position;
+} frozen_key;
+
+static int compare_frozen_keys(const void *a, const void *b)
+{
+    const frozen_key *key_a = (const frozen_key*)a;
+    const frozen_key *key_b = (const frozen_key*)b;
+    int order = strcmp(key_a->key, key_b->key);
+
+    if (order != 0)
+    {
+        return order;
+    }
+    /* the first of equal keys is the one a lookup finds */
+    return (key_a->position < key_b->position) ? -1 : (key_a->position > key_b->position);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_Freeze(const cJSON *item)
+{
+    frozen_entry *entries = NULL;
+    size_t num_entries = 0;
+    size_t capacity = 0;
+    frozen_strings strings = { NULL, 0, 0, 0 };
+    frozen_key *keys = NULL;
+    size_t max_children = 0;
+    size_t index_bytes = 0;
+    size_t nodes_bytes = 0;
+    size_t i = 0;
+    frozen_header *header = NULL;
+    cJSON *nodes = NULL;
+    unsigned char *indexes = NULL;
+    char *text = NULL;
+
+    if (item == NULL)
+    {
+        return NULL;
+    }
+
+    /* breadth-first walk of the source, placing the children of every entry after all entries so far */
+    capacity = 64;
+    entries = (frozen_entry*)global_hooks.allocate(capacity * sizeof(frozen_entry));
+    if (entries == NULL)
+    {
+        goto fail;
+    }
+    entries[0].source = item;
+    entries[0].packed_index = (size_t)-1;
+    num_entries = 1;
+    for (i = 0; i < num_entries; i++)
+    {
+        frozen_entry *entry = &entries[i];
+        const cJSON *source = entry->source;
+        size_t count = 0;
+        const double *values = NULL;
+        const cJSON *child = NULL;
+
+        entry->first_child = num_entries;
+        entry->num_children = 0;
+        entry->string = (size_t)-1;
+        entry->valuestring = (size_t)-1;
+        entry->index = (size_t)-1;
+        if (entry->packed_index != (size_t)-1)
+        {
+            continue;
+        }
+        if ((i > 0) && (source->string != NULL))
+        {
+            entry->string = frozen_intern(&strings, source->string);
+            if (entry->string == (size_t)-1)
+            {
+                goto fail;
+            }
+        }
+        if ((((source->type & 0xFF) == cJSON_String) || ((source->type & 0xFF) == cJSON_Raw)) && (source->valuestring != NULL))
+        {
+            entry->valuestring = frozen_intern(&strings, source->valuestring);
+            if (entry->valuestring == (size_t)-1)
+            {
+                goto fail;
+            }
+        }
+        if (((source->type & 0xFF) != cJSON_Array) && ((source->type & 0xFF) != cJSON_Object))
+        {
+            continue;
+        }
+
+        values = cJSON_GetPackedArray(source, &count);
+        if (values == NULL)
+        {
+            if (!cJSON_MaterializeForRead(source))
+            {
+                goto fail;
+            }
+            for (child = source->child; child != NULL; child = child->next)
+            {
+                count++;
+            }
+        }
+        if (num_entries + count > capacity)
+        {
+            frozen_entry *grown = NULL;
+            while (num_entries + count > capacity)
+            {
+                capacity *= 2;
+            }
+            grown = (frozen_entry*)global_hooks.allocate(capacity * sizeof(frozen_entry));
+            if (grown == NULL)
+            {
+                goto fail;
+            }
+            memcpy(grown, entries, num_entries * sizeof(frozen_entry));
+            global_hooks.deallocate(entries);
+            entries = grown;
+            entry = &entries[i];
+        }
+        child = (values == NULL) ? source->child : NULL;
+        for (entry->num_children = 0; entry->num_children < count; entry->num_children++)
+        {
+            frozen_entry *child_entry = &entries[num_entries++];
+            child_entry->source = (values == NULL) ? child : source;
+            child_entry->packed_index = (values == NULL) ? (size_t)-1 : entry->num_children;
+            child = (values == NULL) ? child->next : NULL;
+        }
+        if (((source->type & 0xFF) == cJSON_Object) && (count >= FROZEN_INDEX_MIN))
+        {
+            entry->index = index_bytes;
+            index_bytes += (count + 1) * sizeof(unsigned int);
+            max_children = (count > max_children) ? count : max_children;
+        }
+    }
+
+    /* one block: header, nodes, indexes and strings */
+    nodes_bytes = num_entries * sizeof(cJSON);
+    header = (frozen_header*)global_hooks.allocate(sizeof(frozen_header) + nodes_bytes + index_bytes + strings.bytes);
+    if (header == NULL)
+    {
+        goto fail;
+    }
+    header->num_nodes = num_entries;
+    header->size = sizeof(frozen_header) + nodes_bytes + index_bytes + strings.bytes;
+    nodes = (cJSON*)(void*)(header + 1);
+    indexes = (unsigned char*)nodes + nodes_bytes;
+    text = (char*)indexes + index_bytes;
+    memset(nodes, 0, nodes_bytes);
+
+    for (i = 0; i < strings.capacity; i++)
+    {
+        if (strings.slots[i].string != NULL)
+        {
+            memcpy(text + strings.slots[i].offset, strings.slots[i].string, strings.slots[i].length + 1);
+        }
+    }
+
+    if (max_children > 0)
+    {
+        keys = (frozen_key*)global_hooks.allocate(max_children * sizeof(frozen_key));
+        if (keys == NULL)
+        {
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < num_entries; i++)
+    {
+        const frozen_entry *entry = &entries[i];
+        cJSON *node = &nodes[i];
+        size_t k = 0;
+
+        node->flags = FROZEN_NODE | ((i == 0) ? FROZEN_ROOT : 0);
+        if (entry->packed_index != (size_t)-1)
+        {
+            size_t count = 0;
+            node->type = cJSON_Number;
+            cJSON_SetNumberHelper(node, cJSON_GetPackedArray(entry->source, &count)[entry->packed_index]);
+        }
+        else
+        {
+            node->type = entry->source->type & 0xFF;
+            node->valueint = entry->source->valueint;
+            node->valuedouble = entry->source->valuedouble;
+        }
+        node->string = (entry->string != (size_t)-1) ? text + entry->string : NULL;
+        if (entry->valuestring != (size_t)-1)
+        {
+            node->valuestring = text + entry->valuestring;
+        }
+        if (entry->num_children == 0)
+        {
+            continue;
+        }
+
+        node->child = &nodes[entry->first_child];
+        for (k = 0; k < entry->num_children; k++)
+        {
+            cJSON *child = &nodes[entry->first_child + k];
+            child->prev = (k == 0) ? &nodes[entry->first_child + entry->num_children - 1] : child - 1;
+            child->next = (k + 1 < entry->num_children) ? child + 1 : NULL;
+        }
+
+        if (entry->index != (size_t)-1)
+        {
+            unsigned int *index = (unsigned int*)(void*)(indexes + entry->index);
+            for (k = 0; k < entry->num_children; k++)
+            {
+                const char *key = entries[entry->first_child + k].source->string;
+                keys[k].key = (key != NULL) ? key : "";
+                keys[k].position = (unsigned int)k;
+            }
+            qsort(keys, entry->num_children, sizeof(frozen_key), compare_frozen_keys);
+            index[0] = (unsigned int)entry->num_children;
+            for (k = 0; k < entry->num_children; k++)
+            {
+                index[k + 1] = keys[k].position;
+            }
+            node->valuestring = (char*)index;
+        }
+    }
+
+    if (keys != NULL)
+    {
+        global_hooks.deallocate(keys);
+    }
+    if (strings.slots != NULL)
+    {
+        global_hooks.deallocate(strings.slots);
+    }
+    global_hooks.deallocate(entries);
+
+    return nodes;
+
+fail:
+    if (header != NULL)
+    {
+        global_hooks.deallocate(header);
+    }
+    if (strings.slots != NULL)
+    {
+        global_hooks.deallocate(strings.slots);
+    }
+    if (entries != NULL)
+    {
+        global_hooks.deallocate(entries);
+    }
+
+    return NULL;
+}
+
+CJSON_PUBLIC(size_t) cJSON_GetFrozenSize(const cJSON *item)
+{
+    if ((item == NULL) || !(item->flags & FROZEN_ROOT))
+    {
+        return 0;
+    }
+
+    return ((const frozen_header*)(const void*)item - 1)->size;
+}
+
+/* Frees a frozen tree through its root, dropping the handles of its nodes first. */
+static void delete_frozen(cJSON * const root)
+{
+    frozen_header *header = (frozen_header*)(void*)root - 1;
+    size_t i = 0;
+
+    for (i = 0; (i < header->num_nodes) && (global_hooks.unregister != NULL); i++)
+    {
+        if (root[i].flags & VISIBLE_IN_TCL)
+        {
+            global_hooks.unregister(&root[i]);
+        }
+    }
+    global_hooks.deallocate(header);
+}
+
+/* Binary search of the key index of a frozen object. */
+static cJSON *get_frozen_member(const cJSON * const object, const char * const name)
+{
+    const unsigned int *index = (const unsigned int*)(const void*)object->valuestring;
+    size_t low = 0;
+    size_t high = index[0];
+
+    while (low < high)
+    {
+        size_t middle = low + ((high - low) / 2);
+        const cJSON *member = object->child + index[middle + 1];
+        if (strcmp((member->string != NULL) ? member->string : "", name) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if ((low < index[0]) && (object->child[index[low + 1]].string != NULL)
+        && (strcmp(object->child[index[low + 1]].string, name) == 0))
+    {
+        return object->child + index[low + 1];
+    }
+
+    return NULL;
+}
+
 /* Get Array size/item / object item. */
 CJSON_PUBLIC(int) cJSON_GetArraySize(const cJSON *array)
 {
@@ -1847,6 +3928,14 @@ CJSON_PUBLIC(int) cJSON_GetArraySize(const cJSON *array)
         return 0;
     }
 
+    /* tjson change: counting the values of a packed array does not need their nodes */
+    if (array->flags & PACKED_ARRAY)
+    {
+        packed_values(array, &size);
+        return (int)size;
+    }
+
+    cJSON_MaterializeForRead(array);    /* tjson change */
     child = array->child;
 
     while(child != NULL)
@@ -1869,6 +3958,7 @@ static cJSON* get_array_item(const cJSON *array, size_t index)
         return NULL;
     }
 
+    cJSON_Materialize(array);   /* tjson change */
     current_child = array->child;
     while ((current_child != NULL) && (index > 0))
     {
@@ -1898,6 +3988,13 @@ static cJSON *get_object_item(const cJSON * const object, const char * const nam
         return NULL;
     }
 
+    /* tjson change: the members of larger frozen objects are indexed by key */
+    if (case_sensitive && (object->flags & FROZEN_NODE) && ((object->type & 0xFF) == cJSON_Object) && (object->valuestring != NULL))
+    {
+        return get_frozen_member(object, name);
+    }
+
+    cJSON_Materialize(object);  /* tjson change */
     current_element = object->child;
     if (case_sensitive)
     {
@@ -1958,6 +4055,7 @@ static cJSON *create_reference(const cJSON *item, const internal_hooks * const h
         return NULL;
     }
 
+    cJSON_Materialize(item);    /* tjson change: the reference shares the children */
     memcpy(reference, item, sizeof(cJSON));
     reference->string = NULL;
     reference->type |= cJSON_IsReference;
@@ -1969,11 +4067,13 @@ static cJSON_bool add_item_to_array(cJSON *array, cJSON *item)
 {
     cJSON *child = NULL;
 
-    if ((item == NULL) || (array == NULL) || (array == item))
+    if ((item == NULL) || (array == NULL) || (array == item) || (array->flags & FROZEN_NODE))   /* tjson change */
     {
         return false;
     }
 
+    cJSON_Materialize(array);   /* tjson change */
+    unshape(array);             /* tjson change */
     child = array->child;
     /*
      * To find the last item in array quickly, we use prev in array
@@ -2025,7 +4125,7 @@ static cJSON_bool add_item_to_object(cJSON * const object, const char * const st
     char *new_key = NULL;
     int new_type = cJSON_Invalid;
 
-    if ((object == NULL) || (string == NULL) || (item == NULL) || (object == item))
+    if ((object == NULL) || (string == NULL) || (item == NULL) || (object == item) || (object->flags & FROZEN_NODE))  /* tjson change */
     {
         return false;
     }
@@ -2046,13 +4146,14 @@ static cJSON_bool add_item_to_object(cJSON * const object, const char * const st
         new_type = item->type & ~cJSON_StringIsConst;
     }
 
-    if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
+    if (!(item->type & cJSON_StringIsConst) && !(item->flags & STRING_NOT_OWNED) && (item->string != NULL))   /* tjson change */
     {
         hooks->deallocate(item->string);
     }
 
     item->string = new_key;
     item->type = new_type;
+    item->flags &= ~STRING_NOT_OWNED;  /* tjson change */
 
     return add_item_to_array(object, item);
 }
@@ -2198,11 +4299,12 @@ CJSON_PUBLIC(cJSON*) cJSON_AddArrayToObject(cJSON * const object, const char * c
 
 CJSON_PUBLIC(cJSON *) cJSON_DetachItemViaPointer(cJSON *parent, cJSON * const item)
 {
-    if ((parent == NULL) || (item == NULL))
+    if ((parent == NULL) || (item == NULL) || (parent->flags & FROZEN_NODE))    /* tjson change */
     {
         return NULL;
     }
 
+    unshape(parent);    /* tjson change */
     if (item != parent->child)
     {
         /* not the first element */
@@ -2276,7 +4378,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_InsertItemInArray(cJSON *array, int which, cJSON
 {
     cJSON *after_inserted = NULL;
 
-    if (which < 0)
+    if ((which < 0) || ((array != NULL) && (array->flags & FROZEN_NODE)))  /* tjson change */
     {
         return false;
     }
@@ -2287,6 +4389,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_InsertItemInArray(cJSON *array, int which, cJSON
         return add_item_to_array(array, newitem);
     }
 
+    unshape(array);     /* tjson change */
     newitem->next = after_inserted;
     newitem->prev = after_inserted->prev;
     after_inserted->prev = newitem;
@@ -2303,7 +4406,7 @@ CJSON_PUBLIC(cJSON_bool) cJSON_InsertItemInArray(cJSON *array, int which, cJSON
 
 CJSON_PUBLIC(cJSON_bool) cJSON_ReplaceItemViaPointer(cJSON * const parent, cJSON * const item, cJSON * replacement)
 {
-    if ((parent == NULL) || (parent->child == NULL) || (replacement == NULL) || (item == NULL))
+    if ((parent == NULL) || (parent->child == NULL) || (replacement == NULL) || (item == NULL) || (parent->flags & FROZEN_NODE))    /* tjson change */
     {
         return false;
     }
@@ -2313,6 +4416,12 @@ CJSON_PUBLIC(cJSON_bool) cJSON_ReplaceItemViaPointer(cJSON * const parent, cJSON
         return true;
     }
 
+    /* tjson change: a value replaced under the same key keeps the shape */
+    if ((replacement->string == NULL) || (item->string == NULL) || (strcmp(replacement->string, item->string) != 0))
+    {
+        unshape(parent);
+    }
+
     replacement->next = item->next;
     replacement->prev = item->prev;
 
@@ -2368,11 +4477,12 @@ static cJSON_bool replace_item_in_object(cJSON *object, const char *string, cJSO
     }
 
     /* replace the name in the replacement */
-    if (!(replacement->type & cJSON_StringIsConst) && (replacement->string != NULL))
+    if (!(replacement->type & cJSON_StringIsConst) && !(replacement->flags & STRING_NOT_OWNED) && (replacement->string != NULL))    /* tjson change */
     {
         cJSON_free(replacement->string);
     }
     replacement->string = (char*)cJSON_strdup((const unsigned char*)string, &global_hooks);
+    replacement->flags &= ~STRING_NOT_OWNED;   /* tjson change */
     if (replacement->string == NULL)
     {
         return false;
@@ -2674,6 +4784,32 @@ CJSON_PUBLIC(cJSON *) cJSON_CreateDoubleArray(const double *numbers, int count)
     return a;
 }
 
+CJSON_PUBLIC(cJSON *) cJSON_CreatePackedArray(const double *numbers, size_t count)
+{
+    cJSON *a = NULL;
+    double *values = NULL;
+
+    if (numbers == NULL)
+    {
+        return NULL;
+    }
+
+    a = cJSON_CreateArray();
+    if ((a == NULL) || (count == 0))
+    {
+        return a;
+    }
+    values = pack_array(a, count);
+    if (values == NULL)
+    {
+        cJSON_Delete(a);
+        return NULL;
+    }
+    memcpy(values, numbers, count * sizeof(double));
+
+    return a;
+}
+
 CJSON_PUBLIC(cJSON *) cJSON_CreateStringArray(const char *const *strings, int count)
 {
     size_t i = 0;
@@ -2727,6 +4863,32 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
     {
         goto fail;
     }
+    /* tjson change: a packed array is copied as such */
+    if ((item->flags & PACKED_ARRAY) && recurse)
+    {
+        size_t count = 0;
+        const double *values = packed_values(item, &count);
+        newitem = cJSON_CreatePackedArray(values, count);
+        if (!newitem)
+        {
+            goto fail;
+        }
+        if (item->string)
+        {
+            newitem->string = (item->type&cJSON_StringIsConst) ? item->string : (char*)cJSON_strdup((unsigned char*)item->string, &global_hooks);
+            newitem->type |= item->type & cJSON_StringIsConst;
+            if (!newitem->string)
+            {
+                goto fail;
+            }
+        }
+        return newitem;
+    }
+    /* tjson change: a lazy node must not copy its raw text as valuestring */
+    if (!(item->flags & PACKED_ARRAY) && !cJSON_MaterializeForRead(item))
+    {
+        goto fail;
+    }
     /* Create new item */
     newitem = cJSON_New_Item(&global_hooks);
     if (!newitem)
@@ -2737,7 +4899,8 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
     newitem->type = item->type & (~cJSON_IsReference);
     newitem->valueint = item->valueint;
     newitem->valuedouble = item->valuedouble;
-    if (item->valuestring)
+    /* tjson change: arrays and objects may keep a shape, packed values or a key index in valuestring */
+    if (item->valuestring && (((item->type & 0xFF) == cJSON_String) || ((item->type & 0xFF) == cJSON_Raw)))
     {
         newitem->valuestring = (char*)cJSON_strdup((unsigned char*)item->valuestring, &global_hooks);
         if (!newitem->valuestring)
@@ -3055,8 +5218,13 @@ CJSON_PUBLIC(cJSON_bool) cJSON_Compare(const cJSON * const a, const cJSON * cons
 
         case cJSON_Array:
         {
-            cJSON *a_element = a->child;
-            cJSON *b_element = b->child;
+            cJSON *a_element = NULL;
+            cJSON *b_element = NULL;
+
+            cJSON_Materialize(a);   /* tjson change */
+            cJSON_Materialize(b);   /* tjson change */
+            a_element = a->child;
+            b_element = b->child;
 
             for (; (a_element != NULL) && (b_element != NULL);)
             {
@@ -100,6 +100,18 @@ then using the CJSON_API_VISIBILITY flag to "export" the same symbols the way CJ
 #define cJSON_StringIsConst 512
 
 #define VISIBLE_IN_TCL 1            /* tjson change */
+#define LAZY_SUBTREE 2              /* tjson change */
+#define INSITU_STRING 4             /* tjson change: string points into the parsed buffer */
+#define INSITU_VALUESTRING 8        /* tjson change: valuestring points into the parsed buffer */
+#define INLINE_STRING 16            /* tjson change: string is stored after the node, in its allocation */
+#define INLINE_VALUESTRING 32       /* tjson change: valuestring is stored after the node, in its allocation */
+#define INTERNED_STRING 64          /* tjson change: string is shared, through a cJSON_KeySet or a shared subtree */
+#define SHAPED_OBJECT 128           /* tjson change: valuestring points at the shape shared with the sibling records */
+#define PACKED_ARRAY 256            /* tjson change: the elements are numbers kept in one vector at valuestring */
+#define FROZEN_NODE 512             /* tjson change: part of a read-only tree made by cJSON_Freeze */
+#define FROZEN_ROOT 1024            /* tjson change: the root of such a tree, which owns the whole of it */
+#define INTERNED_VALUESTRING 2048   /* tjson change: valuestring is shared, like an INTERNED_STRING */
+#define SHARED_SUBTREE 4096         /* tjson change: a reference to children shared with equal subtrees, see cJSON_Dedup */
 
 /* The cJSON structure: */
 typedef struct cJSON
@@ -118,14 +130,15 @@ typedef struct cJSON
 
     /* The item's string, if type==cJSON_String  and type == cJSON_Raw */
     char *valuestring;
-    /* writing to valueint is DEPRECATED, use cJSON_SetNumberValue instead */
-    int valueint;
     /* The item's number, if type==cJSON_Number */
     double valuedouble;
 
     /* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
     char *string;
 
+    /* writing to valueint is DEPRECATED, use cJSON_SetNumberValue instead */
+    int valueint;   /* tjson change: last, so that a node is 64 bytes on 64-bit platforms */
+
 } cJSON;
 
 typedef struct cJSON_Hooks
@@ -150,6 +163,11 @@ CJSON_PUBLIC(const char*) cJSON_Version(void);
 /* Supply malloc, realloc and free functions to cJSON */
 CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks);
 
+/* tjson change: the parser keeps open arrays/objects on the heap, so the nesting limit
+ * (CJSON_NESTING_LIMIT by default) can be raised at runtime. */
+CJSON_PUBLIC(void) cJSON_SetNestingLimit(size_t limit);
+CJSON_PUBLIC(size_t) cJSON_GetNestingLimit(void);
+
 /* Memory Management: the caller is always responsible to free the results from all variants of cJSON_Parse (with cJSON_Delete) and cJSON_Print (with stdlib free, cJSON_Hooks.free_fn, or cJSON_free as appropriate). The exception is cJSON_PrintPreallocated, where the caller has full responsibility of the buffer. */
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value);
@@ -158,6 +176,60 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_len
 /* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error so will match cJSON_GetErrorPtr(). */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated);
+/* tjson change: validate the whole input, but only build the first level of the tree. Nested arrays and
+ * objects are kept as LAZY_SUBTREE nodes that point into "value" and get parsed on first access, so
+ * "value" must outlive the returned tree. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseLazyWithLength(const char *value, size_t buffer_length);
+/* tjson change: parses "value" destructively, unescaping strings and keys in place and pointing
+ * valuestring/string into it instead of allocating them, so "value" must outlive the returned tree. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSituWithLength(char *value, size_t buffer_length, cJSON_bool lazy);
+/* tjson change: a set of object keys shared by the trees parsed with it. Each distinct key is stored once
+ * and the members point at it, so the set must outlive those trees. It holds at most "max_keys" keys,
+ * further keys are allocated per member as usual. "lock"/"unlock" (may be NULL) guard a set shared by
+ * threads. The set allocates with malloc/free, independently of the hooks. */
+typedef struct cJSON_KeySet cJSON_KeySet;
+CJSON_PUBLIC(cJSON_KeySet *) cJSON_CreateKeySet(size_t max_keys, void (*lock)(void), void (*unlock)(void));
+CJSON_PUBLIC(void) cJSON_DeleteKeySet(cJSON_KeySet *keys);
+CJSON_PUBLIC(size_t) cJSON_KeySetSize(const cJSON_KeySet *keys);
+/* tjson change: like cJSON_ParseWithLength (or cJSON_ParseLazyWithLength), with keys interned into "keys".
+ * Keys with escape sequences and keys of lazily parsed subtrees are not interned. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseInternedWithLength(const char *value, size_t buffer_length, cJSON_KeySet *keys, cJSON_bool lazy);
+/* tjson change: checks that "value" holds exactly one well-formed JSON value, with nothing but whitespace after it,
+ * without building a tree. Numbers and \u escapes are checked against the JSON grammar, so this is stricter than
+ * cJSON_ParseWithLength, which also accepts e.g. [01] or [1.] and ignores trailing data. */
+CJSON_PUBLIC(cJSON_bool) cJSON_Validate(const char *value, size_t buffer_length);
+/* tjson change: builds the children of a LAZY_SUBTREE or PACKED_ARRAY node and gives a SHARED_SUBTREE node
+ * children of its own, a no-op for any other node. */
+CJSON_PUBLIC(cJSON_bool) cJSON_Materialize(const cJSON *item);
+/* tjson change: like cJSON_Materialize, but a SHARED_SUBTREE node keeps its shared children, for walkers that
+ * only read them and never hand them out. */
+CJSON_PUBLIC(cJSON_bool) cJSON_MaterializeForRead(const cJSON *item);
+/* tjson change: turns every array under "item" that holds at least "min_count" elements, all of them numbers,
+ * into a PACKED_ARRAY whose values are stored back to back instead of one node each. The nodes come back
+ * when the array is materialized, i.e. as soon as an element is accessed or the array is modified.
+ * Lazy subtrees are left alone. Returns the number of arrays packed. */
+CJSON_PUBLIC(size_t) cJSON_PackArrays(cJSON *item, size_t min_count);
+/* tjson change: the values of a PACKED_ARRAY node and their number in "count", NULL for any other node. */
+CJSON_PUBLIC(const double *) cJSON_GetPackedArray(const cJSON *item, size_t *count);
+/* tjson change: hash-conses the tree under "item", bottom-up. Every array/object equal to one met before
+ * becomes a SHARED_SUBTREE reference to a single copy of their children, which is added to "store" (an array
+ * that must outlive the tree), then the keys and string values met more than once are moved into "keys".
+ * Subtrees holding nodes visible in Tcl, lazy subtrees and shaped records are left alone. A shared subtree
+ * is copied one level at a time on cJSON_Materialize, i.e. before it is modified or a child is handed out. */
+typedef struct cJSON_DedupStats
+{
+    size_t subtrees;    /* arrays/objects that became shared */
+    size_t strings;     /* strings that became shared, not counting their first occurrence */
+    size_t bytes_saved; /* as counted by the nodes and strings freed, less the shared copies */
+} cJSON_DedupStats;
+CJSON_PUBLIC(cJSON_bool) cJSON_Dedup(cJSON *item, cJSON *store, cJSON_KeySet *keys, cJSON_DedupStats *stats);
+/* tjson change: copies "item" into a single read-only block: the nodes in breadth-first order, so the
+ * children of every array/object are contiguous, a sorted key index for objects of 8 members or more and
+ * each distinct string once. Lazy subtrees of "item" are materialized, packed arrays are copied as nodes.
+ * The frozen tree cannot be modified and is freed as a whole by cJSON_Delete on its root. */
+CJSON_PUBLIC(cJSON *) cJSON_Freeze(const cJSON *item);
+/* tjson change: the bytes taken by a frozen tree, given its root, 0 for any other node. */
+CJSON_PUBLIC(size_t) cJSON_GetFrozenSize(const cJSON *item);
 
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
@@ -223,6 +295,8 @@ CJSON_PUBLIC(cJSON *) cJSON_CreateArrayReference(const cJSON *child);
 CJSON_PUBLIC(cJSON *) cJSON_CreateIntArray(const int *numbers, int count);
 CJSON_PUBLIC(cJSON *) cJSON_CreateFloatArray(const float *numbers, int count);
 CJSON_PUBLIC(cJSON *) cJSON_CreateDoubleArray(const double *numbers, int count);
+/* tjson change: like cJSON_CreateDoubleArray, but the array is created packed (see cJSON_PackArrays). */
+CJSON_PUBLIC(cJSON *) cJSON_CreatePackedArray(const double *numbers, size_t count);
 CJSON_PUBLIC(cJSON *) cJSON_CreateStringArray(const char *const *strings, int count);
 
 /* Append item to the specified array/object. */
@@ -294,7 +368,7 @@ CJSON_PUBLIC(char*) cJSON_SetValuestring(cJSON *object, const char *valuestring)
 )
 
 /* Macro for iterating over an array or object */
-#define cJSON_ArrayForEach(element, array) for(element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
+#define cJSON_ArrayForEach(element, array) for(element = (array != NULL) ? (cJSON_Materialize(array), (array)->child) : NULL; element != NULL; element = element->next)  /* tjson change */
 
 /* malloc/free objects using the malloc/free functions that have been set with cJSON_InitHooks */
 CJSON_PUBLIC(void *) cJSON_malloc(size_t size);
@@ -0,0 +1,118 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "filemap.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef DEBUG
+# define DBG(x) x
+#else
+# define DBG(x)
+#endif
+
+// Maps the whole file read-only into memory, or writable with private
+// copy-on-write pages if "copy_on_write" is set (writes never reach the
+// file). An empty file yields data == NULL and length == 0.
+int tjson_MapFile(Tcl_Interp *interp, Tcl_Obj *pathPtr, int copy_on_write, tjson_filemap_t *map) {
+    memset(map, 0, sizeof(tjson_filemap_t));
+
+    const char *native_path = Tcl_FSGetNativePath(pathPtr);
+    if (native_path == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't open \"%s\": invalid path", Tcl_GetString(pathPtr)));
+        return TCL_ERROR;
+    }
+
+#ifdef _WIN32
+    HANDLE file_handle = CreateFileW((LPCWSTR) native_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't open \"%s\"", Tcl_GetString(pathPtr)));
+        return TCL_ERROR;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_handle, &size)) {
+        CloseHandle(file_handle);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't stat \"%s\"", Tcl_GetString(pathPtr)));
+        return TCL_ERROR;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file_handle);
+        return TCL_OK;
+    }
+    HANDLE mapping_handle = CreateFileMappingW(file_handle, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (mapping_handle == NULL) {
+        CloseHandle(file_handle);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't map \"%s\"", Tcl_GetString(pathPtr)));
+        return TCL_ERROR;
+    }
+    void *data = MapViewOfFile(mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't map \"%s\"", Tcl_GetString(pathPtr)));
+        return TCL_ERROR;
+    }
+    map->file_handle = file_handle;
+    map->mapping_handle = mapping_handle;
+    map->data = (const char *) data;
+    map->length = (size_t) size.QuadPart;
+#else
+    int fd = open(native_path, O_RDONLY);
+    if (fd < 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't open \"%s\": %s", Tcl_GetString(pathPtr), strerror(errno)));
+        return TCL_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't stat \"%s\": %s", Tcl_GetString(pathPtr), strerror(errno)));
+        close(fd);
+        return TCL_ERROR;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return TCL_OK;
+    }
+    void *data = mmap(NULL, (size_t) st.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("couldn't map \"%s\": %s", Tcl_GetString(pathPtr), strerror(errno)));
+        return TCL_ERROR;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+    map->data = (const char *) data;
+    map->length = (size_t) st.st_size;
+#endif
+
+    DBG(fprintf(stderr, "MapFile: %s length=%zu\n", Tcl_GetString(pathPtr), map->length));
+    return TCL_OK;
+}
+
+void tjson_UnmapFile(tjson_filemap_t *map) {
+    if (map->data == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile((LPCVOID) map->data);
+    CloseHandle((HANDLE) map->mapping_handle);
+    CloseHandle((HANDLE) map->file_handle);
+#else
+    munmap((void *) map->data, map->length);
+#endif
+    map->data = NULL;
+    map->length = 0;
+}
@@ -0,0 +1,24 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_FILEMAP_H
+#define TJSON_FILEMAP_H
+
+#include <tcl.h>
+#include <stddef.h>
+
+typedef struct {
+    const char *data;
+    size_t length;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+} tjson_filemap_t;
+
+int tjson_MapFile(Tcl_Interp *interp, Tcl_Obj *pathPtr, int copy_on_write, tjson_filemap_t *map);
+void tjson_UnmapFile(tjson_filemap_t *map);
+
+#endif //TJSON_FILEMAP_H
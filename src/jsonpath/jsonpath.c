@@ -1,7 +1,10 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "jsonpath.h"
+#include "../stack/stack.h"
+#include "../shape/shape.h"
 
 #ifdef DEBUG
 # define DBG(x) x
@@ -20,9 +23,13 @@ typedef enum {
     WILDCARD_NAME,
     WILDCARD_INDEX,
     INDICES_SET,
-    INDICES_SLICE
+    INDICES_SLICE,
+    NAMES_SET,
+    FILTER
 } jsonpath_node_enum_t;
 
+struct jsonpath_filter;
+
 typedef struct jsonpath_node {
     struct jsonpath_node *next;
     jsonpath_node_enum_t type;
@@ -36,7 +43,15 @@ typedef struct jsonpath_node {
         struct {
             int start;
             int end;
+            int step;
+            int has_start;      // start and end may be left out, their default depends on the step
+            int has_end;
         } indices_slice;
+        struct {
+            char **names;
+            int length;
+        } names_set;
+        struct jsonpath_filter *filter;
     } data;
 } jsonpath_node_t;
 
@@ -74,6 +89,8 @@ jsonpath_node_t *reverse_linked_list(jsonpath_node_t *head) {
     return prev;
 }
 
+static void jsonpath_filter_free(struct jsonpath_filter *filter);
+
 void jsonpath_free(jsonpath_node_t *node) {
     jsonpath_node_t *curr = node;
     while (curr != NULL) {
@@ -85,6 +102,15 @@ void jsonpath_free(jsonpath_node_t *node) {
             case INDICES_SET:
                 Tcl_Free((char *) curr->data.indices_set.indices);
                 break;
+            case NAMES_SET:
+                for (int i = 0; i < curr->data.names_set.length; i++) {
+                    Tcl_Free(curr->data.names_set.names[i]);
+                }
+                Tcl_Free((char *) curr->data.names_set.names);
+                break;
+            case FILTER:
+                jsonpath_filter_free(curr->data.filter);
+                break;
             default:
                 break;
         }
@@ -93,13 +119,10 @@ void jsonpath_free(jsonpath_node_t *node) {
     }
 }
 
+// frees the nodes parsed so far when parsing fails; every node is complete
+// by the time it is inserted, so this is the same as freeing a whole path
 void jsonpath_free_list(jsonpath_node_t *node) {
-    jsonpath_node_t *curr = node;
-    while (curr != NULL) {
-        jsonpath_node_t *next = curr->next;
-        Tcl_Free((char *) curr);
-        curr = next;
-    }
+    jsonpath_free(node);
 }
 
 static void jsonpath_insert_node_to_list(jsonpath_node_t *node, jsonpath_node_t **nodes, int *nodes_length) {
@@ -107,6 +130,691 @@ static void jsonpath_insert_node_to_list(jsonpath_node_t *node, jsonpath_node_t
     *nodes = node;
     (*nodes_length)++;
 }
+// Filter expressions.
+//
+// "[?(expr)]" selects the elements of an array, or the member values of an
+// object, for which "expr" holds. The expression is compiled into code for a
+// small stack machine: operands are paths relative to the tested value ("@",
+// "@.a.b", "@['a'][0]") and literals, a comparison pops two values and pushes
+// a boolean, and "&&" / "||" jump over their right-hand side once the left
+// one decides the outcome. A path on its own tests whether the value exists.
+//
+// Comparisons are only allowed between operands and groups only between
+// boolean terms, so the machine never holds more than two values at a time.
+
+#define JSONPATH_FILTER_MAX_NESTING 32
+#define JSONPATH_FILTER_STACK_SIZE 2
+
+#define FILTERCHAR(c) (CHARTYPE(alnum, c) || (c) == '_' || (c) == '-' || ((unsigned char) (c)) >= 0x80)
+
+typedef enum {
+    FILTER_PUSH,            // push operand "arg"
+    FILTER_EXISTS,          // push whether the path of operand "arg" resolves
+    FILTER_EQ,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE,
+    FILTER_NOT,
+    FILTER_JUMP_IF_FALSE,   // jump to "arg" if the top value is false, otherwise pop it
+    FILTER_JUMP_IF_TRUE     // jump to "arg" if the top value is true, otherwise pop it
+} jsonpath_filter_op_t;
+
+typedef struct {
+    jsonpath_filter_op_t op;
+    int arg;
+} jsonpath_filter_insn_t;
+
+typedef struct {
+    char *name;     // NULL for an index
+    int index;
+} jsonpath_filter_step_t;
+
+typedef struct {
+    int is_path;
+    int type;       // cJSON_Number, cJSON_String, cJSON_True, cJSON_False or cJSON_NULL for a literal
+    double number;
+    char *string;
+    jsonpath_filter_step_t *steps;
+    int num_steps;
+} jsonpath_filter_operand_t;
+
+typedef struct jsonpath_filter {
+    jsonpath_filter_insn_t *code;
+    int code_length;
+    int code_size;
+    jsonpath_filter_operand_t *operands;
+    int num_operands;
+    int operands_size;
+} jsonpath_filter_t;
+
+// "type" is 0 for a path that does not resolve
+typedef struct {
+    int type;
+    double number;
+    const char *string;
+    const cJSON *node;
+} jsonpath_filter_value_t;
+
+typedef struct {
+    Tcl_Interp *interp;
+    const char *p;
+    const char *end;
+    jsonpath_filter_t *filter;
+    int nesting;
+} jsonpath_filter_parser_t;
+
+static void jsonpath_filter_free(jsonpath_filter_t *filter) {
+    for (int i = 0; i < filter->num_operands; i++) {
+        jsonpath_filter_operand_t *operand = &filter->operands[i];
+        if (operand->string != NULL) {
+            Tcl_Free(operand->string);
+        }
+        for (int j = 0; j < operand->num_steps; j++) {
+            if (operand->steps[j].name != NULL) {
+                Tcl_Free(operand->steps[j].name);
+            }
+        }
+        if (operand->steps != NULL) {
+            Tcl_Free((char *) operand->steps);
+        }
+    }
+    Tcl_Free((char *) filter->operands);
+    Tcl_Free((char *) filter->code);
+    Tcl_Free((char *) filter);
+}
+
+static int jsonpath_filter_error(jsonpath_filter_parser_t *parser, const char *message) {
+    Tcl_SetObjResult(parser->interp, Tcl_ObjPrintf("Invalid JSONPath: %s", message));
+    return TCL_ERROR;
+}
+
+static void jsonpath_filter_skip_ws(jsonpath_filter_parser_t *parser) {
+    while (parser->p < parser->end && CHARTYPE(space, parser->p[0])) {
+        parser->p++;
+    }
+}
+
+static int jsonpath_filter_emit(jsonpath_filter_t *filter, jsonpath_filter_op_t op, int arg) {
+    if (filter->code_length == filter->code_size) {
+        filter->code_size *= 2;
+        filter->code = (jsonpath_filter_insn_t *) Tcl_Realloc((char *) filter->code,
+                                                              sizeof(jsonpath_filter_insn_t) * filter->code_size);
+    }
+    filter->code[filter->code_length].op = op;
+    filter->code[filter->code_length].arg = arg;
+    return filter->code_length++;
+}
+
+static jsonpath_filter_operand_t *jsonpath_filter_new_operand(jsonpath_filter_t *filter) {
+    if (filter->num_operands == filter->operands_size) {
+        filter->operands_size *= 2;
+        filter->operands = (jsonpath_filter_operand_t *) Tcl_Realloc((char *) filter->operands,
+                                                                     sizeof(jsonpath_filter_operand_t) * filter->operands_size);
+    }
+    jsonpath_filter_operand_t *operand = &filter->operands[filter->num_operands++];
+    memset(operand, 0, sizeof(jsonpath_filter_operand_t));
+    return operand;
+}
+
+// "p" points to the opening quote, either ' or "; a backslash takes the
+// character after it literally
+static int jsonpath_filter_parse_string(jsonpath_filter_parser_t *parser, char **string) {
+    char quote = parser->p[0];
+    const char *p = parser->p + 1;
+    char *result = (char *) Tcl_Alloc(parser->end - p + 1);
+    size_t length = 0;
+    while (p < parser->end && p[0] != quote) {
+        if (p[0] == '\\' && p + 1 < parser->end) {
+            p++;
+        }
+        result[length++] = *p++;
+    }
+    if (p == parser->end) {
+        Tcl_Free(result);
+        return jsonpath_filter_error(parser, "unterminated string in filter expression");
+    }
+    result[length] = '\0';
+    *string = result;
+    parser->p = p + 1;
+    return TCL_OK;
+}
+
+static int jsonpath_filter_parse_path(jsonpath_filter_parser_t *parser, jsonpath_filter_operand_t *operand) {
+    int size = 0;
+    operand->is_path = 1;
+    parser->p++;
+    while (parser->p < parser->end && (parser->p[0] == '.' || parser->p[0] == '[')) {
+        if (operand->num_steps == size) {
+            size = size == 0 ? 4 : size * 2;
+            operand->steps = (jsonpath_filter_step_t *) Tcl_Realloc((char *) operand->steps,
+                                                                    sizeof(jsonpath_filter_step_t) * size);
+        }
+        jsonpath_filter_step_t *step = &operand->steps[operand->num_steps];
+        step->name = NULL;
+        step->index = 0;
+        if (parser->p[0] == '.') {
+            const char *name = ++parser->p;
+            while (parser->p < parser->end && FILTERCHAR(parser->p[0])) {
+                parser->p++;
+            }
+            if (parser->p == name) {
+                return jsonpath_filter_error(parser, "'.' must be followed by a child name in filter expression");
+            }
+            step->name = jsonpath_strndup(name, parser->p - name);
+            operand->num_steps++;
+            continue;
+        }
+        parser->p++;
+        if (parser->p < parser->end && (parser->p[0] == '\'' || parser->p[0] == '"')) {
+            if (TCL_OK != jsonpath_filter_parse_string(parser, &step->name)) {
+                return TCL_ERROR;
+            }
+        } else {
+            char *index_end;
+            step->index = (int) strtol(parser->p, &index_end, 10);
+            if (index_end == parser->p) {
+                return jsonpath_filter_error(parser, "child index or name expected in filter expression");
+            }
+            parser->p = index_end;
+        }
+        operand->num_steps++;
+        if (parser->p >= parser->end || parser->p[0] != ']') {
+            return jsonpath_filter_error(parser, "']' expected in filter expression");
+        }
+        parser->p++;
+    }
+    return TCL_OK;
+}
+
+static int jsonpath_filter_keyword(jsonpath_filter_parser_t *parser, const char *keyword) {
+    size_t length = strlen(keyword);
+    if ((size_t) (parser->end - parser->p) < length || memcmp(parser->p, keyword, length) != 0) {
+        return 0;
+    }
+    if (parser->p + length < parser->end && FILTERCHAR(parser->p[length])) {
+        return 0;
+    }
+    parser->p += length;
+    return 1;
+}
+
+static int jsonpath_filter_parse_operand(jsonpath_filter_parser_t *parser, int *index) {
+    jsonpath_filter_skip_ws(parser);
+    if (parser->p >= parser->end) {
+        return jsonpath_filter_error(parser, "operand expected in filter expression");
+    }
+    *index = parser->filter->num_operands;
+    jsonpath_filter_operand_t *operand = jsonpath_filter_new_operand(parser->filter);
+    char c = parser->p[0];
+    if (c == '@') {
+        return jsonpath_filter_parse_path(parser, operand);
+    }
+    if (c == '\'' || c == '"') {
+        operand->type = cJSON_String;
+        return jsonpath_filter_parse_string(parser, &operand->string);
+    }
+    if (c == '-' || CHARTYPE(digit, c)) {
+        const char *p = parser->p;
+        while (p < parser->end && (CHARTYPE(digit, p[0]) || p[0] == '-' || p[0] == '+' || p[0] == '.' || p[0] == 'e' || p[0] == 'E')) {
+            p++;
+        }
+        char *number = jsonpath_strndup(parser->p, p - parser->p);
+        char *number_end;
+        operand->type = cJSON_Number;
+        operand->number = strtod(number, &number_end);
+        int valid = number_end != number && *number_end == '\0';
+        Tcl_Free(number);
+        if (!valid) {
+            return jsonpath_filter_error(parser, "invalid number in filter expression");
+        }
+        parser->p = p;
+        return TCL_OK;
+    }
+    if (jsonpath_filter_keyword(parser, "true")) {
+        operand->type = cJSON_True;
+    } else if (jsonpath_filter_keyword(parser, "false")) {
+        operand->type = cJSON_False;
+    } else if (jsonpath_filter_keyword(parser, "null")) {
+        operand->type = cJSON_NULL;
+    } else {
+        return jsonpath_filter_error(parser, "operand expected in filter expression");
+    }
+    return TCL_OK;
+}
+
+static int jsonpath_filter_parse_comparator(jsonpath_filter_parser_t *parser, jsonpath_filter_op_t *op) {
+    const char *p = parser->p;
+    if (parser->end - p < 2 || p[1] != '=') {
+        if (p < parser->end && (p[0] == '<' || p[0] == '>')) {
+            *op = p[0] == '<' ? FILTER_LT : FILTER_GT;
+            parser->p++;
+            return 1;
+        }
+        return 0;
+    }
+    switch (p[0]) {
+        case '=': *op = FILTER_EQ; break;
+        case '!': *op = FILTER_NE; break;
+        case '<': *op = FILTER_LE; break;
+        case '>': *op = FILTER_GE; break;
+        default: return 0;
+    }
+    parser->p += 2;
+    return 1;
+}
+
+static int jsonpath_filter_parse_or(jsonpath_filter_parser_t *parser);
+
+static int jsonpath_filter_parse_term(jsonpath_filter_parser_t *parser) {
+    jsonpath_filter_skip_ws(parser);
+    if (parser->p < parser->end && (parser->p[0] == '!' || parser->p[0] == '(')) {
+        if (parser->nesting == JSONPATH_FILTER_MAX_NESTING) {
+            return jsonpath_filter_error(parser, "filter expression nested too deeply");
+        }
+        parser->nesting++;
+        int rc;
+        if (parser->p[0] == '!') {
+            parser->p++;
+            rc = jsonpath_filter_parse_term(parser);
+            jsonpath_filter_emit(parser->filter, FILTER_NOT, 0);
+        } else {
+            parser->p++;
+            rc = jsonpath_filter_parse_or(parser);
+            jsonpath_filter_skip_ws(parser);
+            if (rc == TCL_OK) {
+                if (parser->p >= parser->end || parser->p[0] != ')') {
+                    rc = jsonpath_filter_error(parser, "')' expected in filter expression");
+                } else {
+                    parser->p++;
+                }
+            }
+        }
+        parser->nesting--;
+        return rc;
+    }
+
+    int left, right;
+    jsonpath_filter_op_t op;
+    if (TCL_OK != jsonpath_filter_parse_operand(parser, &left)) {
+        return TCL_ERROR;
+    }
+    jsonpath_filter_skip_ws(parser);
+    if (!jsonpath_filter_parse_comparator(parser, &op)) {
+        if (parser->filter->operands[left].is_path) {
+            jsonpath_filter_emit(parser->filter, FILTER_EXISTS, left);
+        } else {
+            jsonpath_filter_emit(parser->filter, FILTER_PUSH, left);
+        }
+        return TCL_OK;
+    }
+    if (TCL_OK != jsonpath_filter_parse_operand(parser, &right)) {
+        return TCL_ERROR;
+    }
+    jsonpath_filter_emit(parser->filter, FILTER_PUSH, left);
+    jsonpath_filter_emit(parser->filter, FILTER_PUSH, right);
+    jsonpath_filter_emit(parser->filter, op, 0);
+    return TCL_OK;
+}
+
+static int jsonpath_filter_parse_and(jsonpath_filter_parser_t *parser) {
+    if (TCL_OK != jsonpath_filter_parse_term(parser)) {
+        return TCL_ERROR;
+    }
+    for (;;) {
+        jsonpath_filter_skip_ws(parser);
+        if (parser->end - parser->p < 2 || parser->p[0] != '&' || parser->p[1] != '&') {
+            return TCL_OK;
+        }
+        parser->p += 2;
+        int jump = jsonpath_filter_emit(parser->filter, FILTER_JUMP_IF_FALSE, 0);
+        if (TCL_OK != jsonpath_filter_parse_term(parser)) {
+            return TCL_ERROR;
+        }
+        parser->filter->code[jump].arg = parser->filter->code_length;
+    }
+}
+
+static int jsonpath_filter_parse_or(jsonpath_filter_parser_t *parser) {
+    if (TCL_OK != jsonpath_filter_parse_and(parser)) {
+        return TCL_ERROR;
+    }
+    for (;;) {
+        jsonpath_filter_skip_ws(parser);
+        if (parser->end - parser->p < 2 || parser->p[0] != '|' || parser->p[1] != '|') {
+            return TCL_OK;
+        }
+        parser->p += 2;
+        int jump = jsonpath_filter_emit(parser->filter, FILTER_JUMP_IF_TRUE, 0);
+        if (TCL_OK != jsonpath_filter_parse_and(parser)) {
+            return TCL_ERROR;
+        }
+        parser->filter->code[jump].arg = parser->filter->code_length;
+    }
+}
+
+// "p" points to "[?(", on success "*next" is set to the position after the closing ")]"
+static int jsonpath_filter_compile(Tcl_Interp *interp, const char *p, const char *end,
+                                   jsonpath_filter_t **filterPtr, const char **next) {
+    jsonpath_filter_parser_t parser;
+    jsonpath_filter_t *filter = (jsonpath_filter_t *) Tcl_Alloc(sizeof(jsonpath_filter_t));
+    filter->code_size = 16;
+    filter->code_length = 0;
+    filter->code = (jsonpath_filter_insn_t *) Tcl_Alloc(sizeof(jsonpath_filter_insn_t) * filter->code_size);
+    filter->operands_size = 4;
+    filter->num_operands = 0;
+    filter->operands = (jsonpath_filter_operand_t *) Tcl_Alloc(sizeof(jsonpath_filter_operand_t) * filter->operands_size);
+
+    parser.interp = interp;
+    parser.p = p + 2;
+    parser.end = end;
+    parser.filter = filter;
+    parser.nesting = 0;
+    if (parser.p >= end || parser.p[0] != '(') {
+        jsonpath_filter_free(filter);
+        return jsonpath_filter_error(&parser, "'[?' must be followed by '('");
+    }
+    parser.p++;
+    if (TCL_OK != jsonpath_filter_parse_or(&parser)) {
+        jsonpath_filter_free(filter);
+        return TCL_ERROR;
+    }
+    jsonpath_filter_skip_ws(&parser);
+    if (end - parser.p < 2 || parser.p[0] != ')' || parser.p[1] != ']') {
+        jsonpath_filter_free(filter);
+        return jsonpath_filter_error(&parser, "')]' expected after filter expression");
+    }
+    *filterPtr = filter;
+    *next = parser.p + 2;
+    return TCL_OK;
+}
+
+static cJSON *jsonpath_filter_resolve(const jsonpath_filter_operand_t *operand, cJSON *item) {
+    for (int i = 0; i < operand->num_steps && item != NULL; i++) {
+        const jsonpath_filter_step_t *step = &operand->steps[i];
+        if (step->name != NULL) {
+            item = cJSON_IsObject(item) ? tjson_GetObjectItem(item, step->name) : NULL;
+        } else if (cJSON_IsArray(item)) {
+            int index = step->index;
+            if (index < 0) {
+                index += cJSON_GetArraySize(item);
+            }
+            item = cJSON_GetArrayItem(item, index);
+        } else {
+            item = NULL;
+        }
+    }
+    return item;
+}
+
+static void jsonpath_filter_set_bool(jsonpath_filter_value_t *value, int b) {
+    value->type = b ? cJSON_True : cJSON_False;
+    value->node = NULL;
+}
+
+static int jsonpath_filter_truthy(const jsonpath_filter_value_t *value) {
+    return value->type != 0 && value->type != cJSON_False && value->type != cJSON_NULL;
+}
+
+// Missing values are equal to each other, like null is to null. Only numbers
+// and strings are ordered; arrays and objects are only equal to themselves.
+static int jsonpath_filter_compare(jsonpath_filter_op_t op, const jsonpath_filter_value_t *a,
+                                   const jsonpath_filter_value_t *b) {
+    int equal;
+    int order = 0;
+    int ordered = 0;
+    if (a->type != b->type) {
+        equal = 0;
+    } else if (a->type == cJSON_Number) {
+        ordered = 1;
+        order = (a->number > b->number) - (a->number < b->number);
+        equal = a->number == b->number;
+    } else if (a->type == cJSON_String) {
+        ordered = 1;
+        order = strcmp(a->string, b->string);
+        equal = order == 0;
+    } else if (a->type == cJSON_Array || a->type == cJSON_Object || a->type == cJSON_Raw) {
+        equal = a->node == b->node;
+    } else {
+        equal = 1;
+    }
+    switch (op) {
+        case FILTER_EQ:
+            return equal;
+        case FILTER_NE:
+            return !equal;
+        case FILTER_LT:
+            return ordered && order < 0;
+        case FILTER_LE:
+            return equal || (ordered && order < 0);
+        case FILTER_GT:
+            return ordered && order > 0;
+        case FILTER_GE:
+            return equal || (ordered && order > 0);
+        default:
+            return 0;
+    }
+}
+
+static int jsonpath_filter_test(const jsonpath_filter_t *filter, cJSON *item) {
+    jsonpath_filter_value_t stack[JSONPATH_FILTER_STACK_SIZE];
+    int top = 0;
+    int pc = 0;
+    while (pc < filter->code_length) {
+        const jsonpath_filter_insn_t *insn = &filter->code[pc++];
+        switch (insn->op) {
+            case FILTER_PUSH: {
+                const jsonpath_filter_operand_t *operand = &filter->operands[insn->arg];
+                jsonpath_filter_value_t *value = &stack[top++];
+                if (operand->is_path) {
+                    cJSON *node = jsonpath_filter_resolve(operand, item);
+                    value->node = node;
+                    value->type = node == NULL ? 0 : (node->type & 0xFF);
+                    value->number = node == NULL ? 0 : node->valuedouble;
+                    value->string = node == NULL ? NULL : node->valuestring;
+                } else {
+                    value->node = NULL;
+                    value->type = operand->type;
+                    value->number = operand->number;
+                    value->string = operand->string;
+                }
+                break;
+            }
+            case FILTER_EXISTS:
+                jsonpath_filter_set_bool(&stack[top++], jsonpath_filter_resolve(&filter->operands[insn->arg], item) != NULL);
+                break;
+            case FILTER_NOT:
+                jsonpath_filter_set_bool(&stack[top - 1], !jsonpath_filter_truthy(&stack[top - 1]));
+                break;
+            case FILTER_JUMP_IF_FALSE:
+                if (!jsonpath_filter_truthy(&stack[top - 1])) {
+                    pc = insn->arg;
+                } else {
+                    top--;
+                }
+                break;
+            case FILTER_JUMP_IF_TRUE:
+                if (jsonpath_filter_truthy(&stack[top - 1])) {
+                    pc = insn->arg;
+                } else {
+                    top--;
+                }
+                break;
+            default:
+                top--;
+                jsonpath_filter_set_bool(&stack[top - 1], jsonpath_filter_compare(insn->op, &stack[top - 1], &stack[top]));
+                break;
+        }
+    }
+    return jsonpath_filter_truthy(&stack[0]);
+}
+
+// Bracketed selectors.
+//
+// "['a']" and "[1]" select one member or element, "['a','b']" and "[1,-1]"
+// a union of them in the given order, and "[start:end:step]" a slice, where
+// each of the three may be left out. Negative indices count from the end of
+// the array.
+
+static const char *jsonpath_skip_spaces(const char *p, const char *end) {
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+// Returns 0 when there is no integer at "p".
+static int jsonpath_parse_int(const char *p, const char *end, int *value, const char **next) {
+    const char *q = p;
+    if (q < end && *q == '-') {
+        q++;
+    }
+    if (q == end || !CHARTYPE(digit, *q)) {
+        return 0;
+    }
+    long long n = strtoll(p, (char **) next, 10);
+    *value = n > INT_MAX ? INT_MAX : (n < -INT_MAX ? -INT_MAX : (int) n);
+    return 1;
+}
+
+static int jsonpath_parse_error(Tcl_Interp *interp, const char *message) {
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(message, -1));
+    return TCL_ERROR;
+}
+
+// "p" is at the opening quote of the first name.
+static int jsonpath_parse_names(Tcl_Interp *interp, const char *p, const char *end, jsonpath_node_t **nodePtr,
+                                const char **next) {
+    int size = 4;
+    int length = 0;
+    char **names = (char **) Tcl_Alloc(sizeof(char *) * size);
+    const char *message = "Invalid JSONPath: ',' or ']' expected";
+    for (;;) {
+        const char *q = p + 1;
+        while (q < end && q[0] != '\'' && PROPCHAR(q[0])) {
+            q++;
+        }
+        if (q == end || q[0] != '\'') {
+            if (length == 0) {
+                message = q == end
+                          ? "Invalid JSONPath: \"['\" must be followed by a wildcard or a name in single quotes"
+                          : "Invalid JSONPath: ']' expected";
+            }
+            break;
+        }
+        if (length == size) {
+            size *= 2;
+            names = (char **) Tcl_Realloc((char *) names, sizeof(char *) * size);
+        }
+        names[length++] = jsonpath_strndup(p + 1, q - p - 1);
+        p = jsonpath_skip_spaces(q + 1, end);
+        if (p < end && p[0] == ']') {
+            jsonpath_node_t *node;
+            if (length == 1) {
+                node = jsonpath_node_new(CHILD_NAME);
+                node->data.child_name = names[0];
+                Tcl_Free((char *) names);
+            } else {
+                node = jsonpath_node_new(NAMES_SET);
+                node->data.names_set.names = names;
+                node->data.names_set.length = length;
+            }
+            *nodePtr = node;
+            *next = p + 1;
+            return TCL_OK;
+        }
+        if (p == end || p[0] != ',') {
+            break;
+        }
+        p = jsonpath_skip_spaces(p + 1, end);
+        if (p == end || p[0] != '\'') {
+            break;
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        Tcl_Free(names[i]);
+    }
+    Tcl_Free((char *) names);
+    return jsonpath_parse_error(interp, message);
+}
+
+// "p" is right after the opening bracket.
+static int jsonpath_parse_indices(Tcl_Interp *interp, const char *p, const char *end, jsonpath_node_t **nodePtr,
+                                  const char **next) {
+    int start = 0;
+    int has_start = jsonpath_parse_int(p, end, &start, &p);
+    p = jsonpath_skip_spaces(p, end);
+
+    if (p < end && p[0] == ':') {
+        int slice_end = 0;
+        int step = 1;
+        p = jsonpath_skip_spaces(p + 1, end);
+        int has_end = jsonpath_parse_int(p, end, &slice_end, &p);
+        p = jsonpath_skip_spaces(p, end);
+        if (p < end && p[0] == ':') {
+            p = jsonpath_skip_spaces(p + 1, end);
+            if (jsonpath_parse_int(p, end, &step, &p) && step == 0) {
+                return jsonpath_parse_error(interp, "Invalid JSONPath: slice step cannot be zero");
+            }
+            p = jsonpath_skip_spaces(p, end);
+        }
+        if (p == end || p[0] != ']') {
+            return jsonpath_parse_error(interp, "Invalid JSONPath: ']' expected");
+        }
+        jsonpath_node_t *node = jsonpath_node_new(INDICES_SLICE);
+        node->data.indices_slice.start = start;
+        node->data.indices_slice.end = slice_end;
+        node->data.indices_slice.step = step;
+        node->data.indices_slice.has_start = has_start;
+        node->data.indices_slice.has_end = has_end;
+        *nodePtr = node;
+        *next = p + 1;
+        return TCL_OK;
+    }
+
+    if (!has_start) {
+        return jsonpath_parse_error(interp, "Invalid JSONPath: ']' expected");
+    }
+    if (p < end && p[0] == ']') {
+        jsonpath_node_t *node = jsonpath_node_new(CHILD_INDEX);
+        node->data.child_index = start;
+        *nodePtr = node;
+        *next = p + 1;
+        return TCL_OK;
+    }
+    if (p == end || p[0] != ',') {
+        return jsonpath_parse_error(interp, "Invalid JSONPath: ']' expected");
+    }
+
+    int size = 16;
+    int *indices = (int *) Tcl_Alloc(sizeof(int) * size);
+    int length = 0;
+    indices[length++] = start;
+    while (p < end && p[0] == ',') {
+        p = jsonpath_skip_spaces(p + 1, end);
+        if (length == size) {
+            size *= 2;
+            indices = (int *) Tcl_Realloc((char *) indices, sizeof(int) * size);
+        }
+        if (!jsonpath_parse_int(p, end, &indices[length++], &p)) {
+            p = end;
+            break;
+        }
+        p = jsonpath_skip_spaces(p, end);
+    }
+    if (p == end || p[0] != ']') {
+        Tcl_Free((char *) indices);
+        return jsonpath_parse_error(interp, "Invalid JSONPath: ',' or ']' expected");
+    }
+    jsonpath_node_t *node = jsonpath_node_new(INDICES_SET);
+    node->data.indices_set.indices = indices;
+    node->data.indices_set.length = length;
+    *nodePtr = node;
+    *next = p + 1;
+    return TCL_OK;
+}
+
 static int jsonpath_parse(Tcl_Interp *interp, const char *jsonpath, int length, jsonpath_node_t **nodes) {
 
     DBG(fprintf(stderr, "jsonpath_parse: %.*s\n", length, jsonpath));
@@ -205,149 +913,42 @@ static int jsonpath_parse(Tcl_Interp *interp, const char *jsonpath, int length,
                     return TCL_ERROR;
                 }
                 // if "curr" is equal to "[*]" then it's a "WILDCARD_INDEX"
-                if (curr[1] == '*' && curr[2] == ']') {
+                if (curr[1] == '?') {
+                    const char *p;
+                    jsonpath_filter_t *filter;
+                    if (TCL_OK != jsonpath_filter_compile(interp, curr, end, &filter, &p)) {
+                        jsonpath_free_list(*nodes);
+                        return TCL_ERROR;
+                    }
+                    jsonpath_node_t *node = jsonpath_node_new(FILTER);
+                    node->data.filter = filter;
+                    jsonpath_insert_node_to_list(node, nodes, &nodes_length);
+                    curr = p;
+                } else if (curr[1] == '*' && curr[2] == ']') {
                     DBG(fprintf(stderr, "wildcard index\n"));
                     jsonpath_node_t *node = jsonpath_node_new(WILDCARD_INDEX);
                     jsonpath_insert_node_to_list(node, nodes, &nodes_length);
                     curr += 3;
-                } else if (curr[1] == '\'') {
+                } else if (curr[1] == '\'' && curr[2] == '*' && curr[3] == '\'' && curr[4] == ']') {
                     // if "curr" is equal to "['*']" then it's a "WILDCARD_NAME"
-                    if (curr[2] == '*' && curr[3] == '\'' && curr[4] == ']') {
-                        DBG(fprintf(stderr, "wildcard name\n"));
-                        jsonpath_node_t *node = jsonpath_node_new(WILDCARD_NAME);
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr += 5;
-                    } else {
-                        // if "curr" is equal to "['name']" then it's a "CHILD_NAME"
-                        const char *p = curr + 2;
-                        while (p < end && p[0] != '\'' && PROPCHAR(p[0])) {
-                            p++;
-                        }
-                        if (p == end) {
-                            jsonpath_free_list(*nodes);
-                            Tcl_SetObjResult(interp, Tcl_NewStringObj(
-                                    "Invalid JSONPath: \"['\" must be followed by a wildcard or a name in single quotes",
-                                    -1));
-                            return TCL_ERROR;
-                        }
-                        if (p + 1 == end || p[1] != ']') {
-                            jsonpath_free_list(*nodes);
-                            Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: ']' expected", -1));
-                            return TCL_ERROR;
-                        }
-
-                        DBG(fprintf(stderr, "child name: %.*s\n", (int) (p - curr - 2), curr + 2));
-
-                        jsonpath_node_t *node = jsonpath_node_new(CHILD_NAME);
-                        node->data.child_name = jsonpath_strndup(curr + 2, p - curr - 2);
-
-                        DBG(fprintf(stderr, "child name: %s\n", node->data.child_name));
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr = p + 2;
-                    }
+                    DBG(fprintf(stderr, "wildcard name\n"));
+                    jsonpath_node_t *node = jsonpath_node_new(WILDCARD_NAME);
+                    jsonpath_insert_node_to_list(node, nodes, &nodes_length);
+                    curr += 5;
                 } else {
-                    const char *p = curr + 1;
-                    // five cases:
-                    // (a) "curr" is equal to "[123]" then it's a "CHILD_INDEX"
-                    // (b) "curr" is equal to "[123,456]" then it's an "INDICES_SET"
-                    // (c) "curr" is equal to "[123:456]" then it's an "INDICES_SLICE",
-                    //     possibly with a "step" in between the "start" and the "end" of the slice
-                    // (d) "curr" is equal to "[:456]" then it's an "INDICES_SLICE" with an empty "start"
-
-                    int sign = 1;
-
-                    if (p[0] == '-') {
-                        sign = -1;
-                        p++;
-                    }
-
-                    if (p[0] == ':') {
-                        // TODO: get sign here
-                        // case (d) slice with an empty start
-                        int slice_end = strtoll(p + 1, (char **) &p, 10);
-                        if (p[0] != ']') {
-                            jsonpath_free_list(*nodes);
-                            Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: ']' expected", -1));
-                            return TCL_ERROR;
-                        }
-                        jsonpath_node_t *node = jsonpath_node_new(INDICES_SLICE);
-                        node->data.indices_slice.start = 0;
-                        node->data.indices_slice.end = slice_end;
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr = p + 1;
-                        break;
-                    }
-
-                    int index = strtoll(p, (char **) &p, 10) * sign;
-                    DBG(fprintf(stderr, "index: %d\n", index));
-
-                    if (p[0] == ',') {
-                        // case (b) set of indices
-                        int k = 16;
-                        int *indices = (int *) Tcl_Alloc(sizeof(int) * k);
-                        int indices_length = 0;
-                        indices[indices_length++] = index;
-                        while (p[0] != ']') {
-                            p++;
-                            if (p[0] == '-') {
-                                sign = -1;
-                                p++;
-                            } else {
-                                sign = 1;
-                            }
-                            indices[indices_length++] = strtoll(p, (char **) &p, 10);
-                            if (p[0] != ',' && p[0] != ']') {
-                                Tcl_Free((char *) indices);
-                                jsonpath_free_list(*nodes);
-                                Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: ',' or ']' expected", -1));
-                                return TCL_ERROR;
-                            }
-                            if (indices_length == k) {
-                                k *= 2;
-                                indices = (int *) Tcl_Realloc((char *) indices, sizeof(int) * k);
-                            }
-                        }
-                        jsonpath_node_t *node = jsonpath_node_new(INDICES_SET);
-                        node->data.indices_set.indices = indices;
-                        node->data.indices_set.length = indices_length;
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr = p + 1;
-                        break;
-                    } else if (p[0] == ':') {
-                        // case (c) slice
-                        int slice_start = index;
-                        int slice_end = 0;
-                        p++;
-                        if (p[0] == '-') {
-                            sign = -1;
-                            p++;
-                        } else {
-                            sign = 1;
-                        }
-                        slice_end = strtoll(p, (char **) &p, 10) * sign;
-                        if (p[0] != ']') {
-                            jsonpath_free_list(*nodes);
-                            Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: ']' expected", -1));
-                            return TCL_ERROR;
-                        }
-                        jsonpath_node_t *node = jsonpath_node_new(INDICES_SLICE);
-                        node->data.indices_slice.start = slice_start;
-                        node->data.indices_slice.end = slice_end;
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr = p + 1;
-                        break;
-                    } else if (p[0] == ']') {
-                        // case (a) single index
-                        jsonpath_node_t *node = jsonpath_node_new(CHILD_INDEX);
-                        node->data.child_index = index;
-                        jsonpath_insert_node_to_list(node, nodes, &nodes_length);
-                        curr = p + 1;
-                        break;
-                    } else {
+                    // "['name']" is a "CHILD_NAME" and "['a','b']" a "NAMES_SET", "[1]" is a "CHILD_INDEX",
+                    // "[1,3]" an "INDICES_SET" and "[start:end:step]" an "INDICES_SLICE"
+                    const char *p;
+                    jsonpath_node_t *node;
+                    int rc = curr[1] == '\''
+                             ? jsonpath_parse_names(interp, curr + 1, end, &node, &p)
+                             : jsonpath_parse_indices(interp, curr + 1, end, &node, &p);
+                    if (rc != TCL_OK) {
                         jsonpath_free_list(*nodes);
-                        Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: ']' expected", -1));
                         return TCL_ERROR;
                     }
+                    jsonpath_insert_node_to_list(node, nodes, &nodes_length);
+                    curr = p;
                 }
                 break;
             default:
@@ -361,244 +962,656 @@ static int jsonpath_parse(Tcl_Interp *interp, const char *jsonpath, int length,
     return TCL_OK;
 }
 
-static int add_item_to_result(jsonpath_result_t *result, cJSON *item) {
-    result->items[result->items_length++] = item;
-    if (result->items_length > result->k) {
+// Resolves a negative index against the size of "array", returns -1 when the
+// index is out of bounds.
+static int jsonpath_resolve_index(cJSON *array, int index) {
+    int length = cJSON_GetArraySize(array);
+    if (index < 0) {
+        index += length;
+    }
+    return index >= 0 && index < length ? index : -1;
+}
+
+// Resolves the bounds of a slice over "length" elements: the position of its
+// first element and the one it stops at, after the last for a positive step
+// and before it for a negative one. Bounds left out default to the whole
+// array in the direction of the step, and bounds outside of the array are
+// clamped to it, so that a slice selects no element rather than failing.
+// Both ::tjson::query and ::tjson::extract go through here.
+static void jsonpath_slice_bounds(const jsonpath_node_t *step, int length, int *start, int *end) {
+    int stride = step->data.indices_slice.step;
+    // positions a bound is clamped to, in the direction of the step
+    int low = stride > 0 ? 0 : -1;
+    int high = stride > 0 ? length : length - 1;
+    *start = step->data.indices_slice.start;
+    *end = step->data.indices_slice.end;
+    if (!step->data.indices_slice.has_start) {
+        *start = stride > 0 ? low : high;
+    } else if (*start < 0) {
+        *start += length;
+    }
+    if (!step->data.indices_slice.has_end) {
+        *end = stride > 0 ? high : low;
+    } else if (*end < 0) {
+        *end += length;
+    }
+    *start = *start < low ? low : (*start > high ? high : *start);
+    *end = *end < low ? low : (*end > high ? high : *end);
+}
+
+static int add_item_to_result(jsonpath_result_t *result, cJSON *item, cJSON *parent) {
+    if (result->items == NULL) {
+        result->items_length++;
+        return TCL_OK;
+    }
+    if (result->items_length == result->k) {
         result->k *= 2;
         result->items = (cJSON **) Tcl_Realloc((char *)result->items, sizeof(cJSON *) * result->k);
         if (result->items == NULL) {
             return TCL_ERROR;
         }
+        if (result->parents != NULL) {
+            result->parents = (cJSON **) Tcl_Realloc((char *)result->parents, sizeof(cJSON *) * result->k);
+            if (result->parents == NULL) {
+                return TCL_ERROR;
+            }
+        }
     }
+    if (result->parents != NULL) {
+        result->parents[result->items_length] = parent;
+    }
+    result->items[result->items_length++] = item;
     return TCL_OK;
 }
 
-static int jsonpath_eval(Tcl_Interp *interp, jsonpath_node_t *node, cJSON *root, jsonpath_result_t *result) {
-    if (node == NULL) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: node is NULL", -1));
-        return TCL_ERROR;
-    }
-    DBG(fprintf(stderr, "jsonpath_eval, type: %d\n", node->type));
+// Key index.
+//
+// Every member of an object in the document has an entry in the list of its
+// key, in document order. The entries are numbered in that order across all
+// keys, and each one also records the number past the last entry under its
+// value, so that the entries under a member are those numbered between the
+// two. The index is not built for a document with lazy or shared subtrees:
+// walking them would parse or copy them, which is what -lazy and dedup are
+// there to avoid, and a deep scan prunes or unshares them on its own.
+
+typedef struct {
     cJSON *item;
-    switch (node->type) {
-        case ROOT:
-            DBG(fprintf(stderr, "eval,root: %p\n", root));
-            if (node->next != NULL) {
-                if (TCL_OK != jsonpath_eval(interp, node->next, root, result)) {
-                    return TCL_ERROR;
-                }
-            } else {
-                if (TCL_OK != add_item_to_result(result, root)) {
-                    Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                    return TCL_ERROR;
-                }
-                return TCL_OK;
+    size_t number;          // position of the entry in document order
+    size_t end;             // number past the last entry under the member
+} jsonpath_index_entry_t;
+
+typedef struct {
+    jsonpath_index_entry_t *entries;
+    size_t num_entries;
+    size_t size;
+} jsonpath_index_list_t;
+
+struct jsonpath_index {
+    cJSON *root;
+    int usable;
+    Tcl_HashTable keys;     // key -> jsonpath_index_list_t
+};
+
+typedef struct {
+    cJSON *child;                   // next child to index
+    int object;                     // whether the children are members
+    jsonpath_index_list_t *list;    // list holding the entry of the value, if any
+    size_t entry;
+} jsonpath_index_frame_t;
+
+static void jsonpath_index_clear(jsonpath_index_t *index) {
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *entryPtr = Tcl_FirstHashEntry(&index->keys, &search); entryPtr != NULL;
+         entryPtr = Tcl_NextHashEntry(&search)) {
+        jsonpath_index_list_t *list = (jsonpath_index_list_t *) Tcl_GetHashValue(entryPtr);
+        Tcl_Free((char *) list->entries);
+        Tcl_Free((char *) list);
+    }
+    Tcl_DeleteHashTable(&index->keys);
+}
+
+void jsonpath_index_free(jsonpath_index_t *index) {
+    if (index == NULL) {
+        return;
+    }
+    jsonpath_index_clear(index);
+    Tcl_Free((char *) index);
+}
+
+// Pushes a frame for the children of "item", or closes its entry right away
+// when it has none to index.
+static int jsonpath_index_enter(Tcl_Interp *interp, tjson_stack_t *stack, cJSON *item, jsonpath_index_list_t *list, size_t entry,
+                                size_t number) {
+    if (item->flags & (LAZY_SUBTREE | SHARED_SUBTREE)) {
+        return 0;
+    }
+    if ((cJSON_IsArray(item) && !(item->flags & PACKED_ARRAY)) || cJSON_IsObject(item)) {
+        jsonpath_index_frame_t *frame = (jsonpath_index_frame_t *) tjson_StackPush(interp, stack);
+        if (frame == NULL) {
+            return 0;
+        }
+        frame->child = item->child;
+        frame->object = cJSON_IsObject(item);
+        frame->list = list;
+        frame->entry = entry;
+    } else if (list != NULL) {
+        list->entries[entry].end = number;
+    }
+    return 1;
+}
+
+// Always returns an index; one that is not usable stands for a document that
+// cannot be indexed until it changes.
+static jsonpath_index_t *jsonpath_index_build(Tcl_Interp *interp, cJSON *root) {
+    jsonpath_index_t *index = (jsonpath_index_t *) Tcl_Alloc(sizeof(jsonpath_index_t));
+    index->root = root;
+    Tcl_InitHashTable(&index->keys, TCL_STRING_KEYS);
+
+    tjson_stack_t stack;
+    tjson_StackInit(&stack, sizeof(jsonpath_index_frame_t), cJSON_GetNestingLimit() + 1);
+    size_t number = 0;
+    int usable = jsonpath_index_enter(interp, &stack, root, NULL, 0, number);
+    while (usable && stack.depth > 0) {
+        jsonpath_index_frame_t *frame = (jsonpath_index_frame_t *) tjson_StackTop(&stack);
+        cJSON *child = frame->child;
+        if (child == NULL) {
+            if (frame->list != NULL) {
+                frame->list->entries[frame->entry].end = number;
             }
-            break;
-        case CHILD_NAME:
-            DBG(fprintf(stderr, "eval,child_name: %d %p %p\n", node->type, node->next, node->data.child_name));
-            item = cJSON_GetObjectItemCaseSensitive(root, node->data.child_name);
-            if (item == NULL) {
-                return TCL_OK;
-            }
-            if (node->next == NULL) {
-                if (TCL_OK != add_item_to_result(result, item)) {
-                    DBG(fprintf(stderr, "failed to add item to result\n"));
-                    Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                    return TCL_ERROR;
-                }
-                DBG(fprintf(stderr, "added item to result\n"));
+            tjson_StackPop(&stack);
+            continue;
+        }
+        frame->child = child->next;
+        jsonpath_index_list_t *list = NULL;
+        size_t entry = 0;
+        if (frame->object && child->string != NULL) {
+            int newEntry;
+            Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&index->keys, child->string, &newEntry);
+            if (newEntry) {
+                list = (jsonpath_index_list_t *) Tcl_Alloc(sizeof(jsonpath_index_list_t));
+                memset(list, 0, sizeof(jsonpath_index_list_t));
+                Tcl_SetHashValue(entryPtr, (ClientData) list);
             } else {
-                if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                    return TCL_ERROR;
-                }
+                list = (jsonpath_index_list_t *) Tcl_GetHashValue(entryPtr);
             }
+            if (list->num_entries == list->size) {
+                list->size = list->size == 0 ? 4 : list->size * 2;
+                list->entries = (jsonpath_index_entry_t *) Tcl_Realloc((char *) list->entries,
+                                                                       sizeof(jsonpath_index_entry_t) * list->size);
+            }
+            entry = list->num_entries++;
+            list->entries[entry].item = child;
+            list->entries[entry].number = number++;
+        }
+        // may grow the stack, "frame" is not to be used after this
+        usable = jsonpath_index_enter(interp, &stack, child, list, entry, number);
+    }
+    tjson_StackFree(&stack);
+
+    index->usable = usable;
+    if (!usable) {
+        jsonpath_index_clear(index);
+        Tcl_InitHashTable(&index->keys, TCL_STRING_KEYS);
+    }
+    return index;
+}
+
+// Evaluation.
+//
+// Paths are evaluated from a work list instead of by recursion. A frame
+// applies one step to one value and hands out the values the step selects,
+// one at a time and in document order. The steps that select at most one
+// value ("$", ".name", "[n]") are followed on the spot, any other step gets a
+// frame of its own on top of the frame that selected its value, so a frame
+// only resumes once everything under its last selection is done. A deep
+// scan pushes a frame for each array or object it descends into, and skips
+// those that cannot hold the name it looks for. A deep scan from the root of
+// an indexed document walks the entries of the name in the key index
+// instead, skipping those under an entry it already selected.
+//
+// Evaluation stops as soon as every result has reached its limit.
+//
+// When several paths are evaluated at once, a frame continues with a node of
+// their trie (see jsonpath_match_multi_obj) instead of the next step of a
+// single path.
+
+typedef struct {
+    int path;
+    jsonpath_node_t *node;
+} jsonpath_trie_scan_t;
+
+typedef struct jsonpath_trie {
+    jsonpath_node_t *step;              // step leading to this node, NULL for the root
+    struct jsonpath_trie **children;
+    int num_children;
+    int *ends;                          // paths ending at this node
+    int num_ends;
+    jsonpath_trie_scan_t *scans;        // paths continuing with a deep scan
+    int num_scans;
+} jsonpath_trie_t;
+
+typedef struct {
+    jsonpath_node_t *step;      // step applied by the frame
+    cJSON *parent;              // value the step is applied to
+    cJSON *item;                // next child to consider, or the value selected by a single step
+    int index;                  // position of "item" in a slice, or next position in an index set
+    int end;                    // end of a slice
+    jsonpath_trie_t *trie;      // trie node reached by the step, NULL when evaluating a single path
+    int path;                   // result of the single path
+    jsonpath_index_list_t *keyed;   // entries walked by an indexed deep scan
+    size_t position;                // next entry to consider
+    size_t bound;                   // entries numbered below this are under a selected one
+} jsonpath_frame_t;
+
+typedef struct {
+    Tcl_Interp *interp;
+    tjson_stack_t stack;
+    jsonpath_result_t *results;
+    int open;                   // results still taking matches
+    cJSON *root;
+    jsonpath_index_t **indexPtr;    // key index of "root", NULL to scan without one
+} jsonpath_engine_t;
+
+// "num_frames" is the number of frames the steps may need on top of the
+// ones deep scans push for the levels of the document
+static void jsonpath_engine_init(jsonpath_engine_t *engine, Tcl_Interp *interp, jsonpath_result_t *results,
+                                 int num_results, int num_frames) {
+    engine->interp = interp;
+    engine->results = results;
+    engine->open = 0;
+    engine->root = NULL;
+    engine->indexPtr = NULL;
+    for (int i = 0; i < num_results; i++) {
+        if (results[i].limit <= 0 || results[i].items_length < results[i].limit) {
+            engine->open++;
+        }
+    }
+    tjson_StackInit(&engine->stack, sizeof(jsonpath_frame_t), cJSON_GetNestingLimit() + num_frames);
+}
+
+static int jsonpath_engine_add(jsonpath_engine_t *engine, int path, cJSON *item, cJSON *parent) {
+    jsonpath_result_t *result = &engine->results[path];
+    if (result->limit > 0 && result->items_length >= result->limit) {
+        return TCL_OK;
+    }
+    if (TCL_OK != add_item_to_result(result, item, parent)) {
+        Tcl_SetObjResult(engine->interp, Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
+        return TCL_ERROR;
+    }
+    if (result->limit > 0 && result->items_length == result->limit) {
+        engine->open--;
+    }
+    return TCL_OK;
+}
+
+// Checks "step" against "parent" and pushes a frame for it, unless it
+// cannot select anything.
+static int jsonpath_engine_push(jsonpath_engine_t *engine, jsonpath_node_t *step, cJSON *parent,
+                                jsonpath_trie_t *trie, int path) {
+    Tcl_Interp *interp = engine->interp;
+    cJSON *item = NULL;
+    int index = 0;
+    int end = 0;
+    jsonpath_index_list_t *keyed = NULL;
+    switch (step->type) {
+        case ROOT:
+            item = parent;
+            break;
+        case CHILD_NAME:
+            item = tjson_GetObjectItem(parent, step->data.child_name);
             break;
         case CHILD_INDEX:
-            if (!cJSON_IsArray(root)) {
+            if (!cJSON_IsArray(parent)) {
                 Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: CHILD_INDEX - not an array", -1));
                 return TCL_ERROR;
             }
-            if (node->data.child_index < 0 || node->data.child_index >= cJSON_GetArraySize(root)) {
+            index = jsonpath_resolve_index(parent, step->data.child_index);
+            if (index < 0) {
                 Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: child index out of bounds", -1));
                 return TCL_ERROR;
             }
-            item = cJSON_GetArrayItem(root, node->data.child_index);
-            if (node->next == NULL) {
-                if (TCL_OK != add_item_to_result(result, item)) {
-                    Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                    return TCL_ERROR;
-                }
-            } else {
-                if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                    return TCL_ERROR;
-                }
+            item = cJSON_GetArrayItem(parent, index);
+            break;
+        case WILDCARD_NAME:
+            // TODO: cases trailing '*' in a path like "$.foo.bar.*" and "$.foo.bar.*.baz" where bar is an array
+            if (cJSON_IsObject(parent)) {
+                cJSON_Materialize(parent);
+                item = parent->child;
+            }
+            break;
+        case WILDCARD_INDEX:
+            // TODO: cases trailing '*' in a path like "$.foo.bar[*]" and "$.foo.bar[*].baz" where bar is an object
+            if (cJSON_IsArray(parent)) {
+                cJSON_Materialize(parent);
+                item = parent->child;
             }
             break;
         case DEEP_SCAN:
-            switch ((root->type) & 0xFF) {
-                case cJSON_Object:
-                    item = root->child;
-                    while (item != NULL) {
-                        if (node->next->type == CHILD_NAME && strcmp(node->next->data.child_name, item->string) == 0) {
-                            DBG(fprintf(stderr, "eval,deep scan object,entering: %s\n", item->string));
-                            if (TCL_OK != jsonpath_eval(interp, node->next, root, result)) {
-                                return TCL_ERROR;
-                            }
-                            DBG(fprintf(stderr, "eval,deep scan object,leaving: %s\n", item->string));
-                        } else {
-                            DBG(fprintf(stderr, "eval,deep scan object (in): %s %s\n", node->next->data.child_name, item->string));
-                            if (TCL_OK != jsonpath_eval(interp, node, item, result)) {
-                                return TCL_ERROR;
-                            }
-                            DBG(fprintf(stderr, "eval,deep scan object (out): %s %s\n", node->next->data.child_name, item->string));
-                        }
-                        item = item->next;
-                    }
-                    break;
-                case cJSON_Array:
-                    item = root->child;
-                    for (int i = 0; item != NULL; item = item->next, i++) {
-                        if (node->next->type == CHILD_INDEX && node->next->data.child_index == i) {
-                            DBG(fprintf(stderr, "eval,deep scan array,entering: %d\n", i));
-                            if (TCL_OK != jsonpath_eval(interp, node->next, root, result)) {
-                                return TCL_ERROR;
-                            }
-                        } else {
-                            DBG(fprintf(stderr, "eval,deep scan array: %d\n", i));
-                            if (TCL_OK != jsonpath_eval(interp, node, item, result)) {
-                                return TCL_ERROR;
-                            }
-                        }
+            // the index does not know the parents of its entries
+            if (engine->indexPtr != NULL && parent == engine->root && engine->results[path].parents == NULL) {
+                if (*engine->indexPtr == NULL) {
+                    *engine->indexPtr = jsonpath_index_build(interp, parent);
+                }
+                if ((*engine->indexPtr)->usable) {
+                    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&(*engine->indexPtr)->keys, step->next->data.child_name);
+                    if (entryPtr == NULL) {
+                        return TCL_OK;
                     }
+                    keyed = (jsonpath_index_list_t *) Tcl_GetHashValue(entryPtr);
+                    item = parent;
                     break;
-                default:
-                    break;
-            }
-            return TCL_OK;
-        case WILDCARD_NAME:
-            DBG(fprintf(stderr, "eval,wildcard_name,next: %p\n", node->next));
-            if (cJSON_IsObject(root)) {
-                item = root->child;
-                while (item != NULL) {
-                    DBG(fprintf(stderr, "%s\n", cJSON_Print(item)));
-                    if (node->next != NULL) {
-                        if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                            return TCL_ERROR;
-                        }
-                    } else {
-                        if (TCL_OK != add_item_to_result(result, item)) {
-                            Tcl_SetObjResult(interp,
-                                             Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                            return TCL_ERROR;
-                        }
-                    }
-                    item = item->next;
                 }
-            } else {
-                // TODO: cases trailing '*' in a path like "$.foo.bar.*" and "$.foo.bar.*.baz" where bar is an array
-//                if (TCL_OK != add_item_to_result(result, root)) {
-//                    Tcl_SetObjResult(interp,
-//                                     Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-//                    return TCL_ERROR;
-//                }
             }
-            return TCL_OK;
-        case WILDCARD_INDEX:
-            if (cJSON_IsArray(root)) {
-                item = root->child;
-                while (item != NULL) {
-                    if (node->next != NULL) {
-                        if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                            return TCL_ERROR;
-                        }
-                    } else {
-                        if (TCL_OK != add_item_to_result(result, item)) {
-                            Tcl_SetObjResult(interp,
-                                             Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                            return TCL_ERROR;
-                        }
-                    }
-                    item = item->next;
-                }
-            } else {
-                // TODO: cases trailing '*' in a path like "$.foo.bar[*]" and "$.foo.bar[*].baz" where bar is an object
-//                if (TCL_OK != add_item_to_result(result, root)) {
-//                    Tcl_SetObjResult(interp,
-//                                     Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-//                    return TCL_ERROR;
-//                }
+            // fall through
+        case FILTER:
+            if (cJSON_IsArray(parent) || cJSON_IsObject(parent)) {
+                cJSON_Materialize(parent);
+                item = parent->child;
             }
-            return TCL_OK;
+            break;
         case INDICES_SET:
-            if (!cJSON_IsArray(root)) {
+            if (!cJSON_IsArray(parent)) {
                 Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: not an array", -1));
                 return TCL_ERROR;
             }
-            for (int i = 0; i < node->data.indices_set.length; i++) {
-                int index = node->data.indices_set.indices[i];
-                item = cJSON_GetArrayItem(root, index);
-                if (node->next != NULL) {
-                    if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                        return TCL_ERROR;
-                    }
-                } else {
-                    if (TCL_OK != add_item_to_result(result, item)) {
-                        Tcl_SetObjResult(interp,
-                                         Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                        return TCL_ERROR;
-                    }
-                }
+            // "end" holds the size for the negative indices
+            end = cJSON_GetArraySize(parent);
+            item = parent;
+            break;
+        case NAMES_SET:
+            if (cJSON_IsObject(parent)) {
+                item = parent;
             }
-            return TCL_OK;
-        case INDICES_SLICE:
-            if (!cJSON_IsArray(root)) {
+            break;
+        case INDICES_SLICE: {
+            if (!cJSON_IsArray(parent)) {
                 Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: not an array", -1));
                 return TCL_ERROR;
             }
-            int start = node->data.indices_slice.start;
-            int end = node->data.indices_slice.end;
-            int length = cJSON_GetArraySize(root);
-            if (start < 0) {
-                start = length + start;
-            }
-            if (end < 0) {
-                end = length + end;
+            int stride = step->data.indices_slice.step;
+            jsonpath_slice_bounds(step, cJSON_GetArraySize(parent), &index, &end);
+            if (stride > 0 ? index < end : index > end) {
+                item = cJSON_GetArrayItem(parent, index);
             }
-            if (end == 0) {
-                end = length;
-            }
-            if (start < 0 || start >= length) {
-                Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: slice start out of bounds", -1));
-                return TCL_ERROR;
-            }
-            if (end < 0 || end > length) {
-                Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: slice end out of bounds", -1));
-                return TCL_ERROR;
+            break;
+        }
+        default:
+            break;
+    }
+    if (item == NULL) {
+        return TCL_OK;
+    }
+    jsonpath_frame_t *frame = (jsonpath_frame_t *) tjson_StackPush(interp, &engine->stack);
+    if (frame == NULL) {
+        return TCL_ERROR;
+    }
+    frame->step = step;
+    frame->parent = parent;
+    frame->item = item;
+    frame->index = index;
+    frame->end = end;
+    frame->trie = trie;
+    frame->path = path;
+    frame->keyed = keyed;
+    frame->position = 0;
+    frame->bound = 0;
+    return TCL_OK;
+}
+
+// Follows the steps of a single path from "item", a child of "parent", for
+// as long as they select at most one value, then pushes a frame for the next
+// one.
+static int jsonpath_engine_follow(jsonpath_engine_t *engine, jsonpath_node_t *step, cJSON *item, cJSON *parent,
+                                  int path) {
+    for (; step != NULL; step = step->next) {
+        switch (step->type) {
+            case ROOT:
+                break;
+            case CHILD_NAME:
+                parent = item;
+                item = tjson_GetObjectItem(item, step->data.child_name);
+                if (item == NULL) {
+                    jsonpath_result_t *result = &engine->results[path];
+                    if (step->next == NULL && result->missing && result->parents != NULL && cJSON_IsObject(parent)) {
+                        result->missing_name = step->data.child_name;
+                        return jsonpath_engine_add(engine, path, NULL, parent);
+                    }
+                    return TCL_OK;
+                }
+                break;
+            case CHILD_INDEX:
+                if (!cJSON_IsArray(item)) {
+                    Tcl_SetObjResult(engine->interp, Tcl_NewStringObj("Invalid JSONPath: CHILD_INDEX - not an array", -1));
+                    return TCL_ERROR;
+                }
+                int index = jsonpath_resolve_index(item, step->data.child_index);
+                if (index < 0) {
+                    Tcl_SetObjResult(engine->interp, Tcl_NewStringObj("Invalid JSONPath: child index out of bounds", -1));
+                    return TCL_ERROR;
+                }
+                parent = item;
+                item = cJSON_GetArrayItem(item, index);
+                break;
+            default:
+                return jsonpath_engine_push(engine, step, item, NULL, path);
+        }
+    }
+    return jsonpath_engine_add(engine, path, item, parent);
+}
+
+static int jsonpath_engine_enter(jsonpath_engine_t *engine, jsonpath_trie_t *trie, cJSON *item, cJSON *parent) {
+    for (int i = 0; i < trie->num_ends; i++) {
+        if (TCL_OK != jsonpath_engine_add(engine, trie->ends[i], item, parent)) {
+            return TCL_ERROR;
+        }
+    }
+    for (int i = 0; i < trie->num_scans; i++) {
+        if (TCL_OK != jsonpath_engine_push(engine, trie->scans[i].node, item, NULL, trie->scans[i].path)) {
+            return TCL_ERROR;
+        }
+    }
+    for (int i = 0; i < trie->num_children; i++) {
+        if (TCL_OK != jsonpath_engine_push(engine, trie->children[i]->step, item, trie->children[i], 0)) {
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+static int jsonpath_contains(const char *text, size_t length, const char *name, size_t name_length) {
+    const char *end = text + length;
+    while ((size_t) (end - text) >= name_length) {
+        const char *p = memchr(text, name[0], end - text - name_length + 1);
+        if (p == NULL) {
+            return 0;
+        }
+        if (memcmp(p, name, name_length) == 0) {
+            return 1;
+        }
+        text = p + 1;
+    }
+    return 0;
+}
+
+// Whether a deep scan for "name" can skip "item" without looking inside:
+// scalars and packed arrays hold no keys, and a lazy subtree whose text has
+// no escape sequence holds its keys verbatim, so it cannot have "name" when
+// the text does not contain it. Such a subtree is left unparsed.
+static int jsonpath_scan_prunes(const cJSON *item, const char *name) {
+    if (!(cJSON_IsArray(item) || cJSON_IsObject(item)) || (item->flags & PACKED_ARRAY)) {
+        return 1;
+    }
+    if (item->flags & LAZY_SUBTREE) {
+        size_t length = (size_t) item->valuedouble;
+        return memchr(item->valuestring, '\\', length) == NULL
+               && !jsonpath_contains(item->valuestring, length, name, strlen(name));
+    }
+    return 0;
+}
+
+// Whether the member at "position" of a union selects the same value as one
+// before it. "length" is the size of the array for the negative indices.
+static int jsonpath_union_repeats(const jsonpath_node_t *step, int position, int length) {
+    for (int i = 0; i < position; i++) {
+        if (step->type == NAMES_SET) {
+            if (strcmp(step->data.names_set.names[i], step->data.names_set.names[position]) == 0) {
+                return 1;
             }
-            item = cJSON_GetArrayItem(root, start);
-            while (item != NULL && start < end) {
-                if (node->next != NULL) {
-                    if (TCL_OK != jsonpath_eval(interp, node->next, item, result)) {
-                        return TCL_ERROR;
+            continue;
+        }
+        int a = step->data.indices_set.indices[i];
+        int b = step->data.indices_set.indices[position];
+        if ((a < 0 ? a + length : a) == (b < 0 ? b + length : b)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int jsonpath_engine_run(jsonpath_engine_t *engine) {
+    tjson_stack_t *stack = &engine->stack;
+    while (stack->depth > 0 && engine->open > 0) {
+        jsonpath_frame_t *frame = (jsonpath_frame_t *) tjson_StackTop(stack);
+        jsonpath_node_t *step = frame->step;
+        jsonpath_node_t *next = step->next;
+        cJSON *selected = NULL;
+        int distinct = frame->trie == NULL && engine->results[frame->path].parents != NULL;
+        switch (step->type) {
+            case ROOT:
+            case CHILD_NAME:
+            case CHILD_INDEX:
+                selected = frame->item;
+                frame->item = NULL;
+                break;
+            case WILDCARD_NAME:
+            case WILDCARD_INDEX:
+                selected = frame->item;
+                if (selected != NULL) {
+                    frame->item = selected->next;
+                }
+                break;
+            case FILTER:
+                while (frame->item != NULL && !jsonpath_filter_test(step->data.filter, frame->item)) {
+                    frame->item = frame->item->next;
+                }
+                selected = frame->item;
+                if (selected != NULL) {
+                    frame->item = selected->next;
+                }
+                break;
+            case INDICES_SET:
+                while (selected == NULL && frame->index < step->data.indices_set.length) {
+                    int index = step->data.indices_set.indices[frame->index++];
+                    if (index < 0) {
+                        index += frame->end;
+                    }
+                    if (index >= 0 && !(distinct && jsonpath_union_repeats(step, frame->index - 1, frame->end))) {
+                        selected = cJSON_GetArrayItem(frame->parent, index);
+                    }
+                }
+                break;
+            case NAMES_SET:
+                while (selected == NULL && frame->index < step->data.names_set.length) {
+                    if (!(distinct && jsonpath_union_repeats(step, frame->index, 0))) {
+                        selected = tjson_GetObjectItem(frame->parent, step->data.names_set.names[frame->index]);
+                    }
+                    frame->index++;
+                }
+                break;
+            case INDICES_SLICE: {
+                // "item" is only set while it lies within the slice
+                int stride = step->data.indices_slice.step;
+                selected = frame->item;
+                if (selected == NULL) {
+                    break;
+                }
+                frame->index += stride;
+                if (stride > 0 ? frame->index < frame->end : frame->index > frame->end) {
+                    for (int i = 0; i < abs(stride); i++) {
+                        frame->item = stride > 0 ? frame->item->next : frame->item->prev;
                     }
                 } else {
-                    if (TCL_OK != add_item_to_result(result, item)) {
-                        Tcl_SetObjResult(interp,
-                                         Tcl_NewStringObj("Invalid JSONPath: failed to add item to result", -1));
-                        return TCL_ERROR;
+                    frame->item = NULL;
+                }
+                break;
+            }
+            case DEEP_SCAN: {
+                // a member matching the name ends the scan for its branch
+                if (frame->keyed != NULL) {
+                    while (frame->position < frame->keyed->num_entries) {
+                        jsonpath_index_entry_t *entry = &frame->keyed->entries[frame->position++];
+                        if (entry->number >= frame->bound) {
+                            frame->bound = entry->end;
+                            selected = entry->item;
+                            next = next->next;
+                            break;
+                        }
                     }
+                    break;
+                }
+                cJSON *child = frame->item;
+                if (child == NULL) {
+                    break;
+                }
+                frame->item = child->next;
+                const char *name = next->data.child_name;
+                if (cJSON_IsObject(frame->parent) && child->string != NULL && strcmp(child->string, name) == 0) {
+                    selected = child;
+                    next = next->next;
+                    break;
+                }
+                if (!jsonpath_scan_prunes(child, name)
+                    && TCL_OK != jsonpath_engine_push(engine, step, child, NULL, frame->path)) {
+                    return TCL_ERROR;
                 }
-                item = item->next;
-                start++;
+                continue;
             }
-            return TCL_OK;
-        default:
-            return TCL_OK;
+            default:
+                break;
+        }
+        if (selected == NULL) {
+            tjson_StackPop(stack);
+            continue;
+        }
+        // may push frames, "frame" is not to be used after this
+        int rc = frame->trie != NULL
+                 ? jsonpath_engine_enter(engine, frame->trie, selected, frame->parent)
+                 : jsonpath_engine_follow(engine, next, selected, frame->parent, frame->path);
+        if (rc != TCL_OK) {
+            return TCL_ERROR;
+        }
     }
     return TCL_OK;
 }
 
+static int jsonpath_eval(Tcl_Interp *interp, jsonpath_node_t *nodes, cJSON *root, jsonpath_index_t **indexPtr,
+                         jsonpath_result_t *result) {
+    if (nodes == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: node is NULL", -1));
+        return TCL_ERROR;
+    }
+    // only the steps selecting several values get a frame
+    int num_frames = 0;
+    for (jsonpath_node_t *node = nodes; node != NULL; node = node->next) {
+        if (node->type != ROOT && node->type != CHILD_NAME && node->type != CHILD_INDEX && node->type != DEEP_SCAN) {
+            num_frames++;
+        }
+    }
+    jsonpath_engine_t engine;
+    jsonpath_engine_init(&engine, interp, result, 1, num_frames);
+    engine.root = root;
+    engine.indexPtr = indexPtr;
+    int rc = TCL_OK;
+    if (engine.open > 0) {
+        rc = jsonpath_engine_follow(&engine, nodes, root, NULL, 0);
+    }
+    if (rc == TCL_OK) {
+        rc = jsonpath_engine_run(&engine);
+    }
+    tjson_StackFree(&engine.stack);
+    return rc;
+}
+
 int jsonpath_match(Tcl_Interp *interp, const char *jsonpath, int length, cJSON *root, jsonpath_result_t *result) {
     jsonpath_node_t *nodes = NULL;
     if (TCL_OK != jsonpath_parse(interp, jsonpath, length, &nodes)) {
@@ -606,10 +1619,812 @@ int jsonpath_match(Tcl_Interp *interp, const char *jsonpath, int length, cJSON *
         return TCL_ERROR;
     }
     DBG(fprintf(stderr, "nodes: %p\n", nodes));
-    if (TCL_OK != jsonpath_eval(interp, nodes, root, result)) {
+    if (TCL_OK != jsonpath_eval(interp, nodes, root, NULL, result)) {
         jsonpath_free(nodes);
         return TCL_ERROR;
     }
     jsonpath_free(nodes);
     return TCL_OK;
-}
\ No newline at end of file
+}
+
+// Compiled paths.
+//
+// A path is parsed once into a program that is shared by reference: the
+// internal representation of the Tcl_Obj holding the path points at it, and
+// so does an entry of the per-thread LRU cache keyed by the path text, which
+// finds the program again once the object has been freed or shimmered to
+// another type (e.g. a path built anew for each call).
+
+#define JSONPATH_CACHE_SIZE 256
+
+typedef struct {
+    size_t refCount;
+    jsonpath_node_t *nodes;
+} jsonpath_program_t;
+
+typedef struct jsonpath_cache_entry {
+    struct jsonpath_cache_entry *prev;
+    struct jsonpath_cache_entry *next;
+    Tcl_HashEntry *hashPtr;
+    jsonpath_program_t *program;
+} jsonpath_cache_entry_t;
+
+// most recently used first
+typedef struct {
+    int initialized;
+    Tcl_HashTable table;
+    jsonpath_cache_entry_t *head;
+    jsonpath_cache_entry_t *tail;
+    int size;
+} jsonpath_cache_t;
+
+static Tcl_ThreadDataKey jsonpath_CacheKey;
+
+static void jsonpath_retain(jsonpath_program_t *program) {
+    program->refCount++;
+}
+
+static void jsonpath_release(jsonpath_program_t *program) {
+    if (--program->refCount == 0) {
+        jsonpath_free(program->nodes);
+        Tcl_Free((char *) program);
+    }
+}
+
+static void jsonpath_FreeIntRep(Tcl_Obj *objPtr) {
+    jsonpath_release((jsonpath_program_t *) objPtr->internalRep.twoPtrValue.ptr1);
+    objPtr->typePtr = NULL;
+}
+
+static void jsonpath_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+
+// the string representation is never discarded, so there is no
+// updateStringProc, and programs are only made by jsonpath_get_program
+static const Tcl_ObjType jsonpath_ObjType = {
+    "tjson.jsonpath",
+    jsonpath_FreeIntRep,
+    jsonpath_DupIntRep,
+    NULL,
+    NULL
+};
+
+static void jsonpath_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr) {
+    jsonpath_program_t *program = (jsonpath_program_t *) srcPtr->internalRep.twoPtrValue.ptr1;
+    jsonpath_retain(program);
+    dupPtr->internalRep.twoPtrValue.ptr1 = program;
+    dupPtr->internalRep.twoPtrValue.ptr2 = NULL;
+    dupPtr->typePtr = &jsonpath_ObjType;
+}
+
+static void jsonpath_CacheUnlink(jsonpath_cache_t *cache, jsonpath_cache_entry_t *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+static void jsonpath_CachePushFront(jsonpath_cache_t *cache, jsonpath_cache_entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+static void jsonpath_CacheEvict(jsonpath_cache_t *cache, jsonpath_cache_entry_t *entry) {
+    jsonpath_CacheUnlink(cache, entry);
+    Tcl_DeleteHashEntry(entry->hashPtr);
+    jsonpath_release(entry->program);
+    Tcl_Free((char *) entry);
+    cache->size--;
+}
+
+static void jsonpath_CacheThreadExit(ClientData unused) {
+    jsonpath_cache_t *cache = (jsonpath_cache_t *) Tcl_GetThreadData(&jsonpath_CacheKey, sizeof(jsonpath_cache_t));
+    while (cache->head != NULL) {
+        jsonpath_CacheEvict(cache, cache->head);
+    }
+    Tcl_DeleteHashTable(&cache->table);
+    cache->initialized = 0;
+}
+
+static jsonpath_cache_t *jsonpath_GetCache(void) {
+    jsonpath_cache_t *cache = (jsonpath_cache_t *) Tcl_GetThreadData(&jsonpath_CacheKey, sizeof(jsonpath_cache_t));
+    if (!cache->initialized) {
+        Tcl_InitHashTable(&cache->table, TCL_STRING_KEYS);
+        cache->head = NULL;
+        cache->tail = NULL;
+        cache->size = 0;
+        cache->initialized = 1;
+        Tcl_CreateThreadExitHandler(jsonpath_CacheThreadExit, NULL);
+    }
+    return cache;
+}
+
+// Returns the program of the path held by "pathPtr", compiling it only if
+// neither the object nor the cache of the calling thread has it. The caller
+// releases the program once done with it.
+static int jsonpath_get_program(Tcl_Interp *interp, Tcl_Obj *pathPtr, jsonpath_program_t **programPtr) {
+    jsonpath_program_t *program;
+    if (pathPtr->typePtr == &jsonpath_ObjType) {
+        program = (jsonpath_program_t *) pathPtr->internalRep.twoPtrValue.ptr1;
+        jsonpath_retain(program);
+        *programPtr = program;
+        return TCL_OK;
+    }
+
+    const char *jsonpath = Tcl_GetString(pathPtr);
+    int length = (int) pathPtr->length;
+    jsonpath_cache_t *cache = jsonpath_GetCache();
+    int newEntry;
+    Tcl_HashEntry *hashPtr = Tcl_CreateHashEntry(&cache->table, jsonpath, &newEntry);
+    if (!newEntry) {
+        jsonpath_cache_entry_t *entry = (jsonpath_cache_entry_t *) Tcl_GetHashValue(hashPtr);
+        jsonpath_CacheUnlink(cache, entry);
+        jsonpath_CachePushFront(cache, entry);
+        program = entry->program;
+    } else {
+        jsonpath_node_t *nodes = NULL;
+        if (TCL_OK != jsonpath_parse(interp, jsonpath, length, &nodes)) {
+            Tcl_DeleteHashEntry(hashPtr);
+            return TCL_ERROR;
+        }
+        program = (jsonpath_program_t *) Tcl_Alloc(sizeof(jsonpath_program_t));
+        program->refCount = 1;
+        program->nodes = nodes;
+        jsonpath_cache_entry_t *entry = (jsonpath_cache_entry_t *) Tcl_Alloc(sizeof(jsonpath_cache_entry_t));
+        entry->hashPtr = hashPtr;
+        entry->program = program;
+        Tcl_SetHashValue(hashPtr, (ClientData) entry);
+        jsonpath_CachePushFront(cache, entry);
+        if (++cache->size > JSONPATH_CACHE_SIZE) {
+            jsonpath_CacheEvict(cache, cache->tail);
+        }
+    }
+
+    if (pathPtr->typePtr != NULL && pathPtr->typePtr->freeIntRepProc != NULL) {
+        pathPtr->typePtr->freeIntRepProc(pathPtr);
+    }
+    jsonpath_retain(program);
+    pathPtr->internalRep.twoPtrValue.ptr1 = program;
+    pathPtr->internalRep.twoPtrValue.ptr2 = NULL;
+    pathPtr->typePtr = &jsonpath_ObjType;
+
+    jsonpath_retain(program);
+    *programPtr = program;
+    return TCL_OK;
+}
+
+int jsonpath_match_obj(Tcl_Interp *interp, Tcl_Obj *pathPtr, cJSON *root, jsonpath_index_t **indexPtr,
+                       jsonpath_result_t *result) {
+    jsonpath_program_t *program;
+    if (TCL_OK != jsonpath_get_program(interp, pathPtr, &program)) {
+        return TCL_ERROR;
+    }
+    int rc = jsonpath_eval(interp, program->nodes, root, indexPtr, result);
+    jsonpath_release(program);
+    return rc;
+}
+
+// Evaluation of several paths at once.
+//
+// The step lists of the paths are merged into a trie, so that a prefix
+// shared by several paths (e.g. "$.store.book[*]") is resolved once per
+// document. A deep scan is not shared: the paths continuing with one hang
+// off the node of their prefix and are evaluated on their own from there.
+
+static jsonpath_trie_t *jsonpath_trie_new(jsonpath_node_t *step) {
+    jsonpath_trie_t *trie = (jsonpath_trie_t *) Tcl_Alloc(sizeof(jsonpath_trie_t));
+    memset(trie, 0, sizeof(jsonpath_trie_t));
+    trie->step = step;
+    return trie;
+}
+
+static void jsonpath_trie_free(jsonpath_trie_t *trie) {
+    for (int i = 0; i < trie->num_children; i++) {
+        jsonpath_trie_free(trie->children[i]);
+    }
+    Tcl_Free((char *) trie->children);
+    Tcl_Free((char *) trie->ends);
+    Tcl_Free((char *) trie->scans);
+    Tcl_Free((char *) trie);
+}
+
+// Filters are only shared by paths that share their program, i.e. that are
+// the same text up to there.
+static int jsonpath_step_equals(const jsonpath_node_t *a, const jsonpath_node_t *b) {
+    if (a->type != b->type) {
+        return 0;
+    }
+    switch (a->type) {
+        case CHILD_NAME:
+            return strcmp(a->data.child_name, b->data.child_name) == 0;
+        case CHILD_INDEX:
+            return a->data.child_index == b->data.child_index;
+        case INDICES_SET:
+            return a->data.indices_set.length == b->data.indices_set.length
+                   && memcmp(a->data.indices_set.indices, b->data.indices_set.indices,
+                             sizeof(int) * a->data.indices_set.length) == 0;
+        case INDICES_SLICE:
+            return a->data.indices_slice.start == b->data.indices_slice.start
+                   && a->data.indices_slice.end == b->data.indices_slice.end
+                   && a->data.indices_slice.step == b->data.indices_slice.step
+                   && a->data.indices_slice.has_start == b->data.indices_slice.has_start
+                   && a->data.indices_slice.has_end == b->data.indices_slice.has_end;
+        case NAMES_SET:
+            if (a->data.names_set.length != b->data.names_set.length) {
+                return 0;
+            }
+            for (int i = 0; i < a->data.names_set.length; i++) {
+                if (strcmp(a->data.names_set.names[i], b->data.names_set.names[i]) != 0) {
+                    return 0;
+                }
+            }
+            return 1;
+        case FILTER:
+            return a->data.filter == b->data.filter;
+        default:
+            return 1;
+    }
+}
+
+static void jsonpath_trie_insert(jsonpath_trie_t *trie, int path, jsonpath_node_t *node) {
+    for (; node != NULL && node->type != DEEP_SCAN; node = node->next) {
+        jsonpath_trie_t *child = NULL;
+        for (int i = 0; i < trie->num_children; i++) {
+            if (jsonpath_step_equals(trie->children[i]->step, node)) {
+                child = trie->children[i];
+                break;
+            }
+        }
+        if (child == NULL) {
+            child = jsonpath_trie_new(node);
+            trie->children = (jsonpath_trie_t **) Tcl_Realloc((char *) trie->children,
+                                                              sizeof(jsonpath_trie_t *) * (trie->num_children + 1));
+            trie->children[trie->num_children++] = child;
+        }
+        trie = child;
+    }
+    if (node == NULL) {
+        trie->ends = (int *) Tcl_Realloc((char *) trie->ends, sizeof(int) * (trie->num_ends + 1));
+        trie->ends[trie->num_ends++] = path;
+    } else {
+        trie->scans = (jsonpath_trie_scan_t *) Tcl_Realloc((char *) trie->scans,
+                                                           sizeof(jsonpath_trie_scan_t) * (trie->num_scans + 1));
+        trie->scans[trie->num_scans].path = path;
+        trie->scans[trie->num_scans].node = node;
+        trie->num_scans++;
+    }
+}
+
+int jsonpath_match_multi_obj(Tcl_Interp *interp, int num_paths, Tcl_Obj *const paths[], cJSON *root,
+                             jsonpath_index_t **indexPtr, jsonpath_result_t *results) {
+    jsonpath_program_t **programs = (jsonpath_program_t **) Tcl_Alloc(sizeof(jsonpath_program_t *) * (num_paths + 1));
+    jsonpath_trie_t *trie = jsonpath_trie_new(NULL);
+    int num_programs = 0;
+    int num_frames = 0;
+    int rc = TCL_OK;
+    for (int i = 0; i < num_paths; i++) {
+        if (TCL_OK != jsonpath_get_program(interp, paths[i], &programs[i])) {
+            rc = TCL_ERROR;
+            break;
+        }
+        num_programs++;
+        if (programs[i]->nodes == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: node is NULL", -1));
+            rc = TCL_ERROR;
+            break;
+        }
+        // every path starts with the root
+        jsonpath_trie_insert(trie, i, programs[i]->nodes->next);
+        // at worst, every step of every path has a frame
+        for (jsonpath_node_t *node = programs[i]->nodes; node != NULL; node = node->next) {
+            num_frames++;
+        }
+    }
+    if (rc == TCL_OK) {
+        jsonpath_engine_t engine;
+        jsonpath_engine_init(&engine, interp, results, num_paths, num_frames);
+        engine.root = root;
+        engine.indexPtr = indexPtr;
+        rc = jsonpath_engine_enter(&engine, trie, root, NULL);
+        if (rc == TCL_OK) {
+            rc = jsonpath_engine_run(&engine);
+        }
+        tjson_StackFree(&engine.stack);
+    }
+    jsonpath_trie_free(trie);
+    for (int i = 0; i < num_programs; i++) {
+        jsonpath_release(programs[i]);
+    }
+    Tcl_Free((char *) programs);
+    return rc;
+}
+
+// Streaming evaluation over raw JSON text.
+//
+// The step list is compiled into an automaton whose states are positions in
+// the list: state "i" means that steps [0, i) have matched and steps[i] is
+// the next one to try. Every value in the text is visited with the set of
+// states that are active for it, kept as a bitmask. Values for which no
+// state is active are skipped without being parsed, and a value for which
+// the final state is active is handed to the caller as a span of text.
+
+#define JSONPATH_STREAM_MAX_STEPS 64
+
+typedef struct {
+    jsonpath_node_t *steps[JSONPATH_STREAM_MAX_STEPS];
+    int num_steps;
+    const char *json;
+    const char *end;
+    const char *error;
+    int depth;
+    jsonpath_emit_fn *emit;
+    void *clientData;
+    int stopped;
+} jsonpath_stream_t;
+
+typedef unsigned long long jsonpath_states_t;
+
+#define STATE_BIT(i) (((jsonpath_states_t) 1) << (i))
+
+static const char *jsonpath_stream_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// "p" points to the opening quote, returns the position after the closing one
+static const char *jsonpath_stream_skip_string(const char *p, const char *end) {
+    p++;
+    for (;;) {
+        const char *q = memchr(p, '"', end - p);
+        if (q == NULL) {
+            return NULL;
+        }
+        // the quote is escaped if preceded by an odd number of backslashes
+        const char *b = q;
+        while (b > p && b[-1] == '\\') {
+            b--;
+        }
+        if (((q - b) & 1) == 0) {
+            return q + 1;
+        }
+        p = q + 1;
+    }
+}
+
+// Skips a complete value without looking at its contents beyond brackets
+// and quotes. Returns the position after the value or NULL if the text
+// ends prematurely.
+static const char *jsonpath_stream_skip_value(const char *p, const char *end) {
+    if (p >= end) {
+        return NULL;
+    }
+    if (*p == '"') {
+        return jsonpath_stream_skip_string(p, end);
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (p < end) {
+            switch (*p) {
+                case '"':
+                    p = jsonpath_stream_skip_string(p, end);
+                    if (p == NULL) {
+                        return NULL;
+                    }
+                    continue;
+                case '{':
+                case '[':
+                    depth++;
+                    break;
+                case '}':
+                case ']':
+                    if (--depth == 0) {
+                        return p + 1;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            p++;
+        }
+        return NULL;
+    }
+    // literal or number
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+static int jsonpath_stream_key_equals(const char *key, size_t key_length, const char *name) {
+    if (memchr(key, '\\', key_length) == NULL) {
+        return strlen(name) == key_length && memcmp(key, name, key_length) == 0;
+    }
+    // escaped keys are rare, let the parser unescape them
+    cJSON *item = cJSON_ParseWithLength(key - 1, key_length + 2);
+    int equals = item != NULL && cJSON_IsString(item) && strcmp(item->valuestring, name) == 0;
+    cJSON_Delete(item);
+    return equals;
+}
+
+static int jsonpath_stream_array_length(const char *p, const char *end) {
+    int length = 0;
+    p = jsonpath_stream_skip_ws(p + 1, end);
+    if (p < end && *p == ']') {
+        return 0;
+    }
+    while (p < end) {
+        p = jsonpath_stream_skip_value(p, end);
+        if (p == NULL) {
+            return -1;
+        }
+        length++;
+        p = jsonpath_stream_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p = jsonpath_stream_skip_ws(p + 1, end);
+            continue;
+        }
+        break;
+    }
+    return length;
+}
+
+// Filters need the value itself: its text is parsed on its own and tested
+// like a node of a document. Invalid text fails the extraction.
+static int jsonpath_stream_filter_test(jsonpath_stream_t *stream, const jsonpath_filter_t *filter, const char *p) {
+    const char *value_end = jsonpath_stream_skip_value(p, stream->end);
+    cJSON *item = value_end != NULL ? cJSON_ParseWithLength(p, value_end - p) : NULL;
+    if (item == NULL) {
+        stream->error = p;
+        return 0;
+    }
+    int matches = jsonpath_filter_test(filter, item);
+    cJSON_Delete(item);
+    return matches;
+}
+
+static jsonpath_states_t jsonpath_stream_member_states(jsonpath_stream_t *stream, jsonpath_states_t states,
+                                                       const char *key, size_t key_length, const char *value) {
+    jsonpath_states_t next = 0;
+    for (int i = 0; i < stream->num_steps; i++) {
+        if (!(states & STATE_BIT(i))) {
+            continue;
+        }
+        jsonpath_node_t *step = stream->steps[i];
+        switch (step->type) {
+            case CHILD_NAME:
+                if (jsonpath_stream_key_equals(key, key_length, step->data.child_name)) {
+                    next |= STATE_BIT(i + 1);
+                }
+                break;
+            case WILDCARD_NAME:
+                next |= STATE_BIT(i + 1);
+                break;
+            case NAMES_SET:
+                for (int j = 0; j < step->data.names_set.length; j++) {
+                    if (jsonpath_stream_key_equals(key, key_length, step->data.names_set.names[j])) {
+                        next |= STATE_BIT(i + 1);
+                        break;
+                    }
+                }
+                break;
+            case FILTER:
+                if (jsonpath_stream_filter_test(stream, step->data.filter, value)) {
+                    next |= STATE_BIT(i + 1);
+                }
+                break;
+            case DEEP_SCAN:
+                // a matching member ends the scan for that branch, like jsonpath_eval
+                if (jsonpath_stream_key_equals(key, key_length, stream->steps[i + 1]->data.child_name)) {
+                    next |= STATE_BIT(i + 2);
+                } else {
+                    next |= STATE_BIT(i);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return next;
+}
+
+static jsonpath_states_t jsonpath_stream_element_states(jsonpath_stream_t *stream, jsonpath_states_t states,
+                                                        int index, int length, const char *value) {
+    jsonpath_states_t next = 0;
+    for (int i = 0; i < stream->num_steps; i++) {
+        if (!(states & STATE_BIT(i))) {
+            continue;
+        }
+        jsonpath_node_t *step = stream->steps[i];
+        switch (step->type) {
+            case CHILD_INDEX:
+                if (step->data.child_index == (step->data.child_index < 0 ? index - length : index)) {
+                    next |= STATE_BIT(i + 1);
+                }
+                break;
+            case WILDCARD_INDEX:
+                next |= STATE_BIT(i + 1);
+                break;
+            case FILTER:
+                if (jsonpath_stream_filter_test(stream, step->data.filter, value)) {
+                    next |= STATE_BIT(i + 1);
+                }
+                break;
+            case INDICES_SET:
+                for (int j = 0; j < step->data.indices_set.length; j++) {
+                    int k = step->data.indices_set.indices[j];
+                    if (k == (k < 0 ? index - length : index)) {
+                        next |= STATE_BIT(i + 1);
+                        break;
+                    }
+                }
+                break;
+            case INDICES_SLICE: {
+                // elements come in document order whatever the step
+                int stride = step->data.indices_slice.step;
+                int start, end;
+                jsonpath_slice_bounds(step, length < 0 ? INT_MAX : length, &start, &end);
+                if (stride > 0) {
+                    if (index >= start && index < end && (index - start) % stride == 0) {
+                        next |= STATE_BIT(i + 1);
+                    }
+                } else {
+                    if (index <= start && index > end && (start - index) % -stride == 0) {
+                        next |= STATE_BIT(i + 1);
+                    }
+                }
+                break;
+            }
+            case DEEP_SCAN:
+                next |= STATE_BIT(i);
+                break;
+            default:
+                break;
+        }
+    }
+    return next;
+}
+
+// whether some active step counts from the end of the array
+static int jsonpath_stream_needs_length(jsonpath_stream_t *stream, jsonpath_states_t states) {
+    for (int i = 0; i < stream->num_steps; i++) {
+        if (!(states & STATE_BIT(i))) {
+            continue;
+        }
+        jsonpath_node_t *step = stream->steps[i];
+        switch (step->type) {
+            case CHILD_INDEX:
+                if (step->data.child_index < 0) {
+                    return 1;
+                }
+                break;
+            case INDICES_SET:
+                for (int j = 0; j < step->data.indices_set.length; j++) {
+                    if (step->data.indices_set.indices[j] < 0) {
+                        return 1;
+                    }
+                }
+                break;
+            case INDICES_SLICE:
+                if (step->data.indices_slice.step < 0
+                    || (step->data.indices_slice.has_start && step->data.indices_slice.start < 0)
+                    || (step->data.indices_slice.has_end && step->data.indices_slice.end < 0)) {
+                    return 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+static const char *jsonpath_stream_value(jsonpath_stream_t *stream, const char *p, jsonpath_states_t states);
+
+static const char *jsonpath_stream_object(jsonpath_stream_t *stream, const char *p, jsonpath_states_t states) {
+    const char *end = stream->end;
+    p = jsonpath_stream_skip_ws(p + 1, end);
+    if (p < end && *p == '}') {
+        return p + 1;
+    }
+    while (p < end) {
+        if (*p != '"') {
+            stream->error = p;
+            return NULL;
+        }
+        const char *key = p + 1;
+        const char *key_end = jsonpath_stream_skip_string(p, end);
+        if (key_end == NULL) {
+            stream->error = p;
+            return NULL;
+        }
+        p = jsonpath_stream_skip_ws(key_end, end);
+        if (p >= end || *p != ':') {
+            stream->error = p;
+            return NULL;
+        }
+        p = jsonpath_stream_skip_ws(p + 1, end);
+        jsonpath_states_t next = jsonpath_stream_member_states(stream, states, key, key_end - key - 1, p);
+        if (stream->error != NULL) {
+            return NULL;
+        }
+        p = jsonpath_stream_value(stream, p, next);
+        if (p == NULL || stream->stopped) {
+            return p;
+        }
+        p = jsonpath_stream_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p = jsonpath_stream_skip_ws(p + 1, end);
+            continue;
+        }
+        if (p < end && *p == '}') {
+            return p + 1;
+        }
+        break;
+    }
+    stream->error = p;
+    return NULL;
+}
+
+static const char *jsonpath_stream_array(jsonpath_stream_t *stream, const char *p, jsonpath_states_t states) {
+    const char *end = stream->end;
+    int length = -1;
+    if (jsonpath_stream_needs_length(stream, states)) {
+        length = jsonpath_stream_array_length(p, end);
+        if (length < 0) {
+            stream->error = p;
+            return NULL;
+        }
+    }
+    p = jsonpath_stream_skip_ws(p + 1, end);
+    if (p < end && *p == ']') {
+        return p + 1;
+    }
+    int index = 0;
+    while (p < end) {
+        jsonpath_states_t next = jsonpath_stream_element_states(stream, states, index, length, p);
+        if (stream->error != NULL) {
+            return NULL;
+        }
+        p = jsonpath_stream_value(stream, p, next);
+        if (p == NULL || stream->stopped) {
+            return p;
+        }
+        index++;
+        p = jsonpath_stream_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p = jsonpath_stream_skip_ws(p + 1, end);
+            continue;
+        }
+        if (p < end && *p == ']') {
+            return p + 1;
+        }
+        break;
+    }
+    stream->error = p;
+    return NULL;
+}
+
+static const char *jsonpath_stream_value(jsonpath_stream_t *stream, const char *p, jsonpath_states_t states) {
+    const char *end = stream->end;
+    if (p >= end) {
+        stream->error = p;
+        return NULL;
+    }
+
+    jsonpath_states_t final_state = STATE_BIT(stream->num_steps);
+    if (states & final_state) {
+        const char *value_end = jsonpath_stream_skip_value(p, end);
+        if (value_end == NULL) {
+            stream->error = p;
+            return NULL;
+        }
+        if (TCL_OK != stream->emit(stream->clientData, p, value_end - p)) {
+            stream->stopped = 1;
+            return value_end;
+        }
+        states &= ~final_state;
+        if (states == 0) {
+            return value_end;
+        }
+    }
+
+    if (states == 0 || (*p != '{' && *p != '[')) {
+        const char *value_end = jsonpath_stream_skip_value(p, end);
+        if (value_end == NULL) {
+            stream->error = p;
+        }
+        return value_end;
+    }
+
+    if (stream->depth >= CJSON_NESTING_LIMIT) {
+        stream->error = p;
+        return NULL;
+    }
+    stream->depth++;
+    const char *value_end = *p == '{'
+                            ? jsonpath_stream_object(stream, p, states)
+                            : jsonpath_stream_array(stream, p, states);
+    stream->depth--;
+    return value_end;
+}
+
+static int jsonpath_extract_nodes(Tcl_Interp *interp, jsonpath_node_t *nodes, const char *json, size_t json_length,
+                                  jsonpath_emit_fn *emit, void *clientData) {
+    if (nodes == NULL || nodes->type != ROOT) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: must start with '$'", -1));
+        return TCL_ERROR;
+    }
+
+    jsonpath_stream_t stream;
+    stream.num_steps = 0;
+    for (jsonpath_node_t *node = nodes->next; node != NULL; node = node->next) {
+        if (stream.num_steps == JSONPATH_STREAM_MAX_STEPS - 1) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("Invalid JSONPath: too many steps", -1));
+            return TCL_ERROR;
+        }
+        stream.steps[stream.num_steps++] = node;
+    }
+    stream.json = json;
+    stream.end = json + json_length;
+    stream.error = NULL;
+    stream.depth = 0;
+    stream.emit = emit;
+    stream.clientData = clientData;
+    stream.stopped = 0;
+
+    const char *p = jsonpath_stream_skip_ws(json, stream.end);
+    // skip the UTF-8 byte order mark
+    if (stream.end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+        p += 3;
+    }
+    p = jsonpath_stream_value(&stream, p, STATE_BIT(0));
+
+    if (stream.stopped) {
+        return TCL_ERROR;
+    }
+    if (p != NULL && jsonpath_stream_skip_ws(p, stream.end) != stream.end) {
+        stream.error = p;
+        p = NULL;
+    }
+    if (p == NULL) {
+        size_t offset = stream.error != NULL ? (size_t) (stream.error - json) : json_length;
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid json at offset %lu", (unsigned long) offset));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+int jsonpath_extract(Tcl_Interp *interp, const char *jsonpath, int length, const char *json, size_t json_length,
+                     jsonpath_emit_fn *emit, void *clientData) {
+    jsonpath_node_t *nodes = NULL;
+    if (TCL_OK != jsonpath_parse(interp, jsonpath, length, &nodes)) {
+        return TCL_ERROR;
+    }
+    int rc = jsonpath_extract_nodes(interp, nodes, json, json_length, emit, clientData);
+    jsonpath_free(nodes);
+    return rc;
+}
+
+int jsonpath_extract_obj(Tcl_Interp *interp, Tcl_Obj *pathPtr, const char *json, size_t json_length,
+                         jsonpath_emit_fn *emit, void *clientData) {
+    jsonpath_program_t *program;
+    if (TCL_OK != jsonpath_get_program(interp, pathPtr, &program)) {
+        return TCL_ERROR;
+    }
+    int rc = jsonpath_extract_nodes(interp, program->nodes, json, json_length, emit, clientData);
+    jsonpath_release(program);
+    return rc;
+}
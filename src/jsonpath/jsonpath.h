@@ -7,9 +7,47 @@
 typedef struct {
     int k;
     int items_length;
-    cJSON **items;
+    cJSON **items;  // NULL to only count the matches in "items_length"
+    cJSON **parents;    // when not NULL, receives the parent of each match (NULL for the root), and a union
+                        // selects each value once, so that no match is given twice
+    int limit;      // evaluation stops adding matches once there are this many, 0 for no limit
+    int missing;    // when set along with "parents", a path ending in a child name also gives each object it
+                    // reaches without that member, as the parent of a NULL match
+    const char *missing_name;   // the name of such a member, owned by the compiled path
 } jsonpath_result_t;
 
+// Index of the members of a document by key, in document order, that lets
+// a recursive descent from the root ("$..name") go straight to the members
+// it selects instead of walking the document. See jsonpath_match_obj.
+typedef struct jsonpath_index jsonpath_index_t;
+
+// called for every matched value of a streaming extraction with the span of
+// its text; returning anything but TCL_OK stops the extraction
+typedef int (jsonpath_emit_fn)(void *clientData, const char *value, size_t length);
+
 int jsonpath_match(Tcl_Interp *interp, const char *jsonpath, int length, cJSON *root, jsonpath_result_t *result);
+int jsonpath_extract(Tcl_Interp *interp, const char *jsonpath, int length, const char *json, size_t json_length,
+                     jsonpath_emit_fn *emit, void *clientData);
+
+// Same as above for a path held by a Tcl_Obj: the compiled path is kept in
+// its internal representation and in a bounded per-thread cache, so that
+// evaluating the same path again skips parsing it.
+//
+// When "indexPtr" is not NULL, a recursive descent from "root" uses the key
+// index it points to, building it first if it is NULL. The index is only
+// read and the pointer only written, so concurrent queries of a document
+// may share an index but each needs a pointer of its own; the caller keeps
+// an index built into it for later queries and frees it once the document
+// changes.
+int jsonpath_match_obj(Tcl_Interp *interp, Tcl_Obj *pathPtr, cJSON *root, jsonpath_index_t **indexPtr,
+                       jsonpath_result_t *result);
+// Evaluates "num_paths" paths over the same document in one traversal,
+// resolving the steps shared by a prefix of several paths only once. Each
+// path adds its matches to its own result in "results".
+int jsonpath_match_multi_obj(Tcl_Interp *interp, int num_paths, Tcl_Obj *const paths[], cJSON *root,
+                             jsonpath_index_t **indexPtr, jsonpath_result_t *results);
+void jsonpath_index_free(jsonpath_index_t *index);
+int jsonpath_extract_obj(Tcl_Interp *interp, Tcl_Obj *pathPtr, const char *json, size_t json_length,
+                         jsonpath_emit_fn *emit, void *clientData);
 
 #endif //TJSON_JSONPATH_H
@@ -7,6 +7,14 @@
 #include "cJSON/cJSON.h"
 #include "jsonpath/jsonpath.h"
 #include "custom_triple_notation/custom_triple_notation.h"
+#include "threadpool/threadpool.h"
+#include "filemap/filemap.h"
+#include "utf8/utf8.h"
+#include "stack/stack.h"
+#include "pool/pool.h"
+#include "shape/shape.h"
+#include "packed/packed.h"
+#include "pointer/pointer.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -54,13 +62,95 @@ static int tjson_ModuleInitialized;
 static Tcl_HashTable tjson_NodeToInternal_HT;
 static Tcl_Mutex tjson_NodeToInternal_HT_Mutex;
 
+// Roots parsed with -lazy point into their source text until every subtree
+// has been materialized, so the text lives as long as the root does. The
+// same goes for the key set of a root parsed with -intern, the shapes of
+// one parsed with -shapes, the subtrees shared by ::tjson::dedup and the
+// key index of one parsed with -keyindex.
+typedef struct {
+    jsonpath_index_t *index;
+    int refcount;                   // one for the document holding it, one per query walking it
+} tjson_key_index_t;
+
+typedef struct {
+    char *text;
+    tjson_filemap_t map;
+    cJSON_KeySet *keys;
+    tjson_shapes_t shapes;
+    cJSON *shared;
+    int keyindex;
+    int serialized;                 // reads build nodes in place (-lazy, -packed, dedup), see tjson_HandleCmd
+    Tcl_Mutex mutex;                // held by the commands on a serialized document
+    Tcl_Mutex index_mutex;          // guards the index and the epoch, queries may run in any thread
+    tjson_key_index_t *index;       // built by the first query that needs it, dropped by the next change
+    unsigned long epoch;            // bumped by every command that changes the structure of the document
+} tjson_document_t;
+
+// keys interned per document, or into one process-wide set that is never freed
+typedef enum {
+    TJSON_INTERN_DOCUMENT,
+    TJSON_INTERN_GLOBAL
+} tjson_intern_t;
+
+static const char *tjson_intern_modes[] = {"document", "global", NULL};
+
+#define TJSON_DOCUMENT_KEYS_MAX 65536
+#define TJSON_GLOBAL_KEYS_MAX 65536
+
+// shorter arrays of numbers are not worth a vector of their own
+#define TJSON_PACKED_MIN_COUNT 8
+
+// distinct strings shared by the dedup pass of a document parsed without -intern
+#define TJSON_DEDUP_STRINGS_MAX (1 << 20)
+
+static tjson_intern_t tjson_InternMode = TJSON_INTERN_DOCUMENT;
+static cJSON_KeySet *tjson_GlobalKeys;
+static Tcl_Mutex tjson_GlobalKeys_Mutex;
+
+static Tcl_HashTable tjson_RootToDocument_HT;
+static Tcl_Mutex tjson_RootToDocument_HT_Mutex;
+
+// The documents of the nodes below their root that have a handle, so that
+// a command given such a handle finds the key index and the mutex of its
+// document. Guarded by tjson_RootToDocument_HT_Mutex.
+static Tcl_HashTable tjson_NodeToDocument_HT;
+
 typedef struct {
     Tcl_Interp *interp;
     char *handle;
     char *varname;
     cJSON *item;
+    int in_arena;
+    Tcl_WideInt arena_generation;
 } tjson_trace_t;
 
+// Handles registered for nodes in the arena of a thread, unregistered in bulk
+// when the arena is reset.
+typedef struct {
+    cJSON **nodes;
+    size_t num_nodes;
+    size_t capacity;
+} tjson_arena_nodes_t;
+
+static Tcl_ThreadDataKey tjson_ArenaNodesKey;
+
+static void tjson_TrackArenaNode(cJSON *internal);
+
+typedef enum {
+    TJSON_FORMAT_HANDLE,
+    TJSON_FORMAT_SIMPLE,
+    TJSON_FORMAT_TYPED,
+    TJSON_FORMAT_JSON
+} tjson_format_t;
+
+static const char *tjson_formats[] = {
+        "handle",
+        "simple",
+        "typed",
+        "json",
+        NULL
+};
+
 static int
 tjson_RegisterNode(const char *name, cJSON *internal) {
 
@@ -73,6 +163,10 @@ tjson_RegisterNode(const char *name, cJSON *internal) {
     }
     Tcl_MutexUnlock(&tjson_NodeToInternal_HT_Mutex);
 
+    if (newEntry && tjson_PoolArenaContains(internal)) {
+        tjson_TrackArenaNode(internal);
+    }
+
     DBG(fprintf(stderr, "--> RegisterNode: name=%s internal=%p %s\n", name, internal,
                 newEntry ? "entered into" : "already in"));
 
@@ -101,6 +195,250 @@ void tjson_Unregister(cJSON *internal) {
     char name[80];
     CMD_NAME(name, internal);
     tjson_UnregisterNode(name);
+
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_NodeToDocument_HT, (char *) internal);
+    if (entryPtr != NULL) {
+        Tcl_DeleteHashEntry(entryPtr);
+    }
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+}
+
+// Returns the document of a root, or the one recorded for a node below it.
+// The caller holds tjson_RootToDocument_HT_Mutex.
+static tjson_document_t *
+tjson_FindDocument(cJSON *node) {
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_RootToDocument_HT, (char *) node);
+    if (entryPtr == NULL) {
+        entryPtr = Tcl_FindHashEntry(&tjson_NodeToDocument_HT, (char *) node);
+    }
+    return entryPtr != NULL ? (tjson_document_t *) Tcl_GetHashValue(entryPtr) : NULL;
+}
+
+// Registers the handle of "item", a node reached from the node "from" of the
+// same tree, and marks it to be unregistered when cJSON_Delete is called.
+static void
+tjson_RegisterChildNode(const char *name, cJSON *item, cJSON *from) {
+    item->flags |= VISIBLE_IN_TCL;
+    if (!tjson_RegisterNode(name, item)) {
+        return;
+    }
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    tjson_document_t *doc = tjson_FindDocument(from);
+    if (doc != NULL) {
+        int newEntry;
+        Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&tjson_NodeToDocument_HT, (char *) item, &newEntry);
+        Tcl_SetHashValue(entryPtr, (ClientData) doc);
+    }
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+}
+
+static void
+tjson_RegisterDocument(cJSON *root, tjson_document_t *doc) {
+    int newEntry;
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&tjson_RootToDocument_HT, (char *) root, &newEntry);
+    Tcl_SetHashValue(entryPtr, (ClientData) doc);
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+}
+
+// Drops a reference to a key index, the caller holds the mutex of its
+// document (or is freeing it).
+static void
+tjson_DecrKeyIndexRef(tjson_key_index_t *keyIndex) {
+    if (keyIndex != NULL && --keyIndex->refcount == 0) {
+        jsonpath_index_free(keyIndex->index);
+        Tcl_Free((char *) keyIndex);
+    }
+}
+
+static void
+tjson_FreeDocument(tjson_document_t *doc) {
+    if (doc->text != NULL) {
+        Tcl_Free(doc->text);
+    }
+    tjson_UnmapFile(&doc->map);
+    cJSON_Delete(doc->shared);
+    cJSON_DeleteKeySet(doc->keys);
+    tjson_FreeShapes(&doc->shapes);
+    tjson_DecrKeyIndexRef(doc->index);
+    Tcl_MutexFinalize(&doc->index_mutex);
+    Tcl_MutexFinalize(&doc->mutex);
+    Tcl_Free((char *) doc);
+}
+
+// Tells the document "node" belongs to that its structure changed, which
+// drops its key index.
+static void
+tjson_BumpMutationEpoch(cJSON *node) {
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    tjson_document_t *doc = tjson_FindDocument(node);
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+    if (doc == NULL || !doc->keyindex) {
+        return;
+    }
+
+    Tcl_MutexLock(&doc->index_mutex);
+    doc->epoch++;
+    tjson_DecrKeyIndexRef(doc->index);
+    doc->index = NULL;
+    Tcl_MutexUnlock(&doc->index_mutex);
+}
+
+// The key index a query of a root runs with: the one of its document, held
+// until the query is done, or one the query builds itself and hands to the
+// document afterwards. Concurrent queries each build into their own pointer,
+// so none of them frees or replaces the index another one walks.
+typedef struct {
+    tjson_document_t *doc;      // NULL when the root was not parsed with -keyindex
+    tjson_key_index_t *held;
+    jsonpath_index_t *index;    // what the query walks, or builds when NULL
+    unsigned long epoch;        // epoch of the document when the query started
+} tjson_query_index_t;
+
+// Returns the pointer to pass to the query, NULL when "root" has no key index.
+static jsonpath_index_t **
+tjson_AcquireKeyIndex(cJSON *root, tjson_query_index_t *queryIndex) {
+    tjson_document_t *doc = NULL;
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_RootToDocument_HT, (char *) root);
+    if (entryPtr != NULL) {
+        doc = (tjson_document_t *) Tcl_GetHashValue(entryPtr);
+    }
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+    if (doc == NULL || !doc->keyindex) {
+        queryIndex->doc = NULL;
+        return NULL;
+    }
+
+    Tcl_MutexLock(&doc->index_mutex);
+    queryIndex->doc = doc;
+    queryIndex->held = doc->index;
+    if (queryIndex->held != NULL) {
+        queryIndex->held->refcount++;
+    }
+    queryIndex->epoch = doc->epoch;
+    Tcl_MutexUnlock(&doc->index_mutex);
+    queryIndex->index = queryIndex->held != NULL ? queryIndex->held->index : NULL;
+    return &queryIndex->index;
+}
+
+static void
+tjson_ReleaseKeyIndex(tjson_query_index_t *queryIndex) {
+    tjson_document_t *doc = queryIndex->doc;
+    if (doc == NULL) {
+        return;
+    }
+
+    Tcl_MutexLock(&doc->index_mutex);
+    if (queryIndex->held == NULL && queryIndex->index != NULL) {
+        // keep what the query built, unless another query was first or the
+        // document changed since
+        if (doc->index == NULL && doc->epoch == queryIndex->epoch) {
+            doc->index = (tjson_key_index_t *) Tcl_Alloc(sizeof(tjson_key_index_t));
+            doc->index->index = queryIndex->index;
+            doc->index->refcount = 1;
+        } else {
+            jsonpath_index_free(queryIndex->index);
+        }
+    }
+    tjson_DecrKeyIndexRef(queryIndex->held);
+    Tcl_MutexUnlock(&doc->index_mutex);
+}
+
+static void tjson_LockGlobalKeys(void) {
+    Tcl_MutexLock(&tjson_GlobalKeys_Mutex);
+}
+
+static void tjson_UnlockGlobalKeys(void) {
+    Tcl_MutexUnlock(&tjson_GlobalKeys_Mutex);
+}
+
+static cJSON_KeySet *tjson_GetGlobalKeys(void) {
+    Tcl_MutexLock(&tjson_GlobalKeys_Mutex);
+    if (tjson_GlobalKeys == NULL) {
+        tjson_GlobalKeys = cJSON_CreateKeySet(TJSON_GLOBAL_KEYS_MAX, tjson_LockGlobalKeys, tjson_UnlockGlobalKeys);
+    }
+    Tcl_MutexUnlock(&tjson_GlobalKeys_Mutex);
+    return tjson_GlobalKeys;
+}
+
+// Deletes a root node together with the document it was parsed from, if any.
+static void
+tjson_DeleteRoot(cJSON *root) {
+    tjson_document_t *doc = NULL;
+
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_RootToDocument_HT, (char *) root);
+    if (entryPtr != NULL) {
+        doc = (tjson_document_t *) Tcl_GetHashValue(entryPtr);
+        Tcl_DeleteHashEntry(entryPtr);
+    }
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+
+    cJSON_Delete(root);
+    if (doc != NULL) {
+        tjson_FreeDocument(doc);
+    }
+}
+
+// Wipes the arena of the calling thread: the handles of its nodes and the
+// documents of its lazy or in-situ roots go first, then all of its memory.
+static void
+tjson_ResetArena(void) {
+    tjson_arena_nodes_t *arena = (tjson_arena_nodes_t *) Tcl_GetThreadData(&tjson_ArenaNodesKey, sizeof(tjson_arena_nodes_t));
+    char name[80];
+
+    Tcl_MutexLock(&tjson_NodeToInternal_HT_Mutex);
+    for (size_t i = 0; i < arena->num_nodes; i++) {
+        CMD_NAME(name, arena->nodes[i]);
+        Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_NodeToInternal_HT, name);
+        if (entryPtr != NULL && Tcl_GetHashValue(entryPtr) == (ClientData) arena->nodes[i]) {
+            Tcl_DeleteHashEntry(entryPtr);
+        }
+    }
+    Tcl_MutexUnlock(&tjson_NodeToInternal_HT_Mutex);
+
+    for (size_t i = 0; i < arena->num_nodes; i++) {
+        tjson_document_t *doc = NULL;
+        Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+        Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_RootToDocument_HT, (char *) arena->nodes[i]);
+        if (entryPtr != NULL) {
+            doc = (tjson_document_t *) Tcl_GetHashValue(entryPtr);
+            Tcl_DeleteHashEntry(entryPtr);
+        }
+        entryPtr = Tcl_FindHashEntry(&tjson_NodeToDocument_HT, (char *) arena->nodes[i]);
+        if (entryPtr != NULL) {
+            Tcl_DeleteHashEntry(entryPtr);
+        }
+        Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+        if (doc != NULL) {
+            tjson_FreeDocument(doc);
+        }
+    }
+
+    arena->num_nodes = 0;
+    tjson_PoolArenaReset();
+}
+
+static void tjson_ArenaThreadExit(ClientData unused) {
+    tjson_ResetArena();
+    tjson_arena_nodes_t *arena = (tjson_arena_nodes_t *) Tcl_GetThreadData(&tjson_ArenaNodesKey, sizeof(tjson_arena_nodes_t));
+    Tcl_Free((char *) arena->nodes);
+    arena->nodes = NULL;
+    arena->capacity = 0;
+}
+
+static void tjson_TrackArenaNode(cJSON *internal) {
+    tjson_arena_nodes_t *arena = (tjson_arena_nodes_t *) Tcl_GetThreadData(&tjson_ArenaNodesKey, sizeof(tjson_arena_nodes_t));
+    if (arena->num_nodes == arena->capacity) {
+        if (arena->capacity == 0) {
+            Tcl_CreateThreadExitHandler(tjson_ArenaThreadExit, NULL);
+        }
+        arena->capacity = arena->capacity == 0 ? 64 : arena->capacity * 2;
+        arena->nodes = (cJSON **) Tcl_Realloc((char *) arena->nodes, arena->capacity * sizeof(cJSON *));
+    }
+    arena->nodes[arena->num_nodes++] = internal;
 }
 
 static cJSON *
@@ -120,11 +458,9 @@ tjson_GetInternalFromNode(const char *name) {
 
 
 
-static Tcl_Obj *tjson_TreeToSimple(Tcl_Interp *interp, cJSON *item) {
+static Tcl_Obj *tjson_ScalarToSimple(cJSON *item) {
 
     double d;
-    Tcl_Obj *listPtr;
-    Tcl_Obj *dictPtr;
     switch ((item->type) & 0xFF)
     {
         case cJSON_NULL:
@@ -154,110 +490,240 @@ static Tcl_Obj *tjson_TreeToSimple(Tcl_Interp *interp, cJSON *item) {
 
         case cJSON_String:
             return Tcl_NewStringObj(item->valuestring, -1);
-        case cJSON_Array:
-            listPtr = Tcl_NewListObj(0, NULL);
-            cJSON *current_element = item->child;
-            while (current_element != NULL) {
-                Tcl_ListObjAppendElement(interp, listPtr, tjson_TreeToSimple(interp, current_element));
-                current_element = current_element->next;
-            }
-            return listPtr;
-        case cJSON_Object:
-            dictPtr = Tcl_NewDictObj();
-            cJSON *current_item = item->child;
-            while (current_item) {
-                Tcl_DictObjPut(
-                        interp,
-                        dictPtr,
-                        Tcl_NewStringObj(current_item->string, -1),
-                        tjson_TreeToSimple(interp, current_item));
-                current_item = current_item->next;
-            }
-            return dictPtr;
         default:
             return NULL;
     }
 }
 
-static Tcl_Obj *tjson_TreeToTyped(Tcl_Interp *interp, cJSON *item) {
+static Tcl_Obj *tjson_NewTypedObj(const char *type, Tcl_Obj *valuePtr) {
+    Tcl_Obj *objv[2];
+    objv[0] = Tcl_NewStringObj(type, -1);
+    objv[1] = valuePtr;
+    return Tcl_NewListObj(2, objv);
+}
+
+static Tcl_Obj *tjson_ScalarToTyped(cJSON *item) {
 
     double d;
-    Tcl_Obj *resultPtr = Tcl_NewListObj(0, NULL);
-    Tcl_Obj *listPtr;
-    Tcl_Obj *dictPtr;
     switch ((item->type) & 0xFF)
     {
         case cJSON_NULL:
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("S", 1));
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("", 0));
-            return resultPtr;
+            return tjson_NewTypedObj("S", Tcl_NewStringObj("", 0));
         case cJSON_False:
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("BOOL", 4));
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewBooleanObj(0));
-            return resultPtr;
+            return tjson_NewTypedObj("BOOL", Tcl_NewBooleanObj(0));
         case cJSON_True:
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("BOOL", 4));
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewBooleanObj(1));
-            return resultPtr;
+            return tjson_NewTypedObj("BOOL", Tcl_NewBooleanObj(1));
         case cJSON_Number:
             d = item->valuedouble;
             if (isnan(d) || isinf(d)) {
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("S", 1));
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("", 0));
-                return resultPtr;
+                return tjson_NewTypedObj("S", Tcl_NewStringObj("", 0));
             } else if(d == (double)item->valueint) {
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("N", 1));
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewIntObj(item->valueint));
-                return resultPtr;
+                return tjson_NewTypedObj("N", Tcl_NewIntObj(item->valueint));
             } else {
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("N", 1));
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewDoubleObj(item->valuedouble));
-                return resultPtr;
+                return tjson_NewTypedObj("N", Tcl_NewDoubleObj(item->valuedouble));
             }
         case cJSON_Raw:
-        {
-            if (item->valuestring == NULL)
-            {
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("S", 1));
-                Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("", 0));
-                return resultPtr;
+        case cJSON_String:
+            return tjson_NewTypedObj("S", Tcl_NewStringObj(item->valuestring != NULL ? item->valuestring : "", -1));
+        default:
+            return Tcl_NewListObj(0, NULL);
+    }
+}
+
+// What a conversion prepares once per shape rather than once per record: the
+// key objects of to_simple/to_typed, or the escaped keys of to_json.
+typedef struct {
+    Tcl_Obj **keyObjs;
+    char *json;             // "key": of each key, back to back
+    size_t *json_offsets;   // num_keys + 1 offsets into "json"
+} tjson_shape_keys_t;
+
+typedef struct {
+    Tcl_HashTable table;    // shape -> tjson_shape_keys_t
+    const tjson_shape_t *last_shape;
+    tjson_shape_keys_t *last_keys;
+} tjson_shape_cache_t;
+
+static int tjson_EscapeJsonString(Tcl_Obj *objPtr, Tcl_DString *dsPtr);
+
+static void tjson_ShapeCacheInit(tjson_shape_cache_t *cache) {
+    Tcl_InitHashTable(&cache->table, TCL_ONE_WORD_KEYS);
+    cache->last_shape = NULL;
+    cache->last_keys = NULL;
+}
+
+static tjson_shape_keys_t *tjson_ShapeCacheGet(tjson_shape_cache_t *cache, const tjson_shape_t *shape, int json) {
+    if (shape == cache->last_shape) {
+        return cache->last_keys;
+    }
+    int newEntry;
+    Tcl_HashEntry *entryPtr = Tcl_CreateHashEntry(&cache->table, (char *) shape, &newEntry);
+    tjson_shape_keys_t *keys;
+    if (newEntry) {
+        keys = (tjson_shape_keys_t *) Tcl_Alloc(sizeof(tjson_shape_keys_t));
+        memset(keys, 0, sizeof(tjson_shape_keys_t));
+        if (json) {
+            Tcl_DString ds;
+            Tcl_DStringInit(&ds);
+            keys->json_offsets = (size_t *) Tcl_Alloc((shape->num_keys + 1) * sizeof(size_t));
+            for (size_t i = 0; i < shape->num_keys; i++) {
+                keys->json_offsets[i] = Tcl_DStringLength(&ds);
+                Tcl_DStringAppend(&ds, "\"", 1);
+                Tcl_Obj *keyPtr = Tcl_NewStringObj(shape->keys[i], (Tcl_Size) shape->key_lengths[i]);
+                Tcl_IncrRefCount(keyPtr);
+                tjson_EscapeJsonString(keyPtr, &ds);
+                Tcl_DecrRefCount(keyPtr);
+                Tcl_DStringAppend(&ds, "\":", 2);
+            }
+            keys->json_offsets[shape->num_keys] = Tcl_DStringLength(&ds);
+            keys->json = Tcl_Alloc(Tcl_DStringLength(&ds));
+            memcpy(keys->json, Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+            Tcl_DStringFree(&ds);
+        } else {
+            keys->keyObjs = (Tcl_Obj **) Tcl_Alloc(shape->num_keys * sizeof(Tcl_Obj *));
+            for (size_t i = 0; i < shape->num_keys; i++) {
+                keys->keyObjs[i] = Tcl_NewStringObj(shape->keys[i], (Tcl_Size) shape->key_lengths[i]);
+                Tcl_IncrRefCount(keys->keyObjs[i]);
+            }
+        }
+        Tcl_SetHashValue(entryPtr, (ClientData) keys);
+    } else {
+        keys = (tjson_shape_keys_t *) Tcl_GetHashValue(entryPtr);
+    }
+    cache->last_shape = shape;
+    cache->last_keys = keys;
+    return keys;
+}
+
+static void tjson_ShapeCacheFree(tjson_shape_cache_t *cache) {
+    Tcl_HashSearch search;
+    for (Tcl_HashEntry *entryPtr = Tcl_FirstHashEntry(&cache->table, &search); entryPtr != NULL;
+         entryPtr = Tcl_NextHashEntry(&search)) {
+        const tjson_shape_t *shape = (const tjson_shape_t *) Tcl_GetHashKey(&cache->table, entryPtr);
+        tjson_shape_keys_t *keys = (tjson_shape_keys_t *) Tcl_GetHashValue(entryPtr);
+        if (keys->keyObjs != NULL) {
+            for (size_t i = 0; i < shape->num_keys; i++) {
+                Tcl_DecrRefCount(keys->keyObjs[i]);
             }
+            Tcl_Free((char *) keys->keyObjs);
+        }
+        if (keys->json != NULL) {
+            Tcl_Free(keys->json);
+            Tcl_Free((char *) keys->json_offsets);
+        }
+        Tcl_Free((char *) keys);
+    }
+    Tcl_DeleteHashTable(&cache->table);
+}
+
+// Converts the values of a packed array in one go, as if they were nodes.
+static Tcl_Obj *tjson_PackedToObj(const double *values, size_t count, int typed) {
+    Tcl_Obj **objv = (Tcl_Obj **) Tcl_Alloc(count * sizeof(Tcl_Obj *));
+    cJSON number;
+    memset(&number, 0, sizeof(cJSON));
+    number.type = cJSON_Number;
+    for (size_t i = 0; i < count; i++) {
+        cJSON_SetNumberHelper(&number, values[i]);
+        objv[i] = typed ? tjson_ScalarToTyped(&number) : tjson_ScalarToSimple(&number);
+    }
+    Tcl_Obj *listPtr = Tcl_NewListObj((Tcl_Size) count, objv);
+    Tcl_Free((char *) objv);
+    return typed ? tjson_NewTypedObj("L", listPtr) : listPtr;
+}
 
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("S", 1));
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj(item->valuestring, -1));
+typedef struct {
+    cJSON *item;        // array or object being converted
+    cJSON *child;       // child currently being converted
+    Tcl_Obj *objPtr;    // list or dict of the children converted so far
+    Tcl_Obj **keyObjs;  // keys of a record, by position, or NULL
+    size_t index;       // position of "child"
+} tjson_tree_frame_t;
+
+// Converts a tree to nested lists/dicts (or typed {type value} pairs) with an
+// explicit stack, so deep documents cannot overflow the C stack. Returns NULL
+// with an error in "interp" if the tree is deeper than the nesting limit.
+static Tcl_Obj *tjson_TreeToObj(Tcl_Interp *interp, cJSON *item, int typed) {
+    tjson_stack_t stack;
+    tjson_tree_frame_t *frame;
+    Tcl_Obj *valuePtr;
+    cJSON *current = item;
+    tjson_shape_cache_t cache;
+
+    tjson_ShapeCacheInit(&cache);
+    tjson_StackInit(&stack, sizeof(tjson_tree_frame_t), cJSON_GetNestingLimit());
+    for (;;) {
+        size_t count;
+        const double *values = cJSON_GetPackedArray(current, &count);
+        if (values != NULL) {
+            valuePtr = tjson_PackedToObj(values, count, typed);
+        } else if (cJSON_IsArray(current) || cJSON_IsObject(current)) {
+            frame = (tjson_tree_frame_t *) tjson_StackPush(interp, &stack);
+            if (frame == NULL) {
+                goto error;
+            }
+            cJSON_MaterializeForRead(current);
+            frame->item = current;
+            frame->child = current->child;
+            frame->objPtr = cJSON_IsArray(current) ? Tcl_NewListObj(0, NULL) : Tcl_NewDictObj();
+            frame->keyObjs = tjson_IsShaped(current) ? tjson_ShapeCacheGet(&cache, tjson_GetShape(current), 0)->keyObjs : NULL;
+            frame->index = 0;
+            if (frame->child != NULL) {
+                current = frame->child;
+                continue;
+            }
+            tjson_StackPop(&stack);
+            valuePtr = typed ? tjson_NewTypedObj(cJSON_IsArray(current) ? "L" : "M", frame->objPtr) : frame->objPtr;
+        } else {
+            valuePtr = typed ? tjson_ScalarToTyped(current) : tjson_ScalarToSimple(current);
         }
 
-        case cJSON_String:
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("S", 1));
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj(item->valuestring, -1));
-            return resultPtr;
-        case cJSON_Array:
-            listPtr = Tcl_NewListObj(0, NULL);
-            cJSON *current_element = item->child;
-            while (current_element != NULL) {
-                Tcl_ListObjAppendElement(interp, listPtr, tjson_TreeToTyped(interp, current_element));
-                current_element = current_element->next;
+        // the value of "current" is complete, add it to its parent
+        for (;;) {
+            if (stack.depth == 0) {
+                tjson_StackFree(&stack);
+                tjson_ShapeCacheFree(&cache);
+                return valuePtr;
             }
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("L", 1));
-            Tcl_ListObjAppendElement(interp, resultPtr, listPtr);
-            return resultPtr;
-        case cJSON_Object:
-            dictPtr = Tcl_NewDictObj();
-            cJSON *current_item = item->child;
-            while (current_item) {
-                Tcl_DictObjPut(
-                        interp,
-                        dictPtr,
-                        Tcl_NewStringObj(current_item->string, -1),
-                        tjson_TreeToTyped(interp, current_item));
-                current_item = current_item->next;
+            frame = (tjson_tree_frame_t *) tjson_StackTop(&stack);
+            if (valuePtr != NULL) {
+                if (cJSON_IsArray(frame->item)) {
+                    Tcl_ListObjAppendElement(interp, frame->objPtr, valuePtr);
+                } else {
+                    Tcl_Obj *keyPtr = frame->keyObjs != NULL
+                            ? frame->keyObjs[frame->index]
+                            : Tcl_NewStringObj(frame->child->string, -1);
+                    Tcl_DictObjPut(interp, frame->objPtr, keyPtr, valuePtr);
+                }
             }
-            Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("M", 1));
-            Tcl_ListObjAppendElement(interp, resultPtr, dictPtr);
-            return resultPtr;
-        default:
-            return resultPtr;
+            frame->child = frame->child->next;
+            frame->index++;
+            if (frame->child != NULL) {
+                current = frame->child;
+                break;
+            }
+            tjson_StackPop(&stack);
+            valuePtr = typed ? tjson_NewTypedObj(cJSON_IsArray(frame->item) ? "L" : "M", frame->objPtr) : frame->objPtr;
+        }
+    }
+
+error:
+    // the objects of open containers are not owned by anything yet
+    for (size_t i = 0; i < stack.depth; i++) {
+        frame = (tjson_tree_frame_t *) tjson_StackFrame(&stack, i);
+        Tcl_IncrRefCount(frame->objPtr);
+        Tcl_DecrRefCount(frame->objPtr);
     }
+    tjson_StackFree(&stack);
+    tjson_ShapeCacheFree(&cache);
+    return NULL;
+}
+
+static Tcl_Obj *tjson_TreeToSimple(Tcl_Interp *interp, cJSON *item) {
+    return tjson_TreeToObj(interp, item, 0);
+}
+
+static Tcl_Obj *tjson_TreeToTyped(Tcl_Interp *interp, cJSON *item) {
+    return tjson_TreeToObj(interp, item, 1);
 }
 
 static int tjson_JsonToTypedCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
@@ -269,8 +735,15 @@ static int tjson_JsonToTypedCmd(ClientData  clientData, Tcl_Interp *interp, int
 
     if (length > 0) {
         cJSON *root_structure = cJSON_ParseWithLength(json, length);
+        if (!root_structure) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid json", -1));
+            return TCL_ERROR;
+        }
         Tcl_Obj *resultPtr = tjson_TreeToTyped(interp, root_structure);
         cJSON_Delete(root_structure);
+        if (resultPtr == NULL) {
+            return TCL_ERROR;
+        }
         Tcl_SetObjResult(interp, resultPtr);
     }
 
@@ -289,6 +762,9 @@ static int tjson_JsonToSimpleCmd(ClientData  clientData, Tcl_Interp *interp, int
         if (root_structure) {
             Tcl_Obj *resultPtr = tjson_TreeToSimple(interp, root_structure);
             cJSON_Delete(root_structure);
+            if (resultPtr == NULL) {
+                return TCL_ERROR;
+            }
             Tcl_SetObjResult(interp, resultPtr);
         } else {
             Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid json", -1));
@@ -319,8 +795,10 @@ char *tjson_VarTraceProc(ClientData clientData, Tcl_Interp *interp, const char *
     }
     if (flags & TCL_TRACE_UNSETS) {
         DBG(fprintf(stderr, "VarTraceProc: TCL_TRACE_UNSETS\n"));
-        if (tjson_UnregisterNode(trace->handle)) {
-            cJSON_Delete(trace->item);
+        // after an arena reset the handle may name a newer node at the same address
+        int stale = trace->in_arena && trace->arena_generation != tjson_PoolArenaGeneration();
+        if (!stale && tjson_UnregisterNode(trace->handle)) {
+            tjson_DeleteRoot(trace->item);
         }
         Tcl_Free((char *) trace->varname);
         Tcl_Free((char *) trace->handle);
@@ -343,91 +821,683 @@ static char *tjson_strndup(const char *s, size_t n) {
     return result;
 }
 
+// Binds the handle of a root node to a variable. Unsetting the variable
+// destroys the node, writing to it is an error.
+static void tjson_TraceHandleVar(Tcl_Interp *interp, Tcl_Obj *varnamePtr, const char *handle, cJSON *root) {
+    tjson_trace_t *trace = (tjson_trace_t *) Tcl_Alloc(sizeof(tjson_trace_t));
+    trace->interp = interp;
+    trace->varname = tjson_strndup(Tcl_GetString(varnamePtr), 80);
+    trace->handle = tjson_strndup(handle, 80);
+    trace->item = root;
+    trace->in_arena = tjson_PoolArenaContains(root);
+    trace->arena_generation = tjson_PoolArenaGeneration();
+    const char *objVar = Tcl_GetString(varnamePtr);
+    Tcl_UnsetVar(interp, objVar, 0);
+    Tcl_SetVar  (interp, objVar, handle, 0);
+    Tcl_TraceVar(interp,objVar,TCL_TRACE_WRITES|TCL_TRACE_UNSETS,
+                 (Tcl_VarTraceProc*) tjson_VarTraceProc,
+                 (ClientData) trace);
+}
+
+typedef struct {
+    int lazy;
+    int insitu;
+    int arena;
+    int intern;
+    int shapes;
+    int packed;
+    int dedup;
+    int keyindex;
+} tjson_parse_options_t;
+
+// Consumes the leading options of parse and parse_file. Only exact option
+// names are taken as options so that a document such as "-1" still parses.
+static int tjson_GetParseOptions(Tcl_Interp *interp, int objc, Tcl_Obj * const objv[], tjson_parse_options_t *opts,
+                                 int *argIndex) {
+    static const char *options[] = {"-lazy", "-insitu", "-arena", "-intern", "-shapes", "-packed", "-dedup",
+                                    "-keyindex", NULL};
+    enum options { OPT_LAZY, OPT_INSITU, OPT_ARENA, OPT_INTERN, OPT_SHAPES, OPT_PACKED, OPT_DEDUP, OPT_KEYINDEX };
+
+    opts->lazy = 0;
+    opts->insitu = 0;
+    opts->arena = 0;
+    opts->intern = 0;
+    opts->shapes = 0;
+    opts->packed = 0;
+    opts->dedup = 0;
+    opts->keyindex = 0;
+    int i;
+    for (i = 1; i < objc - 1; i++) {
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObjStruct(NULL, objv[i], options, sizeof(char *), "option", TCL_EXACT, &index)) {
+            break;
+        }
+        switch ((enum options) index) {
+            case OPT_LAZY:
+                opts->lazy = 1;
+                break;
+            case OPT_INSITU:
+                opts->insitu = 1;
+                break;
+            case OPT_ARENA:
+                opts->arena = 1;
+                break;
+            case OPT_INTERN:
+                opts->intern = 1;
+                break;
+            case OPT_SHAPES:
+                // records of one array share their key strings as well
+                opts->shapes = 1;
+                opts->intern = 1;
+                break;
+            case OPT_PACKED:
+                opts->packed = 1;
+                break;
+            case OPT_DEDUP:
+                opts->dedup = 1;
+                break;
+            case OPT_KEYINDEX:
+                opts->keyindex = 1;
+                break;
+        }
+    }
+    *argIndex = i;
+    return TCL_OK;
+}
+
+// File contents never went through Tcl's encoding layer, so they are checked
+// before parsing rather than turning into broken Tcl strings later.
+static int tjson_CheckFileUtf8(Tcl_Interp *interp, tjson_filemap_t *map) {
+    size_t offset;
+    if (!tjson_ValidateUtf8(map->data, map->length, &offset)) {
+        tjson_UnmapFile(map);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid utf-8 at offset %" TCL_SIZE_MODIFIER "d", (Tcl_Size) offset));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+// Parses "length" bytes at "json". With -lazy or -insitu the tree keeps
+// pointing into the text, so "doc" is set to the document that must outlive
+// the root; the text is copied into it unless "map" already owns the bytes
+// (a copy-on-write mapping for -insitu).
+static cJSON *tjson_ParseText(const char *json, size_t length, tjson_parse_options_t *opts,
+                              tjson_filemap_t *map, tjson_document_t **docPtr) {
+    *docPtr = NULL;
+
+    // in-situ keys already live in the text, nothing to intern
+    cJSON_KeySet *keys = NULL;
+    int owns_keys = 0;
+    if (opts->intern && !opts->insitu) {
+        owns_keys = tjson_InternMode == TJSON_INTERN_DOCUMENT;
+        keys = owns_keys ? cJSON_CreateKeySet(TJSON_DOCUMENT_KEYS_MAX, NULL, NULL) : tjson_GetGlobalKeys();
+    }
+
+    if (!opts->lazy && !opts->insitu) {
+        if (keys == NULL) {
+            return cJSON_ParseWithLength(json, length);
+        }
+        cJSON *root = cJSON_ParseInternedWithLength(json, length, keys, 0);
+        if (owns_keys) {
+            if (root == NULL) {
+                cJSON_DeleteKeySet(keys);
+                return NULL;
+            }
+            tjson_document_t *doc = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+            memset(doc, 0, sizeof(tjson_document_t));
+            doc->keys = keys;
+            *docPtr = doc;
+        }
+        return root;
+    }
+
+    tjson_document_t *doc = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+    memset(doc, 0, sizeof(tjson_document_t));
+    if (owns_keys) {
+        doc->keys = keys;
+    }
+    if (map != NULL) {
+        doc->map = *map;
+        map->data = NULL;
+        map->length = 0;
+    } else {
+        doc->text = Tcl_Alloc(length);
+        memcpy(doc->text, json, length);
+        json = doc->text;
+    }
+    cJSON *root = opts->insitu
+            ? cJSON_ParseInSituWithLength((char *) json, length, opts->lazy)
+            : cJSON_ParseInternedWithLength(json, length, keys, 1);
+    if (root == NULL) {
+        tjson_FreeDocument(doc);
+        return NULL;
+    }
+    doc->serialized = opts->lazy;
+    *docPtr = doc;
+    return root;
+}
+
+// Shares the equal subtrees and the repeated strings of "root", see
+// cJSON_Dedup, keeping the shared parts with its document, which is created
+// if the root has none yet.
+static int tjson_DedupDocument(cJSON *root, tjson_document_t **docPtr, cJSON_DedupStats *stats) {
+    if (*docPtr == NULL) {
+        *docPtr = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+        memset(*docPtr, 0, sizeof(tjson_document_t));
+    }
+    tjson_document_t *doc = *docPtr;
+    doc->serialized = 1;
+    if (doc->keys == NULL) {
+        doc->keys = cJSON_CreateKeySet(TJSON_DEDUP_STRINGS_MAX, NULL, NULL);
+    }
+    if (doc->shared == NULL) {
+        doc->shared = cJSON_CreateArray();
+    }
+    return cJSON_Dedup(root, doc->shared, doc->keys, stats);
+}
+
+static cJSON *tjson_ParseDocument(const char *json, size_t length, tjson_parse_options_t *opts,
+                                  tjson_filemap_t *map, tjson_document_t **docPtr) {
+    cJSON *root = tjson_ParseText(json, length, opts, map, docPtr);
+    if (root == NULL) {
+        return NULL;
+    }
+    if (opts->packed && cJSON_PackArrays(root, TJSON_PACKED_MIN_COUNT) > 0) {
+        if (*docPtr == NULL) {
+            *docPtr = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+            memset(*docPtr, 0, sizeof(tjson_document_t));
+        }
+        (*docPtr)->serialized = 1;
+    }
+    if (opts->shapes) {
+        if (*docPtr == NULL) {
+            *docPtr = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+            memset(*docPtr, 0, sizeof(tjson_document_t));
+        }
+        tjson_BuildShapes(NULL, root, &(*docPtr)->shapes);
+    }
+    if (opts->dedup) {
+        // whatever could not be shared stays as parsed
+        cJSON_DedupStats stats;
+        tjson_DedupDocument(root, docPtr, &stats);
+    }
+    if (opts->keyindex) {
+        // built on first use, a document that is never searched never pays for it
+        if (*docPtr == NULL) {
+            *docPtr = (tjson_document_t *) Tcl_Alloc(sizeof(tjson_document_t));
+            memset(*docPtr, 0, sizeof(tjson_document_t));
+        }
+        (*docPtr)->keyindex = 1;
+    }
+    return root;
+}
+
 static int tjson_ParseCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
     DBG(fprintf(stderr, "ParseCmd\n"));
-    CheckArgs(2,3,1,"json ?varname?");
+    CheckArgs(2,11,1,"?-lazy? ?-insitu? ?-arena? ?-intern? ?-shapes? ?-packed? ?-dedup? ?-keyindex? json ?varname?");
+
+    tjson_parse_options_t opts;
+    int argIndex;
+    if (TCL_OK != tjson_GetParseOptions(interp, objc, objv, &opts, &argIndex)) {
+        return TCL_ERROR;
+    }
+    if (objc - argIndex > 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-lazy? ?-insitu? ?-arena? ?-intern? ?-shapes? ?-packed? ?-dedup? ?-keyindex? json ?varname?");
+        return TCL_ERROR;
+    }
 
     Tcl_Size length;
-    const char *json = Tcl_GetStringFromObj(objv[1], &length);
+    const char *json = Tcl_GetStringFromObj(objv[argIndex], &length);
     if (length == 0) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("empty json", -1));
         return TCL_ERROR;
     }
-    cJSON *root_structure = cJSON_ParseWithLength(json, length);
+    tjson_document_t *doc;
+    // a failed parse leaves its partial nodes in the arena until the reset
+    int previous = tjson_PoolArenaSetActive(opts.arena);
+    cJSON *root_structure = tjson_ParseDocument(json, length, &opts, NULL, &doc);
+    tjson_PoolArenaSetActive(previous);
     if (!root_structure) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid json", -1));
         return TCL_ERROR;
     }
+    if (doc != NULL) {
+        tjson_RegisterDocument(root_structure, doc);
+    }
 
     char handle[80];
     CMD_NAME(handle, root_structure);
     tjson_RegisterNode(handle, root_structure);
 
-    if (objc == 3) {
-        tjson_trace_t *trace = (tjson_trace_t *) Tcl_Alloc(sizeof(tjson_trace_t));
-        trace->interp = interp;
-        trace->varname = tjson_strndup(Tcl_GetString(objv[2]), 80);
-        trace->handle = tjson_strndup(handle, 80);
-        trace->item = root_structure;
-        const char *objVar = Tcl_GetString(objv[2]);
-        Tcl_UnsetVar(interp, objVar, 0);
-        Tcl_SetVar  (interp, objVar, handle, 0);
-        Tcl_TraceVar(interp,objVar,TCL_TRACE_WRITES|TCL_TRACE_UNSETS,
-                     (Tcl_VarTraceProc*) tjson_VarTraceProc,
-                     (ClientData) trace);
+    if (objc - argIndex == 2) {
+        tjson_TraceHandleVar(interp, objv[argIndex + 1], handle, root_structure);
     }
 
     Tcl_SetObjResult(interp, Tcl_NewStringObj(handle, -1));
     return TCL_OK;
 }
 
-static int tjson_DestroyCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
-    DBG(fprintf(stderr, "DestroyCmd\n"));
-    CheckArgs(2,2,1,"handle");
+static int tjson_ParseFileCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ParseFileCmd\n"));
+    CheckArgs(2,11,1,"?-lazy? ?-insitu? ?-arena? ?-intern? ?-shapes? ?-packed? ?-dedup? ?-keyindex? path ?varname?");
 
-    const char *handle = Tcl_GetString(objv[1]);
-    cJSON *item = tjson_GetInternalFromNode(handle);
-    if (!item) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+    tjson_parse_options_t opts;
+    int argIndex;
+    if (TCL_OK != tjson_GetParseOptions(interp, objc, objv, &opts, &argIndex)) {
+        return TCL_ERROR;
+    }
+    if (objc - argIndex > 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-lazy? ?-insitu? ?-arena? ?-intern? ?-shapes? ?-packed? ?-dedup? ?-keyindex? path ?varname?");
         return TCL_ERROR;
     }
 
-    tjson_UnregisterNode(handle);
-    // todo: if the node is root
-    if (item->prev == NULL && item->next == NULL) {
-        cJSON_Delete(item);
-    } else {
-        SetResult("node is not a root");
+    // parse straight from the mapping, no intermediate Tcl string; a lazy or
+    // in-situ document keeps the mapping until the root is deleted
+    tjson_filemap_t map;
+    if (TCL_OK != tjson_MapFile(interp, objv[argIndex], opts.insitu, &map)) {
+        return TCL_ERROR;
+    }
+    if (map.length == 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("empty json", -1));
+        return TCL_ERROR;
+    }
+    if (TCL_OK != tjson_CheckFileUtf8(interp, &map)) {
+        return TCL_ERROR;
+    }
+    tjson_document_t *doc;
+    int previous = tjson_PoolArenaSetActive(opts.arena);
+    cJSON *root_structure = tjson_ParseDocument(map.data, map.length, &opts, &map, &doc);
+    tjson_PoolArenaSetActive(previous);
+    tjson_UnmapFile(&map);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid json", -1));
         return TCL_ERROR;
     }
+    if (doc != NULL) {
+        tjson_RegisterDocument(root_structure, doc);
+    }
+
+    char handle[80];
+    CMD_NAME(handle, root_structure);
+    tjson_RegisterNode(handle, root_structure);
+
+    if (objc - argIndex == 2) {
+        tjson_TraceHandleVar(interp, objv[argIndex + 1], handle, root_structure);
+    }
 
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(handle, -1));
     return TCL_OK;
 }
 
-static int tjson_SizeCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
-    DBG(fprintf(stderr, "SizeCmd\n"));
-    CheckArgs(2,2,1,"handle");
+static int tjson_ValidateCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ValidateCmd\n"));
+    CheckArgs(2,3,1,"json ?-utf8?");
 
-    const char *handle = Tcl_GetString(objv[1]);
-    cJSON *root_structure = tjson_GetInternalFromNode(handle);
-    if (!root_structure) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
-        return TCL_ERROR;
+    int check_utf8 = 0;
+    if (objc == 3) {
+        static const char *options[] = {"-utf8", NULL};
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[2], options, "option", 0, &index)) {
+            return TCL_ERROR;
+        }
+        check_utf8 = 1;
     }
 
-    if (!cJSON_IsArray(root_structure) && !cJSON_IsObject(root_structure)) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is not an array or object", -1));
-        return TCL_ERROR;
+    // a payload read from a binary channel is checked as is, any other value
+    // through its string representation
+    const char *json;
+    Tcl_Size length;
+    if (objv[1]->typePtr == Tcl_GetObjType("bytearray") && objv[1]->bytes == NULL) {
+        json = (const char *) Tcl_GetByteArrayFromObj(objv[1], &length);
+    } else {
+        json = Tcl_GetStringFromObj(objv[1], &length);
     }
 
-    int size = cJSON_GetArraySize(root_structure);
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(size));
+    int valid = (!check_utf8 || tjson_ValidateUtf8(json, length, NULL)) && cJSON_Validate(json, length);
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(valid));
     return TCL_OK;
 }
 
-static int tjson_CreateItemFromSpec(Tcl_Interp *interp, Tcl_Obj *specPtr, cJSON **item) {
-    // "specPtr" is a list of two elements: type and value
-    Tcl_Size length;
+// The nesting limit is process-wide, as the parser and the walkers keep their
+// open containers on the heap it may be raised well past the default.
+static int tjson_MaxDepthCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "MaxDepthCmd\n"));
+    CheckArgs(1,2,1,"?depth?");
+
+    if (objc == 2) {
+        Tcl_WideInt depth;
+        if (TCL_OK != Tcl_GetWideIntFromObj(interp, objv[1], &depth)) {
+            return TCL_ERROR;
+        }
+        if (depth < 1) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("depth must be a positive integer", -1));
+            return TCL_ERROR;
+        }
+        cJSON_SetNestingLimit((size_t) depth);
+    }
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) cJSON_GetNestingLimit()));
+    return TCL_OK;
+}
+
+static const char *tjson_allocators[] = {"malloc", "tcl", NULL};
+
+static int tjson_ConfigureCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ConfigureCmd\n"));
+    CheckArgs(1,9,1,"?-pool boolean? ?-pool_cache bytes? ?-allocator malloc|tcl? ?-intern document|global?");
+
+    int enabled;
+    tjson_allocator_t allocator;
+    size_t cache_bytes;
+    tjson_PoolGetConfig(&enabled, &allocator, &cache_bytes);
+    tjson_intern_t intern = tjson_InternMode;
+
+    static const char *options[] = {"-pool", "-pool_cache", "-allocator", "-intern", NULL};
+    enum options { OPT_POOL, OPT_POOL_CACHE, OPT_ALLOCATOR, OPT_INTERN };
+    for (int i = 1; i < objc; i += 2) {
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &index)) {
+            return TCL_ERROR;
+        }
+        if (i + 1 == objc) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing value for %s", Tcl_GetString(objv[i])));
+            return TCL_ERROR;
+        }
+        switch ((enum options) index) {
+            case OPT_POOL:
+                if (TCL_OK != Tcl_GetBooleanFromObj(interp, objv[i + 1], &enabled)) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_POOL_CACHE: {
+                Tcl_WideInt bytes;
+                if (TCL_OK != Tcl_GetWideIntFromObj(interp, objv[i + 1], &bytes)) {
+                    return TCL_ERROR;
+                }
+                if (bytes < 0) {
+                    SetResult("pool cache size must be non-negative");
+                    return TCL_ERROR;
+                }
+                cache_bytes = (size_t) bytes;
+                break;
+            }
+            case OPT_ALLOCATOR:
+                if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i + 1], tjson_allocators, "allocator", 0, (int *) &allocator)) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_INTERN:
+                if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i + 1], tjson_intern_modes, "intern mode", 0, (int *) &intern)) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+    tjson_PoolConfigure(enabled, allocator, cache_bytes);
+    tjson_InternMode = intern;
+
+    Tcl_Obj *resultPtr = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("-pool", -1));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewBooleanObj(enabled));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("-pool_cache", -1));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewWideIntObj((Tcl_WideInt) cache_bytes));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("-allocator", -1));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj(tjson_allocators[allocator], -1));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj("-intern", -1));
+    Tcl_ListObjAppendElement(interp, resultPtr, Tcl_NewStringObj(tjson_intern_modes[intern], -1));
+    Tcl_SetObjResult(interp, resultPtr);
+    return TCL_OK;
+}
+
+static int tjson_PoolStatsCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "PoolStatsCmd\n"));
+    CheckArgs(1,1,1,"");
+
+    tjson_pool_stats_t stats;
+    tjson_PoolGetStats(&stats);
+
+    Tcl_Obj *dictPtr = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("hits", -1), Tcl_NewWideIntObj(stats.hits));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("misses", -1), Tcl_NewWideIntObj(stats.misses));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("cached", -1), Tcl_NewWideIntObj(stats.cached));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("cached_bytes", -1), Tcl_NewWideIntObj(stats.cached_bytes));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("arena_bytes", -1), Tcl_NewWideIntObj(stats.arena_bytes));
+    Tcl_SetObjResult(interp, dictPtr);
+    return TCL_OK;
+}
+
+static int tjson_ArenaResetCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ArenaResetCmd\n"));
+    CheckArgs(1,1,1,"");
+
+    tjson_ResetArena();
+    return TCL_OK;
+}
+
+// Runs a command that takes a handle with the arena active when the handle
+// belongs to the arena of the calling thread, so that the nodes it adds to
+// (or materializes in) a request-scoped document are wiped together with it.
+// Reading a -lazy, -packed or deduplicated document parses, unpacks or
+// copies its subtrees in place, so the commands on such a document hold its
+// mutex: they may come from several threads, and run one at a time.
+static int tjson_HandleCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    Tcl_ObjCmdProc *proc = (Tcl_ObjCmdProc *) clientData;
+    cJSON *item = objc < 2 ? NULL : tjson_GetInternalFromNode(Tcl_GetString(objv[1]));
+    if (item == NULL) {
+        return proc(NULL, interp, objc, objv);
+    }
+
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    tjson_document_t *doc = tjson_FindDocument(item);
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+    if (doc != NULL && !doc->serialized) {
+        doc = NULL;
+    }
+    if (doc != NULL) {
+        Tcl_MutexLock(&doc->mutex);
+    }
+
+    int arena = tjson_PoolArenaInUse() && tjson_PoolArenaContains(item);
+    int previous = arena ? tjson_PoolArenaSetActive(1) : 0;
+    int rc = proc(NULL, interp, objc, objv);
+    if (arena) {
+        tjson_PoolArenaSetActive(previous);
+    }
+
+    if (doc != NULL) {
+        Tcl_MutexUnlock(&doc->mutex);
+    }
+    return rc;
+}
+
+static int tjson_DestroyCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "DestroyCmd\n"));
+    CheckArgs(2,2,1,"handle");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *item = tjson_GetInternalFromNode(handle);
+    if (!item) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    tjson_UnregisterNode(handle);
+    // todo: if the node is root
+    if (item->prev == NULL && item->next == NULL) {
+        tjson_DeleteRoot(item);
+    } else {
+        SetResult("node is not a root");
+        return TCL_ERROR;
+    }
+
+    return TCL_OK;
+}
+
+static int tjson_SizeCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "SizeCmd\n"));
+    CheckArgs(2,2,1,"handle");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    if (!cJSON_IsArray(root_structure) && !cJSON_IsObject(root_structure)) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is not an array or object", -1));
+        return TCL_ERROR;
+    }
+
+    int size = cJSON_GetArraySize(root_structure);
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(size));
+    return TCL_OK;
+}
+
+// An aggregate as to_simple would return it, an int when it has no fraction.
+static Tcl_Obj *tjson_NewNumberObj(double d) {
+    cJSON number;
+    memset(&number, 0, sizeof(cJSON));
+    number.type = cJSON_Number;
+    cJSON_SetNumberHelper(&number, d);
+    return tjson_ScalarToSimple(&number);
+}
+
+// Aggregates of an array of numbers, computed over the vector of a packed
+// array or over a copy of the values of any other array.
+static int tjson_ArrayStatsCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ArrayStatsCmd\n"));
+    CheckArgs(2,2,1,"handle");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    if (!cJSON_IsArray(root_structure)) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is not an array", -1));
+        return TCL_ERROR;
+    }
+
+    size_t count;
+    const double *values = cJSON_GetPackedArray(root_structure, &count);
+    double *copy = NULL;
+    if (values == NULL) {
+        count = (size_t) cJSON_GetArraySize(root_structure);
+        copy = (double *) Tcl_Alloc((count > 0 ? count : 1) * sizeof(double));
+        size_t i = 0;
+        cJSON_MaterializeForRead(root_structure);
+        for (cJSON *element = root_structure->child; element != NULL; element = element->next) {
+            if (!cJSON_IsNumber(element)) {
+                Tcl_Free((char *) copy);
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("array holds a value that is not a number", -1));
+                return TCL_ERROR;
+            }
+            copy[i++] = element->valuedouble;
+        }
+        values = copy;
+    }
+
+    tjson_packed_stats_t stats;
+    tjson_PackedStats(values, count, &stats);
+    if (copy != NULL) {
+        Tcl_Free((char *) copy);
+    }
+
+    Tcl_Obj *dictPtr = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("count", -1), Tcl_NewWideIntObj((Tcl_WideInt) stats.count));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("sum", -1), tjson_NewNumberObj(stats.sum));
+    if (count > 0) {
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("min", -1), tjson_NewNumberObj(stats.min));
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("max", -1), tjson_NewNumberObj(stats.max));
+        // a sum that overflowed leaves the mean empty, as it does the sum
+        double mean = stats.sum / (double) count;
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("mean", -1),
+                       isnan(mean) || isinf(mean) ? Tcl_NewObj() : Tcl_NewDoubleObj(mean));
+    } else {
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("min", -1), Tcl_NewObj());
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("max", -1), Tcl_NewObj());
+        Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("mean", -1), Tcl_NewObj());
+    }
+    Tcl_SetObjResult(interp, dictPtr);
+    return TCL_OK;
+}
+
+// Memory taken by a tree: node structs, short strings stored inline after
+// their node and strings in blocks of their own. Lazy subtrees are counted as
+// a single node and in-situ strings, which live in the document, as nothing.
+// A packed array is one node and the block of its values.
+// A frozen tree is one block, a frozen subtree counts its nodes only.
+// A shared subtree is one node, its children are kept by the document.
+static int tjson_StatsCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "StatsCmd\n"));
+    CheckArgs(2,2,1,"handle");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_WideInt nodes = 0, blocks = 0, bytes = 0;
+    tjson_stack_t stack;
+    tjson_StackInit(&stack, sizeof(cJSON *), (size_t) -1);
+    *(cJSON **) tjson_StackPush(interp, &stack) = root_structure;
+    while (stack.depth > 0) {
+        cJSON *item = *(cJSON **) tjson_StackTop(&stack);
+        tjson_StackPop(&stack);
+        nodes++;
+        if (item->flags & FROZEN_NODE) {
+            // strings and key indexes are shared within the block
+            bytes += sizeof(cJSON);
+            for (cJSON *child = item->child; child != NULL; child = child->next) {
+                *(cJSON **) tjson_StackPush(interp, &stack) = child;
+            }
+            continue;
+        }
+        blocks++;
+        bytes += sizeof(cJSON);
+        if (item->string != NULL && !(item->flags & (INSITU_STRING | INTERNED_STRING))) {
+            blocks += (item->flags & INLINE_STRING) || (item->type & cJSON_StringIsConst) ? 0 : 1;
+            bytes += strlen(item->string) + 1;
+        }
+        size_t count;
+        if (cJSON_GetPackedArray(item, &count) != NULL) {
+            blocks++;
+            bytes += sizeof(size_t) + count * sizeof(double);
+        } else if (item->valuestring != NULL
+            && !(item->flags & (INSITU_VALUESTRING | INTERNED_VALUESTRING | LAZY_SUBTREE | SHAPED_OBJECT))
+            && !(item->type & cJSON_IsReference)) {
+            blocks += (item->flags & INLINE_VALUESTRING) ? 0 : 1;
+            bytes += strlen(item->valuestring) + 1;
+        }
+        if (!(item->type & cJSON_IsReference)) {
+            for (cJSON *child = item->child; child != NULL; child = child->next) {
+                *(cJSON **) tjson_StackPush(interp, &stack) = child;
+            }
+        }
+    }
+    tjson_StackFree(&stack);
+    if (root_structure->flags & FROZEN_ROOT) {
+        blocks = 1;
+        bytes = (Tcl_WideInt) cJSON_GetFrozenSize(root_structure);
+    }
+
+    Tcl_Obj *dictPtr = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("nodes", -1), Tcl_NewWideIntObj(nodes));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("blocks", -1), Tcl_NewWideIntObj(blocks));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("bytes", -1), Tcl_NewWideIntObj(bytes));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("bytes_per_node", -1),
+                   Tcl_NewDoubleObj((double) bytes / (double) nodes));
+    Tcl_SetObjResult(interp, dictPtr);
+    return TCL_OK;
+}
+
+static int tjson_CreateItemFromSpec(Tcl_Interp *interp, Tcl_Obj *specPtr, cJSON **item) {
+    // "specPtr" is a list of two elements: type and value
+    Tcl_Size length;
     Tcl_ListObjLength(interp, specPtr, &length);
     if (length != 2) {
         Tcl_Obj *resultPtr = Tcl_NewStringObj("invalid spec length: ", -1);
@@ -507,10 +1577,22 @@ static int tjson_CreateItemFromSpec(Tcl_Interp *interp, Tcl_Obj *specPtr, cJSON
 
 static int tjson_CreateCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
     DBG(fprintf(stderr, "CreateCmd\n"));
-    CheckArgs(2,3,1,"typed_item_spec ?varname?");
+    CheckArgs(2,4,1,"?-arena? typed_item_spec ?varname?");
+
+    int argIndex = 1;
+    int arena = objc > 2 && strcmp(Tcl_GetString(objv[1]), "-arena") == 0;
+    if (arena) {
+        argIndex++;
+    } else if (objc == 4) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-arena? typed_item_spec ?varname?");
+        return TCL_ERROR;
+    }
 
     cJSON *item = NULL;
-    if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[1], &item)) {
+    int previous = tjson_PoolArenaSetActive(arena);
+    int rc = tjson_CreateItemFromSpec(interp, objv[argIndex], &item);
+    tjson_PoolArenaSetActive(previous);
+    if (TCL_OK != rc) {
         return TCL_ERROR;
     }
 
@@ -518,24 +1600,98 @@ static int tjson_CreateCmd(ClientData  clientData, Tcl_Interp *interp, int objc,
     CMD_NAME(handle, item);
     tjson_RegisterNode(handle, item);
 
-    if (objc == 3) {
-        tjson_trace_t *trace = (tjson_trace_t *) Tcl_Alloc(sizeof(tjson_trace_t));
-        trace->interp = interp;
-        trace->varname = tjson_strndup(Tcl_GetString(objv[2]), 80);
-        trace->handle = tjson_strndup(handle, 80);
-        trace->item = item;
-        const char *objVar = Tcl_GetString(objv[2]);
-        Tcl_UnsetVar(interp, objVar, 0);
-        Tcl_SetVar  (interp, objVar, handle, 0);
-        Tcl_TraceVar(interp,objVar,TCL_TRACE_WRITES|TCL_TRACE_UNSETS,
-                     (Tcl_VarTraceProc*) tjson_VarTraceProc,
-                     (ClientData) trace);
+    if (objc - argIndex == 2) {
+        tjson_TraceHandleVar(interp, objv[argIndex + 1], handle, item);
     }
 
     Tcl_SetObjResult(interp, Tcl_NewStringObj(handle, -1));
     return TCL_OK;
 }
 
+// Copies a tree into a single read-only block (see cJSON_Freeze) and returns
+// a handle to the copy, which has no document and is freed with destroy like
+// any root. The original is left as it is.
+static int tjson_FreezeCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "FreezeCmd\n"));
+    CheckArgs(2,3,1,"handle ?varname?");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    cJSON *frozen = cJSON_Freeze(root_structure);
+    if (frozen == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("error while freezing", -1));
+        return TCL_ERROR;
+    }
+
+    char frozen_handle[80];
+    CMD_NAME(frozen_handle, frozen);
+    tjson_RegisterNode(frozen_handle, frozen);
+
+    if (objc == 3) {
+        tjson_TraceHandleVar(interp, objv[2], frozen_handle, frozen);
+    }
+
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(frozen_handle, -1));
+    return TCL_OK;
+}
+
+// Shares the equal subtrees and repeated strings of a root in place. A shared
+// part gets copied, one level at a time, as it is modified or its children
+// are handed out.
+static int tjson_DedupCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "DedupCmd\n"));
+    CheckArgs(2,2,1,"handle");
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    if (root_structure->prev != NULL || root_structure->next != NULL) {
+        SetResult("node is not a root");
+        return TCL_ERROR;
+    }
+
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
+    tjson_document_t *doc = NULL;
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_HashEntry *entryPtr = Tcl_FindHashEntry(&tjson_RootToDocument_HT, (char *) root_structure);
+    if (entryPtr != NULL) {
+        doc = (tjson_document_t *) Tcl_GetHashValue(entryPtr);
+    }
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
+    int registered = doc != NULL;
+
+    cJSON_DedupStats stats;
+    int ok = tjson_DedupDocument(root_structure, &doc, &stats);
+    tjson_BumpMutationEpoch(root_structure);
+    if (!registered) {
+        tjson_RegisterDocument(root_structure, doc);
+    }
+    if (!ok) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("error while deduplicating", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *dictPtr = Tcl_NewDictObj();
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("subtrees", -1), Tcl_NewWideIntObj((Tcl_WideInt) stats.subtrees));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("strings", -1), Tcl_NewWideIntObj((Tcl_WideInt) stats.strings));
+    Tcl_DictObjPut(interp, dictPtr, Tcl_NewStringObj("bytes_saved", -1), Tcl_NewWideIntObj((Tcl_WideInt) stats.bytes_saved));
+    Tcl_SetObjResult(interp, dictPtr);
+    return TCL_OK;
+}
+
 static int tjson_AddItemToObjectCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
     DBG(fprintf(stderr, "AddItemToObjectCmd\n"));
     CheckArgs(4,4,1,"handle key typed_item_spec");
@@ -552,6 +1708,11 @@ static int tjson_AddItemToObjectCmd(ClientData  clientData, Tcl_Interp *interp,
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     cJSON *item = NULL;
     if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[3], &item)) {
         return TCL_ERROR;
@@ -560,6 +1721,7 @@ static int tjson_AddItemToObjectCmd(ClientData  clientData, Tcl_Interp *interp,
         Tcl_SetObjResult(interp, Tcl_NewStringObj("error while adding item", -1));
         return TCL_ERROR;
     }
+    tjson_BumpMutationEpoch(root_structure);
     return TCL_OK;
 }
 
@@ -579,6 +1741,11 @@ static int tjson_ReplaceItemInObjectCmd(ClientData  clientData, Tcl_Interp *inte
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     cJSON *item = NULL;
     if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[3], &item)) {
         return TCL_ERROR;
@@ -587,6 +1754,7 @@ static int tjson_ReplaceItemInObjectCmd(ClientData  clientData, Tcl_Interp *inte
         Tcl_SetObjResult(interp, Tcl_NewStringObj("error while replacing item", -1));
         return TCL_ERROR;
     }
+    tjson_BumpMutationEpoch(root_structure);
     return TCL_OK;
 }
 
@@ -606,7 +1774,13 @@ static int tjson_DeleteItemFromObjectCmd(ClientData  clientData, Tcl_Interp *int
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     cJSON_DeleteItemFromObjectCaseSensitive(root_structure, Tcl_GetString(objv[2]));
+    tjson_BumpMutationEpoch(root_structure);
     return TCL_OK;
 }
 
@@ -626,7 +1800,7 @@ static int tjson_GetObjectItemCmd(ClientData  clientData, Tcl_Interp *interp, in
         return TCL_ERROR;
     }
 
-    cJSON *item = cJSON_GetObjectItemCaseSensitive(root_structure, Tcl_GetString(objv[2]));
+    cJSON *item = tjson_GetObjectItem(root_structure, Tcl_GetString(objv[2]));
     if (item == NULL) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("key not found", -1));
         return TCL_ERROR;
@@ -634,9 +1808,7 @@ static int tjson_GetObjectItemCmd(ClientData  clientData, Tcl_Interp *interp, in
 
     char item_handle[80];
     CMD_NAME(item_handle, item);
-    tjson_RegisterNode(item_handle, item);
-    // IMPORTANT: mark the node to unregister when cJSON_Delete is called
-    item->flags |= VISIBLE_IN_TCL;
+    tjson_RegisterChildNode(item_handle, item, root_structure);
 
     Tcl_SetObjResult(interp, Tcl_NewStringObj(item_handle, -1));
     return TCL_OK;
@@ -680,11 +1852,17 @@ static int tjson_AddItemToArrayCmd(ClientData  clientData, Tcl_Interp *interp, i
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     cJSON *item = NULL;
     if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[2], &item)) {
         return TCL_ERROR;
     }
     cJSON_AddItemToArray(root_structure, item);
+    tjson_BumpMutationEpoch(root_structure);
 
     return TCL_OK;
 }
@@ -705,6 +1883,11 @@ static int tjson_InsertItemInArrayCmd(ClientData  clientData, Tcl_Interp *interp
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     int index;
     if (TCL_OK != Tcl_GetIntFromObj(interp, objv[2], &index)) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid index", -1));
@@ -721,6 +1904,7 @@ static int tjson_InsertItemInArrayCmd(ClientData  clientData, Tcl_Interp *interp
         return TCL_ERROR;
     }
     cJSON_InsertItemInArray(root_structure, index, item);
+    tjson_BumpMutationEpoch(root_structure);
 
     return TCL_OK;
 }
@@ -741,6 +1925,11 @@ static int tjson_ReplaceItemInArrayCmd(ClientData  clientData, Tcl_Interp *inter
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     int index;
     if (TCL_OK != Tcl_GetIntFromObj(interp, objv[2], &index)) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid index", -1));
@@ -757,6 +1946,7 @@ static int tjson_ReplaceItemInArrayCmd(ClientData  clientData, Tcl_Interp *inter
         return TCL_ERROR;
     }
     cJSON_ReplaceItemInArray(root_structure, index, item);
+    tjson_BumpMutationEpoch(root_structure);
 
     return TCL_OK;
 }
@@ -777,6 +1967,11 @@ static int tjson_DeleteItemFromArrayCmd(ClientData  clientData, Tcl_Interp *inte
         return TCL_ERROR;
     }
 
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
     int index;
     if (TCL_OK != Tcl_GetIntFromObj(interp, objv[2], &index)) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid index", -1));
@@ -789,6 +1984,7 @@ static int tjson_DeleteItemFromArrayCmd(ClientData  clientData, Tcl_Interp *inte
     }
 
     cJSON_DeleteItemFromArray(root_structure, index);
+    tjson_BumpMutationEpoch(root_structure);
 
     return TCL_OK;
 }
@@ -823,9 +2019,7 @@ static int tjson_GetArrayItemCmd(ClientData  clientData, Tcl_Interp *interp, int
     cJSON *item = cJSON_GetArrayItem(root_structure, index);
     char item_handle[80];
     CMD_NAME(item_handle, item);
-    tjson_RegisterNode(item_handle, item);
-    // IMPORTANT: mark the node to unregister when cJSON_Delete is called
-    item->flags |= VISIBLE_IN_TCL;
+    tjson_RegisterChildNode(item_handle, item, root_structure);
 
     Tcl_SetObjResult(interp, Tcl_NewStringObj(item_handle, -1));
 
@@ -859,7 +2053,9 @@ static int tjson_GetValueStringCmd(ClientData  clientData, Tcl_Interp *interp, i
         return TCL_ERROR;
     }
 
-    Tcl_Obj *resultPtr = Tcl_NewStringObj(root_structure->valuestring, -1);
+    // containers keep other data in valuestring
+    const char *valuestring = cJSON_IsArray(root_structure) || cJSON_IsObject(root_structure) ? NULL : root_structure->valuestring;
+    Tcl_Obj *resultPtr = Tcl_NewStringObj(valuestring, -1);
     Tcl_SetObjResult(interp, resultPtr);
     return TCL_OK;
 }
@@ -984,9 +2180,7 @@ static int tjson_GetChildItemsCmd(ClientData  clientData, Tcl_Interp *interp, in
     cJSON_ArrayForEach(element, root_structure) {
         char item_handle[80];
         CMD_NAME(item_handle, element);
-        tjson_RegisterNode(item_handle, element);
-        // IMPORTANT: mark the node to unregister when cJSON_Delete is called
-        element->flags |= VISIBLE_IN_TCL;
+        tjson_RegisterChildNode(item_handle, element, root_structure);
 
         if (TCL_OK != Tcl_ListObjAppendElement(interp, list_ptr, Tcl_NewStringObj(item_handle, -1))) {
             Tcl_DecrRefCount(list_ptr);
@@ -1013,6 +2207,9 @@ static int tjson_ToSimpleCmd(ClientData  clientData, Tcl_Interp *interp, int obj
     }
 
     Tcl_Obj *resultPtr = tjson_TreeToSimple(interp, root_structure);
+    if (resultPtr == NULL) {
+        return TCL_ERROR;
+    }
     Tcl_SetObjResult(interp, resultPtr);
     return TCL_OK;
 }
@@ -1029,6 +2226,9 @@ static int tjson_ToTypedCmd(ClientData  clientData, Tcl_Interp *interp, int objc
     }
 
     Tcl_Obj *resultPtr = tjson_TreeToTyped(interp, root_structure);
+    if (resultPtr == NULL) {
+        return TCL_ERROR;
+    }
     Tcl_SetObjResult(interp, resultPtr);
     return TCL_OK;
 }
@@ -1078,8 +2278,26 @@ static int tjson_EscapeJsonString(Tcl_Obj *objPtr, Tcl_DString *dsPtr) {
     return TCL_OK;
 }
 
-static int tjson_TreeToJson(Tcl_Interp *interp, cJSON *item, int num_spaces, Tcl_DString *dsPtr) {
-    double d;
+static void tjson_AppendSpaces(Tcl_DString *dsPtr, int num_spaces) {
+    for (int i = 0; i < num_spaces; i++) {
+        Tcl_DStringAppend(dsPtr, SP, 1);
+    }
+}
+
+// Prints a number the way Tcl prints the int or double to_simple returns for it.
+static void tjson_AppendNumber(double d, int valueint, Tcl_DString *dsPtr) {
+    char buffer[TCL_DOUBLE_SPACE];
+    if (isnan(d) || isinf(d)) {
+        Tcl_DStringAppend(dsPtr, "null", 4);
+    } else if (d == (double) valueint) {
+        Tcl_DStringAppend(dsPtr, buffer, snprintf(buffer, sizeof(buffer), "%d", valueint));
+    } else {
+        Tcl_PrintDouble(NULL, d, buffer);
+        Tcl_DStringAppend(dsPtr, buffer, -1);
+    }
+}
+
+static int tjson_ScalarToJson(Tcl_Interp *interp, cJSON *item, Tcl_DString *dsPtr) {
     switch ((item->type) & 0xFF)
     {
         case cJSON_NULL:
@@ -1092,27 +2310,8 @@ static int tjson_TreeToJson(Tcl_Interp *interp, cJSON *item, int num_spaces, Tcl
             Tcl_DStringAppend(dsPtr, "true", 4);
             return TCL_OK;
         case cJSON_Number:
-            d = item->valuedouble;
-            if (isnan(d) || isinf(d)) {
-                Tcl_DStringAppend(dsPtr, "null", 4);
-                return TCL_OK;
-            } else if(d == (double)item->valueint) {
-                Tcl_Size intstr_length;
-                Tcl_Obj *intObjPtr = Tcl_NewIntObj(item->valueint);
-                Tcl_IncrRefCount(intObjPtr);
-                const char *intstr = Tcl_GetStringFromObj(intObjPtr, &intstr_length);
-                Tcl_DStringAppend(dsPtr, intstr, intstr_length);
-                Tcl_DecrRefCount(intObjPtr);
-                return TCL_OK;
-            } else {
-                Tcl_Size doublestr_length;
-                Tcl_Obj *doubleObjPtr = Tcl_NewDoubleObj(item->valuedouble);
-                Tcl_IncrRefCount(doubleObjPtr);
-                const char *doublestr = Tcl_GetStringFromObj(doubleObjPtr, &doublestr_length);
-                Tcl_DStringAppend(dsPtr, doublestr, doublestr_length);
-                Tcl_DecrRefCount(doubleObjPtr);
-                return TCL_OK;
-            }
+            tjson_AppendNumber(item->valuedouble, item->valueint, dsPtr);
+            return TCL_OK;
         case cJSON_Raw:
         {
             if (item->valuestring == NULL)
@@ -1137,86 +2336,146 @@ static int tjson_TreeToJson(Tcl_Interp *interp, cJSON *item, int num_spaces, Tcl
             Tcl_DStringAppend(dsPtr, "\"", 1);
             Tcl_DecrRefCount(strObjPtr);
             return TCL_OK;
-        case cJSON_Array:
-            Tcl_DStringAppend(dsPtr, LBRACKET, 1);
-            if (num_spaces) {
-                Tcl_DStringAppend(dsPtr, NL, 1);
-            }
-            cJSON *current_element = item->child;
-            int first_array_element = 1;
-            while (current_element != NULL) {
-                if (first_array_element) {
-                    first_array_element = 0;
-                } else {
-                    Tcl_DStringAppend(dsPtr, COMMA, 1);
-                    if (num_spaces) {
-                        Tcl_DStringAppend(dsPtr, NL, 1);
-                    }
-                }
-                if (num_spaces) {
-                    for (int i = 0; i < num_spaces; i++) {
-                        Tcl_DStringAppend(dsPtr, SP, 1);
-                    }
-                }
-                if (TCL_OK != tjson_TreeToJson(interp, current_element, num_spaces > 0 ? num_spaces + 2 : 0, dsPtr)) {
-                    return TCL_ERROR;
-                }
-                current_element = current_element->next;
+        default:
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid type", -1));
+            return TCL_ERROR;
+    }
+}
+
+typedef struct {
+    cJSON *item;        // array or object being printed
+    cJSON *child;       // child currently being printed
+    int num_spaces;     // indentation of the children, 0 when not pretty printing
+    tjson_shape_keys_t *keys;   // escaped keys of a record, or NULL
+    size_t index;       // position of "child"
+} tjson_json_frame_t;
+
+// Starts a child of an open array/object: separator, indentation and key.
+static void tjson_AppendJsonMember(tjson_json_frame_t *frame, int first, Tcl_DString *dsPtr) {
+    if (!first) {
+        Tcl_DStringAppend(dsPtr, COMMA, 1);
+        if (frame->num_spaces) {
+            Tcl_DStringAppend(dsPtr, NL, 1);
+        }
+    }
+    tjson_AppendSpaces(dsPtr, frame->num_spaces);
+    if (frame->keys != NULL) {
+        size_t offset = frame->keys->json_offsets[frame->index];
+        Tcl_DStringAppend(dsPtr, frame->keys->json + offset,
+                          (Tcl_Size) (frame->keys->json_offsets[frame->index + 1] - offset));
+        if (frame->num_spaces) {
+            Tcl_DStringAppend(dsPtr, SP, 1);
+        }
+    } else if (cJSON_IsObject(frame->item)) {
+        Tcl_DStringAppend(dsPtr, "\"", 1);
+        Tcl_Obj *strToEscapeObjPtr = Tcl_NewStringObj(frame->child->string, -1);
+        Tcl_IncrRefCount(strToEscapeObjPtr);
+        tjson_EscapeJsonString(strToEscapeObjPtr, dsPtr);
+        Tcl_DecrRefCount(strToEscapeObjPtr);
+        Tcl_DStringAppend(dsPtr, "\":", 2);
+        if (frame->num_spaces) {
+            Tcl_DStringAppend(dsPtr, SP, 1);
+        }
+    }
+}
+
+static void tjson_AppendJsonEnd(tjson_json_frame_t *frame, Tcl_DString *dsPtr) {
+    if (frame->num_spaces) {
+        Tcl_DStringAppend(dsPtr, NL, 1);
+        tjson_AppendSpaces(dsPtr, frame->num_spaces - 2);
+    }
+    Tcl_DStringAppend(dsPtr, cJSON_IsArray(frame->item) ? RBRACKET : RBRACE, 1);
+}
+
+// Prints the values of a packed array with the layout of any other array.
+static void tjson_PackedToJson(const double *values, size_t count, int num_spaces, Tcl_DString *dsPtr) {
+    cJSON number;
+    memset(&number, 0, sizeof(cJSON));
+    Tcl_DStringAppend(dsPtr, LBRACKET, 1);
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            Tcl_DStringAppend(dsPtr, COMMA, 1);
+        }
+        if (num_spaces) {
+            Tcl_DStringAppend(dsPtr, NL, 1);
+            tjson_AppendSpaces(dsPtr, num_spaces);
+        }
+        cJSON_SetNumberHelper(&number, values[i]);
+        tjson_AppendNumber(number.valuedouble, number.valueint, dsPtr);
+    }
+    if (num_spaces) {
+        Tcl_DStringAppend(dsPtr, NL, 1);
+        tjson_AppendSpaces(dsPtr, num_spaces - 2);
+    }
+    Tcl_DStringAppend(dsPtr, RBRACKET, 1);
+}
+
+// Prints a tree as json, indenting nested values by two more spaces per level
+// when "num_spaces" is not 0. Uses an explicit stack, like tjson_TreeToObj.
+static int tjson_TreeToJson(Tcl_Interp *interp, cJSON *item, int num_spaces, Tcl_DString *dsPtr) {
+    tjson_stack_t stack;
+    tjson_json_frame_t *frame;
+    cJSON *current = item;
+    int next_spaces = num_spaces;
+    tjson_shape_cache_t cache;
+
+    tjson_ShapeCacheInit(&cache);
+    tjson_StackInit(&stack, sizeof(tjson_json_frame_t), cJSON_GetNestingLimit());
+    for (;;) {
+        size_t count;
+        const double *values = cJSON_GetPackedArray(current, &count);
+        if (values != NULL) {
+            tjson_PackedToJson(values, count, next_spaces, dsPtr);
+        } else if (cJSON_IsArray(current) || cJSON_IsObject(current)) {
+            frame = (tjson_json_frame_t *) tjson_StackPush(interp, &stack);
+            if (frame == NULL) {
+                tjson_StackFree(&stack);
+                tjson_ShapeCacheFree(&cache);
+                return TCL_ERROR;
             }
-            if (num_spaces) {
+            Tcl_DStringAppend(dsPtr, cJSON_IsArray(current) ? LBRACKET : LBRACE, 1);
+            if (next_spaces) {
                 Tcl_DStringAppend(dsPtr, NL, 1);
-                for (int i = 0; i < num_spaces - 2; i++) {
-                    Tcl_DStringAppend(dsPtr, SP, 1);
-                }
             }
-            Tcl_DStringAppend(dsPtr, RBRACKET, 1);
-            return TCL_OK;
-        case cJSON_Object:
-            Tcl_DStringAppend(dsPtr, LBRACE, 1);
-            if (num_spaces) {
-                Tcl_DStringAppend(dsPtr, NL, 1);
+            cJSON_MaterializeForRead(current);
+            frame->item = current;
+            frame->child = current->child;
+            frame->num_spaces = next_spaces;
+            frame->keys = tjson_IsShaped(current) ? tjson_ShapeCacheGet(&cache, tjson_GetShape(current), 1) : NULL;
+            frame->index = 0;
+            if (frame->child != NULL) {
+                tjson_AppendJsonMember(frame, 1, dsPtr);
+                current = frame->child;
+                next_spaces = next_spaces > 0 ? next_spaces + 2 : 0;
+                continue;
             }
-            cJSON *current_item = item->child;
-            int first_object_item = 1;
-            while (current_item) {
-                if (first_object_item) {
-                    first_object_item = 0;
-                } else {
-                    Tcl_DStringAppend(dsPtr, COMMA, 1);
-                    if (num_spaces) {
-                        Tcl_DStringAppend(dsPtr, NL, 1);
-                    }
-                }
-                if (num_spaces) {
-                    for (int i = 0; i < num_spaces; i++) {
-                        Tcl_DStringAppend(dsPtr, SP, 1);
-                    }
-                }
-                Tcl_DStringAppend(dsPtr, "\"", 1);
-                Tcl_Obj *strToEscapeObjPtr = Tcl_NewStringObj(current_item->string, -1);
-                Tcl_IncrRefCount(strToEscapeObjPtr);
-                tjson_EscapeJsonString(strToEscapeObjPtr, dsPtr);
-                Tcl_DecrRefCount(strToEscapeObjPtr);
-                Tcl_DStringAppend(dsPtr, "\":", 2);
-                if (num_spaces) {
-                    Tcl_DStringAppend(dsPtr, SP, 1);
-                }
-                if (TCL_OK != tjson_TreeToJson(interp, current_item, num_spaces > 0 ? num_spaces + 2 : 0, dsPtr)) {
-                    return TCL_ERROR;
-                }
-                current_item = current_item->next;
+            tjson_AppendJsonEnd(frame, dsPtr);
+            tjson_StackPop(&stack);
+        } else if (TCL_OK != tjson_ScalarToJson(interp, current, dsPtr)) {
+            tjson_StackFree(&stack);
+            tjson_ShapeCacheFree(&cache);
+            return TCL_ERROR;
+        }
+
+        // "current" has been printed, move on to its next sibling
+        for (;;) {
+            if (stack.depth == 0) {
+                tjson_StackFree(&stack);
+                tjson_ShapeCacheFree(&cache);
+                return TCL_OK;
             }
-            if (num_spaces) {
-                Tcl_DStringAppend(dsPtr, NL, 1);
-                for (int i = 0; i < num_spaces - 2; i++) {
-                    Tcl_DStringAppend(dsPtr, SP, 1);
-                }
+            frame = (tjson_json_frame_t *) tjson_StackTop(&stack);
+            frame->child = frame->child->next;
+            frame->index++;
+            if (frame->child != NULL) {
+                tjson_AppendJsonMember(frame, 0, dsPtr);
+                current = frame->child;
+                next_spaces = frame->num_spaces > 0 ? frame->num_spaces + 2 : 0;
+                break;
             }
-            Tcl_DStringAppend(dsPtr, RBRACE, 1);
-            return TCL_OK;
-        default:
-            Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid type", -1));
-            return TCL_ERROR;
+            tjson_AppendJsonEnd(frame, dsPtr);
+            tjson_StackPop(&stack);
+        }
     }
 }
 
@@ -1264,9 +2523,157 @@ static int tjson_ToPrettyJsonCmd(ClientData  clientData, Tcl_Interp *interp, int
     return TCL_OK;
 }
 
+// formats of "::tjson::query -values", in the order of tjson_format_t
+static const char *tjson_value_formats[] = {
+        "simple",
+        "typed",
+        "json",
+        NULL
+};
+
+// Returns the matches of a query of "root" as a list of handles, each match
+// being registered as a handle of its own, or as a list of values converted
+// in place, which adds nothing to the handle table.
+static Tcl_Obj *tjson_MatchesToList(Tcl_Interp *interp, cJSON *root, jsonpath_result_t *result, tjson_format_t format,
+                                    Tcl_DString *dsPtr) {
+    Tcl_Obj *listPtr = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < result->items_length; i++) {
+        Tcl_Obj *elemPtr;
+        switch (format) {
+            case TJSON_FORMAT_HANDLE: {
+                char item_handle[80];
+                CMD_NAME(item_handle, result->items[i]);
+                tjson_RegisterChildNode(item_handle, result->items[i], root);
+                elemPtr = Tcl_NewStringObj(item_handle, -1);
+                break;
+            }
+            case TJSON_FORMAT_SIMPLE:
+            case TJSON_FORMAT_TYPED:
+                elemPtr = format == TJSON_FORMAT_SIMPLE
+                          ? tjson_TreeToSimple(interp, result->items[i])
+                          : tjson_TreeToTyped(interp, result->items[i]);
+                break;
+            case TJSON_FORMAT_JSON:
+                Tcl_DStringSetLength(dsPtr, 0);
+                elemPtr = TCL_OK == tjson_TreeToJson(interp, result->items[i], 0, dsPtr)
+                          ? Tcl_NewStringObj(Tcl_DStringValue(dsPtr), Tcl_DStringLength(dsPtr))
+                          : NULL;
+                break;
+        }
+        if (elemPtr == NULL) {
+            Tcl_DecrRefCount(listPtr);
+            return NULL;
+        }
+        Tcl_ListObjAppendElement(interp, listPtr, elemPtr);
+    }
+    return listPtr;
+}
+
+// what a query returns: its matches, how many there are or whether there is any
+typedef enum {
+    TJSON_QUERY_MATCHES,
+    TJSON_QUERY_COUNT,
+    TJSON_QUERY_EXISTS
+} tjson_query_mode_t;
+
+typedef struct {
+    tjson_format_t format;
+    tjson_query_mode_t mode;
+    int limit;
+} tjson_query_options_t;
+
+// Parses the options of the query commands, starting at objv[first].
+static int tjson_GetQueryOptions(Tcl_Interp *interp, int first, int objc, Tcl_Obj * const objv[], const char *usage,
+                                 tjson_query_options_t *opts) {
+    static const char *options[] = {"-values", "-limit", "-count", "-exists", NULL};
+    enum options { OPT_VALUES, OPT_LIMIT, OPT_COUNT, OPT_EXISTS };
+
+    opts->format = TJSON_FORMAT_HANDLE;
+    opts->mode = TJSON_QUERY_MATCHES;
+    opts->limit = 0;
+    for (int i = first; i < objc; i++) {
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &index)) {
+            return TCL_ERROR;
+        }
+        switch ((enum options) index) {
+            case OPT_VALUES:
+            case OPT_LIMIT:
+                if (i + 1 == objc) {
+                    Tcl_WrongNumArgs(interp, 1, objv, usage);
+                    return TCL_ERROR;
+                }
+                if (index == OPT_VALUES) {
+                    if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[++i], tjson_value_formats, "format", 0, &index)) {
+                        return TCL_ERROR;
+                    }
+                    opts->format = (tjson_format_t) (TJSON_FORMAT_SIMPLE + index);
+                } else {
+                    if (TCL_OK != Tcl_GetIntFromObj(interp, objv[++i], &opts->limit)) {
+                        return TCL_ERROR;
+                    }
+                    if (opts->limit < 1) {
+                        SetResult("limit must be a positive integer");
+                        return TCL_ERROR;
+                    }
+                }
+                break;
+            case OPT_COUNT:
+            case OPT_EXISTS:
+                if (opts->mode != TJSON_QUERY_MATCHES) {
+                    SetResult("-count and -exists cannot be combined");
+                    return TCL_ERROR;
+                }
+                opts->mode = index == OPT_COUNT ? TJSON_QUERY_COUNT : TJSON_QUERY_EXISTS;
+                break;
+        }
+    }
+    if (opts->mode != TJSON_QUERY_MATCHES && opts->format != TJSON_FORMAT_HANDLE) {
+        SetResult("-values cannot be combined with -count or -exists");
+        return TCL_ERROR;
+    }
+    if (opts->mode == TJSON_QUERY_EXISTS) {
+        opts->limit = 1;
+    }
+    return TCL_OK;
+}
+
+// With -count or -exists the matches are only counted, into no buffer at all.
+static void tjson_InitQueryResult(jsonpath_result_t *result, tjson_query_options_t *opts) {
+    result->items_length = 0;
+    result->limit = opts->limit;
+    result->parents = NULL;
+    result->missing = 0;
+    if (opts->mode == TJSON_QUERY_MATCHES) {
+        result->k = 16;
+        result->items = (cJSON **) Tcl_Alloc(sizeof(cJSON *) * result->k);
+    } else {
+        result->k = 0;
+        result->items = NULL;
+    }
+}
+
+static Tcl_Obj *tjson_QueryResultToObj(Tcl_Interp *interp, cJSON *root, jsonpath_result_t *result,
+                                       tjson_query_options_t *opts, Tcl_DString *dsPtr) {
+    switch (opts->mode) {
+        case TJSON_QUERY_COUNT:
+            return Tcl_NewIntObj(result->items_length);
+        case TJSON_QUERY_EXISTS:
+            return Tcl_NewBooleanObj(result->items_length > 0);
+        default:
+            return tjson_MatchesToList(interp, root, result, opts->format, dsPtr);
+    }
+}
+
 static int tjson_QueryCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
-    DBG(fprintf(stderr, "AppendItemToArrayCmd\n"));
-    CheckArgs(3, 3, 1, "handle jsonpath");
+    DBG(fprintf(stderr, "QueryCmd\n"));
+    CheckArgs(3, 8, 1, "handle jsonpath ?-values simple|typed|json? ?-limit n? ?-count|-exists?");
+
+    tjson_query_options_t opts;
+    if (TCL_OK != tjson_GetQueryOptions(interp, 3, objc, objv,
+                                        "handle jsonpath ?-values simple|typed|json? ?-limit n? ?-count|-exists?", &opts)) {
+        return TCL_ERROR;
+    }
 
     const char *handle = Tcl_GetString(objv[1]);
     cJSON *root_structure = tjson_GetInternalFromNode(handle);
@@ -1275,132 +2682,888 @@ static int tjson_QueryCmd(ClientData  clientData, Tcl_Interp *interp, int objc,
         return TCL_ERROR;
     }
 
-    Tcl_Size length;
-    const char *jsonpath = Tcl_GetStringFromObj(objv[2], &length);
     jsonpath_result_t result;
-    result.k = 16;
-    result.items_length = 0;
-    result.items = (cJSON **)malloc(sizeof(cJSON *) * result.k);
-    if (TCL_OK != jsonpath_match(interp, jsonpath, length, root_structure, &result)) {
-        free(result.items);
+    tjson_InitQueryResult(&result, &opts);
+    tjson_query_index_t queryIndex;
+    int rc = jsonpath_match_obj(interp, objv[2], root_structure, tjson_AcquireKeyIndex(root_structure, &queryIndex),
+                                &result);
+    tjson_ReleaseKeyIndex(&queryIndex);
+    if (TCL_OK != rc) {
+        Tcl_Free((char *) result.items);
         return TCL_ERROR;
     }
-    Tcl_Obj *listPtr = Tcl_NewListObj(0, NULL);
-    for (int i = 0; i < result.items_length; i++) {
-        char item_handle[80];
-        CMD_NAME(item_handle, result.items[i]);
-        tjson_RegisterNode(item_handle, result.items[i]);
-        // IMPORTANT: mark the node to unregister when cJSON_Delete is called
-        result.items[i]->flags |= VISIBLE_IN_TCL;
-        Tcl_ListObjAppendElement(interp, listPtr, Tcl_NewStringObj(item_handle, -1));
+    Tcl_DString ds;
+    Tcl_DStringInit(&ds);
+    Tcl_Obj *resultPtr = tjson_QueryResultToObj(interp, root_structure, &result, &opts, &ds);
+    Tcl_DStringFree(&ds);
+    Tcl_Free((char *) result.items);
+    if (resultPtr == NULL) {
+        return TCL_ERROR;
     }
-    free(result.items);
-    Tcl_SetObjResult(interp, listPtr);
+    Tcl_SetObjResult(interp, resultPtr);
     return TCL_OK;
 }
 
-static int serialize(Tcl_Interp *interp, Tcl_Obj *specPtr, Tcl_DString *dsPtr);
+// Evaluates all paths in one traversal of the document and returns a dict
+// of name -> matches, each converted like ::tjson::query does. The options
+// apply to each path on its own.
+static int tjson_QueryMultiCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "QueryMultiCmd\n"));
+    CheckArgs(3, 8, 1, "handle {name jsonpath ...} ?-values simple|typed|json? ?-limit n? ?-count|-exists?");
 
-static int serialize_list(Tcl_Interp *interp, Tcl_Obj *listPtr, Tcl_DString *dsPtr) {
-    Tcl_DStringAppend(dsPtr, LBRACKET, 1);
-    Tcl_Size listLength;
-    Tcl_ListObjLength(interp, listPtr, &listLength);
-    int first = 1;
-    for (Tcl_Size i = 0; i < listLength; i++) {
-        if (!first) {
-            Tcl_DStringAppend(dsPtr, COMMA, 1);
-        } else {
-            first = 0;
-        }
-        Tcl_Obj *elemSpecPtr;
-        Tcl_ListObjIndex(interp, listPtr, i, &elemSpecPtr);
-        if (TCL_OK != serialize(interp, elemSpecPtr, dsPtr)) {
+    tjson_query_options_t opts;
+    if (TCL_OK != tjson_GetQueryOptions(interp, 3, objc, objv,
+                                        "handle {name jsonpath ...} ?-values simple|typed|json? ?-limit n? ?-count|-exists?",
+                                        &opts)) {
+        return TCL_ERROR;
+    }
+
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Size num_elems;
+    Tcl_Obj **elems;
+    if (TCL_OK != Tcl_ListObjGetElements(interp, objv[2], &num_elems, &elems)) {
+        return TCL_ERROR;
+    }
+    if (num_elems % 2 != 0) {
+        SetResult("missing jsonpath for the last name");
+        return TCL_ERROR;
+    }
+    // the result is a dict, a repeated name would drop the matches of a path
+    Tcl_HashTable seen;
+    Tcl_InitHashTable(&seen, TCL_STRING_KEYS);
+    for (Tcl_Size i = 0; i < num_elems; i += 2) {
+        int newEntry;
+        Tcl_CreateHashEntry(&seen, Tcl_GetString(elems[i]), &newEntry);
+        if (!newEntry) {
+            Tcl_DeleteHashTable(&seen);
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("duplicate name \"%s\"", Tcl_GetString(elems[i])));
             return TCL_ERROR;
         }
     }
-    Tcl_DStringAppend(dsPtr, RBRACKET, 1);
+    Tcl_DeleteHashTable(&seen);
+
+    // hold on to the names and paths, the element array is only borrowed from the list
+    int num_paths = (int) (num_elems / 2);
+    Tcl_Obj **paths = (Tcl_Obj **) Tcl_Alloc(sizeof(Tcl_Obj *) * (num_paths + 1));
+    Tcl_Obj **names = (Tcl_Obj **) Tcl_Alloc(sizeof(Tcl_Obj *) * (num_paths + 1));
+    jsonpath_result_t *results = (jsonpath_result_t *) Tcl_Alloc(sizeof(jsonpath_result_t) * (num_paths + 1));
+    for (int i = 0; i < num_paths; i++) {
+        names[i] = elems[2 * i];
+        paths[i] = elems[2 * i + 1];
+        Tcl_IncrRefCount(names[i]);
+        Tcl_IncrRefCount(paths[i]);
+        tjson_InitQueryResult(&results[i], &opts);
+    }
+
+    tjson_query_index_t queryIndex;
+    int rc = jsonpath_match_multi_obj(interp, num_paths, paths, root_structure,
+                                      tjson_AcquireKeyIndex(root_structure, &queryIndex), results);
+    tjson_ReleaseKeyIndex(&queryIndex);
+    Tcl_Obj *dictPtr = Tcl_NewDictObj();
+    Tcl_DString ds;
+    Tcl_DStringInit(&ds);
+    for (int i = 0; i < num_paths && rc == TCL_OK; i++) {
+        Tcl_Obj *valuePtr = tjson_QueryResultToObj(interp, root_structure, &results[i], &opts, &ds);
+        if (valuePtr == NULL) {
+            rc = TCL_ERROR;
+            break;
+        }
+        Tcl_DictObjPut(interp, dictPtr, names[i], valuePtr);
+    }
+    Tcl_DStringFree(&ds);
+    for (int i = 0; i < num_paths; i++) {
+        Tcl_DecrRefCount(names[i]);
+        Tcl_DecrRefCount(paths[i]);
+        Tcl_Free((char *) results[i].items);
+    }
+    Tcl_Free((char *) paths);
+    Tcl_Free((char *) names);
+    Tcl_Free((char *) results);
+    if (rc != TCL_OK) {
+        Tcl_DecrRefCount(dictPtr);
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, dictPtr);
     return TCL_OK;
 }
 
-static int serialize_map(Tcl_Interp *interp, Tcl_Obj *dictPtr, Tcl_DString *dsPtr) {
-    Tcl_DStringAppend(dsPtr, LBRACE, -1);
-    Tcl_DictSearch search;
-    Tcl_Obj *key, *elemSpecPtr;
-    int done;
-    if (Tcl_DictObjFirst(interp, dictPtr, &search,
-                         &key, &elemSpecPtr, &done) != TCL_OK) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid dict", -1));
-        return TCL_ERROR; // invalid dict
-    }
-    int first = 1;
-    for (; !done; Tcl_DictObjNext(&search, &key, &elemSpecPtr, &done)) {
-        if (!first) {
-            Tcl_DStringAppend(dsPtr, COMMA, 1);
-        } else {
-            first = 0;
+// Replaces "item" of "parent" by pointer. A member keeps its key, and a
+// shaped object its shape.
+static int tjson_ReplaceItem(cJSON *parent, cJSON *item, cJSON *replacement) {
+    if (item->string != NULL) {
+        size_t length = strlen(item->string) + 1;
+        replacement->string = (char *) cJSON_malloc(length);
+        if (replacement->string == NULL) {
+            return 0;
         }
-        Tcl_DStringAppend(dsPtr, "\"", 1);
-        tjson_EscapeJsonString(key, dsPtr);
-        Tcl_DStringAppend(dsPtr, "\":", 2);
-        if (TCL_OK != serialize(interp, elemSpecPtr, dsPtr)) {
+        memcpy(replacement->string, item->string, length);
+    }
+    return cJSON_ReplaceItemViaPointer(parent, item, replacement);
+}
+
+// Evaluates the path of query_set and query_delete, collecting each match
+// once along with its parent, so that the edits are made by pointer without
+// looking the matches up again. The matches of a path never nest (a deep
+// scan ends its descent at a match), so editing one leaves the others alone.
+// The node of the handle is stored in "nodePtr". With "missing", a path
+// ending in a child name also gives each object lacking that member, as the
+// parent of a NULL match.
+static int tjson_QueryEditMatches(Tcl_Interp *interp, Tcl_Obj * const objv[], const char *verb, int missing,
+                                  cJSON **nodePtr, jsonpath_result_t *result) {
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    *nodePtr = root_structure;
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    if (root_structure->flags & FROZEN_NODE) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
+    result->k = 16;
+    result->items_length = 0;
+    result->items = (cJSON **) Tcl_Alloc(sizeof(cJSON *) * result->k);
+    result->parents = (cJSON **) Tcl_Alloc(sizeof(cJSON *) * result->k);
+    result->limit = 0;
+    result->missing = missing;
+    result->missing_name = NULL;
+    if (TCL_OK != jsonpath_match_obj(interp, objv[2], root_structure, NULL, result)) {
+        return TCL_ERROR;
+    }
+
+    for (int i = 0; i < result->items_length; i++) {
+        if (result->parents[i] == NULL) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot %s the root", verb));
             return TCL_ERROR;
         }
     }
-    Tcl_DictObjDone(&search);
-    Tcl_DStringAppend(dsPtr, RBRACE, 1);
     return TCL_OK;
 }
 
-static int serialize(Tcl_Interp *interp, Tcl_Obj *specPtr, Tcl_DString *dsPtr) {
-    Tcl_Size length;
-    Tcl_ListObjLength(interp, specPtr, &length);
-    if (length != 2) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid spec", -1));
-        return TCL_ERROR;  /* invalid spec length */
+// Replaces every match of the path with a value built from the typed spec,
+// adding the member named by the last step of the path to the objects that
+// lack it, and returns the number of values set.
+static int tjson_QuerySetCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "QuerySetCmd\n"));
+    CheckArgs(4,4,1,"handle jsonpath typed_item_spec");
+
+    cJSON *value = NULL;
+    if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[3], &value)) {
+        return TCL_ERROR;
     }
-    Tcl_Obj *typePtr, *valuePtr;
-    Tcl_ListObjIndex(interp, specPtr, 0, &typePtr);
-    Tcl_ListObjIndex(interp, specPtr, 1, &valuePtr);
-    Tcl_Size typeLength;
-    const char *type = Tcl_GetStringFromObj(typePtr, &typeLength);
-    Tcl_Size numstr_length;
-    const char *numstr;
-    switch(type[0]) {
-        case 'S':
-            Tcl_DStringAppend(dsPtr, "\"", 1);
-            tjson_EscapeJsonString(valuePtr, dsPtr);
-            Tcl_DStringAppend(dsPtr, "\"", 1);
-            break;
-        case 'N':
-            numstr = Tcl_GetStringFromObj(valuePtr, &numstr_length);
-            Tcl_DStringAppend(dsPtr, numstr, numstr_length);
+
+    cJSON *root_structure;
+    jsonpath_result_t result;
+    result.items = NULL;
+    result.parents = NULL;
+    if (TCL_OK != tjson_QueryEditMatches(interp, objv, "replace", 1, &root_structure, &result)) {
+        Tcl_Free((char *) result.items);
+        Tcl_Free((char *) result.parents);
+        cJSON_Delete(value);
+        return TCL_ERROR;
+    }
+
+    // the last match takes the value itself, the others a copy of it
+    int replaced = 0;
+    for (; replaced < result.items_length; replaced++) {
+        cJSON *item = result.items[replaced];
+        cJSON *replacement = replaced + 1 < result.items_length ? cJSON_Duplicate(value, 1) : value;
+        if (replacement == NULL) {
             break;
-        case 'B':
-            if (typeLength == 1) {
-                // TODO
-            } else if (0 == strcmp("BOOL", type)) {
-                int flag;
-                Tcl_GetBooleanFromObj(interp, valuePtr, &flag);
-                Tcl_DStringAppend(dsPtr, flag ? "true" : "false", flag ? 4 : 5);
-            }
+        }
+        int ok = item != NULL
+                 ? tjson_ReplaceItem(result.parents[replaced], item, replacement)
+                 : cJSON_AddItemToObject(result.parents[replaced], result.missing_name, replacement);
+        if (!ok) {
+            cJSON_Delete(replacement);
             break;
-        case 'M':
-            if (TCL_OK != serialize_map(interp, valuePtr, dsPtr)) {
+        }
+    }
+    Tcl_Free((char *) result.items);
+    Tcl_Free((char *) result.parents);
+    if (replaced > 0) {
+        tjson_BumpMutationEpoch(root_structure);
+    }
+    if (replaced < result.items_length) {
+        if (replaced + 1 < result.items_length) {
+            cJSON_Delete(value);
+        }
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("error while replacing item", -1));
+        return TCL_ERROR;
+    }
+    if (replaced == 0) {
+        cJSON_Delete(value);
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(replaced));
+    return TCL_OK;
+}
+
+// Deletes every match of the path and returns the number of values deleted.
+static int tjson_QueryDeleteCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "QueryDeleteCmd\n"));
+    CheckArgs(3,3,1,"handle jsonpath");
+
+    cJSON *root_structure;
+    jsonpath_result_t result;
+    result.items = NULL;
+    result.parents = NULL;
+    if (TCL_OK != tjson_QueryEditMatches(interp, objv, "delete", 0, &root_structure, &result)) {
+        Tcl_Free((char *) result.items);
+        Tcl_Free((char *) result.parents);
+        return TCL_ERROR;
+    }
+
+    for (int i = 0; i < result.items_length; i++) {
+        cJSON_Delete(cJSON_DetachItemViaPointer(result.parents[i], result.items[i]));
+    }
+    int deleted = result.items_length;
+    Tcl_Free((char *) result.items);
+    Tcl_Free((char *) result.parents);
+    if (deleted > 0) {
+        tjson_BumpMutationEpoch(root_structure);
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(deleted));
+    return TCL_OK;
+}
+
+// Resolves the JSON Pointer in objv[2] from the node of the handle in
+// objv[1], which is stored in "nodePtr".
+static int tjson_ResolvePointerArgs(Tcl_Interp *interp, Tcl_Obj * const objv[], int modify, cJSON **nodePtr,
+                                    tjson_pointer_t *pointer) {
+    const char *handle = Tcl_GetString(objv[1]);
+    cJSON *root_structure = tjson_GetInternalFromNode(handle);
+    *nodePtr = root_structure;
+    if (!root_structure) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node not found", -1));
+        return TCL_ERROR;
+    }
+
+    if (modify && (root_structure->flags & FROZEN_NODE)) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("node is frozen", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Size length;
+    const char *text = Tcl_GetStringFromObj(objv[2], &length);
+    const char *error;
+    if (!tjson_PointerResolve(root_structure, text, (size_t) length, pointer, &error)) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(error, -1));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+static int tjson_PointerGetCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "PointerGetCmd\n"));
+    CheckArgs(3,4,1,"handle pointer ?-simple?");
+
+    static const char *options[] = {"-simple", NULL};
+    int index;
+    if (objc == 4 && TCL_OK != Tcl_GetIndexFromObj(interp, objv[3], options, "option", 0, &index)) {
+        return TCL_ERROR;
+    }
+
+    cJSON *root_structure;
+    tjson_pointer_t pointer;
+    if (TCL_OK != tjson_ResolvePointerArgs(interp, objv, 0, &root_structure, &pointer)) {
+        return TCL_ERROR;
+    }
+
+    cJSON *item = pointer.item;
+    if (item == NULL) {
+        SetResult(cJSON_IsArray(pointer.parent) ? "index out of bounds" : "key not found");
+        return TCL_ERROR;
+    }
+
+    if (objc == 4) {
+        Tcl_Obj *resultPtr = tjson_TreeToSimple(interp, item);
+        if (resultPtr == NULL) {
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, resultPtr);
+        return TCL_OK;
+    }
+
+    char item_handle[80];
+    CMD_NAME(item_handle, item);
+    tjson_RegisterChildNode(item_handle, item, root_structure);
+
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(item_handle, -1));
+    return TCL_OK;
+}
+
+// Replaces the value the pointer refers to, or adds it when the last token
+// names a missing member or the end of an array.
+static int tjson_PointerSetCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "PointerSetCmd\n"));
+    CheckArgs(4,4,1,"handle pointer typed_item_spec");
+
+    cJSON *root_structure;
+    tjson_pointer_t pointer;
+    if (TCL_OK != tjson_ResolvePointerArgs(interp, objv, 1, &root_structure, &pointer)) {
+        return TCL_ERROR;
+    }
+
+    if (pointer.parent == NULL) {
+        SetResult("cannot replace the root");
+        return TCL_ERROR;
+    }
+
+    if (pointer.item == NULL && cJSON_IsArray(pointer.parent)
+        && pointer.index != cJSON_GetArraySize(pointer.parent)) {
+        SetResult("index out of bounds");
+        return TCL_ERROR;
+    }
+
+    cJSON *item = NULL;
+    if (TCL_OK != tjson_CreateItemFromSpec(interp, objv[3], &item)) {
+        return TCL_ERROR;
+    }
+
+    int ok;
+    if (pointer.item != NULL) {
+        ok = tjson_ReplaceItem(pointer.parent, pointer.item, item);
+    } else if (cJSON_IsArray(pointer.parent)) {
+        ok = cJSON_AddItemToArray(pointer.parent, item);
+    } else {
+        Tcl_DString ds;
+        Tcl_DStringInit(&ds);
+        Tcl_DStringSetLength(&ds, (Tcl_Size) pointer.token_length);
+        tjson_PointerUnescape(pointer.token, pointer.token_length, Tcl_DStringValue(&ds));
+        ok = cJSON_AddItemToObject(pointer.parent, Tcl_DStringValue(&ds), item);
+        Tcl_DStringFree(&ds);
+    }
+    if (!ok) {
+        cJSON_Delete(item);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("error while replacing item", -1));
+        return TCL_ERROR;
+    }
+    tjson_BumpMutationEpoch(root_structure);
+    return TCL_OK;
+}
+
+// Deletes the value the pointer refers to, if there is one.
+static int tjson_PointerDeleteCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "PointerDeleteCmd\n"));
+    CheckArgs(3,3,1,"handle pointer");
+
+    cJSON *root_structure;
+    tjson_pointer_t pointer;
+    if (TCL_OK != tjson_ResolvePointerArgs(interp, objv, 1, &root_structure, &pointer)) {
+        return TCL_ERROR;
+    }
+
+    if (pointer.parent == NULL) {
+        SetResult("cannot delete the root");
+        return TCL_ERROR;
+    }
+
+    if (pointer.item != NULL) {
+        cJSON_Delete(cJSON_DetachItemViaPointer(pointer.parent, pointer.item));
+        tjson_BumpMutationEpoch(root_structure);
+    }
+    return TCL_OK;
+}
+
+// Converts a freshly parsed root into the requested result format. For
+// TJSON_FORMAT_HANDLE the root is registered and owned by the handle table,
+// otherwise it is deleted once converted.
+static int tjson_RootToObj(Tcl_Interp *interp, cJSON *root, tjson_format_t format, Tcl_Obj **resultPtr) {
+    char handle[80];
+    Tcl_DString ds;
+    switch (format) {
+        case TJSON_FORMAT_HANDLE:
+            CMD_NAME(handle, root);
+            tjson_RegisterNode(handle, root);
+            *resultPtr = Tcl_NewStringObj(handle, -1);
+            return TCL_OK;
+        case TJSON_FORMAT_SIMPLE:
+        case TJSON_FORMAT_TYPED:
+            *resultPtr = format == TJSON_FORMAT_SIMPLE ? tjson_TreeToSimple(interp, root) : tjson_TreeToTyped(interp, root);
+            if (*resultPtr == NULL) {
+                cJSON_Delete(root);
                 return TCL_ERROR;
             }
             break;
-        case 'L':
-            if (TCL_OK != serialize_list(interp, valuePtr, dsPtr)) {
+        case TJSON_FORMAT_JSON:
+            Tcl_DStringInit(&ds);
+            if (TCL_OK != tjson_TreeToJson(interp, root, 0, &ds)) {
+                Tcl_DStringFree(&ds);
+                cJSON_Delete(root);
                 return TCL_ERROR;
             }
+            *resultPtr = Tcl_NewStringObj(Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+            Tcl_DStringFree(&ds);
             break;
-        default:
-            Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid type in spec", -1));
-            return TCL_ERROR;  /* invalid type */
+    }
+    cJSON_Delete(root);
+    return TCL_OK;
+}
+
+// Destroys the documents a failing command has already registered and put
+// in its result list as handles, which would otherwise never be freed.
+static void tjson_DestroyHandleList(Tcl_Obj *listPtr) {
+    Tcl_Size num_handles;
+    Tcl_Obj **handles;
+    if (TCL_OK != Tcl_ListObjGetElements(NULL, listPtr, &num_handles, &handles)) {
+        return;
+    }
+    for (Tcl_Size i = 0; i < num_handles; i++) {
+        const char *handle = Tcl_GetString(handles[i]);
+        cJSON *root = tjson_GetInternalFromNode(handle);
+        if (root != NULL) {
+            tjson_UnregisterNode(handle);
+            tjson_DeleteRoot(root);
+        }
+    }
+}
+
+typedef struct {
+    const char **texts;
+    size_t *lengths;
+    cJSON **roots;
+} tjson_parse_many_t;
+
+static void tjson_ParseManyWorkProc(void *clientData, size_t index) {
+    tjson_parse_many_t *batch = (tjson_parse_many_t *) clientData;
+    batch->roots[index] = batch->lengths[index] > 0
+            ? cJSON_ParseWithLength(batch->texts[index], batch->lengths[index])
+            : NULL;
+}
+
+// Parses all documents of "batch" on "num_threads" threads and converts the
+// results on the calling thread, in input order. Tcl objects are never
+// touched off-thread.
+static int tjson_ParseBatch(Tcl_Interp *interp, tjson_parse_many_t *batch, size_t num_docs, int num_threads,
+                            tjson_format_t format) {
+    tjson_RunParallel(num_threads, num_docs, tjson_ParseManyWorkProc, batch);
+
+    for (size_t i = 0; i < num_docs; i++) {
+        if (batch->roots[i] == NULL) {
+            for (size_t j = 0; j < num_docs; j++) {
+                if (batch->roots[j] != NULL) {
+                    cJSON_Delete(batch->roots[j]);
+                }
+            }
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid json at index %" TCL_SIZE_MODIFIER "d", (Tcl_Size) i));
+            return TCL_ERROR;
+        }
+    }
+
+    Tcl_Obj *listPtr = Tcl_NewListObj(0, NULL);
+    for (size_t i = 0; i < num_docs; i++) {
+        Tcl_Obj *elemPtr = NULL;
+        cJSON *root = batch->roots[i];
+        batch->roots[i] = NULL;
+        if (TCL_OK != tjson_RootToObj(interp, root, format, &elemPtr)) {
+            for (size_t j = i + 1; j < num_docs; j++) {
+                cJSON_Delete(batch->roots[j]);
+            }
+            if (format == TJSON_FORMAT_HANDLE) {
+                tjson_DestroyHandleList(listPtr);
+            }
+            Tcl_DecrRefCount(listPtr);
+            return TCL_ERROR;
+        }
+        Tcl_ListObjAppendElement(interp, listPtr, elemPtr);
+    }
+    Tcl_SetObjResult(interp, listPtr);
+    return TCL_OK;
+}
+
+static int tjson_GetParseManyOptions(Tcl_Interp *interp, int objc, Tcl_Obj * const objv[], int last,
+                                     int *num_threads, tjson_format_t *format) {
+    static const char *options[] = {"-threads", "-format", NULL};
+    enum options { OPT_THREADS, OPT_FORMAT };
+
+    *num_threads = tjson_DefaultNumThreads();
+    *format = TJSON_FORMAT_HANDLE;
+    for (int i = 1; i < last; i += 2) {
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &index)) {
+            return TCL_ERROR;
+        }
+        if (i + 1 >= last) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing value for option \"%s\"", options[index]));
+            return TCL_ERROR;
+        }
+        switch ((enum options) index) {
+            case OPT_THREADS:
+                if (TCL_OK != Tcl_GetIntFromObj(interp, objv[i + 1], num_threads)) {
+                    return TCL_ERROR;
+                }
+                if (*num_threads < 1) {
+                    SetResult("number of threads must be positive");
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_FORMAT:
+                if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i + 1], tjson_formats, "format", 0, (int *) format)) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
     }
     return TCL_OK;
 }
 
+static int tjson_ParseManyCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ParseManyCmd\n"));
+    if (objc < 2 || objc % 2 != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-threads n? ?-format handle|simple|typed|json? json_list");
+        return TCL_ERROR;
+    }
+
+    int num_threads;
+    tjson_format_t format;
+    if (TCL_OK != tjson_GetParseManyOptions(interp, objc, objv, objc - 1, &num_threads, &format)) {
+        return TCL_ERROR;
+    }
+
+    Tcl_Size num_docs;
+    Tcl_Obj **docs;
+    if (TCL_OK != Tcl_ListObjGetElements(interp, objv[objc - 1], &num_docs, &docs)) {
+        return TCL_ERROR;
+    }
+
+    tjson_parse_many_t batch;
+    batch.texts = (const char **) Tcl_Alloc(sizeof(char *) * (num_docs + 1));
+    batch.lengths = (size_t *) Tcl_Alloc(sizeof(size_t) * (num_docs + 1));
+    batch.roots = (cJSON **) Tcl_Alloc(sizeof(cJSON *) * (num_docs + 1));
+    // string reps must be generated here, the workers may not touch Tcl_Objs
+    for (Tcl_Size i = 0; i < num_docs; i++) {
+        Tcl_Size length;
+        batch.texts[i] = Tcl_GetStringFromObj(docs[i], &length);
+        batch.lengths[i] = length;
+        batch.roots[i] = NULL;
+    }
+
+    int rc = tjson_ParseBatch(interp, &batch, num_docs, num_threads, format);
+
+    Tcl_Free((char *) batch.texts);
+    Tcl_Free((char *) batch.lengths);
+    Tcl_Free((char *) batch.roots);
+    return rc;
+}
+
+static int tjson_ParseNdjsonFileCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ParseNdjsonFileCmd\n"));
+    if (objc < 2 || objc % 2 != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-threads n? ?-format handle|simple|typed|json? path");
+        return TCL_ERROR;
+    }
+
+    int num_threads;
+    tjson_format_t format;
+    if (TCL_OK != tjson_GetParseManyOptions(interp, objc, objv, objc - 1, &num_threads, &format)) {
+        return TCL_ERROR;
+    }
+
+    tjson_filemap_t map;
+    if (TCL_OK != tjson_MapFile(interp, objv[objc - 1], 0, &map)) {
+        return TCL_ERROR;
+    }
+    if (TCL_OK != tjson_CheckFileUtf8(interp, &map)) {
+        return TCL_ERROR;
+    }
+    const char *content = map.data;
+    const char *end = content + map.length;
+
+    // one document per line, blank lines are skipped
+    size_t k = 1024;
+    size_t num_docs = 0;
+    tjson_parse_many_t batch;
+    batch.texts = (const char **) Tcl_Alloc(sizeof(char *) * k);
+    batch.lengths = (size_t *) Tcl_Alloc(sizeof(size_t) * k);
+    const char *p = content;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+        const char *line_end = eol;
+        while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        while (line_end > p && (line_end[-1] == ' ' || line_end[-1] == '\t' || line_end[-1] == '\r')) {
+            line_end--;
+        }
+        if (line_end > p) {
+            if (num_docs == k) {
+                k *= 2;
+                batch.texts = (const char **) Tcl_Realloc((char *) batch.texts, sizeof(char *) * k);
+                batch.lengths = (size_t *) Tcl_Realloc((char *) batch.lengths, sizeof(size_t) * k);
+            }
+            batch.texts[num_docs] = p;
+            batch.lengths[num_docs] = line_end - p;
+            num_docs++;
+        }
+        p = eol + 1;
+    }
+    batch.roots = (cJSON **) Tcl_Alloc(sizeof(cJSON *) * (num_docs + 1));
+    memset(batch.roots, 0, sizeof(cJSON *) * (num_docs + 1));
+
+    int rc = tjson_ParseBatch(interp, &batch, num_docs, num_threads, format);
+
+    Tcl_Free((char *) batch.texts);
+    Tcl_Free((char *) batch.lengths);
+    Tcl_Free((char *) batch.roots);
+    tjson_UnmapFile(&map);
+    return rc;
+}
+
+typedef struct {
+    Tcl_Interp *interp;
+    tjson_format_t format;
+    Tcl_Obj *listPtr;
+    const char *json;
+} tjson_extract_t;
+
+static int tjson_ExtractEmit(void *clientData, const char *value, size_t length) {
+    tjson_extract_t *ctx = (tjson_extract_t *) clientData;
+    Tcl_Obj *elemPtr;
+    if (ctx->format == TJSON_FORMAT_JSON) {
+        // the matched text is already valid json, hand it out verbatim
+        elemPtr = Tcl_NewStringObj(value, (Tcl_Size) length);
+    } else {
+        cJSON *root = cJSON_ParseWithLength(value, length);
+        if (root == NULL) {
+            Tcl_SetObjResult(ctx->interp, Tcl_ObjPrintf("invalid json at offset %lu",
+                                                        (unsigned long) (value - ctx->json)));
+            return TCL_ERROR;
+        }
+        if (TCL_OK != tjson_RootToObj(ctx->interp, root, ctx->format, &elemPtr)) {
+            return TCL_ERROR;
+        }
+    }
+    return Tcl_ListObjAppendElement(ctx->interp, ctx->listPtr, elemPtr);
+}
+
+static int tjson_ExtractCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
+    DBG(fprintf(stderr, "ExtractCmd\n"));
+    static const char *options[] = {"-format", "-file", NULL};
+    enum options { OPT_FORMAT, OPT_FILE };
+
+    tjson_format_t format = TJSON_FORMAT_SIMPLE;
+    Tcl_Obj *pathPtr = NULL;
+    int i = 1;
+    while (i < objc - 2) {
+        int index;
+        if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &index)) {
+            return TCL_ERROR;
+        }
+        switch ((enum options) index) {
+            case OPT_FORMAT:
+                if (TCL_OK != Tcl_GetIndexFromObj(interp, objv[i + 1], tjson_formats, "format", 0, (int *) &format)) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_FILE:
+                pathPtr = objv[i + 1];
+                break;
+        }
+        i += 2;
+    }
+    if ((pathPtr == NULL && objc - i != 2) || (pathPtr != NULL && objc - i != 1)) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-format handle|simple|typed|json? json|-file path jsonpath");
+        return TCL_ERROR;
+    }
+
+    tjson_filemap_t map;
+    const char *json;
+    size_t json_length;
+    if (pathPtr != NULL) {
+        if (TCL_OK != tjson_MapFile(interp, pathPtr, 0, &map)) {
+            return TCL_ERROR;
+        }
+        if (TCL_OK != tjson_CheckFileUtf8(interp, &map)) {
+            return TCL_ERROR;
+        }
+        json = map.data;
+        json_length = map.length;
+    } else {
+        Tcl_Size length;
+        json = Tcl_GetStringFromObj(objv[i], &length);
+        json_length = length;
+    }
+    if (json_length == 0) {
+        if (pathPtr != NULL) {
+            tjson_UnmapFile(&map);
+        }
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("empty json", -1));
+        return TCL_ERROR;
+    }
+
+    tjson_extract_t ctx;
+    ctx.interp = interp;
+    ctx.format = format;
+    ctx.listPtr = Tcl_NewListObj(0, NULL);
+    ctx.json = json;
+    Tcl_IncrRefCount(ctx.listPtr);
+
+    int rc = jsonpath_extract_obj(interp, objv[objc - 1], json, json_length, tjson_ExtractEmit, &ctx);
+    if (pathPtr != NULL) {
+        tjson_UnmapFile(&map);
+    }
+    if (rc == TCL_OK) {
+        Tcl_SetObjResult(interp, ctx.listPtr);
+    } else if (format == TJSON_FORMAT_HANDLE) {
+        tjson_DestroyHandleList(ctx.listPtr);
+    }
+    Tcl_DecrRefCount(ctx.listPtr);
+    return rc;
+}
+
+typedef struct {
+    Tcl_Obj *valuePtr;      // list of element specs, or dict of member specs
+    int is_map;
+    Tcl_Size index;         // next element of a list
+    Tcl_Size length;        // number of elements of a list
+    Tcl_DictSearch search;  // member iteration of a dict, in progress while on the stack
+} tjson_serialize_frame_t;
+
+// Moves "frame" to its next element or member, storing its spec in
+// "specPtrPtr" and appending the separator and key. Returns 0 when the list
+// or dict is exhausted.
+static int serialize_next(Tcl_Interp *interp, tjson_serialize_frame_t *frame, int first, Tcl_Obj **specPtrPtr,
+                          Tcl_DString *dsPtr) {
+    if (frame->is_map) {
+        Tcl_Obj *key;
+        int done;
+        if (!first) {
+            Tcl_DictObjNext(&frame->search, &key, specPtrPtr, &done);
+        } else if (Tcl_DictObjFirst(interp, frame->valuePtr, &frame->search, &key, specPtrPtr, &done) != TCL_OK) {
+            return -1;
+        }
+        if (done) {
+            return 0;
+        }
+        if (!first) {
+            Tcl_DStringAppend(dsPtr, COMMA, 1);
+        }
+        Tcl_DStringAppend(dsPtr, "\"", 1);
+        tjson_EscapeJsonString(key, dsPtr);
+        Tcl_DStringAppend(dsPtr, "\":", 2);
+        return 1;
+    }
+
+    if (first) {
+        Tcl_ListObjLength(interp, frame->valuePtr, &frame->length);
+    }
+    if (frame->index >= frame->length) {
+        return 0;
+    }
+    if (frame->index > 0) {
+        Tcl_DStringAppend(dsPtr, COMMA, 1);
+    }
+    Tcl_ListObjIndex(interp, frame->valuePtr, frame->index++, specPtrPtr);
+    return 1;
+}
+
+// Serializes a typed spec with an explicit stack of open lists and maps.
+static int serialize(Tcl_Interp *interp, Tcl_Obj *specPtr, Tcl_DString *dsPtr) {
+    tjson_stack_t stack;
+    tjson_serialize_frame_t *frame;
+    int rc = TCL_ERROR;
+    int more;
+
+    tjson_StackInit(&stack, sizeof(tjson_serialize_frame_t), cJSON_GetNestingLimit());
+    for (;;) {
+        Tcl_Size length;
+        Tcl_ListObjLength(interp, specPtr, &length);
+        if (length != 2) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid spec", -1));
+            goto done;  /* invalid spec length */
+        }
+        Tcl_Obj *typePtr, *valuePtr;
+        Tcl_ListObjIndex(interp, specPtr, 0, &typePtr);
+        Tcl_ListObjIndex(interp, specPtr, 1, &valuePtr);
+        Tcl_Size typeLength;
+        const char *type = Tcl_GetStringFromObj(typePtr, &typeLength);
+        Tcl_Size numstr_length;
+        const char *numstr;
+        switch(type[0]) {
+            case 'S':
+                Tcl_DStringAppend(dsPtr, "\"", 1);
+                tjson_EscapeJsonString(valuePtr, dsPtr);
+                Tcl_DStringAppend(dsPtr, "\"", 1);
+                break;
+            case 'N':
+                numstr = Tcl_GetStringFromObj(valuePtr, &numstr_length);
+                Tcl_DStringAppend(dsPtr, numstr, numstr_length);
+                break;
+            case 'B':
+                if (typeLength == 1) {
+                    // TODO
+                } else if (0 == strcmp("BOOL", type)) {
+                    int flag;
+                    Tcl_GetBooleanFromObj(interp, valuePtr, &flag);
+                    Tcl_DStringAppend(dsPtr, flag ? "true" : "false", flag ? 4 : 5);
+                }
+                break;
+            case 'M':
+            case 'L':
+                frame = (tjson_serialize_frame_t *) tjson_StackPush(interp, &stack);
+                if (frame == NULL) {
+                    goto done;
+                }
+                frame->valuePtr = valuePtr;
+                frame->is_map = type[0] == 'M';
+                frame->index = 0;
+                frame->length = 0;
+                Tcl_DStringAppend(dsPtr, frame->is_map ? LBRACE : LBRACKET, 1);
+                more = serialize_next(interp, frame, 1, &specPtr, dsPtr);
+                if (more < 0) {
+                    tjson_StackPop(&stack);
+                    Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid dict", -1));
+                    goto done; // invalid dict
+                }
+                if (more) {
+                    continue;
+                }
+                Tcl_DStringAppend(dsPtr, frame->is_map ? RBRACE : RBRACKET, 1);
+                tjson_StackPop(&stack);
+                break;
+            default:
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("invalid type in spec", -1));
+                goto done;  /* invalid type */
+        }
+
+        // the value is complete, move on to the next element of the enclosing list or map
+        for (;;) {
+            if (stack.depth == 0) {
+                rc = TCL_OK;
+                goto done;
+            }
+            frame = (tjson_serialize_frame_t *) tjson_StackTop(&stack);
+            if (serialize_next(interp, frame, 0, &specPtr, dsPtr)) {
+                break;
+            }
+            Tcl_DStringAppend(dsPtr, frame->is_map ? RBRACE : RBRACKET, 1);
+            tjson_StackPop(&stack);
+        }
+    }
+
+done:
+    for (size_t i = 0; i < stack.depth; i++) {
+        frame = (tjson_serialize_frame_t *) tjson_StackFrame(&stack, i);
+        if (frame->is_map) {
+            Tcl_DictObjDone(&frame->search);
+        }
+    }
+    tjson_StackFree(&stack);
+    return rc;
+}
+
 
 static int tjson_TypedToJsonCmd(ClientData  clientData, Tcl_Interp *interp, int objc, Tcl_Obj * const objv[] ) {
     DBG(fprintf(stderr, "TypedToJsonCmd\n"));
@@ -1457,20 +3620,27 @@ static void tjson_ExitHandler(ClientData unused) {
     Tcl_MutexLock(&tjson_NodeToInternal_HT_Mutex);
     Tcl_DeleteHashTable(&tjson_NodeToInternal_HT);
     Tcl_MutexUnlock(&tjson_NodeToInternal_HT_Mutex);
+    Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+    Tcl_DeleteHashTable(&tjson_RootToDocument_HT);
+    Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
 }
 
 
 void tjson_InitModule() {
     if (!tjson_ModuleInitialized) {
         cJSON_Hooks *hooks = malloc(sizeof(cJSON_Hooks));
-        hooks->malloc_fn = NULL;
-        hooks->free_fn = NULL;
+        hooks->malloc_fn = tjson_PoolAlloc;
+        hooks->free_fn = tjson_PoolFree;
         hooks->unregister_fn = tjson_Unregister;
         cJSON_InitHooks(hooks);
         free(hooks);
         Tcl_MutexLock(&tjson_NodeToInternal_HT_Mutex);
         Tcl_InitHashTable(&tjson_NodeToInternal_HT, TCL_STRING_KEYS);
         Tcl_MutexUnlock(&tjson_NodeToInternal_HT_Mutex);
+        Tcl_MutexLock(&tjson_RootToDocument_HT_Mutex);
+        Tcl_InitHashTable(&tjson_RootToDocument_HT, TCL_ONE_WORD_KEYS);
+        Tcl_InitHashTable(&tjson_NodeToDocument_HT, TCL_ONE_WORD_KEYS);
+        Tcl_MutexUnlock(&tjson_RootToDocument_HT_Mutex);
         Tcl_CreateThreadExitHandler(tjson_ExitHandler, NULL);
         tjson_ModuleInitialized = 1;
         DBG(fprintf(stderr, "tjson module initialized\n"));
@@ -1498,34 +3668,53 @@ int Tjson_Init(Tcl_Interp *interp) {
     Tcl_CreateObjCommand(interp, "::tjson::typed_to_json", tjson_TypedToJsonCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::escape_json_string", tjson_EscapeJsonStringCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::parse", tjson_ParseCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::parse_file", tjson_ParseFileCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::parse_many", tjson_ParseManyCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::parse_ndjson_file", tjson_ParseNdjsonFileCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::validate", tjson_ValidateCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::max_depth", tjson_MaxDepthCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::configure", tjson_ConfigureCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::pool_stats", tjson_PoolStatsCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::arena_reset", tjson_ArenaResetCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::create", tjson_CreateCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::destroy", tjson_DestroyCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::size", tjson_SizeCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::add_item_to_object", tjson_AddItemToObjectCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::replace_item_in_object", tjson_ReplaceItemInObjectCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::delete_item_from_object", tjson_DeleteItemFromObjectCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::get_object_item", tjson_GetObjectItemCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::has_object_item", tjson_HasObjectItemCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::add_item_to_array", tjson_AddItemToArrayCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::insert_item_in_array", tjson_InsertItemInArrayCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::replace_item_in_array", tjson_ReplaceItemInArrayCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::delete_item_from_array", tjson_DeleteItemFromArrayCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::get_array_item", tjson_GetArrayItemCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::get_string", tjson_GetStringCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::get_valuestring", tjson_GetValueStringCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_number", tjson_IsNumberCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_bool", tjson_IsBoolCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_object", tjson_IsObjectCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_array", tjson_IsArrayCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_string", tjson_IsStringCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::is_null", tjson_IsNullCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::get_child_items", tjson_GetChildItemsCmd, NULL, NULL);
-
-    Tcl_CreateObjCommand(interp, "::tjson::to_simple", tjson_ToSimpleCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::to_typed", tjson_ToTypedCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::to_json", tjson_ToJsonCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::to_pretty_json", tjson_ToPrettyJsonCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, "::tjson::query", tjson_QueryCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::freeze", tjson_HandleCmd, (ClientData) tjson_FreezeCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::dedup", tjson_HandleCmd, (ClientData) tjson_DedupCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::size", tjson_HandleCmd, (ClientData) tjson_SizeCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::stats", tjson_HandleCmd, (ClientData) tjson_StatsCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::array_stats", tjson_HandleCmd, (ClientData) tjson_ArrayStatsCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::add_item_to_object", tjson_HandleCmd, (ClientData) tjson_AddItemToObjectCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::replace_item_in_object", tjson_HandleCmd, (ClientData) tjson_ReplaceItemInObjectCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::delete_item_from_object", tjson_HandleCmd, (ClientData) tjson_DeleteItemFromObjectCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::get_object_item", tjson_HandleCmd, (ClientData) tjson_GetObjectItemCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::has_object_item", tjson_HandleCmd, (ClientData) tjson_HasObjectItemCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::add_item_to_array", tjson_HandleCmd, (ClientData) tjson_AddItemToArrayCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::insert_item_in_array", tjson_HandleCmd, (ClientData) tjson_InsertItemInArrayCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::replace_item_in_array", tjson_HandleCmd, (ClientData) tjson_ReplaceItemInArrayCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::delete_item_from_array", tjson_HandleCmd, (ClientData) tjson_DeleteItemFromArrayCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::get_array_item", tjson_HandleCmd, (ClientData) tjson_GetArrayItemCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::get_string", tjson_HandleCmd, (ClientData) tjson_GetStringCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::get_valuestring", tjson_HandleCmd, (ClientData) tjson_GetValueStringCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_number", tjson_HandleCmd, (ClientData) tjson_IsNumberCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_bool", tjson_HandleCmd, (ClientData) tjson_IsBoolCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_object", tjson_HandleCmd, (ClientData) tjson_IsObjectCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_array", tjson_HandleCmd, (ClientData) tjson_IsArrayCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_string", tjson_HandleCmd, (ClientData) tjson_IsStringCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::is_null", tjson_HandleCmd, (ClientData) tjson_IsNullCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::get_child_items", tjson_HandleCmd, (ClientData) tjson_GetChildItemsCmd, NULL);
+
+    Tcl_CreateObjCommand(interp, "::tjson::to_simple", tjson_HandleCmd, (ClientData) tjson_ToSimpleCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::to_typed", tjson_HandleCmd, (ClientData) tjson_ToTypedCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::to_json", tjson_HandleCmd, (ClientData) tjson_ToJsonCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::to_pretty_json", tjson_HandleCmd, (ClientData) tjson_ToPrettyJsonCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::query", tjson_HandleCmd, (ClientData) tjson_QueryCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::query_multi", tjson_HandleCmd, (ClientData) tjson_QueryMultiCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::query_set", tjson_HandleCmd, (ClientData) tjson_QuerySetCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::query_delete", tjson_HandleCmd, (ClientData) tjson_QueryDeleteCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::pointer_get", tjson_HandleCmd, (ClientData) tjson_PointerGetCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::pointer_set", tjson_HandleCmd, (ClientData) tjson_PointerSetCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::pointer_delete", tjson_HandleCmd, (ClientData) tjson_PointerDeleteCmd, NULL);
+    Tcl_CreateObjCommand(interp, "::tjson::extract", tjson_ExtractCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::custom_to_typed", tjson_CustomToTypedCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "::tjson::typed_to_custom", tjson_TypedToCustomCmd, NULL, NULL);
 
@@ -1533,8 +3722,16 @@ int Tjson_Init(Tcl_Interp *interp) {
 }
 
 #ifdef USE_NAVISERVER
+// documents parsed with -arena live for one request, the connection thread
+// wipes its arena when the interp is handed back
+static int tjson_ArenaDeallocateTrace(Tcl_Interp *interp, const void *arg) {
+    tjson_ResetArena();
+    return TCL_OK;
+}
+
 int Ns_ModuleInit(const char *server, const char *module) {
     Ns_TclRegisterTrace(server, (Ns_TclTraceProc *) Tjson_Init, server, NS_TCL_TRACE_CREATE);
+    Ns_TclRegisterTrace(server, tjson_ArenaDeallocateTrace, NULL, NS_TCL_TRACE_DEALLOCATE);
     return NS_OK;
 }
 #endif
@@ -0,0 +1,112 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "packed.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TJSON_PACKED_AVX
+#include <immintrin.h>
+#endif
+
+// Four accumulators per aggregate break the dependency chain of the additions
+// and comparisons, which is what limits a plain loop.
+static void tjson_PackedStatsScalar(const double *values, size_t count, tjson_packed_stats_t *stats) {
+    double sum[4] = {0, 0, 0, 0};
+    double min[4], max[4];
+    size_t i = 0;
+
+    for (int lane = 0; lane < 4; lane++) {
+        min[lane] = max[lane] = values[0];
+    }
+    for (; i + 4 <= count; i += 4) {
+        for (int lane = 0; lane < 4; lane++) {
+            double v = values[i + lane];
+            sum[lane] += v;
+            min[lane] = v < min[lane] ? v : min[lane];
+            max[lane] = v > max[lane] ? v : max[lane];
+        }
+    }
+    for (; i < count; i++) {
+        sum[0] += values[i];
+        min[0] = values[i] < min[0] ? values[i] : min[0];
+        max[0] = values[i] > max[0] ? values[i] : max[0];
+    }
+
+    stats->sum = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    stats->min = min[0];
+    stats->max = max[0];
+    for (int lane = 1; lane < 4; lane++) {
+        stats->min = min[lane] < stats->min ? min[lane] : stats->min;
+        stats->max = max[lane] > stats->max ? max[lane] : stats->max;
+    }
+}
+
+#ifdef TJSON_PACKED_AVX
+
+// Two vectors of four lanes per aggregate, eight values per iteration.
+__attribute__((target("avx")))
+static void tjson_PackedStatsAvx(const double *values, size_t count, tjson_packed_stats_t *stats) {
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    __m256d min0 = _mm256_set1_pd(values[0]), min1 = min0;
+    __m256d max0 = min0, max1 = min0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256d v0 = _mm256_loadu_pd(values + i);
+        __m256d v1 = _mm256_loadu_pd(values + i + 4);
+        sum0 = _mm256_add_pd(sum0, v0);
+        sum1 = _mm256_add_pd(sum1, v1);
+        min0 = _mm256_min_pd(min0, v0);
+        min1 = _mm256_min_pd(min1, v1);
+        max0 = _mm256_max_pd(max0, v0);
+        max1 = _mm256_max_pd(max1, v1);
+    }
+
+    double sum[4], min[4], max[4];
+    _mm256_storeu_pd(sum, _mm256_add_pd(sum0, sum1));
+    _mm256_storeu_pd(min, _mm256_min_pd(min0, min1));
+    _mm256_storeu_pd(max, _mm256_max_pd(max0, max1));
+
+    stats->sum = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    stats->min = min[0];
+    stats->max = max[0];
+    for (int lane = 1; lane < 4; lane++) {
+        stats->min = min[lane] < stats->min ? min[lane] : stats->min;
+        stats->max = max[lane] > stats->max ? max[lane] : stats->max;
+    }
+    for (; i < count; i++) {
+        stats->sum += values[i];
+        stats->min = values[i] < stats->min ? values[i] : stats->min;
+        stats->max = values[i] > stats->max ? values[i] : stats->max;
+    }
+}
+
+static int tjson_HasAvx(void) {
+    static int has_avx = -1;
+    if (has_avx < 0) {
+        __builtin_cpu_init();
+        has_avx = __builtin_cpu_supports("avx") ? 1 : 0;
+    }
+    return has_avx;
+}
+
+#endif
+
+void tjson_PackedStats(const double *values, size_t count, tjson_packed_stats_t *stats) {
+    stats->count = count;
+    stats->sum = 0;
+    stats->min = 0;
+    stats->max = 0;
+    if (count == 0) {
+        return;
+    }
+#ifdef TJSON_PACKED_AVX
+    if (tjson_HasAvx()) {
+        tjson_PackedStatsAvx(values, count, stats);
+        return;
+    }
+#endif
+    tjson_PackedStatsScalar(values, count, stats);
+}
@@ -0,0 +1,24 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_PACKED_H
+#define TJSON_PACKED_H
+
+#include <stddef.h>
+
+// Aggregates of a vector of numbers, such as the values of a packed array
+// (PACKED_ARRAY, see cJSON_PackArrays). All of them are 0 when "count" is 0.
+typedef struct {
+    size_t count;
+    double sum;
+    double min;
+    double max;
+} tjson_packed_stats_t;
+
+// Sums the values in several independent lanes, so the result may differ from
+// a left-to-right sum in the last bits.
+void tjson_PackedStats(const double *values, size_t count, tjson_packed_stats_t *stats);
+
+#endif //TJSON_PACKED_H
@@ -0,0 +1,120 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "pointer.h"
+#include "../shape/shape.h"
+#include <limits.h>
+#include <string.h>
+
+size_t tjson_PointerUnescape(const char *token, size_t length, char *buffer) {
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (token[i] == '~') {
+            buffer[n++] = token[++i] == '0' ? '~' : '/';
+        } else {
+            buffer[n++] = token[i];
+        }
+    }
+    buffer[n] = '\0';
+    return n;
+}
+
+// whether the escaped token names "key"
+static int tjson_PointerTokenEquals(const char *token, size_t length, const char *key) {
+    for (size_t i = 0; i < length; i++, key++) {
+        char c = token[i];
+        if (c == '~') {
+            c = token[++i] == '0' ? '~' : '/';
+        }
+        if (*key != c) {
+            return 0;
+        }
+    }
+    return *key == '\0';
+}
+
+static cJSON *tjson_PointerMember(cJSON *object, const char *token, size_t length) {
+    if (length < TJSON_POINTER_KEY_SIZE) {
+        char key[TJSON_POINTER_KEY_SIZE];
+        tjson_PointerUnescape(token, length, key);
+        return tjson_GetObjectItem(object, key);
+    }
+    cJSON_Materialize(object);
+    for (cJSON *child = object->child; child != NULL; child = child->next) {
+        if (child->string != NULL && tjson_PointerTokenEquals(token, length, child->string)) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+// An array index is "0" or digits without a leading zero, "-" is the end of
+// the array. Indices too large for an int are past the end of any array.
+static int tjson_PointerIndex(cJSON *array, const char *token, size_t length, int *index) {
+    if (length == 1 && token[0] == '-') {
+        *index = cJSON_GetArraySize(array);
+        return 1;
+    }
+    if (length == 0 || (length > 1 && token[0] == '0')) {
+        return 0;
+    }
+    int value = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (token[i] < '0' || token[i] > '9') {
+            return 0;
+        }
+        int digit = token[i] - '0';
+        value = value > (INT_MAX - digit) / 10 ? INT_MAX : 10 * value + digit;
+    }
+    *index = value;
+    return 1;
+}
+
+int tjson_PointerResolve(cJSON *root, const char *pointer, size_t length, tjson_pointer_t *result,
+                         const char **error) {
+    const char *p = pointer;
+    const char *end = pointer + length;
+    result->parent = NULL;
+    result->item = root;
+    result->token = pointer;
+    result->token_length = 0;
+    result->index = -1;
+    if (p < end && *p != '/') {
+        *error = "invalid pointer";
+        return 0;
+    }
+    while (p < end) {
+        cJSON *node = result->item;
+        if (node == NULL) {
+            *error = cJSON_IsArray(result->parent) ? "index out of bounds" : "key not found";
+            return 0;
+        }
+        // "p" is at the '/' before the token
+        const char *token = ++p;
+        while (p < end && *p != '/') {
+            if (*p == '~' && (p + 1 == end || (p[1] != '0' && p[1] != '1'))) {
+                *error = "invalid pointer";
+                return 0;
+            }
+            p += *p == '~' ? 2 : 1;
+        }
+        result->parent = node;
+        result->token = token;
+        result->token_length = p - token;
+        if (cJSON_IsObject(node)) {
+            result->item = tjson_PointerMember(node, token, p - token);
+        } else if (cJSON_IsArray(node)) {
+            if (!tjson_PointerIndex(node, token, p - token, &result->index)) {
+                *error = "invalid index";
+                return 0;
+            }
+            result->item = cJSON_GetArrayItem(node, result->index);
+        } else {
+            *error = "node is not an array or object";
+            return 0;
+        }
+    }
+    return 1;
+}
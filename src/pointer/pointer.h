@@ -0,0 +1,40 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_POINTER_H
+#define TJSON_POINTER_H
+
+#include <tcl.h>
+#include <stddef.h>
+#include "../cJSON/cJSON.h"
+
+// JSON Pointer (RFC 6901): "/a/b/0" refers to a value by the reference
+// tokens leading to it from the root, member names (with "~1" for '/' and
+// "~0" for '~') or array indices, "-" naming the element past the last one.
+//
+// A pointer is resolved in place, one token at a time, without building a
+// path or copying the pointer: a member name is unescaped into a buffer on
+// the C stack, or compared to the keys as it is when longer than that.
+#define TJSON_POINTER_KEY_SIZE 256
+
+typedef struct {
+    cJSON *parent;          // object or array holding "item", NULL for the root itself ("")
+    cJSON *item;            // value referred to, NULL when the last token names none
+    const char *token;      // last reference token, still escaped
+    size_t token_length;
+    int index;              // position of the last token in an array parent
+} tjson_pointer_t;
+
+// Resolves "pointer" from "root". Every token but the last one must refer to
+// a value; the last one may name a missing member, or the element at the end
+// of an array, in which case "item" is NULL. Returns 0 with a static message
+// in "error" when the pointer is malformed or cannot be followed.
+int tjson_PointerResolve(cJSON *root, const char *pointer, size_t length, tjson_pointer_t *result,
+                         const char **error);
+// Writes the member name of an escaped token, NUL-terminated, to "buffer",
+// which has room for "length" + 1 bytes, and returns its length.
+size_t tjson_PointerUnescape(const char *token, size_t length, char *buffer);
+
+#endif //TJSON_POINTER_H
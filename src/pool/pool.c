@@ -0,0 +1,279 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "pool.h"
+#include <stdlib.h>
+
+#ifdef USE_NAVISERVER
+#include "ns.h"
+#endif
+
+#define TJSON_POOL_LARGE 0xFFFF
+#define TJSON_POOL_ARENA 0xFFFE
+
+typedef union {
+    struct {
+        unsigned short size_class;
+        unsigned short allocator;
+    } info;
+    double align;   // keeps the payload aligned like malloc's
+} tjson_block_header_t;
+
+typedef struct tjson_free_block {
+    struct tjson_free_block *next;
+} tjson_free_block_t;
+
+typedef struct tjson_arena_chunk {
+    struct tjson_arena_chunk *next;
+    size_t size;            // usable bytes after the chunk header
+    double align;
+} tjson_arena_chunk_t;
+
+typedef struct {
+    int initialized;
+    int arena_active;
+    tjson_arena_chunk_t *chunks;    // newest first
+    char *arena_cursor;
+    char *arena_limit;
+    Tcl_WideInt arena_generation;
+    tjson_free_block_t *free_lists[TJSON_POOL_NUM_CLASSES];
+    size_t num_free[TJSON_POOL_NUM_CLASSES];
+    tjson_pool_stats_t stats;
+} tjson_pool_t;
+
+static Tcl_ThreadDataKey tjson_PoolKey;
+
+// read without locking on every allocation, a change only affects the blocks
+// allocated after it
+static int tjson_PoolEnabled = 1;
+static tjson_allocator_t tjson_PoolAllocator = TJSON_ALLOCATOR_MALLOC;
+static size_t tjson_PoolCacheBytes = TJSON_POOL_CACHE_BYTES;
+
+// bytes a cached block of "size_class" takes from the allocator
+#define TJSON_POOL_BLOCK_BYTES(size_class) (sizeof(tjson_block_header_t) + ((size_class) + 1) * 16)
+
+static void *tjson_AllocatorAlloc(tjson_allocator_t allocator, size_t size) {
+    if (allocator == TJSON_ALLOCATOR_TCL) {
+#ifdef USE_NAVISERVER
+        return ns_malloc(size);
+#else
+        return Tcl_AttemptAlloc(size);
+#endif
+    }
+    return malloc(size);
+}
+
+static void tjson_AllocatorFree(tjson_allocator_t allocator, void *ptr) {
+    if (allocator == TJSON_ALLOCATOR_TCL) {
+#ifdef USE_NAVISERVER
+        ns_free(ptr);
+#else
+        Tcl_Free(ptr);
+#endif
+        return;
+    }
+    free(ptr);
+}
+
+static void tjson_PoolThreadExit(ClientData clientData) {
+    tjson_PoolRelease();
+    tjson_PoolArenaReset();
+    tjson_pool_t *pool = (tjson_pool_t *) Tcl_GetThreadData(&tjson_PoolKey, sizeof(tjson_pool_t));
+    if (pool->chunks != NULL) {
+        free(pool->chunks);
+        pool->chunks = NULL;
+        pool->arena_cursor = pool->arena_limit = NULL;
+    }
+}
+
+static tjson_pool_t *tjson_GetPool(void) {
+    tjson_pool_t *pool = (tjson_pool_t *) Tcl_GetThreadData(&tjson_PoolKey, sizeof(tjson_pool_t));
+    if (!pool->initialized) {
+        pool->initialized = 1;
+        Tcl_CreateThreadExitHandler(tjson_PoolThreadExit, NULL);
+    }
+    return pool;
+}
+
+static void *tjson_ArenaAlloc(tjson_pool_t *pool, size_t size) {
+    size_t needed = sizeof(tjson_block_header_t) + ((size + 7) & ~(size_t) 7);
+    if (pool->arena_cursor == NULL || (size_t) (pool->arena_limit - pool->arena_cursor) < needed) {
+        size_t chunk_size = pool->chunks == NULL ? TJSON_ARENA_CHUNK_SIZE : pool->chunks->size * 2;
+        if (chunk_size > TJSON_ARENA_MAX_CHUNK_SIZE) {
+            chunk_size = TJSON_ARENA_MAX_CHUNK_SIZE;
+        }
+        if (chunk_size < needed) {
+            chunk_size = needed;
+        }
+        tjson_arena_chunk_t *chunk = (tjson_arena_chunk_t *) malloc(sizeof(tjson_arena_chunk_t) + chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        pool->arena_cursor = (char *) (chunk + 1);
+        pool->arena_limit = pool->arena_cursor + chunk_size;
+    }
+    tjson_block_header_t *header = (tjson_block_header_t *) pool->arena_cursor;
+    pool->arena_cursor += needed;
+    pool->stats.arena_bytes += (Tcl_WideInt) needed;
+    header->info.size_class = TJSON_POOL_ARENA;
+    header->info.allocator = 0;
+    return header + 1;
+}
+
+void *tjson_PoolAlloc(size_t size) {
+    size_t size_class = size > 0 ? (size - 1) / 16 : 0;
+    tjson_block_header_t *header;
+
+    tjson_pool_t *pool = tjson_GetPool();
+    if (pool->arena_active) {
+        return tjson_ArenaAlloc(pool, size);
+    }
+
+    if (!tjson_PoolEnabled || size_class >= TJSON_POOL_NUM_CLASSES) {
+        header = (tjson_block_header_t *) tjson_AllocatorAlloc(tjson_PoolAllocator, sizeof(tjson_block_header_t) + size);
+        if (header == NULL) {
+            return NULL;
+        }
+        header->info.size_class = TJSON_POOL_LARGE;
+        header->info.allocator = (unsigned short) tjson_PoolAllocator;
+        return header + 1;
+    }
+
+    tjson_free_block_t *block = pool->free_lists[size_class];
+    if (block != NULL) {
+        pool->free_lists[size_class] = block->next;
+        pool->num_free[size_class]--;
+        pool->stats.hits++;
+        pool->stats.cached--;
+        pool->stats.cached_bytes -= (Tcl_WideInt) TJSON_POOL_BLOCK_BYTES(size_class);
+        return block;
+    }
+
+    pool->stats.misses++;
+    header = (tjson_block_header_t *) tjson_AllocatorAlloc(tjson_PoolAllocator, TJSON_POOL_BLOCK_BYTES(size_class));
+    if (header == NULL) {
+        return NULL;
+    }
+    header->info.size_class = (unsigned short) size_class;
+    header->info.allocator = (unsigned short) tjson_PoolAllocator;
+    return header + 1;
+}
+
+// gives blocks back to their allocator, largest classes first, until the
+// lists fit in "budget" bytes
+static void tjson_PoolTrim(tjson_pool_t *pool, size_t budget) {
+    for (int i = TJSON_POOL_NUM_CLASSES - 1; i >= 0 && (size_t) pool->stats.cached_bytes > budget; i--) {
+        while (pool->free_lists[i] != NULL && (size_t) pool->stats.cached_bytes > budget) {
+            tjson_free_block_t *block = pool->free_lists[i];
+            pool->free_lists[i] = block->next;
+            pool->num_free[i]--;
+            pool->stats.cached--;
+            pool->stats.cached_bytes -= (Tcl_WideInt) TJSON_POOL_BLOCK_BYTES(i);
+            tjson_block_header_t *header = (tjson_block_header_t *) block - 1;
+            tjson_AllocatorFree((tjson_allocator_t) header->info.allocator, header);
+        }
+    }
+}
+
+void tjson_PoolFree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    tjson_block_header_t *header = (tjson_block_header_t *) ptr - 1;
+    size_t size_class = header->info.size_class;
+    if (size_class == TJSON_POOL_ARENA) {
+        // released all at once by tjson_PoolArenaReset
+        return;
+    }
+    if (size_class != TJSON_POOL_LARGE) {
+        tjson_pool_t *pool = tjson_GetPool();
+        size_t budget = tjson_PoolCacheBytes;
+        size_t block_bytes = TJSON_POOL_BLOCK_BYTES(size_class);
+        if ((size_t) pool->stats.cached_bytes > budget) {
+            // the budget was lowered since the lists were filled
+            tjson_PoolTrim(pool, budget);
+        }
+        if ((size_t) pool->stats.cached_bytes + block_bytes <= budget) {
+            tjson_free_block_t *block = (tjson_free_block_t *) ptr;
+            block->next = pool->free_lists[size_class];
+            pool->free_lists[size_class] = block;
+            pool->num_free[size_class]++;
+            pool->stats.cached++;
+            pool->stats.cached_bytes += (Tcl_WideInt) block_bytes;
+            return;
+        }
+    }
+    tjson_AllocatorFree((tjson_allocator_t) header->info.allocator, header);
+}
+
+void tjson_PoolRelease(void) {
+    tjson_PoolTrim(tjson_GetPool(), 0);
+}
+
+void tjson_PoolConfigure(int enabled, tjson_allocator_t allocator, size_t cache_bytes) {
+    tjson_PoolEnabled = enabled;
+    tjson_PoolAllocator = allocator;
+    tjson_PoolCacheBytes = cache_bytes;
+    tjson_PoolTrim(tjson_GetPool(), cache_bytes);
+}
+
+void tjson_PoolGetConfig(int *enabled, tjson_allocator_t *allocator, size_t *cache_bytes) {
+    *enabled = tjson_PoolEnabled;
+    *allocator = tjson_PoolAllocator;
+    *cache_bytes = tjson_PoolCacheBytes;
+}
+
+void tjson_PoolGetStats(tjson_pool_stats_t *stats) {
+    *stats = tjson_GetPool()->stats;
+}
+
+int tjson_PoolArenaSetActive(int active) {
+    tjson_pool_t *pool = tjson_GetPool();
+    int previous = pool->arena_active;
+    pool->arena_active = active;
+    return previous;
+}
+
+int tjson_PoolArenaInUse(void) {
+    return tjson_GetPool()->stats.arena_bytes != 0;
+}
+
+int tjson_PoolArenaContains(const void *ptr) {
+    tjson_pool_t *pool = (tjson_pool_t *) Tcl_GetThreadData(&tjson_PoolKey, sizeof(tjson_pool_t));
+    for (tjson_arena_chunk_t *chunk = pool->chunks; chunk != NULL; chunk = chunk->next) {
+        const char *data = (const char *) (chunk + 1);
+        if ((const char *) ptr >= data && (const char *) ptr < data + chunk->size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void tjson_PoolArenaReset(void) {
+    tjson_pool_t *pool = tjson_GetPool();
+    tjson_arena_chunk_t *chunk = pool->chunks;
+    if (chunk == NULL) {
+        return;
+    }
+    // keep the oldest (smallest) chunk for the next request
+    while (chunk->next != NULL) {
+        tjson_arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    pool->chunks = chunk;
+    pool->arena_cursor = (char *) (chunk + 1);
+    pool->arena_limit = pool->arena_cursor + chunk->size;
+    pool->arena_generation++;
+    pool->stats.arena_bytes = 0;
+}
+
+Tcl_WideInt tjson_PoolArenaGeneration(void) {
+    return tjson_GetPool()->arena_generation;
+}
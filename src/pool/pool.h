@@ -0,0 +1,70 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_POOL_H
+#define TJSON_POOL_H
+
+#include <tcl.h>
+#include <stddef.h>
+
+// Per-thread free lists for the small blocks cJSON allocates (nodes and short
+// strings), in size classes of 16 bytes up to TJSON_POOL_MAX_SIZE. Each block
+// carries a header with its size class and the allocator it came from, so a
+// block may be freed by any thread and the allocator may be switched while
+// trees are alive. Repeated parse/destroy cycles in a thread reuse the blocks
+// it freed without going through the allocator.
+#define TJSON_POOL_MAX_SIZE 128
+#define TJSON_POOL_NUM_CLASSES (TJSON_POOL_MAX_SIZE / 16)
+
+// default bytes of free blocks (headers included) each thread keeps on its
+// lists, the rest go back to the allocator
+#define TJSON_POOL_CACHE_BYTES 1048576
+
+typedef enum {
+    TJSON_ALLOCATOR_MALLOC,
+    TJSON_ALLOCATOR_TCL     // Tcl_Alloc, or ns_malloc when built for NaviServer
+} tjson_allocator_t;
+
+typedef struct {
+    Tcl_WideInt hits;       // allocations served from the free lists
+    Tcl_WideInt misses;     // allocations that went to the allocator
+    Tcl_WideInt cached;     // blocks currently on the free lists
+    Tcl_WideInt cached_bytes;   // bytes of those blocks, headers included
+    Tcl_WideInt arena_bytes;    // bytes handed out by the arena since its last reset
+} tjson_pool_stats_t;
+
+// Each thread also has an arena for request-scoped documents: while it is
+// active, allocations of the thread are carved from large chunks and freeing
+// them is a no-op; the whole arena is wiped at once by tjson_PoolArenaReset.
+// The first chunk starts at TJSON_ARENA_CHUNK_SIZE bytes and chunks double up
+// to TJSON_ARENA_MAX_CHUNK_SIZE.
+#define TJSON_ARENA_CHUNK_SIZE 16384
+#define TJSON_ARENA_MAX_CHUNK_SIZE 1048576
+
+void *tjson_PoolAlloc(size_t size);
+void tjson_PoolFree(void *ptr);
+
+// "cache_bytes" is the per-thread budget of the free lists; a thread whose
+// lists exceed a lowered budget trims them on its next free
+void tjson_PoolConfigure(int enabled, tjson_allocator_t allocator, size_t cache_bytes);
+void tjson_PoolGetConfig(int *enabled, tjson_allocator_t *allocator, size_t *cache_bytes);
+// statistics of the calling thread
+void tjson_PoolGetStats(tjson_pool_stats_t *stats);
+// returns the free blocks of the calling thread to their allocator
+void tjson_PoolRelease(void);
+
+// makes the allocations of the calling thread go to its arena (or back to
+// the pool) and returns the previous setting
+int tjson_PoolArenaSetActive(int active);
+// whether the arena of the calling thread holds any blocks
+int tjson_PoolArenaInUse(void);
+// whether "ptr" was allocated from the arena of the calling thread
+int tjson_PoolArenaContains(const void *ptr);
+// frees all chunks but the first one, invalidating every block of the arena
+void tjson_PoolArenaReset(void);
+// incremented by every reset, tells apart blocks that reuse the same address
+Tcl_WideInt tjson_PoolArenaGeneration(void);
+
+#endif //TJSON_POOL_H
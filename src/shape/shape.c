@@ -0,0 +1,171 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "shape.h"
+#include "../stack/stack.h"
+#include <string.h>
+
+static size_t tjson_HashKey(const char *key, size_t length) {
+    // FNV-1a
+    size_t hash = (size_t) 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * (size_t) 16777619u;
+    }
+    return hash;
+}
+
+static tjson_shape_t *tjson_NewShape(const cJSON *record, size_t num_keys) {
+    tjson_shape_t *shape = (tjson_shape_t *) Tcl_Alloc(sizeof(tjson_shape_t));
+    size_t index_size = 8;
+    while (index_size < num_keys * 2) {
+        index_size *= 2;
+    }
+    shape->num_keys = num_keys;
+    shape->keys = (char **) Tcl_Alloc(num_keys * sizeof(char *));
+    shape->key_lengths = (size_t *) Tcl_Alloc(num_keys * sizeof(size_t));
+    shape->index = (int *) Tcl_Alloc(index_size * sizeof(int));
+    shape->index_mask = index_size - 1;
+    for (size_t i = 0; i < index_size; i++) {
+        shape->index[i] = -1;
+    }
+
+    size_t i = 0;
+    for (const cJSON *child = record->child; child != NULL; child = child->next, i++) {
+        size_t length = strlen(child->string);
+        shape->keys[i] = Tcl_Alloc(length + 1);
+        memcpy(shape->keys[i], child->string, length + 1);
+        shape->key_lengths[i] = length;
+
+        // the first of duplicate keys wins, as with a linear search
+        size_t slot = tjson_HashKey(child->string, length) & shape->index_mask;
+        while (shape->index[slot] != -1 && strcmp(shape->keys[shape->index[slot]], child->string) != 0) {
+            slot = (slot + 1) & shape->index_mask;
+        }
+        if (shape->index[slot] == -1) {
+            shape->index[slot] = (int) i;
+        }
+    }
+    return shape;
+}
+
+static void tjson_FreeShape(tjson_shape_t *shape) {
+    for (size_t i = 0; i < shape->num_keys; i++) {
+        Tcl_Free(shape->keys[i]);
+    }
+    Tcl_Free((char *) shape->keys);
+    Tcl_Free((char *) shape->key_lengths);
+    Tcl_Free((char *) shape->index);
+    Tcl_Free((char *) shape);
+}
+
+// Number of members of "record" if its keys are those of "first", in order,
+// or 0. Interned keys of the same document compare by address.
+static size_t tjson_SameKeys(const cJSON *first, const cJSON *record) {
+    const cJSON *a = first->child;
+    const cJSON *b = record->child;
+    size_t count = 0;
+    while (a != NULL && b != NULL) {
+        if (a->string == NULL || b->string == NULL
+            || (a->string != b->string && strcmp(a->string, b->string) != 0)) {
+            return 0;
+        }
+        a = a->next;
+        b = b->next;
+        count++;
+    }
+    return a == NULL && b == NULL ? count : 0;
+}
+
+static void tjson_ShapeArray(cJSON *array, tjson_shapes_t *shapes) {
+    cJSON *first = array->child;
+    if (first == NULL || first->next == NULL || !cJSON_IsObject(first) || (first->flags & LAZY_SUBTREE)
+        || first->child == NULL) {
+        return;
+    }
+
+    tjson_shape_t *shape = NULL;
+    size_t num_keys = tjson_SameKeys(first, first);
+    for (cJSON *record = first->next; record != NULL; record = record->next) {
+        if (!cJSON_IsObject(record) || (record->flags & (LAZY_SUBTREE | SHAPED_OBJECT))
+            || tjson_SameKeys(first, record) != num_keys) {
+            continue;
+        }
+        if (shape == NULL) {
+            shape = tjson_NewShape(first, num_keys);
+            if (shapes->num_shapes == shapes->capacity) {
+                shapes->capacity = shapes->capacity == 0 ? 8 : shapes->capacity * 2;
+                shapes->shapes = (tjson_shape_t **) Tcl_Realloc((char *) shapes->shapes,
+                                                                 shapes->capacity * sizeof(tjson_shape_t *));
+            }
+            shapes->shapes[shapes->num_shapes++] = shape;
+            first->flags |= SHAPED_OBJECT;
+            first->valuestring = (char *) shape;
+        }
+        record->flags |= SHAPED_OBJECT;
+        record->valuestring = (char *) shape;
+    }
+}
+
+int tjson_BuildShapes(Tcl_Interp *interp, cJSON *root, tjson_shapes_t *shapes) {
+    tjson_stack_t stack;
+    tjson_StackInit(&stack, sizeof(cJSON *), (size_t) -1);
+    *(cJSON **) tjson_StackPush(interp, &stack) = root;
+    while (stack.depth > 0) {
+        cJSON *item = *(cJSON **) tjson_StackTop(&stack);
+        tjson_StackPop(&stack);
+        if (item->flags & LAZY_SUBTREE) {
+            continue;
+        }
+        if (cJSON_IsArray(item)) {
+            tjson_ShapeArray(item, shapes);
+        }
+        for (cJSON *child = item->child; child != NULL; child = child->next) {
+            if (cJSON_IsArray(child) || cJSON_IsObject(child)) {
+                *(cJSON **) tjson_StackPush(interp, &stack) = child;
+            }
+        }
+    }
+    tjson_StackFree(&stack);
+    return TCL_OK;
+}
+
+void tjson_FreeShapes(tjson_shapes_t *shapes) {
+    for (size_t i = 0; i < shapes->num_shapes; i++) {
+        tjson_FreeShape(shapes->shapes[i]);
+    }
+    if (shapes->shapes != NULL) {
+        Tcl_Free((char *) shapes->shapes);
+    }
+    shapes->shapes = NULL;
+    shapes->num_shapes = shapes->capacity = 0;
+}
+
+int tjson_ShapeIndex(const tjson_shape_t *shape, const char *key) {
+    size_t length = strlen(key);
+    size_t slot = tjson_HashKey(key, length) & shape->index_mask;
+    while (shape->index[slot] != -1) {
+        int i = shape->index[slot];
+        if (shape->key_lengths[i] == length && memcmp(shape->keys[i], key, length) == 0) {
+            return i;
+        }
+        slot = (slot + 1) & shape->index_mask;
+    }
+    return -1;
+}
+
+cJSON *tjson_GetObjectItem(const cJSON *object, const char *key) {
+    if (object == NULL || !tjson_IsShaped(object)) {
+        return cJSON_GetObjectItemCaseSensitive(object, key);
+    }
+    int index = tjson_ShapeIndex(tjson_GetShape(object), key);
+    if (index < 0) {
+        return NULL;
+    }
+    cJSON *child = object->child;
+    while (index-- > 0) {
+        child = child->next;
+    }
+    return child;
+}
@@ -0,0 +1,48 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_SHAPE_H
+#define TJSON_SHAPE_H
+
+#include <tcl.h>
+#include <stddef.h>
+#include "../cJSON/cJSON.h"
+
+// The ordered keys shared by the objects ("records") of an array that all
+// have the same keys in the same order. Each record points at its shape
+// (SHAPED_OBJECT), so a member is found by its position instead of comparing
+// keys, and converters can prepare the keys once per shape instead of once per
+// record. Shapes are immutable; a record whose members are added or removed
+// drops its shape (see unshape in cJSON.c).
+typedef struct {
+    size_t num_keys;
+    char **keys;            // copies, in member order
+    size_t *key_lengths;
+    int *index;             // open addressing table of member positions, -1 when empty
+    size_t index_mask;
+} tjson_shape_t;
+
+// The shapes of one document, freed with its root.
+typedef struct {
+    tjson_shape_t **shapes;
+    size_t num_shapes;
+    size_t capacity;
+} tjson_shapes_t;
+
+#define tjson_IsShaped(item) (((item)->flags & SHAPED_OBJECT) != 0)
+#define tjson_GetShape(item) ((tjson_shape_t *) (item)->valuestring)
+
+// Finds the arrays of at least two records under "root" and gives each of them
+// a shared shape, kept in "shapes". Records that do not match the first one of
+// their array stay plain objects. Lazy subtrees are not visited.
+int tjson_BuildShapes(Tcl_Interp *interp, cJSON *root, tjson_shapes_t *shapes);
+void tjson_FreeShapes(tjson_shapes_t *shapes);
+
+// position of "key" in the shape, or -1
+int tjson_ShapeIndex(const tjson_shape_t *shape, const char *key);
+// cJSON_GetObjectItemCaseSensitive with a positional lookup for records
+cJSON *tjson_GetObjectItem(const cJSON *object, const char *key);
+
+#endif //TJSON_SHAPE_H
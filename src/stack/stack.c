@@ -0,0 +1,42 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "stack.h"
+#include <string.h>
+
+void tjson_StackInit(tjson_stack_t *stack, size_t frame_size, size_t max_depth) {
+    stack->frames = (char *) stack->inline_frames;
+    stack->frame_size = frame_size;
+    stack->depth = 0;
+    stack->capacity = sizeof(stack->inline_frames) / frame_size;
+    stack->max_depth = max_depth;
+}
+
+void *tjson_StackPush(Tcl_Interp *interp, tjson_stack_t *stack) {
+    if (stack->depth >= stack->max_depth) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("maximum nesting depth exceeded", -1));
+        return NULL;
+    }
+    if (stack->depth == stack->capacity) {
+        size_t capacity = 2 * stack->capacity;
+        if (stack->frames == (char *) stack->inline_frames) {
+            char *frames = Tcl_Alloc(capacity * stack->frame_size);
+            memcpy(frames, stack->frames, stack->depth * stack->frame_size);
+            stack->frames = frames;
+        } else {
+            stack->frames = Tcl_Realloc(stack->frames, capacity * stack->frame_size);
+        }
+        stack->capacity = capacity;
+    }
+    return tjson_StackFrame(stack, stack->depth++);
+}
+
+void tjson_StackFree(tjson_stack_t *stack) {
+    if (stack->frames != (char *) stack->inline_frames) {
+        Tcl_Free(stack->frames);
+    }
+    stack->frames = (char *) stack->inline_frames;
+    stack->depth = 0;
+}
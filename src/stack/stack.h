@@ -0,0 +1,36 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_STACK_H
+#define TJSON_STACK_H
+
+#include <tcl.h>
+#include <stddef.h>
+
+// Explicit stack of fixed-size frames used by the tree walkers instead of
+// recursion, so that the depth of a document costs heap rather than C stack.
+// The first frames live inline, so shallow documents never allocate.
+#define TJSON_STACK_INLINE_SIZE 1024
+
+typedef struct {
+    char *frames;
+    size_t frame_size;
+    size_t depth;
+    size_t capacity;
+    size_t max_depth;
+    void *inline_frames[TJSON_STACK_INLINE_SIZE / sizeof(void *)];
+} tjson_stack_t;
+
+#define tjson_StackFrame(stack, i) ((void *) ((stack)->frames + (i) * (stack)->frame_size))
+#define tjson_StackTop(stack) tjson_StackFrame((stack), (stack)->depth - 1)
+#define tjson_StackPop(stack) ((stack)->depth--)
+
+void tjson_StackInit(tjson_stack_t *stack, size_t frame_size, size_t max_depth);
+// Returns the new top frame, or NULL with an error in "interp" once
+// "max_depth" frames are in use.
+void *tjson_StackPush(Tcl_Interp *interp, tjson_stack_t *stack);
+void tjson_StackFree(tjson_stack_t *stack);
+
+#endif //TJSON_STACK_H
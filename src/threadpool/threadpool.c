@@ -0,0 +1,114 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "threadpool.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef DEBUG
+# define DBG(x) x
+#else
+# define DBG(x)
+#endif
+
+// number of items a worker claims at a time, keeps the mutex out of the hot path
+#define TJSON_WORK_CHUNK 32
+#define TJSON_MAX_THREADS 64
+
+typedef struct {
+    tjson_WorkProc *proc;
+    void *clientData;
+    size_t num_items;
+    size_t next_index;
+    Tcl_Mutex mutex;
+} tjson_work_t;
+
+int tjson_DefaultNumThreads(void) {
+    int n;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = (int) info.dwNumberOfProcessors;
+#else
+    n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1) {
+        n = 1;
+    }
+    if (n > TJSON_MAX_THREADS) {
+        n = TJSON_MAX_THREADS;
+    }
+    return n;
+}
+
+static void tjson_DrainWork(tjson_work_t *work) {
+    for (;;) {
+        Tcl_MutexLock(&work->mutex);
+        size_t start = work->next_index;
+        work->next_index += TJSON_WORK_CHUNK;
+        Tcl_MutexUnlock(&work->mutex);
+
+        if (start >= work->num_items) {
+            return;
+        }
+        size_t end = start + TJSON_WORK_CHUNK;
+        if (end > work->num_items) {
+            end = work->num_items;
+        }
+        for (size_t i = start; i < end; i++) {
+            work->proc(work->clientData, i);
+        }
+    }
+}
+
+static Tcl_ThreadCreateType tjson_WorkerThread(ClientData clientData) {
+    tjson_DrainWork((tjson_work_t *) clientData);
+    // runs the thread exit handlers, which return the node pool of the worker
+    Tcl_FinalizeThread();
+    TCL_THREAD_CREATE_RETURN;
+}
+
+// Runs "proc" for all items and returns when every item has been processed.
+// The calling thread takes part in the work, so "num_threads" includes it.
+void tjson_RunParallel(int num_threads, size_t num_items, tjson_WorkProc *proc, void *clientData) {
+    tjson_work_t work;
+    work.proc = proc;
+    work.clientData = clientData;
+    work.num_items = num_items;
+    work.next_index = 0;
+    work.mutex = NULL;
+
+    if (num_threads > TJSON_MAX_THREADS) {
+        num_threads = TJSON_MAX_THREADS;
+    }
+    size_t max_useful = (num_items + TJSON_WORK_CHUNK - 1) / TJSON_WORK_CHUNK;
+    if ((size_t) num_threads > max_useful) {
+        num_threads = (int) max_useful;
+    }
+
+    Tcl_ThreadId thread_ids[TJSON_MAX_THREADS];
+    int num_started = 0;
+    for (int i = 1; i < num_threads; i++) {
+        if (TCL_OK != Tcl_CreateThread(&thread_ids[num_started], tjson_WorkerThread, &work,
+                                       TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE)) {
+            DBG(fprintf(stderr, "RunParallel: failed to create worker thread\n"));
+            break;
+        }
+        num_started++;
+    }
+
+    tjson_DrainWork(&work);
+
+    for (int i = 0; i < num_started; i++) {
+        int result;
+        Tcl_JoinThread(thread_ids[i], &result);
+    }
+    Tcl_MutexFinalize(&work.mutex);
+}
@@ -0,0 +1,19 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_THREADPOOL_H
+#define TJSON_THREADPOOL_H
+
+#include <tcl.h>
+#include <stddef.h>
+
+// "proc" is called once for every index in [0, num_items) from one of the
+// worker threads. It must not call into the Tcl API of any interpreter.
+typedef void (tjson_WorkProc)(void *clientData, size_t index);
+
+int tjson_DefaultNumThreads(void);
+void tjson_RunParallel(int num_threads, size_t num_items, tjson_WorkProc *proc, void *clientData);
+
+#endif //TJSON_THREADPOOL_H
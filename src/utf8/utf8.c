@@ -0,0 +1,215 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#include "utf8.h"
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TJSON_UTF8_SSSE3
+#include <tmmintrin.h>
+#endif
+
+// Scalar validator, also used to locate the error once the vector code has
+// found that there is one.
+static int tjson_ValidateUtf8Scalar(const unsigned char *s, size_t length, size_t *error_offset) {
+    size_t i = 0;
+    while (i < length) {
+        // skip ASCII eight bytes at a time
+        if (i + 8 <= length) {
+            uint64_t word;
+            memcpy(&word, s + i, 8);
+            if ((word & UINT64_C(0x8080808080808080)) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = s[i];
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            n = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 2;
+            if (c == 0xE0) {
+                lo = 0xA0;
+            } else if (c == 0xED) {
+                hi = 0x9F;
+            }
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 3;
+            if (c == 0xF0) {
+                lo = 0x90;
+            } else if (c == 0xF4) {
+                hi = 0x8F;
+            }
+        } else {
+            goto fail;
+        }
+        if (i + n >= length) {
+            goto fail;
+        }
+        if (s[i + 1] < lo || s[i + 1] > hi) {
+            goto fail;
+        }
+        for (size_t k = 2; k <= n; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) {
+                goto fail;
+            }
+        }
+        i += n + 1;
+        continue;
+
+      fail:
+        if (error_offset != NULL) {
+            *error_offset = i;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef TJSON_UTF8_SSSE3
+
+// Lookup-table validation after Keiser & Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte". Each byte is classified by the high nibble
+// of the previous byte, the low nibble of the previous byte and the high
+// nibble of the byte itself; a sequence is invalid when all three lookups
+// agree on an error bit.
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+typedef struct {
+    __m128i error;
+    __m128i prev_input;
+    __m128i prev_incomplete;
+} tjson_utf8_state_t;
+
+__attribute__((target("ssse3")))
+static inline __m128i tjson_Utf8HighNibble(__m128i v) {
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+}
+
+__attribute__((target("ssse3")))
+static inline void tjson_Utf8CheckBlock(tjson_utf8_state_t *state, __m128i input) {
+    if (_mm_movemask_epi8(input) == 0) {
+        // an ASCII block is only an error if the previous one ended mid-sequence
+        state->error = _mm_or_si128(state->error, state->prev_incomplete);
+        state->prev_input = input;
+        state->prev_incomplete = _mm_setzero_si128();
+        return;
+    }
+
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2,
+            TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2,
+            CARRY,
+            CARRY,
+            CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    __m128i prev1 = _mm_alignr_epi8(input, state->prev_input, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, tjson_Utf8HighNibble(prev1));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, tjson_Utf8HighNibble(input));
+    __m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // the second and third continuation bytes of 3 and 4 byte sequences
+    __m128i prev2 = _mm_alignr_epi8(input, state->prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, state->prev_input, 13);
+    __m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8((char) (0xE0 - 0x80)));
+    __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xF0 - 0x80)));
+    __m128i must23_80 = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8((char) 0x80));
+
+    state->error = _mm_or_si128(state->error, _mm_xor_si128(must23_80, special_cases));
+
+    // a lead byte in the last three positions needs bytes from the next block
+    const __m128i max_value = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            (char) (0xF0 - 1), (char) (0xE0 - 1), (char) (0xC0 - 1));
+    state->prev_incomplete = _mm_subs_epu8(input, max_value);
+    state->prev_input = input;
+}
+
+__attribute__((target("ssse3")))
+static int tjson_ValidateUtf8Ssse3(const unsigned char *s, size_t length) {
+    tjson_utf8_state_t state;
+    state.error = _mm_setzero_si128();
+    state.prev_input = _mm_setzero_si128();
+    state.prev_incomplete = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        tjson_Utf8CheckBlock(&state, _mm_loadu_si128((const __m128i *) (s + i)));
+    }
+    if (i < length) {
+        unsigned char tail[16];
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, s + i, length - i);
+        tjson_Utf8CheckBlock(&state, _mm_loadu_si128((const __m128i *) tail));
+    }
+    state.error = _mm_or_si128(state.error, state.prev_incomplete);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(state.error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static int tjson_HasSsse3(void) {
+    static int has_ssse3 = -1;
+    if (has_ssse3 < 0) {
+        __builtin_cpu_init();
+        has_ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    }
+    return has_ssse3;
+}
+
+#endif
+
+int tjson_ValidateUtf8(const char *data, size_t length, size_t *error_offset) {
+    const unsigned char *s = (const unsigned char *) data;
+#ifdef TJSON_UTF8_SSSE3
+    if (tjson_HasSsse3()) {
+        if (tjson_ValidateUtf8Ssse3(s, length)) {
+            return 1;
+        }
+    }
+#endif
+    return tjson_ValidateUtf8Scalar(s, length, error_offset);
+}
@@ -0,0 +1,16 @@
+/**
+ * Copyright Jerily LTD. All Rights Reserved.
+ * SPDX-FileCopyrightText: 2023 Neofytos Dimitriou (neo@jerily.cy)
+ * SPDX-License-Identifier: MIT.
+ */
+#ifndef TJSON_UTF8_H
+#define TJSON_UTF8_H
+
+#include <stddef.h>
+
+// Returns 1 if "data" is well-formed UTF-8 (no overlong forms, surrogates or
+// code points above U+10FFFF), otherwise 0 with the offset of the first byte
+// of the offending sequence in "error_offset" (may be NULL).
+int tjson_ValidateUtf8(const char *data, size_t length, size_t *error_offset);
+
+#endif //TJSON_UTF8_H